@@ -0,0 +1,149 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include <m2ElxChannelDeinterleave.h>
+#include <mitkCommandLineParser.h>
+#include <mitkITKImageImport.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkLogMacros.h>
+
+#include <itkVectorImage.h>
+#include <itkVectorIndexSelectionCastImageFilter.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/** \brief Throughput of the channel deinterleave (m2::ElxChannelDeinterleave) compared to
+ * one itk::VectorIndexSelectionCastImageFilter per channel, as used for the channel selections of a registration.
+ *
+ * A synthetic float vector image is split into K = 1, 2, 4, ... 64 equally spaced channels. For each K and
+ * instruction set the time and the speedup are reported, and the outputs are compared with the ITK result.
+ */
+
+namespace
+{
+  using VectorImageType = itk::VectorImage<float, 3>;
+  using ScalarImageType = itk::Image<float, 3>;
+  using Clock = std::chrono::steady_clock;
+
+  VectorImageType::Pointer CreateImage(unsigned int size, unsigned int components)
+  {
+    auto image = VectorImageType::New();
+    VectorImageType::RegionType region;
+    region.SetSize(0, size);
+    region.SetSize(1, size);
+    region.SetSize(2, 1);
+    image->SetRegions(region);
+    image->SetNumberOfComponentsPerPixel(components);
+    image->Allocate();
+    auto buffer = image->GetBufferPointer();
+    const auto n = std::size_t(size) * size * components;
+    for (std::size_t i = 0; i < n; ++i)
+      buffer[i] = static_cast<float>(1000 + 900 * std::sin(0.001 * i));
+    return image;
+  }
+
+  void Run(unsigned int size, unsigned int components, unsigned int repetitions)
+  {
+    const auto itkImage = CreateImage(size, components);
+    const auto image = mitk::ImportItkImage(itkImage);
+
+    for (unsigned int k = 1; k <= 64 && k <= components; k *= 2)
+    {
+      std::vector<unsigned int> channels;
+      for (unsigned int i = 0; i < k; ++i)
+        channels.push_back(i * components / k);
+
+      // ITK reference: one filter and one pass over the buffer per channel
+      using IndexSelectionType = itk::VectorIndexSelectionCastImageFilter<VectorImageType, ScalarImageType>;
+      std::vector<ScalarImageType::Pointer> reference(k);
+      auto start = Clock::now();
+      for (unsigned int r = 0; r < repetitions; ++r)
+        for (unsigned int i = 0; i < k; ++i)
+        {
+          auto filter = IndexSelectionType::New();
+          filter->SetIndex(channels[i]);
+          filter->SetInput(itkImage);
+          filter->Update();
+          reference[i] = filter->GetOutput();
+        }
+      const double itkSeconds = std::chrono::duration<double>(Clock::now() - start).count() / repetitions;
+      MITK_INFO << "K=" << k << " VectorIndexSelectionCastImageFilter: " << itkSeconds * 1e3 << " ms";
+
+      using Set = m2::ElxChannelDeinterleave::InstructionSet;
+      for (auto set : {Set::Scalar, Set::AVX2})
+      {
+        if (set > m2::ElxWarpKernel::GetInstructionSet())
+          continue;
+        std::vector<mitk::Image::Pointer> outputs;
+        start = Clock::now();
+        for (unsigned int r = 0; r < repetitions; ++r)
+          outputs = m2::ElxChannelDeinterleave::ExtractChannels(image, channels, set);
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count() / repetitions;
+
+        unsigned int differences = 0;
+        const auto bytes = std::size_t(size) * size * sizeof(float);
+        for (unsigned int i = 0; i < k; ++i)
+        {
+          mitk::ImageReadAccessor acc(outputs[i]);
+          differences += std::memcmp(acc.GetData(), reference[i]->GetBufferPointer(), bytes) != 0;
+        }
+        MITK_INFO << "K=" << k << " " << m2::ElxWarpKernel::GetInstructionSetName(set) << ": " << seconds * 1e3
+                  << " ms (x" << itkSeconds / seconds << "), " << differences << " channels differ";
+      }
+    }
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  mitkCommandLineParser parser;
+  parser.setCategory("M2aia Elastix");
+  parser.setTitle("Channel Deinterleave Benchmark");
+  parser.setContributor("M2aia");
+  parser.setDescription(
+    "Compares the single pass channel deinterleave with itk::VectorIndexSelectionCastImageFilter for 1 to 64 channels.");
+  parser.setArgumentPrefix("--", "-");
+  parser.addArgument("size", "s", mitkCommandLineParser::Int, "Size", "Width and height of the image (default: 512).");
+  parser.addArgument(
+    "components", "c", mitkCommandLineParser::Int, "Components", "Number of channels of the image (default: 256).");
+  parser.addArgument(
+    "repetitions", "r", mitkCommandLineParser::Int, "Repetitions", "Number of runs per variant (default: 3).");
+
+  auto parsedArgs = parser.parseArguments(argc, argv);
+  if (parsedArgs.empty())
+    return EXIT_FAILURE;
+
+  unsigned int size = 512, components = 256, repetitions = 3;
+  if (parsedArgs.end() != parsedArgs.find("size"))
+    size = us::any_cast<int>(parsedArgs["size"]);
+  if (parsedArgs.end() != parsedArgs.find("components"))
+    components = us::any_cast<int>(parsedArgs["components"]);
+  if (parsedArgs.end() != parsedArgs.find("repetitions"))
+    repetitions = us::any_cast<int>(parsedArgs["repetitions"]);
+
+  try
+  {
+    Run(size, components, repetitions);
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception &e)
+  {
+    MITK_ERROR << e.what();
+    return EXIT_FAILURE;
+  }
+}
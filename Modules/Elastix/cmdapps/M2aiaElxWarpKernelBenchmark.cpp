@@ -0,0 +1,210 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include <m2ElxTransformEngine.h>
+#include <m2ElxWarpKernel.h>
+#include <mitkCommandLineParser.h>
+#include <mitkLogMacros.h>
+
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkMultiThreaderBase.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkResampleImageFilter.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+/** \brief Throughput of the 2D displacement field warp kernel (m2::ElxWarpKernel) compared to itk::ResampleImageFilter.
+ *
+ * A synthetic float and uint16 image and a smooth displacement field are warped with linear and
+ * nearest neighbor interpolation. For each variant the per-pixel throughput and the number of
+ * pixels that differ from the ITK result are reported.
+ */
+
+namespace
+{
+  using FieldTransformType = m2::ElxTransformEngine::DisplacementFieldTransformType<2, float>;
+  using FieldType = m2::ElxTransformEngine::DisplacementFieldType<2, float>;
+  using Clock = std::chrono::steady_clock;
+
+  template <class TImage>
+  typename TImage::Pointer CreateImage(unsigned int size)
+  {
+    auto image = TImage::New();
+    typename TImage::RegionType region;
+    region.SetSize(0, size);
+    region.SetSize(1, size);
+    image->SetRegions(region);
+    typename TImage::SpacingType spacing;
+    spacing[0] = 0.8;
+    spacing[1] = 1.2;
+    image->SetSpacing(spacing);
+    image->Allocate();
+    itk::ImageRegionIteratorWithIndex<TImage> it(image, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      it.Set(static_cast<typename TImage::PixelType>(1000 + 900 * std::sin(0.05 * i[0]) * std::cos(0.03 * i[1])));
+    }
+    return image;
+  }
+
+  FieldType::Pointer CreateField(unsigned int size)
+  {
+    auto field = CreateImage<itk::Image<float, 2>>(size); // geometry only
+    auto displacement = FieldType::New();
+    displacement->CopyInformation(field);
+    displacement->SetRegions(field->GetLargestPossibleRegion());
+    displacement->Allocate();
+    itk::ImageRegionIteratorWithIndex<FieldType> it(displacement, displacement->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      FieldType::PixelType v;
+      v[0] = 7.5f * std::sin(0.011f * i[1]) + 0.3f;
+      v[1] = 5.5f * std::cos(0.017f * i[0]) - 0.2f;
+      it.Set(v);
+    }
+    return displacement;
+  }
+
+  template <class TInput>
+  void Run(unsigned int size, unsigned int repetitions, bool nearest)
+  {
+    using ImageType = itk::Image<TInput, 2>;
+    const auto input = CreateImage<ImageType>(size);
+    const auto field = CreateField(size);
+    auto transform = FieldTransformType::New();
+    transform->SetDisplacementField(field);
+    const double pixels = double(size) * size * repetitions;
+
+    // ITK reference
+    using ResampleFilterType = itk::ResampleImageFilter<ImageType, ImageType, double, float>;
+    typename ImageType::Pointer reference;
+    auto start = Clock::now();
+    for (unsigned int r = 0; r < repetitions; ++r)
+    {
+      auto resampler = ResampleFilterType::New();
+      resampler->SetInput(input);
+      resampler->SetTransform(transform);
+      resampler->SetOutputParametersFromImage(field);
+      if (nearest)
+        resampler->SetInterpolator(itk::NearestNeighborInterpolateImageFunction<ImageType>::New());
+      else
+        resampler->SetInterpolator(itk::LinearInterpolateImageFunction<ImageType>::New());
+      resampler->Update();
+      reference = resampler->GetOutput();
+    }
+    const double itkSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const std::string name = std::string(std::is_same<TInput, float>::value ? "float " : "uint16") +
+                             (nearest ? " nearest" : " linear ");
+    MITK_INFO << name << " ResampleImageFilter: " << pixels / itkSeconds * 1e-6 << " Mpx/s";
+
+    m2::ElxWarpKernel::Parameters2D parameters;
+    parameters.displacement = reinterpret_cast<const float *>(field->GetBufferPointer());
+    parameters.nearest = nearest;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      parameters.outputSize[i] = size;
+      parameters.outputOrigin[i] = field->GetOrigin()[i];
+      parameters.inputSize[i] = size;
+      parameters.inputOrigin[i] = input->GetOrigin()[i];
+      for (unsigned int j = 0; j < 2; ++j)
+      {
+        parameters.outputIndexToPhysical[i][j] = field->GetIndexToPhysicalPoint()[i][j];
+        parameters.inputPhysicalToIndex[i][j] = input->GetPhysicalPointToIndex()[i][j];
+      }
+    }
+
+    using Set = m2::ElxWarpKernel::InstructionSet;
+    auto output = ImageType::New();
+    output->CopyInformation(reference);
+    output->SetRegions(reference->GetLargestPossibleRegion());
+    output->Allocate();
+    for (auto set : {Set::Scalar, Set::SSE2, Set::AVX2})
+    {
+      if (set > m2::ElxWarpKernel::GetInstructionSet())
+        continue;
+      constexpr unsigned int RowBlockSize = 16;
+      start = Clock::now();
+      for (unsigned int r = 0; r < repetitions; ++r)
+        itk::MultiThreaderBase::New()->ParallelizeArray(
+          0,
+          (size + RowBlockSize - 1) / RowBlockSize,
+          [&](itk::SizeValueType block) {
+            const auto first = static_cast<unsigned int>(block) * RowBlockSize;
+            m2::ElxWarpKernel::Warp2D(
+              parameters, input->GetBufferPointer(), output->GetBufferPointer(), first, std::min(size, first + RowBlockSize), set);
+          },
+          nullptr);
+      const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+      std::size_t differences = 0;
+      double maximumDifference = 0;
+      const auto n = std::size_t(size) * size;
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        const double d = std::abs(double(output->GetBufferPointer()[i]) - double(reference->GetBufferPointer()[i]));
+        differences += d != 0;
+        maximumDifference = std::max(maximumDifference, d);
+      }
+      MITK_INFO << name << " " << m2::ElxWarpKernel::GetInstructionSetName(set) << ": " << pixels / seconds * 1e-6
+                << " Mpx/s (x" << itkSeconds / seconds << "), " << differences << " pixels differ (max "
+                << maximumDifference << ")";
+    }
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  mitkCommandLineParser parser;
+  parser.setCategory("M2aia Elastix");
+  parser.setTitle("Warp Kernel Benchmark");
+  parser.setContributor("M2aia");
+  parser.setDescription("Compares the 2D displacement field warp kernel with itk::ResampleImageFilter.");
+  parser.setArgumentPrefix("--", "-");
+  parser.addArgument("size", "s", mitkCommandLineParser::Int, "Size", "Width and height of the images (default: 2048).");
+  parser.addArgument(
+    "repetitions", "r", mitkCommandLineParser::Int, "Repetitions", "Number of warps per variant (default: 5).");
+
+  auto parsedArgs = parser.parseArguments(argc, argv);
+  if (parsedArgs.empty())
+    return EXIT_FAILURE;
+
+  unsigned int size = 2048, repetitions = 5;
+  if (parsedArgs.end() != parsedArgs.find("size"))
+    size = us::any_cast<int>(parsedArgs["size"]);
+  if (parsedArgs.end() != parsedArgs.find("repetitions"))
+    repetitions = us::any_cast<int>(parsedArgs["repetitions"]);
+
+  try
+  {
+    for (bool nearest : {false, true})
+    {
+      Run<float>(size, repetitions, nearest);
+      Run<unsigned short>(size, repetitions, nearest);
+    }
+    return EXIT_SUCCESS;
+  }
+  catch (const std::exception &e)
+  {
+    MITK_ERROR << e.what();
+    return EXIT_FAILURE;
+  }
+}
@@ -1,7 +1,21 @@
 set(CPP_FILES
+  m2ElxBSplineInterpolator.cpp
+  m2ElxChannelDeinterleave.cpp
+  m2ElxChannelDeinterleaveAVX2.cpp
+  m2ElxChannelFusion.cpp
+  m2ElxChannelStatistics.cpp
   m2ElxRegistrationHelper.cpp
+  m2ElxResampleLUT.cpp
   m2ElxUtil.cpp
   m2ElxDefaultParameterFiles.cpp
+  m2ElxLazyWarpedImage.cpp
+  m2ElxTransformCache.cpp
+  m2ElxTransformEngine.cpp
+  m2ElxTransformParameterMap.cpp
+  m2ElxWarpKernel.cpp
+  m2ElxWarpKernelAVX2.cpp
+  m2ElxWarpOptions.cpp
+  m2ElxWarpSession.cpp
 )
 
 # set(UI_FILES
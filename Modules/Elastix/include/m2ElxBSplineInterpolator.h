@@ -0,0 +1,103 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <mitkImage.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief B-spline interpolation (order 0-5) of a scalar image, equivalent to itk::BSplineInterpolateImageFunction.
+   *
+   * The coefficients are computed once when the interpolator is created: the recursive prefilter
+   * (causal and anti-causal pass per pole, mirror boundary conditions) runs over all lines of one axis
+   * in parallel, axis by axis. Evaluate() uses the separable kernel: (order + 1) weights per axis,
+   * rows of coefficients are reduced first. EvaluateBlock() computes the weights of many points at once
+   * in vectorised loops. Evaluate() and EvaluateBlock() can be called from several threads.
+   */
+  class MITKELASTIX_EXPORT ElxBSplineInterpolator
+  {
+  public:
+    using Pointer = std::shared_ptr<ElxBSplineInterpolator>;
+    static constexpr unsigned int MaximumOrder = 5;
+
+    /**
+     * @brief Computes the coefficients of a scalar image.
+     * @param image Scalar image; the first `dimension` axes are used.
+     * @param dimension 2 or 3.
+     * @param order Spline order 0-5.
+     * @throws mitk::Exception if the image is not scalar or the order is not supported.
+     */
+    static Pointer New(const mitk::Image *image, unsigned int dimension, unsigned int order);
+
+    /**
+     * @brief Interpolates at a continuous index; the index has to be inside the image.
+     */
+    double Evaluate(const double *continuousIndex) const;
+
+    /**
+     * @brief Interpolates n points, see Evaluate(). The weights are computed per axis for blocks of points,
+     * one loop per spline order without branches, so the compiler evaluates the polynomials of several
+     * points per SIMD instruction; the coefficients are then gathered per point.
+     * @param continuousIndices GetDimension() values per point (interleaved); all points have to be inside the image.
+     * @param values Receives n values.
+     */
+    void EvaluateBlock(const double *continuousIndices, std::size_t n, double *values) const;
+
+    /**
+     * @brief Computes the first sample index (before MirrorIndex()) and the order + 1 weights of a coordinate.
+     */
+    static void ComputeWeights(double x, unsigned int order, long long &start, double *weights);
+
+    /**
+     * @brief Mirror boundary condition of the coefficients: maps any sample index into [0, size).
+     */
+    static long long MirrorIndex(long long index, long long size);
+
+    /**
+     * @brief Replaces interleaved samples by their B-spline coefficients in place (the prefilter of New()).
+     * Interpolating the coefficients with the weights of ComputeWeights() gives the result of Evaluate().
+     * @param data components values per pixel; x runs fastest.
+     * @param size Size of 3 axes (1 for missing axes).
+     * @param dimension Only the first dimension axes are filtered, e.g. the slices of a 2D stack stay independent.
+     */
+    static void ComputeCoefficients(
+      double *data, unsigned int components, const unsigned int *size, unsigned int dimension, unsigned int order);
+
+    unsigned int GetOrder() const { return m_Order; }
+    unsigned int GetDimension() const { return m_Dimension; }
+
+  private:
+    ElxBSplineInterpolator() = default;
+    void Prefilter();
+
+    template <unsigned int VOrder>
+    void EvaluateBlock(const double *continuousIndices, std::size_t n, double *values) const;
+
+    /** Tensor product of the weights with the coefficients of the support starting at start. */
+    double Combine(const double (*weights)[MaximumOrder + 1], const long long *start) const;
+
+    unsigned int m_Dimension = 2;
+    unsigned int m_Order = 3;
+    long long m_Size[3] = {1, 1, 1};
+    std::size_t m_Stride[3] = {1, 1, 1};
+    std::vector<double> m_Coefficients;
+  };
+} // namespace m2
@@ -0,0 +1,77 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <m2ElxWarpKernel.h>
+#include <mitkImage.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Extracts several channels of a vector image in one pass over its interleaved pixel buffer.
+   *
+   * Replaces one itk::VectorIndexSelectionCastImageFilter per channel: the buffer is read once in blocks
+   * of pixels that fit into the L2 cache and every selected channel of a block is written before the next
+   * block is loaded. Channels are copied bitwise (components of 4 and 8 bytes are gathered 8 or 4 pixels at
+   * a time with AVX2), so the kernel does not depend on the component type.
+   * The instruction set is selected at runtime like in ElxWarpKernel.
+   */
+  class MITKELASTIX_EXPORT ElxChannelDeinterleave
+  {
+  public:
+    using InstructionSet = ElxWarpKernel::InstructionSet;
+
+    /**
+     * @brief Returns one scalar image per entry of channels, with the component type and geometry of the input.
+     * @param image Vector image (any dimension); a scalar image is accepted for channel 0.
+     * @param channels Channel indices; an index may appear several times.
+     * @throws mitk::Exception if the image is null or a channel index exceeds the number of components.
+     */
+    static std::vector<mitk::Image::Pointer> ExtractChannels(const mitk::Image *image,
+                                                             const std::vector<unsigned int> &channels,
+                                                             InstructionSet instructionSet = InstructionSet::AVX2);
+
+    /**
+     * @brief Copies the channels of the pixels [firstPixel, lastPixel) into the scalar outputs.
+     * @param input Interleaved buffer with numberOfComponents values of componentSize bytes per pixel.
+     * @param outputs One buffer of the whole image per channel.
+     * @param instructionSet Falls back to a supported instruction set if not available.
+     */
+    static void Deinterleave(const void *input,
+                             std::size_t componentSize,
+                             unsigned int numberOfComponents,
+                             const std::vector<unsigned int> &channels,
+                             void *const *outputs,
+                             std::size_t firstPixel,
+                             std::size_t lastPixel,
+                             InstructionSet instructionSet);
+
+    /**
+     * @brief Number of pixels of a block of Deinterleave calls in ExtractChannels (a multiple of 8).
+     */
+    static std::size_t GetPixelBlockSize(std::size_t componentSize, unsigned int numberOfComponents);
+
+    /**
+     * @brief Gathers one channel of n pixels with AVX2 (see m2ElxChannelDeinterleaveAVX2.cpp).
+     * @return The number of pixels written; a multiple of 8 (4 byte components) or 4 (8 byte components).
+     */
+    template <class TComponent>
+    static std::size_t GatherAVX2(const TComponent *input, unsigned int stride, std::size_t n, TComponent *output);
+  };
+} // namespace m2
@@ -0,0 +1,114 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <mitkImage.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Reduces many channels of vector images to a few fused scalar images (weighted sums of the channels).
+   *
+   * A registration on K channel pairs evaluates K metrics per iteration; the fused images carry most of the
+   * information of the channels in 1 to 3 images. The weights are fitted once on the fixed and the moving
+   * image together (Fit) and applied to both (Apply), so the fused images of both are comparable.
+   *
+   * - PCA: principal components of the channel correlation matrix. The covariance is accumulated in one
+   *   multithreaded pass; pixels are subsampled with a regular stride if the number of channels is large.
+   * - NMF: nonnegative loadings of a non-negative matrix factorization of a pixel sample (multiplicative
+   *   updates, channels scaled to unit variance); each fused image is a nonnegative mean of channels.
+   * - Weighted: one image, the weighted sum of the channels with user weights (default: mean of the channels).
+   */
+  class MITKELASTIX_EXPORT ElxChannelFusion
+  {
+  public:
+    enum class Method
+    {
+      None,
+      PCA,
+      NMF,
+      Weighted
+    };
+
+    struct Parameters
+    {
+      Method method = Method::None;
+      /** Number of fused images (PCA, NMF); Weighted always creates one image. */
+      unsigned int numberOfImages = 1;
+      /** Weights per channel (Weighted); empty: equal weights. */
+      std::vector<double> channelWeights;
+    };
+
+    /** Channel mean and covariance of the pixels of one or more images. */
+    struct Statistics
+    {
+      std::vector<double> mean;
+      /** Row-major, numberOfChannels x numberOfChannels. */
+      std::vector<double> covariance;
+      std::size_t numberOfSamples = 0;
+    };
+
+    /** Fused image i = offsets[i] + sum_c weights[i][c] * channel c (raw channel values). */
+    struct Weights
+    {
+      Method method = Method::None;
+      std::vector<std::vector<double>> weights;
+      std::vector<double> offsets;
+      /** PCA: fraction of the total (standardized) variance per fused image. */
+      std::vector<double> explainedVariance;
+
+      /** Text representation (e.g. for a property of the result). */
+      std::string ToString() const;
+      /** @throws mitk::Exception if the text is not a representation of ToString(). */
+      static Weights Parse(const std::string &text);
+    };
+
+    static std::string GetMethodName(Method method);
+    /** @throws mitk::Exception if the name is unknown. */
+    static Method GetMethod(const std::string &name);
+
+    /**
+     * @brief Accumulates channel statistics of the pixels of all images in one multithreaded pass per image.
+     * @param channels The channels per image; all lists have the same length.
+     * @param maximumSamples Pixels are subsampled with a regular stride beyond this number (0: all pixels).
+     * @throws mitk::Exception if the lists do not match or a channel exceeds the components of its image.
+     */
+    static Statistics ComputeStatistics(const std::vector<const mitk::Image *> &images,
+                                        const std::vector<std::vector<unsigned int>> &channels,
+                                        std::size_t maximumSamples = 0);
+
+    /**
+     * @brief Fits the fusion weights on the channels of the images (see ComputeStatistics).
+     * @throws mitk::Exception if the method is None or the channel weights do not match the channels.
+     */
+    static Weights Fit(const std::vector<const mitk::Image *> &images,
+                       const std::vector<std::vector<unsigned int>> &channels,
+                       const Parameters &parameters);
+
+    /**
+     * @brief Creates the fused float images of the channels of image in one multithreaded pass.
+     * @return One scalar image per fused image with the geometry of image.
+     * @throws mitk::Exception if the weights do not match the channels.
+     */
+    static std::vector<mitk::Image::Pointer> Apply(const mitk::Image *image,
+                                                   const std::vector<unsigned int> &channels,
+                                                   const Weights &weights);
+  };
+} // namespace m2
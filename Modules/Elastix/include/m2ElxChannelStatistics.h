@@ -0,0 +1,95 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <mitkImage.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Per-channel statistics of a vector image to rank its channels for a registration.
+   *
+   * The image is sampled once on a coarse grid (every stride-th pixel along each axis) into a channel-major
+   * buffer of at most GetMaximumNumberOfValues() values (channels * samples); images with very many channels
+   * are sampled more coarsely. This is the only pass over the vector image.
+   * The statistics of the channels are then computed in parallel from the buffer, so thousands of channels
+   * take seconds. Flat ion images have a low entropy, noisy ones a low spatial coherence (the gradient energy
+   * is close to that of uncorrelated noise, 2 * variance); both rank low.
+   */
+  class MITKELASTIX_EXPORT ElxChannelStatistics
+  {
+  public:
+    struct Channel
+    {
+      unsigned int index = 0;
+      /** Number of samples of the coarse grid. */
+      std::size_t numberOfSamples = 0;
+      double mean = 0;
+      double variance = 0;
+      /** Shannon entropy (bits) of the histogram of the channel. */
+      double entropy = 0;
+      /** Mean squared difference of neighboring samples of the coarse grid. */
+      double gradientEnergy = 0;
+      /** Mutual information (bits) with the reference image; 0 without a reference. */
+      double mutualInformation = 0;
+      /** Normalized entropy * spatial coherence * (1 + mutual information / entropy of the reference). */
+      double score = 0;
+    };
+
+    struct Parameters
+    {
+      /** Histogram bins of the entropy and the mutual information. */
+      unsigned int numberOfBins = 32;
+      /**
+       * Sampling stride of the coarse grid; 0 chooses the stride from the number of channels. Explicit strides
+       * are increased if the samples would exceed the buffer.
+       */
+      unsigned int stride = 0;
+      /** Bound of the sample buffer (channels * samples); 0 uses GetMaximumNumberOfValues(). */
+      std::size_t maximumNumberOfValues = 0;
+    };
+
+    /**
+     * @brief Computes the statistics of all channels of image.
+     * @param reference Optional image (e.g. the fixed image) for the mutual information. It is sampled at the
+     * world coordinates of the coarse grid of image (nearest neighbor); vector images contribute the mean of
+     * their channels. Samples outside of the reference are ignored.
+     * @return The statistics ordered by channel index.
+     * @throws mitk::Exception if the image is null.
+     */
+    static std::vector<Channel> Compute(const mitk::Image *image,
+                                        const mitk::Image *reference = nullptr,
+                                        const Parameters &parameters = Parameters());
+
+    /**
+     * @brief Sorts the statistics by decreasing score.
+     */
+    static std::vector<Channel> Rank(std::vector<Channel> channels);
+
+    /**
+     * @brief Returns the indices of the best count channels with a positive score.
+     */
+    static std::vector<unsigned int> Suggest(const std::vector<Channel> &channels, unsigned int count = 5);
+
+    /**
+     * @brief Maximum number of values of the coarse sample buffer (channels * samples).
+     */
+    static std::size_t GetMaximumNumberOfValues();
+  };
+} // namespace m2
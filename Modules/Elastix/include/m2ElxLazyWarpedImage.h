@@ -0,0 +1,186 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <m2ElxWarpSession.h>
+#include <mitkImage.h>
+#include <mitkImageDataItem.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace m2
+{
+  /**
+   * @brief Warped image whose pixels are computed when they are accessed.
+   *
+   * The image has the pixel type, size and geometry of the warped result but no pixel buffer of its own; it
+   * references the source image and the warp session of the registration. Slices (GetSliceData) are warped on
+   * first access and kept in a Cache, a least recently used cache with a memory budget that can be shared by
+   * several images. The volume (GetVolumeData, GetChannelData, GetVtkImageData; e.g. for rendering or an
+   * ImageReadAccessor of the whole image) is warped once and kept by the image like the buffer of a regular
+   * image; slices are then copied from it. Pixel values are those of ElxWarpSession::WarpMultiChannel, or of
+   * ElxWarpSession::WarpSlices for stacks warped by a 2D transformation.
+   * The image is read-only and has a single time step. Clone() and Materialize() return a regular image.
+   * Created by ElxRegistrationHelper::CreateLazyWarpedImage.
+   */
+  class MITKELASTIX_EXPORT ElxLazyWarpedImage : public mitk::Image
+  {
+  public:
+    /**
+     * @brief Least recently used cache of warped slices of lazily warped images.
+     *
+     * Slices count against a memory budget (bytes); least recently used slices are removed to stay within the
+     * budget. The most recent slice is always kept, so a slice stays valid at least until the next one is added.
+     * All methods can be called from several threads.
+     */
+    class MITKELASTIX_EXPORT Cache
+    {
+    public:
+      using Pointer = std::shared_ptr<Cache>;
+
+      static Pointer New(std::size_t memoryBudget = std::size_t(256) << 20);
+
+      /**
+       * @brief Returns the slice of image or nullptr.
+       */
+      ImageDataItemPointer Get(const ElxLazyWarpedImage *image, unsigned int slice);
+
+      /**
+       * @brief Adds a slice of image that occupies bytes of memory.
+       */
+      void Add(const ElxLazyWarpedImage *image, unsigned int slice, ImageDataItemPointer item, std::size_t bytes);
+
+      /**
+       * @brief Removes all slices of image.
+       */
+      void Remove(const ElxLazyWarpedImage *image);
+
+      void SetMemoryBudget(std::size_t memoryBudget);
+      std::size_t GetMemoryBudget() const;
+
+      /**
+       * @brief Bytes of all cached slices.
+       */
+      std::size_t GetMemoryUsage() const;
+
+      void Clear();
+
+      unsigned long long GetNumberOfHits() const;
+      unsigned long long GetNumberOfMisses() const;
+
+    private:
+      struct Entry
+      {
+        const ElxLazyWarpedImage *image = nullptr;
+        unsigned int slice = 0;
+        ImageDataItemPointer item;
+        std::size_t bytes = 0;
+      };
+
+      explicit Cache(std::size_t memoryBudget) : m_MemoryBudget(memoryBudget) {}
+
+      /** Removes least recently used entries until the budget is met; the mutex is held by the caller. */
+      void Shrink();
+
+      mutable std::mutex m_Mutex;
+      std::list<Entry> m_Entries;
+      std::size_t m_MemoryBudget = 0;
+      std::size_t m_MemoryUsage = 0;
+      unsigned long long m_Hits = 0;
+      unsigned long long m_Misses = 0;
+    };
+
+    mitkClassMacro(ElxLazyWarpedImage, mitk::Image);
+
+    /**
+     * @param session Session of the registration (see ElxRegistrationHelper::GetWarpSession()).
+     * @param source The moving image prepared for the session (see ElxRegistrationHelper::CreateLazyWarpedImage):
+     * 2D or a single slice for 2D transformations, a stack of slices for 2D transformations or 3D for 3D
+     * transformations. It is referenced, not copied.
+     * @param pixelType The elastix pixel type name of the result.
+     * @param interpolationOrder See ElxWarpSession::Warp(). For 3D transformations, B-spline orders compute the
+     * coefficients of the whole source for every slice; use order 0 or 1 for slice access.
+     * @param cache Shared cache of the slices; nullptr creates a cache with the default budget.
+     * @throws mitk::Exception if the session or the source is null, or the source does not match the session.
+     */
+    static Pointer New(ElxWarpSession::Pointer session,
+                       const mitk::Image *source,
+                       const std::string &pixelType,
+                       int interpolationOrder = -1,
+                       Cache::Pointer cache = nullptr);
+
+    /**
+     * @brief Warps the whole image into a regular image (e.g. to save or process the result).
+     * A volume kept by the image is copied.
+     */
+    mitk::Image::Pointer Materialize() const;
+
+    Cache::Pointer GetCache() const { return m_Cache; }
+
+    ImageDataItemPointer GetSliceData(int s = 0,
+                                      int t = 0,
+                                      int n = 0,
+                                      void *data = nullptr,
+                                      ImportMemoryManagementType importMemoryManagement = CopyMemory) const override;
+
+    ImageDataItemPointer GetVolumeData(int t = 0,
+                                       int n = 0,
+                                       void *data = nullptr,
+                                       ImportMemoryManagementType importMemoryManagement = CopyMemory) const override;
+
+    ImageDataItemPointer GetChannelData(int n = 0,
+                                        void *data = nullptr,
+                                        ImportMemoryManagementType importMemoryManagement = CopyMemory) const override;
+
+    /**
+     * @brief All slices of the single time step are available; they are warped when they are requested.
+     */
+    bool IsSliceSet(int s = 0, int t = 0, int n = 0) const override;
+    bool IsVolumeSet(int t = 0, int n = 0) const override;
+    bool IsChannelSet(int n = 0) const override;
+
+  protected:
+    ElxLazyWarpedImage() = default;
+    ~ElxLazyWarpedImage() override;
+
+  private:
+    /** Warps slice z or copies it from the volume; the mutex is held by the caller. */
+    ImageDataItemPointer WarpSlice(unsigned int z) const;
+
+    /** Warps the volume or copies the single slice; the mutex is held by the caller. */
+    ImageDataItemPointer WarpVolume() const;
+
+    /** Data item of a slice (dimension 2) or the volume (dimension 3) with a copy of the pixels at data. */
+    ImageDataItemPointer CreateItem(unsigned int dimension, const void *data) const;
+
+    std::size_t GetSliceSize() const;
+
+    ElxWarpSession::Pointer m_Session;
+    mitk::Image::ConstPointer m_Source;
+    std::string m_PixelType;
+    int m_InterpolationOrder = -1;
+    // a 2D transformation is applied to every slice of the source (see ElxWarpSession::WarpSlices)
+    bool m_Stack = false;
+    Cache::Pointer m_Cache;
+
+    mutable std::mutex m_Mutex;
+    mutable ImageDataItemPointer m_Volume;
+  };
+} // namespace m2
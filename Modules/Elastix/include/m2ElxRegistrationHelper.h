@@ -15,7 +15,14 @@ See LICENSE.txt for details.
 #pragma once
 
 #include <MitkElastixExports.h>
+#include <m2ElxBSplineInterpolator.h>
+#include <m2ElxChannelFusion.h>
+#include <m2ElxTransformEngine.h>
+#include <m2ElxWarpOptions.h>
+#include <m2ElxLazyWarpedImage.h>
+#include <m2ElxWarpSession.h>
 #include <mitkImage.h>
+#include <mitkLabelSetImage.h>
 #include <mitkPointSet.h>
 #include <string>
 #include <vector>
@@ -39,7 +46,11 @@ namespace m2
     mitk::Image::Pointer m_MovingMask;
     mitk::PointSet::Pointer m_MovingPoints;
 
-    mitk::Image::Pointer m_DeformationField;
+    mutable mitk::Image::Pointer m_DeformationField;
+    mutable mitk::Image::Pointer m_InverseDeformationField;
+    mutable ElxWarpSession::Pointer m_WarpSession;
+    mutable ElxWarpSession::Pointer m_GridWarpSession; // session of the last custom output grid (ElxWarpOptions)
+    mutable std::string m_GridWarpSessionTransformation;
     std::vector<std::string> m_Transformations;
     std::vector<std::string> m_RegistrationParameters = {}; // forces elastix default
     std::string m_BinarySearchPath = "";
@@ -53,27 +64,44 @@ namespace m2
     mutable std::string m_WorkingDirectory = "";
     mutable std::string m_ExternalWorkingDirectory = "";
     bool m_UseMovingImageSpacing = false;
+    unsigned int m_NumberOfRigidStartRotations = 1;
+    bool m_RigidStartFlips = false;
+    bool m_UseInProcessTransforms = true;
+    ElxTransformEngine::DeformationRepresentation m_DeformationRepresentation =
+      ElxTransformEngine::DeformationRepresentation::Automatic;
+    std::size_t m_DeformationMemoryBudget = std::size_t(2) << 30; // 2 GiB
+    // sampled displacement fields of the warp sessions, within m_DeformationMemoryBudget
+    ElxTransformCache::Pointer m_TransformCache = ElxTransformCache::New(m_DeformationMemoryBudget);
+    std::vector<unsigned int> m_DeformationFieldRegionIndex;
+    std::vector<unsigned int> m_DeformationFieldRegionSize;
+    mutable unsigned int m_NumberOfImageCopies = 0; // buffers copied for layout or channel conversions
+    unsigned int m_NumberOfThreads = 0; // threads of an elastix process; 0: elastix default
+    std::vector<std::vector<std::string>> m_TimeStepTransformations;
+    ElxChannelFusion::Parameters m_ChannelFusion;
+    ElxChannelFusion::Weights m_ChannelFusionWeights;
 
     bool CheckDimensions(const mitk::Image *image) const;
 
 
     /**
-    *  @brief ConvertForElastixProcessing function takes a pointer to a mitk::Image as input and returns a pointer to a new mitk::Image object. 
+    *  @brief ConvertForElastixProcessing function takes a pointer to a mitk::Image as input and returns a pointer to a mitk::Image object.
     *  The function first checks if the input image pointer is not null, and if it is not, it proceeds to check the dimension of the image.
-    *  - If the dimension of the image is 3 and the size in the Z dimension is 1, the function creates a new 2D image using ITK and copies the data, spacing, origin and direction from the input image to the new 2D image. The function then returns the new 2D image.
+    *  - If the dimension of the image is 3 and the size in the Z dimension is 1, the function returns a 2D view of the slice: it shares the pixel buffer of the input, only the geometry is rewritten (x-y spacing, origin and direction).
     *  - If the dimension of the image is 2, the function returns the input image as it is.
     *  - If the dimension of the image is 3 and the size in the Z dimension is greater than 1, the function returns the input image as it is.
-    *  - If the dimension of the image is 4, the function creates a new 3D image and copies the data, spacing, origin and direction from the input image to the new 3D image. The function then returns the new 3D image.
+    *  - If the dimension of the image is 4, the function returns a 3D view of the time step timeStep (no copy); a 2D view for 2D+t images.
     *  - If the input image pointer is null, the function throws an exception with the message "Image data is null!".
-    *  @note that this function is not well-suited for handling 4D+t images, and only the first time step is selected.
+    *  Views keep the input alive by the "m2aia.registration.source" property.
     *  @param image pointer to a mitk::Image.
-    *  @return pointer to a new mitk::Image object.
+    *  @param timeStep The time step of a 4D image (see GetTimeStepRegistration).
+    *  @return pointer to the input or a view of it.
+    *  @throws mitk::Exception if the time step exceeds the time steps of the image.
     */
-    mitk::Image::Pointer ConvertForElastixProcessing(const mitk::Image *) const;
+    mitk::Image::Pointer ConvertForElastixProcessing(const mitk::Image *, unsigned int timeStep = 0) const;
 
     /**
     *  @brief Get a 3D image slice from a 2D image.
-    *  - If the input image is 2D, a new 3D image is created with the same properties as the input image, and the 2D image data is copied to the first slice of the new image.
+    *  - If the input image is 2D, a 3D view with a single slice and the geometry of the input image is created; it shares the pixel buffer of the input.
     *  - If the input image is already 3D, the input image is returned.
     *  @param image The input image.
     *  @return mitk::Image::Pointer A 3D image slice.
@@ -86,8 +114,39 @@ namespace m2
     void SymlinkOrWriteNrrd(mitk::Image::Pointer image, std::string targetPath) const;
     std::function<void(std::string)> m_StatusFunction = [](std::string){};
     std::string WriteTransformation(std::string workingDirectory) const;
-    void TransformixDeformationField(std::string workingDirectory);
-    
+    void TransformixDeformationField(std::string workingDirectory) const;
+
+    /**
+    *  @brief Returns the transformations with the output grid of the last one restricted to the deformation field region.
+    */
+    std::vector<std::string> GetDeformationFieldTransformations() const;
+
+    /**
+    *  @brief Runs several short, low-resolution rigid registrations in parallel, each started from a different
+    *  initial rotation (and optionally a flip) about the image centers. The start with the lowest final metric value wins.
+    *  @param exeElastix The elastix executable of the full registration.
+    *  @param workingDirectory The registration working directory; each start uses its own sub-directory.
+    *  @param rigidParameters The parameter file text of the rigid stage.
+    *  @param imageArgs The elastix image arguments (-f, -m, masks, points) of the full registration; each start
+    *  adds its own -threads, -out, -t0 and -p arguments.
+    *  @return The transformation chain [initial transform, short rigid transform] of the best start.
+    *  The last element is used as initial transform of the full registration. Empty if no start succeeded.
+    */
+    std::vector<std::string> MultiStartRigidInitialization(const std::string &exeElastix,
+                                                           const std::string &workingDirectory,
+                                                           const std::string &rigidParameters,
+                                                           const std::vector<std::string> &imageArgs) const;
+
+    /**
+    *  @brief Converts a warping result back to the M2aia layout and restores the z-spacing of inputData.
+    */
+    mitk::Image::Pointer ConvertWarpResult(mitk::Image::Pointer result, const mitk::Image *inputData) const;
+
+    /**
+    *  @brief Creates the parameter text of an affine elastix transform that rotates by angle (radians) about the
+    *  z-axis, optionally flips the x-axis and maps the fixed image center onto the moving image center.
+    */
+    std::string CreateInitialRigidTransform(double angle, bool flip, unsigned int dimension) const;
 
   public:
     ElxRegistrationHelper();
@@ -102,12 +161,88 @@ namespace m2
     void SetAdditionalBinarySearchPath(const std::string &list);
     void UseMovingImageSpacing(bool val){this->m_UseMovingImageSpacing = val;};
 
+    /**
+    *  @brief Enables the multi-start rigid initialization.
+    *  If numberOfRotations > 1 and the first registration stage is a Euler-, Similarity- or AffineTransform,
+    *  short registrations are started from numberOfRotations evenly spaced rotations (x2 if includeFlips).
+    *  The full pipeline continues from the best start.
+    *  @param numberOfRotations Number of initial rotations; 0 or 1 disables the multi-start.
+    *  @param includeFlips Additionally start from the x-flipped versions of each rotation.
+    */
+    void SetMultiStartRigid(unsigned int numberOfRotations, bool includeFlips = false);
+
+    /**
+    *  @brief If enabled (default), WarpImage evaluates supported transformations in-process
+    *  (see ElxTransformEngine) instead of running transformix.
+    */
+    void SetUseInProcessTransforms(bool val);
+
+    /**
+    *  @brief Selects how deformable transformations are represented during in-process warping
+    *  (see ElxTransformEngine::DeformationRepresentation). Default: Automatic.
+    */
+    void SetDeformationRepresentation(ElxTransformEngine::DeformationRepresentation representation);
+
+    /**
+    *  @brief Memory budget (bytes) of the Automatic deformation representation (default: 2 GiB).
+    */
+    void SetDeformationMemoryBudget(std::size_t bytes);
+
     void GetRegistration();
+
+    /**
+    *  @brief Registers every time step of the moving image (3D+t or 2D+t) in its own elastix process.
+    *  The processes run concurrently; numberOfCores (default: all cores) is divided among them.
+    *  @param referenceTimeStep Time step of the moving image that all other time steps are registered to;
+    *  -1 (default) registers to the fixed image, time step by time step if it has the same number of time steps.
+    *  The reference time step itself gets an empty transformation chain.
+    *  @param numberOfCores Core budget of all concurrent registrations.
+    *  @throws mitk::Exception if the registration of a time step failed.
+    */
+    void GetTimeStepRegistration(int referenceTimeStep = -1, unsigned int numberOfCores = 0);
+
+    /**
+    *  @brief Transformation chains per time step (see GetTimeStepRegistration).
+    */
+    std::vector<std::vector<std::string>> GetTimeStepTransformations() const;
+    void SetTimeStepTransformations(const std::vector<std::vector<std::string>> &transformations);
+
+    /**
+    *  @brief Warps every time step of an image with its own transformation chain (see WarpImage).
+    *  @return An image with the time steps of image on the common output grid.
+    *  @throws mitk::Exception if the number of time steps does not match GetTimeStepTransformations().
+    */
+    mitk::Image::Pointer WarpTimeSteps(const mitk::Image *image,
+                                       const std::string &pixelType = "",
+                                       const unsigned char &interpolationOrder = 3) const;
+
+    /**
+    *  @brief Number of threads of each elastix process (0: elastix default).
+    */
+    void SetNumberOfThreads(unsigned int threads);
+
+    /**
+    *  @brief Number of image buffers copied (e.g. channel extraction, pixel type conversion) since the last
+    *  GetRegistration() started. Dimension conversions share the buffers of their inputs and are not counted.
+    */
+    unsigned int GetNumberOfImageCopies() const;
     std::vector<std::string> GetTransformation() const;
     void SetTransformations(const std::vector<std::string> & trafos);
     void SetStatusCallback(const std::function<void(std::string)> & callback);
     void SetChannelSelections(const std::vector<std::pair<unsigned int, unsigned int>> & ch_selection);
 
+    /**
+    *  @brief Registers a few fused images (see ElxChannelFusion) instead of one image pair per channel.
+    *  Applies to vector images; the channels of the channel selections (fixed, moving) are fused, or all channels
+    *  if there are no selections. The weights are fitted on both images and applied to both.
+    */
+    void SetChannelFusion(const ElxChannelFusion::Parameters &parameters);
+
+    /**
+    *  @brief Fusion weights of the last GetRegistration(); empty (method None) if no channels were fused.
+    */
+    ElxChannelFusion::Weights GetChannelFusionWeights() const;
+
     mitk::Image::Pointer GetFixedImage() const{
       return m_FixedImage;
     }
@@ -116,11 +251,171 @@ namespace m2
       return m_MovingImage;
     }
     
+    /**
+    *  @brief Returns the warp session used by WarpImage. It is prepared once (output grid, transform,
+    *  interpolation settings) and reused for all following warps until the transformations or the
+    *  deformation settings change. Setup and per-warp times are reported by the session.
+    *  @return The session or nullptr if the images have to be warped by transformix.
+    */
+    ElxWarpSession::Pointer GetWarpSession() const;
+
+    /**
+    *  @brief Returns a warp session for the output grid of options (see ElxWarpOptions::ApplyToTransformation).
+    *  The session of the last requested grid is kept. Its setup (e.g. sampling a displacement field) only
+    *  covers the requested output.
+    *  @return The session or nullptr if the images have to be warped by transformix.
+    */
+    ElxWarpSession::Pointer GetWarpSession(const ElxWarpOptions &options) const;
+
+    /**
+    *  @brief Warps an image onto the fixed grid.
+    *  @param type The elastix pixel type name of the result. Empty (default): the component type of the
+    *  image is kept (see ElxUtil::GetPixelTypeName); pass "float" to promote integer images.
+    *  @param interpolationOrder 0 (nearest neighbor), 1 (linear) or 2-5 (B-spline). In-process, B-spline
+    *  coefficients are computed once per image (see ElxBSplineInterpolator). Interpolated values of integer
+    *  result types are rounded and clamped to the range of the type; label images and masks have to be
+    *  warped with order 0. Multi-component images are warped in one pass over all components (see
+    *  ElxWarpSession::WarpMultiChannel) with the same orders and result layout. Orders 0 and 1 of 2D scalar
+    *  float/uint16 images use ElxWarpKernel (see ElxWarpSession::UsesWarpKernel), the default order 3 does not.
+    *  @param options Output grid: a region of the fixed grid and/or a coarser spacing (default: the full fixed grid).
+    *  When the grid is coarser than the moving image, the image is smoothed by a Gaussian first
+    *  (ElxWarpOptions::antiAliasing, not for order 0); multi-component images per component and slice stacks
+    *  in-plane.
+    */
     mitk::Image::Pointer WarpImage(const mitk::Image * image,
-                                   const std::string &type = "float",
-                                   const unsigned char &interpolationOrder = 3) const;
-    mitk::Image::Pointer WarpPoints(mitk::PointSet *);
+                                   const std::string &type = "",
+                                   const unsigned char &interpolationOrder = 3,
+                                   const ElxWarpOptions &options = ElxWarpOptions()) const;
+
+    /**
+    *  @brief Creates a lazily warped image (see ElxLazyWarpedImage): slices are warped when they are accessed and
+    *  kept in a least recently used cache; the pixel buffer of the whole image is only created when the volume is
+    *  requested (e.g. for rendering). Pixel values, pixel type and geometry match WarpImage without options.
+    *  @param cache Shared slice cache, e.g. of all results of a view; nullptr creates one per image.
+    *  @return The image, or nullptr if it has to be warped by WarpImage (no in-process session, several time steps).
+    */
+    ElxLazyWarpedImage::Pointer CreateLazyWarpedImage(const mitk::Image *image,
+                                                      const std::string &type = "",
+                                                      const unsigned char &interpolationOrder = 3,
+                                                      ElxLazyWarpedImage::Cache::Pointer cache = nullptr) const;
+
+    /**
+    *  @brief Warps an image file that does not fit into memory into a MetaImage file (.mha), tile by tile
+    *  (see ElxWarpSession::WarpToFile). Deformable transformations are evaluated per tile from their
+    *  coefficient grid; no dense deformation field is created.
+    *  @param type The elastix pixel type name of the result; empty keeps the component type of the input.
+    *  @param interpolationOrder 0 (nearest neighbor) or 1 (linear).
+    *  @param memoryBudget Approximate peak memory (bytes) of the tiles in flight (default: 512 MiB).
+    *  @param options Output grid (see WarpImage); anti-aliasing is not applied.
+    *  @throws mitk::Exception if the transformations can not be evaluated in-process or the order is above 1.
+    */
+    void WarpImageToFile(const std::string &inputPath,
+                         const std::string &outputPath,
+                         const std::string &type = "",
+                         const unsigned char &interpolationOrder = 1,
+                         std::size_t memoryBudget = std::size_t(512) << 20,
+                         const ElxWarpOptions &options = ElxWarpOptions()) const;
+
+    /**
+    *  @brief Warps a list of channel images that share one geometry (see ElxWarpSession::WarpChannels).
+    *  The source position and interpolation weights of each output pixel are computed once for all channels.
+    *  Multi-component images passed to WarpImage are handled the same way.
+    */
+    std::vector<mitk::Image::Pointer> WarpChannels(const std::vector<mitk::Image::ConstPointer> &channels,
+                                                   const std::string &pixelType = "",
+                                                   const unsigned char &interpolationOrder = 1) const;
+
+    /**
+    *  @brief Warps all label groups of a segmentation in one pass (see ElxWarpSession::WarpLabels).
+    *  Labels (values, names, colors and properties) and their grouping are preserved.
+    *  Without an in-process session every group is warped by WarpImage with nearest neighbor interpolation.
+    *  @param smooth Per-label interpolation of signed distance maps instead of nearest neighbor (in-process only).
+    */
+    mitk::MultiLabelSegmentation::Pointer WarpSegmentation(const mitk::MultiLabelSegmentation *segmentation,
+                                                           bool smooth = false) const;
+
+    /**
+    *  @brief Warps a 3D stack slice by slice with 2D transformations (see ElxWarpSession::WarpSlices), e.g. the
+    *  per-section results of a serial-section registration. The result volume is written in place.
+    *  WarpImage applies a 2D registration to all slices of a stack the same way.
+    *  @param sliceTransformations One transformation chain for all slices or one chain per slice.
+    *  Identical chains share one warp session.
+    *  @param interpolationOrder 0 (nearest neighbor), 1 (linear) or 2-5 (B-spline, coefficients per slice).
+    *  @throws mitk::Exception if a chain can not be evaluated in-process or the chains do not match the slices.
+    */
+    mitk::Image::Pointer WarpSlices(const mitk::Image *volume,
+                                    const std::vector<std::vector<std::string>> &sliceTransformations,
+                                    const std::string &pixelType = "",
+                                    const unsigned char &interpolationOrder = 1) const;
+
+    /**
+    *  @brief Exports the resampling lookup table from the grid of movingImage onto the fixed grid
+    *  (see ElxResampleLUT). The table can be saved, mapped again later and applied without the registration.
+    *  @throws mitk::Exception if the transformations can not be evaluated in-process.
+    */
+    ElxResampleLUT::Pointer CreateResampleLUT(const mitk::Image *movingImage) const;
+
+    /**
+    *  @brief Maps all points (all time steps) through the registered transformation chain in-process.
+    *  Like transformix, points are mapped from fixed image space to moving image space.
+    *  For 2D registrations the z-coordinates are kept.
+    *  @param points The input point set; it is not modified.
+    *  @param inverse Map from moving image space to fixed image space instead (e.g. annotations of the moving image).
+    *  The inverse is computed per point (see ElxTransformEngine::TransformPointsInverse).
+    *  @return A new point set with the same point ids.
+    *  @throws mitk::Exception if the transformations are not supported in-process (see ElxTransformEngine)
+    *  or the inverse of a point does not converge.
+    */
+    mitk::PointSet::Pointer WarpPoints(const mitk::PointSet *points, bool inverse = false) const;
+
+    /**
+    *  @brief Maps raw world coordinates (structure of arrays) in-place, see WarpPoints(const mitk::PointSet *, bool).
+    *  All vectors must have the same length.
+    */
+    void WarpPoints(std::vector<double> &x, std::vector<double> &y, std::vector<double> &z, bool inverse = false) const;
+    /**
+    *  @brief Returns the deformation field of the registration (fixed image grid, or the region set by
+    *  SetDeformationFieldRegion). The field is generated on the first call, in-process if possible,
+    *  otherwise by transformix, and kept until the transformations change.
+    */
     mitk::Image::Pointer GetDeformationField() const;
+
+    /**
+    *  @brief Restricts the deformation field to a region of the fixed image grid (pixel index and size).
+    *  Empty vectors select the whole grid (default).
+    */
+    void SetDeformationFieldRegion(const std::vector<unsigned int> &index, const std::vector<unsigned int> &size);
+
+    /**
+    *  @brief Returns true if the transformations are linear (Translation, Euler, Similarity, Affine)
+    *  and can be applied by ApplyToGeometry instead of resampling.
+    */
+    bool CanApplyToGeometry() const;
+
+    /**
+    *  @brief Composes the inverse of the (linear) transformation chain into the IndexToWorld transform of geometry.
+    *  Data shown with the updated geometry is aligned to the fixed image without resampling.
+    *  2D transformations are applied in the x-y plane.
+    *  @throws mitk::Exception if the transformations are not linear.
+    */
+    void ApplyToGeometry(mitk::BaseGeometry *geometry) const;
+
+    /**
+    *  @brief Creates an image that shares the pixel buffer of image (no copy) and is aligned by ApplyToGeometry.
+    *  The source image is kept alive by the "m2aia.registration.source" property of the result.
+    *  @throws mitk::Exception if the transformations are not linear.
+    */
+    mitk::Image::Pointer CreateAlignedImage(const mitk::Image *image) const;
+
+    /**
+    *  @brief Returns the inverse deformation field (moving space to fixed space) on the grid of the moving image.
+    *  In-process transformations are inverted per pixel (see ElxTransformEngine::CreateInverseDisplacementField).
+    *  Otherwise the transformix field of GetDeformationField() is inverted; it is only known on the fixed image grid
+    *  (or the region of SetDeformationFieldRegion), pixels that map outside of it are NaN.
+    *  The result is computed once and cached next to the forward field until the transformations change.
+    *  @throws mitk::Exception if no moving image or deformation field is available or the inversion does not converge.
+    */
+    mitk::Image::Pointer GetInverseDeformationField() const;
   };
 
 } // namespace m2
\ No newline at end of file
@@ -0,0 +1,113 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <mitkImage.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace m2
+{
+  /**
+   * @brief Precomputed resampling lookup table of a registration result for one moving and one fixed grid.
+   *
+   * For every output (fixed grid) pixel the table stores
+   * - the index of the nearest input (moving grid) pixel, or GetOutsideIndex() if the pixel maps outside, and
+   * - the 2^D input pixel indices and weights of linear interpolation,
+   * as structure of arrays (one index and one weight array per interpolation corner).
+   *
+   * Applying the table is a gather and multiply-add per output pixel. The nearest neighbor index map can
+   * also be used directly, e.g. to remap per-pixel spectra without resampling.
+   * Tables are saved as a single binary file (header followed by the arrays) and loaded by memory mapping.
+   * Tables are created by ElxWarpSession::CreateResampleLUT().
+   */
+  class MITKELASTIX_EXPORT ElxResampleLUT
+  {
+  public:
+    using Pointer = std::shared_ptr<ElxResampleLUT>;
+    using IndexType = std::uint64_t;
+    using WeightType = float;
+
+    /**
+     * @brief Binary header of the table (fixed size of 240 bytes).
+     */
+    struct Header
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t dimension;
+      std::uint32_t weightsPerPixel;
+      std::uint32_t reserved;
+      std::uint64_t outputSize[3];
+      std::uint64_t inputSize[3];
+      double origin[3];
+      double spacing[3];
+      double direction[9]; // row-major
+    };
+
+    /**
+     * @brief Allocates an empty table. All pixels are outside and all weights are 0.
+     */
+    static Pointer New(const Header &header);
+
+    /**
+     * @brief Maps a table file written by Save() (read-only).
+     * @throws mitk::Exception if the file is not a valid table.
+     */
+    static Pointer Load(const std::string &path);
+
+    void Save(const std::string &path) const;
+
+    /**
+     * @brief Resamples an image with the table.
+     * @param image Scalar or multi-component image on the moving grid the table was created for.
+     * @param nearest Use the nearest neighbor indices instead of linear interpolation.
+     * @param defaultPixelValue Value of output pixels that map outside of the image.
+     * @return The resampled image (component type of the input) in the M2aia layout.
+     */
+    mitk::Image::Pointer Apply(const mitk::Image *image, bool nearest = false, double defaultPixelValue = 0) const;
+
+    const Header &GetHeader() const { return *m_Header; }
+    std::uint64_t GetNumberOfPixels() const;
+    unsigned int GetWeightsPerPixel() const { return m_Header->weightsPerPixel; }
+    static constexpr IndexType GetOutsideIndex() { return ~IndexType(0); }
+
+    /**
+     * @brief Raw arrays (GetNumberOfPixels() values each). Indices are linear offsets into the input buffer.
+     * The non-const accessors are used to fill new tables; tables returned by Load() are mapped read-only.
+     */
+    const IndexType *GetNearestIndices() const { return m_Nearest; }
+    const IndexType *GetIndices(unsigned int corner) const { return m_Indices + corner * GetNumberOfPixels(); }
+    const WeightType *GetWeights(unsigned int corner) const { return m_Weights + corner * GetNumberOfPixels(); }
+    IndexType *GetNearestIndices() { return m_Nearest; }
+    IndexType *GetIndices(unsigned int corner) { return m_Indices + corner * GetNumberOfPixels(); }
+    WeightType *GetWeights(unsigned int corner) { return m_Weights + corner * GetNumberOfPixels(); }
+
+  private:
+    ElxResampleLUT() = default;
+    void SetBuffer(std::shared_ptr<void> owner, char *data, std::size_t size);
+
+    std::shared_ptr<void> m_Owner;
+    char *m_Data = nullptr;
+    std::size_t m_Size = 0;
+    Header *m_Header = nullptr;
+    IndexType *m_Nearest = nullptr;
+    IndexType *m_Indices = nullptr;
+    WeightType *m_Weights = nullptr;
+  };
+} // namespace m2
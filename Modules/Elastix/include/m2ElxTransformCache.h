@@ -0,0 +1,87 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <itkObject.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Least recently used cache of sampled (displacement field) transforms of transformation chains.
+   *
+   * Entries are keyed by the full content of the chain and a description of the sampling grid, so different
+   * chains never share an entry. The fields count against a memory budget (bytes); least recently used entries
+   * are removed to stay within the budget and fields larger than the budget are not kept.
+   * The cache is owned by ElxRegistrationHelper and passed to ElxTransformEngine and ElxWarpSession.
+   * All methods can be called from several threads.
+   */
+  class MITKELASTIX_EXPORT ElxTransformCache
+  {
+  public:
+    using Pointer = std::shared_ptr<ElxTransformCache>;
+
+    static Pointer New(std::size_t memoryBudget);
+
+    /**
+     * @brief Returns the object of the chain and grid or nullptr.
+     */
+    itk::Object::Pointer Get(const std::vector<std::string> &transformations, const std::string &grid);
+
+    /**
+     * @brief Adds an object that occupies bytes of memory.
+     */
+    void Add(const std::vector<std::string> &transformations,
+             const std::string &grid,
+             itk::Object::Pointer object,
+             std::size_t bytes);
+
+    void SetMemoryBudget(std::size_t memoryBudget);
+    std::size_t GetMemoryBudget() const;
+
+    /**
+     * @brief Bytes of all cached objects.
+     */
+    std::size_t GetMemoryUsage() const;
+
+    void Clear();
+
+  private:
+    struct Entry
+    {
+      std::vector<std::string> transformations;
+      std::string grid;
+      itk::Object::Pointer object;
+      std::size_t bytes = 0;
+    };
+
+    explicit ElxTransformCache(std::size_t memoryBudget) : m_MemoryBudget(memoryBudget) {}
+
+    /** Removes least recently used entries until the budget is met; the mutex is held by the caller. */
+    void Shrink();
+
+    mutable std::mutex m_Mutex;
+    std::list<Entry> m_Entries;
+    std::size_t m_MemoryBudget = 0;
+    std::size_t m_MemoryUsage = 0;
+  };
+} // namespace m2
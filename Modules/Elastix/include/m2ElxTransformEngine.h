@@ -0,0 +1,266 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <m2ElxTransformCache.h>
+#include <m2ElxTransformParameterMap.h>
+
+#include <itkAffineTransform.h>
+#include <itkCompositeTransform.h>
+#include <itkDisplacementFieldTransform.h>
+#include <itkImageBase.h>
+#include <itkTransform.h>
+#include <mitkImage.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief In-process evaluation of elastix transformations (no transformix process, no temporary files).
+   *
+   * Elastix transform parameter files are converted into ITK transforms. Supported are
+   * TranslationTransform, EulerTransform, SimilarityTransform, AffineTransform and
+   * (Recursive)BSplineTransform (spline order 1-3), chained by "HowToCombineTransforms Compose".
+   *
+   * A list of transformations is interpreted like ElxRegistrationHelper::GetTransformation():
+   * element i uses element i-1 as initial transform, i.e. T(x) = T_n(...T_1(T_0(x))).
+   * Like all elastix transforms, the result maps points of the fixed image space to the moving image space.
+   */
+  class MITKELASTIX_EXPORT ElxTransformEngine
+  {
+  public:
+    template <unsigned int VDimension>
+    using TransformType = itk::Transform<double, VDimension, VDimension>;
+
+    template <unsigned int VDimension>
+    using CompositeTransformType = itk::CompositeTransform<double, VDimension>;
+
+    template <unsigned int VDimension>
+    using AffineTransformType = itk::AffineTransform<double, VDimension>;
+
+    template <unsigned int VDimension, class TPrecision = double>
+    using DisplacementFieldTransformType = itk::DisplacementFieldTransform<TPrecision, VDimension>;
+
+    template <unsigned int VDimension, class TPrecision = double>
+    using DisplacementFieldType =
+      typename DisplacementFieldTransformType<VDimension, TPrecision>::DisplacementFieldType;
+
+    /**
+     * @brief Representation of a deformable transformation chain used for resampling.
+     * - DisplacementField: dense field with double components (8 bytes per component)
+     * - CompactDisplacementField: dense field with float components (4 bytes per component)
+     * - CoefficientGrid: no dense field; the BSpline coefficient grids are evaluated for each output pixel
+     *   while resampling (tile by tile, in parallel)
+     * - Automatic: see SelectDeformationRepresentation
+     */
+    enum class DeformationRepresentation
+    {
+      Automatic,
+      DisplacementField,
+      CompactDisplacementField,
+      CoefficientGrid
+    };
+
+    /**
+     * @brief Picks the representation for a grid of numberOfPixels: the double field if it fits into
+     * memoryBudget (bytes), else the float field if it fits, else the coefficient grid.
+     */
+    static DeformationRepresentation SelectDeformationRepresentation(std::size_t numberOfPixels,
+                                                                     unsigned int dimension,
+                                                                     std::size_t memoryBudget);
+
+    /**
+     * @brief Checks if all transformations can be evaluated in-process.
+     * @param transformations The elastix transform parameter file contents.
+     * @return true if CreateCompositeTransform can be used.
+     */
+    static bool CanTransform(const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Returns the common FixedImageDimension of the transformations.
+     * @throws mitk::Exception if the list is empty or the dimensions differ.
+     */
+    static unsigned int GetDimension(const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Creates the ITK transform of a single elastix transform parameter file.
+     * The InitialTransformParametersFileName entry is not followed.
+     * @throws mitk::Exception if the transform is not supported.
+     */
+    template <unsigned int VDimension>
+    static typename TransformType<VDimension>::Pointer CreateTransform(const ElxTransformParameterMap &parameters);
+
+    /**
+     * @brief Creates a composite transform of the whole chain of transformations.
+     * @throws mitk::Exception if a transform is not supported.
+     */
+    template <unsigned int VDimension>
+    static typename CompositeTransformType<VDimension>::Pointer CreateCompositeTransform(
+      const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Checks if all transformations are linear (Translation, Euler, Similarity or Affine).
+     */
+    static bool IsLinear(const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Combines a chain of linear transformations into a single affine matrix and offset.
+     * @throws mitk::Exception if a transformation is not linear.
+     */
+    template <unsigned int VDimension>
+    static typename AffineTransformType<VDimension>::Pointer CreateAffineTransform(
+      const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Combines the linear stages of a chain into a single affine transform; deformable stages are skipped.
+     * This is the part of the chain that is inverted exactly by TransformPointsInverse.
+     */
+    template <unsigned int VDimension>
+    static typename AffineTransformType<VDimension>::Pointer CreateLinearPart(
+      const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Collapses a chain of transformations into a single transform.
+     * - Linear chains become one affine transform (see CreateAffineTransform).
+     * - Chains with a BSpline stage are sampled once into a displacement field on the grid of `reference`
+     *   (consecutive linear stages are combined before sampling).
+     * @param transformations The transformation chain.
+     * @param reference Defines the grid of the displacement field; only its geometry is used.
+     * @param cache Optional; the field is taken from or added to the cache, keyed by chain and grid.
+     */
+    template <unsigned int VDimension>
+    static typename TransformType<VDimension>::Pointer CreateFlattenedTransform(
+      const std::vector<std::string> &transformations,
+      const itk::ImageBase<VDimension> *reference,
+      ElxTransformCache *cache = nullptr);
+
+    /**
+     * @brief Samples a deformable transformation chain into a displacement field transform on the grid of `reference`.
+     * Consecutive linear stages are combined before sampling.
+     * @tparam TPrecision Component type of the field (double or float).
+     * @param cache Optional, see CreateFlattenedTransform.
+     */
+    template <unsigned int VDimension, class TPrecision>
+    static typename DisplacementFieldTransformType<VDimension, TPrecision>::Pointer CreateDisplacementFieldTransform(
+      const std::vector<std::string> &transformations,
+      const itk::ImageBase<VDimension> *reference,
+      ElxTransformCache *cache = nullptr);
+
+    /**
+     * @brief Creates the transform of the whole chain without sampling a dense field;
+     * consecutive linear stages are combined into one affine transform.
+     */
+    template <unsigned int VDimension>
+    static typename CompositeTransformType<VDimension>::Pointer CreateCoefficientGridTransform(
+      const std::vector<std::string> &transformations);
+
+    /**
+     * @brief Transforms a batch of points in-place. Coordinates are passed as structure of arrays (x, y, z).
+     * Linear chains are reduced to one affine matrix that is applied in a plain loop over the arrays;
+     * deformable chains are evaluated exactly per point. Blocks of points are processed in parallel.
+     * @param transformations The transformation chain (maps fixed space to moving space).
+     * @param x,y,z Arrays of n world coordinates. For 2D chains z is ignored and may be null.
+     * @throws mitk::Exception if a transform is not supported.
+     */
+    static void TransformPoints(
+      const std::vector<std::string> &transformations, double *x, double *y, double *z, std::size_t n);
+
+    /**
+     * @brief Maps a batch of points of the moving image space in-place to the fixed image space (inverse of TransformPoints).
+     * The linear part of the chain (see CreateLinearPart) is inverted exactly, so large rotations and flips are handled;
+     * only the deformable residual r(x) = T(x) - A(x) is iterated, x_{k+1} = A^-1(y - r(x_k)) with x_0 = A^-1(y).
+     * Blocks of points are processed in parallel.
+     * @param tolerance Bound of the last update per point in physical units.
+     * @throws mitk::Exception if a transform is not supported or a point does not converge within
+     * maximumNumberOfIterations.
+     */
+    static void TransformPointsInverse(const std::vector<std::string> &transformations,
+                                       double *x,
+                                       double *y,
+                                       double *z,
+                                       std::size_t n,
+                                       unsigned int maximumNumberOfIterations = 50,
+                                       double tolerance = 1e-6);
+
+    /**
+     * @brief Transforms a batch of points in-place using an arbitrary ITK transform, see TransformPoints above.
+     * @param transform A thread-safe transform (TransformPoint is called concurrently).
+     * @param x Array of VDimension coordinate arrays with n values each.
+     */
+    template <unsigned int VDimension>
+    static void TransformPoints(const TransformType<VDimension> *transform, double *x[VDimension], std::size_t n);
+
+    /**
+     * @brief Copies a deformation field image (e.g. deformationField.nrrd of transformix) with VDimension
+     * float or double components into an ITK displacement field.
+     * @throws mitk::Exception if the number or type of components does not match.
+     */
+    template <unsigned int VDimension, class TPrecision = double>
+    static typename DisplacementFieldType<VDimension, TPrecision>::Pointer ToDisplacementField(const mitk::Image *image);
+
+    /**
+     * @brief Samples the inverse of a transformation chain as displacement field on the grid of `reference`,
+     * a grid of the moving image space, see TransformPointsInverse. The chain is evaluated exactly, so the
+     * inverse is defined on the whole grid. Tiles are processed in parallel.
+     * @param tolerance Bound of the last update relative to the smallest spacing of `reference`.
+     * @param maximumResidual Optional; receives the largest last update in physical units.
+     * @throws mitk::Exception if a pixel does not converge within maximumNumberOfIterations.
+     */
+    template <unsigned int VDimension>
+    static typename DisplacementFieldType<VDimension>::Pointer CreateInverseDisplacementField(
+      const std::vector<std::string> &transformations,
+      const itk::ImageBase<VDimension> *reference,
+      unsigned int maximumNumberOfIterations = 50,
+      double tolerance = 1e-3,
+      double *maximumResidual = nullptr);
+
+    /**
+     * @brief Inverts a displacement field (e.g. deformationField.nrrd of transformix) on the grid of `reference`.
+     * The forward map x -> x + u(x) is defined on the grid of `field` (fixed image space), the inverse is sampled on
+     * `reference` (moving image space). The linear part of the forward map is inverted exactly and only the residual
+     * is iterated like in TransformPointsInverse; tiles are processed in parallel.
+     * The forward field is not known outside of its grid: pixels whose iteration leaves the grid of `field` are
+     * rejected and set to NaN.
+     * @param linearPart The linear part of the forward map (see CreateLinearPart); null: it is fitted to the field
+     * by least squares.
+     * @param tolerance Bound of the last update relative to the smallest spacing of `field`.
+     * @param maximumResidual Optional; receives the largest last update in physical units.
+     * @param numberOfOutsidePixels Optional; receives the number of rejected pixels.
+     * @throws mitk::Exception if the linear part is not invertible or a pixel does not converge within
+     * maximumNumberOfIterations.
+     */
+    template <unsigned int VDimension>
+    static typename DisplacementFieldType<VDimension>::Pointer InvertDisplacementField(
+      const DisplacementFieldType<VDimension> *field,
+      const itk::ImageBase<VDimension> *reference,
+      const AffineTransformType<VDimension> *linearPart = nullptr,
+      unsigned int maximumNumberOfIterations = 50,
+      double tolerance = 1e-3,
+      double *maximumResidual = nullptr,
+      std::size_t *numberOfOutsidePixels = nullptr);
+
+    /**
+     * @brief Copies the output grid (Size, Index, Spacing, Origin, Direction) of a transform parameter file,
+     * i.e. the grid transformix resamples onto, to the given image. No pixel buffer is allocated.
+     */
+    template <unsigned int VDimension>
+    static void InitializeOutputGeometry(const ElxTransformParameterMap &parameters, itk::ImageBase<VDimension> *image);
+  };
+
+} // namespace m2
@@ -0,0 +1,76 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Parsed representation of an elastix parameter file (e.g. TransformParameters.0.txt).
+   *
+   * Each "(Name value value ...)" entry is stored as list of strings. Quotes are removed and
+   * comments ("// ...") are ignored. Numbers are always parsed locale independent.
+   */
+  class MITKELASTIX_EXPORT ElxTransformParameterMap
+  {
+  public:
+    /**
+     * @brief Parses the text of an elastix parameter file.
+     * @param text The parameter file content.
+     * @return ElxTransformParameterMap
+     */
+    static ElxTransformParameterMap Parse(const std::string &text);
+
+    bool Has(const std::string &name) const;
+
+    /**
+     * @brief Returns all values of the parameter `name` or an empty list.
+     */
+    std::vector<std::string> GetStrings(const std::string &name) const;
+
+    /**
+     * @brief Returns the first value of the parameter `name` or `defaultValue`.
+     */
+    std::string GetString(const std::string &name, const std::string &defaultValue = "") const;
+
+    /**
+     * @brief Returns all values of the parameter `name` as numbers.
+     * @throws mitk::Exception if a value is not a number.
+     */
+    std::vector<double> GetDoubles(const std::string &name) const;
+
+    /**
+     * @brief Returns the first value of the parameter `name` as number or `defaultValue`.
+     */
+    double GetDouble(const std::string &name, double defaultValue) const;
+
+    /**
+     * @brief Returns the value of FixedImageDimension (default: 2).
+     */
+    unsigned int GetDimension() const;
+
+    /**
+     * @brief Returns the value of Transform, e.g. "EulerTransform".
+     */
+    std::string GetTransformName() const { return GetString("Transform"); }
+
+  private:
+    std::map<std::string, std::vector<std::string>> m_Parameters;
+  };
+} // namespace m2
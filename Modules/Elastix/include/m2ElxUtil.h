@@ -28,8 +28,12 @@ See LICENSE.txt for details.
 #include <mitkImage.h>
 #include <mitkLabelSetImage.h>
 #include <mitkPointSet.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <regex>
 #include <string>
+#include <type_traits>
 #ifdef _WIN32
 #include <filesystem>
 #endif
@@ -89,6 +93,14 @@ namespace m2
       return "";
     }
 
+    /**
+     * @brief Returns the last "Final metric value" reported in an elastix log file.
+     *
+     * @param logFilePath Path to the elastix.log file.
+     * @return double The final metric value, or +infinity if the log does not contain one.
+     */
+    static double GetFinalMetricValue(const std::string &logFilePath);
+
     /**
      * @brief Search the system for elastix executables (name)
      * On Windows: Uses ELASTIX_PATH environment variable
@@ -207,6 +219,72 @@ namespace m2
 
       
 
+    /**
+     * @brief Returns true if `pixelType` names an elastix integer pixel type (e.g. "short", "unsigned_char").
+     */
+    static bool IsIntegerPixelType(const std::string &pixelType)
+    {
+      return pixelType == "short" || pixelType == "unsigned_short" || pixelType == "char" ||
+             pixelType == "unsigned_char" || pixelType == "int" || pixelType == "unsigned_int";
+    }
+
+    /**
+     * @brief Returns the elastix pixel type name (ResultImagePixelType) of the component type of `image`,
+     * e.g. "unsigned_short". Component types elastix does not know (e.g. long) are mapped to "float".
+     */
+    static std::string GetPixelTypeName(const mitk::Image *image)
+    {
+      const auto name = image->GetPixelType().GetComponentTypeAsString();
+      if (name == "float" || name == "double" || IsIntegerPixelType(name))
+        return name;
+      return "float";
+    }
+
+    /**
+     * @brief Converts an interpolated value to a pixel value: integer types are rounded to the nearest
+     * value and clamped to their range.
+     */
+    template <class TOutput>
+    static TOutput CastPixel(double value)
+    {
+      if (std::is_integral<TOutput>::value)
+      {
+        value = std::round(value);
+        value = std::min<double>(std::max<double>(value, std::numeric_limits<TOutput>::lowest()),
+                                 std::numeric_limits<TOutput>::max());
+      }
+      return static_cast<TOutput>(value);
+    }
+
+    /**
+     * @brief Calls `functor` with a value of the C++ type that corresponds to the elastix pixel type name
+     * (ResultImagePixelType), e.g. functor(float{}) for "float".
+     *
+     * @throws mitk::Exception if the name is unknown.
+     */
+    template <class TFunctor>
+    static void AccessByPixelTypeName(const std::string &pixelType, TFunctor &&functor)
+    {
+      if (pixelType == "float")
+        functor(static_cast<float>(0));
+      else if (pixelType == "double")
+        functor(static_cast<double>(0));
+      else if (pixelType == "char")
+        functor(static_cast<char>(0));
+      else if (pixelType == "unsigned_char")
+        functor(static_cast<unsigned char>(0));
+      else if (pixelType == "short")
+        functor(static_cast<short>(0));
+      else if (pixelType == "unsigned_short")
+        functor(static_cast<unsigned short>(0));
+      else if (pixelType == "int")
+        functor(static_cast<int>(0));
+      else if (pixelType == "unsigned_int")
+        functor(static_cast<unsigned int>(0));
+      else
+        mitkThrow() << "Unknown elastix pixel type [" << pixelType << "]";
+    }
+
     static inline std::string to_string(const std::vector<std::string> &list) noexcept
     {
       return std::accumulate(list.begin(), list.end(), std::string(), [](const std::string &a, const std::string &b) { return a + " " + b; });
@@ -0,0 +1,101 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+
+#include <cstddef>
+#include <string>
+
+namespace m2
+{
+  /**
+   * @brief Specialised resampling kernel for 2D scalar images warped by a displacement field.
+   *
+   * Replaces itk::ResampleImageFilter with a linear or nearest neighbor interpolator for the most common
+   * case of warping: no virtual calls, no per-sample bounds checks beyond the buffer test and scan lines
+   * that are processed 4 (AVX2) or 2 (SSE2) pixels at a time. The instruction set is selected at runtime;
+   * the AVX2 variant is only available if the module is built with M2AIA_ELASTIX_SIMD.
+   *
+   * The arithmetic follows ResampleImageFilter, DisplacementFieldTransform<float, 2> and
+   * LinearInterpolateImageFunction step by step (double precision interpolation, float precision transform,
+   * same bounds and edge handling), so results are identical to the ITK path except where ITK evaluates
+   * the displacement field between grid nodes due to rounding of the continuous index.
+   */
+  class MITKELASTIX_EXPORT ElxWarpKernel
+  {
+  public:
+    enum class InstructionSet
+    {
+      Scalar,
+      SSE2,
+      AVX2
+    };
+
+    struct Parameters2D
+    {
+      /** Output grid; equal to the grid of the displacement field. */
+      unsigned int outputSize[2];
+      double outputOrigin[2];
+      double outputIndexToPhysical[2][2];
+
+      /** Displacement of each output pixel (2 interleaved components). */
+      const float *displacement = nullptr;
+
+      /** Input grid. */
+      unsigned int inputSize[2];
+      double inputOrigin[2];
+      double inputPhysicalToIndex[2][2];
+
+      bool nearest = false;
+      /** Round integer results to the nearest value; ResampleImageFilter truncates. */
+      bool round = false;
+      double defaultPixelValue = 0;
+    };
+
+    /**
+     * @brief Returns the best instruction set supported by the build and the CPU.
+     */
+    static InstructionSet GetInstructionSet();
+
+    static std::string GetInstructionSetName(InstructionSet instructionSet);
+
+    /**
+     * @brief Checks if the input type is supported (float or unsigned short).
+     */
+    static bool IsSupportedInputType(const std::string &componentType);
+
+    /**
+     * @brief Warps the rows [firstRow, lastRow) of the output image.
+     * @param output Buffer of the whole output image; values are clamped to the range of TOutput.
+     * @param instructionSet Falls back to a supported instruction set if not available.
+     */
+    template <class TInput, class TOutput>
+    static void Warp2D(const Parameters2D &parameters,
+                       const TInput *input,
+                       TOutput *output,
+                       unsigned int firstRow,
+                       unsigned int lastRow,
+                       InstructionSet instructionSet);
+
+    /**
+     * @brief Interpolates the leading pixels of a row with AVX2 (see m2ElxWarpKernelAVX2.cpp).
+     * @return The number of pixels written to values and inside; a multiple of 4.
+     */
+    template <class TInput>
+    static unsigned int InterpolateRowAVX2(
+      const Parameters2D &parameters, const TInput *input, unsigned int row, double *values, unsigned char *inside);
+  };
+} // namespace m2
@@ -0,0 +1,64 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Output grid of a warp (see ElxRegistrationHelper::WarpImage): a region of the fixed image grid
+   * and/or a coarser output spacing. The default options select the full fixed image grid.
+   *
+   * The options rewrite the output grid (Size, Index, Origin, Spacing) of the last transformation,
+   * so the in-process and the transformix path resample only the requested output.
+   * Vectors are given per axis of the transformation; additional values (e.g. z of a 2D registration) are ignored.
+   */
+  struct MITKELASTIX_EXPORT ElxWarpOptions
+  {
+    /** First pixel (index of the fixed grid) of the region, or its lower corner as physical point (mm). Empty: whole grid. */
+    std::vector<double> regionOrigin;
+    /** Extent of the region along the grid axes in pixels, or in mm. */
+    std::vector<double> regionSize;
+    /** regionOrigin and regionSize are physical coordinates (mm) instead of pixels. */
+    bool physicalRegion = false;
+    /** Output spacing (mm) per axis; if set, downsampleFactor is ignored. */
+    std::vector<double> spacing;
+    /** Output spacing as multiple of the fixed image spacing (> 1 coarsens the grid). */
+    double downsampleFactor = 1;
+    /** Smooth the moving image before it is resampled onto a coarser grid (interpolation order > 0 only). */
+    bool antiAliasing = true;
+
+    bool IsDefault() const;
+
+    /**
+     * @brief Replaces the output grid of an elastix transform parameter text by the grid of the options.
+     * The region is expanded to full pixels and clipped to the grid; output pixels cover it edge to edge.
+     * @throws mitk::Exception if the transformation does not define an output grid, the region is empty
+     * or a spacing is not positive.
+     */
+    std::string ApplyToTransformation(const std::string &parameters) const;
+
+    /**
+     * @brief Gaussian sigmas (mm) to smooth an image with inputSpacing before it is sampled with outputSpacing.
+     * Axes that are not downsampled are 0.
+     */
+    static std::vector<double> GetAntiAliasingSigma(const std::vector<double> &inputSpacing,
+                                                    const std::vector<double> &outputSpacing);
+  };
+} // namespace m2
@@ -0,0 +1,268 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <MitkElastixExports.h>
+#include <m2ElxResampleLUT.h>
+#include <m2ElxTransformEngine.h>
+#include <mitkImage.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace m2
+{
+  /**
+   * @brief Prepared state to warp any number of images with one registration result.
+   *
+   * The output grid, the ITK transform (affine, displacement field or coefficient grid) and
+   * the interpolation settings are set up once; Warp() only resamples.
+   * Sessions are created and owned by ElxRegistrationHelper (see ElxRegistrationHelper::GetWarpSession()).
+   * Warp() can be called from several threads.
+   */
+  class MITKELASTIX_EXPORT ElxWarpSession
+  {
+  public:
+    using Pointer = std::shared_ptr<ElxWarpSession>;
+
+    /**
+     * @brief Session that evaluates the transformations in-process (see ElxTransformEngine).
+     * The output grid is taken from the last transformation.
+     * @param cache Optional; sampled displacement fields are shared with other sessions of the same chain and grid.
+     */
+    static Pointer CreateFromTransformations(const std::vector<std::string> &transformations,
+                                             ElxTransformEngine::DeformationRepresentation representation,
+                                             std::size_t memoryBudget,
+                                             ElxTransformCache *cache = nullptr);
+
+    /**
+     * @brief Session that resamples with a dense deformation field (e.g. of transformix) with 2 or 3 components.
+     * The output grid is the grid of the field; 3D volumes are resampled by the multithreaded ITK resampler.
+     * Images are interpolated linearly unless an interpolation order is passed to Warp().
+     */
+    static Pointer CreateFromDeformationField(const mitk::Image *deformationField);
+
+    /**
+     * @brief Warps an image prepared by ElxRegistrationHelper::ConvertForElastixProcessing.
+     * @param image The moving image; its dimension has to match GetDimension().
+     * @param pixelType The elastix pixel type name of the result.
+     * @param interpolationOrder 0 (nearest neighbor), 1 (linear) or 2-5 (B-spline, see ElxBSplineInterpolator);
+     * -1 uses ResampleInterpolator/FinalBSplineInterpolationOrder of the transformation. Interpolated values
+     * of integer result types are rounded and clamped (see ElxUtil::CastPixel).
+     */
+    mitk::Image::Pointer Warp(const mitk::Image *image, const std::string &pixelType, int interpolationOrder = -1) const;
+
+    /**
+     * @brief Warps all components of a multi-component image (e.g. itk::VectorImage) in a single pass.
+     * The source position and interpolation weights of each output pixel are computed once and applied
+     * to all components, processed in blocks of components per image tile and in parallel over tiles.
+     * For B-spline orders (2-5) the coefficients of all components are computed first (one double copy of the
+     * image); the weights of the shared mapping are then applied to the coefficients, as in Warp().
+     * @param image The moving image (2D, 3D with a single slice, or 3D); it is not converted before.
+     * @param pixelType The elastix pixel type name of the result components.
+     * @param interpolationOrder See Warp().
+     * @return The warped image in the M2aia layout (3D, single slice for 2D transformations).
+     */
+    mitk::Image::Pointer WarpMultiChannel(const mitk::Image *image,
+                                          const std::string &pixelType,
+                                          int interpolationOrder = -1) const;
+
+    /**
+     * @brief Warps a list of single-component channel images that share one geometry, see WarpMultiChannel.
+     * The mapping is computed once per output pixel and applied to every channel.
+     */
+    std::vector<mitk::Image::Pointer> WarpChannels(const std::vector<mitk::Image::ConstPointer> &channels,
+                                                   const std::string &pixelType,
+                                                   int interpolationOrder = -1) const;
+
+    /**
+     * @brief Warps label images that share one geometry (e.g. the groups of a mitk::MultiLabelSegmentation) in a single pass.
+     * The transformation is evaluated once per output pixel for all images. Output tiles are processed in parallel;
+     * per image only the labels whose bounding box overlaps the input footprint of a tile are considered and tiles
+     * without such labels are skipped. Only label pixels are written, the rest of the result stays background (0).
+     * @param labelImages Scalar integer images; the results keep their pixel types and label values.
+     * @param smooth Interpolate the signed distance map of each label linearly (computed within the bounding box of
+     * the label) and assign the label with the smallest negative distance, instead of nearest neighbor interpolation.
+     * @throws mitk::Exception if an image is not a scalar integer image or the geometries differ.
+     */
+    std::vector<mitk::Image::Pointer> WarpLabels(const std::vector<mitk::Image::ConstPointer> &labelImages,
+                                                 bool smooth = false) const;
+
+    /**
+     * @brief Warps a region of the output grid, see WarpMultiChannel. Only the output pixels of the region are computed.
+     * @param index First pixel of the region in the output grid (GetDimension() values).
+     * @param size Size of the region (GetDimension() values).
+     * @return The region in the M2aia layout; its geometry places it inside the output grid.
+     * @throws mitk::Exception if the region exceeds the output grid.
+     */
+    mitk::Image::Pointer WarpRegion(const mitk::Image *image,
+                                    const std::string &pixelType,
+                                    const std::vector<unsigned int> &index,
+                                    const std::vector<unsigned int> &size,
+                                    int interpolationOrder = -1) const;
+
+    /**
+     * @brief Applies the 2D transformation of the session to every z-slice of a 3D stack, see WarpSlices(sessions, ...).
+     */
+    mitk::Image::Pointer WarpSlices(const mitk::Image *volume,
+                                    const std::string &pixelType,
+                                    int interpolationOrder = -1) const;
+
+    /**
+     * @brief Applies 2D transformations slice by slice to a 3D stack (e.g. serial sections) in a single pass.
+     * The result volume is allocated once and written in place: no slice images are extracted. The mapping of
+     * an output tile is computed once per transformation; with a single session it is applied to all slices.
+     * Tiles of all slices are processed in parallel. B-spline orders are supported as in WarpMultiChannel; the
+     * coefficients are computed per slice.
+     * @param sessions One 2D session for all slices, or one session per slice; all share one output grid.
+     * Interpolation settings and the x-y geometry of the result are taken from the first session.
+     * @param volume The moving stack (3D, or 2D as a single slice); it may have several components.
+     * @return The warped stack; the z-axis is taken from volume.
+     * @throws mitk::Exception if the number of sessions does not match the slices or a session is not 2D.
+     */
+    static mitk::Image::Pointer WarpSlices(const std::vector<Pointer> &sessions,
+                                           const mitk::Image *volume,
+                                           const std::string &pixelType,
+                                           int interpolationOrder = -1);
+
+    /**
+     * @brief Size of the output grid (GetDimension() values).
+     */
+    std::vector<unsigned int> GetOutputSize() const;
+
+    /**
+     * @brief IndexToWorld transform of the result of WarpMultiChannel() or WarpSlices() for image, without warping.
+     * The axes of the output grid are set; the z-axis of 2D transformations is taken from image.
+     */
+    mitk::AffineTransform3D::Pointer GetOutputIndexToWorldTransform(const mitk::Image *image) const;
+
+    /**
+     * @brief Warps an image file into an image file tile by tile; neither image is held in memory as a whole.
+     * For every output tile the transformation is evaluated (the displacement sub-field of the tile), only the
+     * bounding box of the source pixels is read from inputPath and the tile is written into outputPath.
+     * Tiles are processed in parallel, one per worker thread. The tile size follows from memoryBudget; tiles
+     * whose input box exceeds the budget are split.
+     * @param inputPath Moving image file; reading in parts requires a streamable format (e.g. MetaImage, NRRD
+     * without compression), other files are loaded once.
+     * @param outputPath Result file that can be written in tiles (MetaImage .mha/.mhd); an existing file is replaced.
+     * @param pixelType The elastix pixel type name of the result; empty keeps the component type of the input.
+     * @param interpolationOrder 0 (nearest neighbor) or 1 (linear); -1 uses the settings of the transformation.
+     * B-spline orders need the coefficients of the whole image and are rejected.
+     * @param memoryBudget Approximate peak memory (bytes) of all tiles in flight.
+     * @throws mitk::Exception if a file can not be read or written, or for interpolation orders above 1.
+     */
+    void WarpToFile(const std::string &inputPath,
+                    const std::string &outputPath,
+                    const std::string &pixelType,
+                    int interpolationOrder,
+                    std::size_t memoryBudget) const;
+
+    /**
+     * @brief Computes the resampling lookup table (nearest neighbor and linear) from the grid of
+     * movingImage onto the output grid of the session.
+     * @param movingImage Defines the input grid; the pixel values are not used.
+     */
+    ElxResampleLUT::Pointer CreateResampleLUT(const mitk::Image *movingImage) const;
+
+    unsigned int GetDimension() const { return m_Dimension; }
+
+    /**
+     * @brief Checks if Warp() uses ElxWarpKernel for 2D scalar float/uint16 images with order 0 or 1.
+     * This requires a 2D displacement field sampled on the output grid; double fields are converted to float
+     * once when the session is created, if the copy fits into the memory budget. B-spline orders (2-5, including
+     * the default order 3 of ElxRegistrationHelper::WarpImage) are evaluated by ElxBSplineInterpolator instead.
+     */
+    bool UsesWarpKernel() const { return m_KernelField.IsNotNull(); }
+
+    /**
+     * @brief Seconds spent to prepare the session.
+     */
+    double GetSetupTime() const { return m_SetupTime; }
+
+    /**
+     * @brief Seconds spent in Warp(), accumulated over all calls.
+     */
+    double GetWarpTime() const;
+
+    unsigned int GetNumberOfWarps() const;
+
+  private:
+    ElxWarpSession() = default;
+
+    /**
+     * @brief Warps 2D scalar float/uint16 images of a displacement field session with ElxWarpKernel, see UsesWarpKernel().
+     * @return nullptr if the kernel does not apply (the ITK resampler is used).
+     */
+    mitk::Image::Pointer WarpWithKernel(const mitk::Image *image,
+                                        const std::string &pixelType,
+                                        unsigned int interpolationOrder) const;
+
+    unsigned int GetInterpolationOrder(const std::string &pixelType, int interpolationOrder) const;
+
+    template <unsigned int VDimension>
+    mitk::Image::Pointer WarpImpl(const mitk::Image *image,
+                                  const std::string &pixelType,
+                                  unsigned int interpolationOrder) const;
+
+    template <unsigned int VDimension>
+    mitk::Image::Pointer WarpBSplineImpl(const mitk::Image *image,
+                                         const std::string &pixelType,
+                                         unsigned int interpolationOrder) const;
+
+    template <unsigned int VDimension>
+    std::vector<mitk::Image::Pointer> WarpComponentsImpl(const std::vector<mitk::Image::ConstPointer> &images,
+                                                         const std::string &pixelType,
+                                                         int interpolationOrder,
+                                                         const std::vector<unsigned int> &regionIndex = {},
+                                                         const std::vector<unsigned int> &regionSize = {}) const;
+
+    template <unsigned int VDimension>
+    std::vector<mitk::Image::Pointer> WarpLabelsImpl(const std::vector<mitk::Image::ConstPointer> &labelImages,
+                                                     bool smooth) const;
+
+    static mitk::Image::Pointer WarpSlicesImpl(const std::vector<const ElxWarpSession *> &sessions,
+                                               const mitk::Image *volume,
+                                               const std::string &pixelType,
+                                               int interpolationOrder);
+
+    template <unsigned int VDimension>
+    ElxResampleLUT::Pointer CreateResampleLUTImpl(const mitk::Image *movingImage) const;
+
+    template <unsigned int VDimension>
+    void WarpToFileImpl(const std::string &inputPath,
+                        const std::string &outputPath,
+                        const std::string &pixelType,
+                        int interpolationOrder,
+                        std::size_t memoryBudget) const;
+
+    void AddWarpTime(double seconds) const;
+
+    unsigned int m_Dimension = 2;
+    itk::LightObject::Pointer m_Transform;
+    itk::LightObject::Pointer m_Reference;
+    // float32 field of the output grid for ElxWarpKernel (2D displacement field sessions only)
+    ElxTransformEngine::DisplacementFieldType<2, float>::ConstPointer m_KernelField;
+    std::string m_Interpolator = "FinalBSplineInterpolator";
+    unsigned int m_SplineOrder = 3;
+    double m_DefaultPixelValue = 0;
+    double m_SetupTime = 0;
+
+    mutable std::mutex m_TimingMutex;
+    mutable double m_WarpTime = 0;
+    mutable unsigned int m_NumberOfWarps = 0;
+  };
+} // namespace m2
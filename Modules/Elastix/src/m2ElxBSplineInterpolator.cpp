@@ -0,0 +1,455 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxBSplineInterpolator.h>
+#include <m2ElxUtil.h>
+
+#include <mitkImageReadAccessor.h>
+
+#include <itkMultiThreaderBase.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  constexpr double Tolerance = 1e-10;
+  constexpr std::size_t LineBlockSize = 64;
+  constexpr std::size_t PointBlockSize = 64;
+
+  /**
+   * Poles of the recursive prefilter (see itk::BSplineDecompositionImageFilter::SetPoles).
+   */
+  std::vector<double> GetPoles(unsigned int order)
+  {
+    switch (order)
+    {
+      case 2:
+        return {std::sqrt(8.0) - 3.0};
+      case 3:
+        return {std::sqrt(3.0) - 2.0};
+      case 4:
+        return {std::sqrt(664.0 - std::sqrt(438976.0)) + std::sqrt(304.0) - 19.0,
+                std::sqrt(664.0 + std::sqrt(438976.0)) - std::sqrt(304.0) - 19.0};
+      case 5:
+        return {std::sqrt(135.0 / 2.0 - std::sqrt(17745.0 / 4.0)) + std::sqrt(105.0 / 4.0) - 13.0 / 2.0,
+                std::sqrt(135.0 / 2.0 + std::sqrt(17745.0 / 4.0)) - std::sqrt(105.0 / 4.0) - 13.0 / 2.0};
+      default:
+        return {};
+    }
+  }
+
+  void InitialCausalCoefficient(double *c, std::size_t n, double z)
+  {
+    auto horizon = n;
+    double zn = z;
+    if (Tolerance > 0)
+      horizon = static_cast<std::size_t>(std::ceil(std::log(Tolerance) / std::log(std::abs(z))));
+
+    if (horizon < n)
+    {
+      // accelerated loop
+      double sum = c[0];
+      for (std::size_t k = 1; k < horizon; ++k)
+      {
+        sum += zn * c[k];
+        zn *= z;
+      }
+      c[0] = sum;
+    }
+    else
+    {
+      // full loop (mirror boundary)
+      const double iz = 1.0 / z;
+      double z2n = std::pow(z, static_cast<double>(n - 1));
+      double sum = c[0] + z2n * c[n - 1];
+      z2n *= z2n * iz;
+      for (std::size_t k = 1; k + 1 < n; ++k)
+      {
+        sum += (zn + z2n) * c[k];
+        zn *= z;
+        z2n *= iz;
+      }
+      c[0] = sum / (1.0 - zn * zn);
+    }
+  }
+
+  void FilterLine(double *c, std::size_t n, const std::vector<double> &poles)
+  {
+    if (n == 1)
+      return;
+
+    double gain = 1;
+    for (auto z : poles)
+      gain *= (1.0 - z) * (1.0 - 1.0 / z);
+    for (std::size_t k = 0; k < n; ++k)
+      c[k] *= gain;
+
+    for (auto z : poles)
+    {
+      InitialCausalCoefficient(c, n, z);
+      for (std::size_t k = 1; k < n; ++k)
+        c[k] += z * c[k - 1];
+      c[n - 1] = (z / (z * z - 1.0)) * (z * c[n - 2] + c[n - 1]);
+      for (std::size_t k = n - 1; k-- > 0;)
+        c[k] = z * (c[k + 1] - c[k]);
+    }
+  }
+
+  /**
+   * Mirror boundary condition like itk::BSplineInterpolateImageFunction::ApplyMirrorBoundaryConditions. The
+   * index is reduced modulo the period for both signs, so supports wider than the axis stay inside it.
+   */
+  inline long long Mirror(long long index, long long size)
+  {
+    if (size == 1)
+      return 0;
+    const auto period = 2 * (size - 1);
+    index = (index < 0 ? -index : index) % period;
+    if (index > size - 1)
+      index = period - index;
+    return index;
+  }
+
+  /**
+   * Weights like itk::BSplineInterpolateImageFunction::SetInterpolationWeights; w is the offset of the
+   * coordinate from the center sample of the support. Weight i is written to weights[i * stride].
+   */
+  template <unsigned int VOrder>
+  inline void SetWeights(double w, double *weights, std::size_t stride = 1)
+  {
+    if (VOrder == 0)
+    {
+      weights[0] = 1;
+    }
+    else if (VOrder == 1)
+    {
+      weights[stride] = w;
+      weights[0] = 1.0 - w;
+    }
+    else if (VOrder == 2)
+    {
+      const double w1 = 0.75 - w * w;
+      const double w2 = 0.5 * (w - w1 + 1.0);
+      weights[stride] = w1;
+      weights[2 * stride] = w2;
+      weights[0] = 1.0 - w1 - w2;
+    }
+    else if (VOrder == 3)
+    {
+      const double w3 = (1.0 / 6.0) * w * w * w;
+      const double w0 = (1.0 / 6.0) + 0.5 * w * (w - 1.0) - w3;
+      const double w2 = w + w0 - 2.0 * w3;
+      weights[0] = w0;
+      weights[stride] = 1.0 - w0 - w2 - w3;
+      weights[2 * stride] = w2;
+      weights[3 * stride] = w3;
+    }
+    else if (VOrder == 4)
+    {
+      const double w2 = w * w;
+      const double t = (1.0 / 6.0) * w2;
+      double w0 = 0.5 - w;
+      w0 *= w0;
+      w0 *= (1.0 / 24.0) * w0;
+      const double t0 = w * (t - 11.0 / 24.0);
+      const double t1 = 19.0 / 96.0 + w2 * (0.25 - t);
+      const double w4 = w0 + t0 + 0.5 * w;
+      weights[0] = w0;
+      weights[stride] = t1 + t0;
+      weights[2 * stride] = 1.0 - w0 - (t1 + t0) - (t1 - t0) - w4;
+      weights[3 * stride] = t1 - t0;
+      weights[4 * stride] = w4;
+    }
+    else
+    {
+      double w2 = w * w;
+      const double w5 = (1.0 / 120.0) * w * w2 * w2;
+      w2 -= w;
+      const double w4 = w2 * w2;
+      w -= 0.5;
+      const double t = w2 * (w2 - 3.0);
+      double t0 = (1.0 / 24.0) * (w2 * (w2 - 5.0) + 46.0 / 5.0);
+      double t1 = (-1.0 / 12.0) * w * (t + 4.0);
+      weights[0] = (1.0 / 24.0) * (1.0 / 5.0 + w2 + w4) - w5;
+      weights[2 * stride] = t0 + t1;
+      weights[3 * stride] = t0 - t1;
+      t0 = (1.0 / 16.0) * (9.0 / 5.0 - t);
+      t1 = (1.0 / 24.0) * w * (w4 - w2 - 5.0);
+      weights[stride] = t0 + t1;
+      weights[4 * stride] = t0 - t1;
+      weights[5 * stride] = w5;
+    }
+  }
+
+  /**
+   * Center sample of the support, like itk::BSplineInterpolateImageFunction::DetermineRegionOfSupport.
+   */
+  template <unsigned int VOrder>
+  inline double GetSupportCenter(double x)
+  {
+    return (VOrder & 1) ? std::floor(x) : std::floor(x + 0.5);
+  }
+} // namespace
+
+m2::ElxBSplineInterpolator::Pointer m2::ElxBSplineInterpolator::New(const mitk::Image *image,
+                                                                    unsigned int dimension,
+                                                                    unsigned int order)
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  if (image->GetPixelType().GetNumberOfComponents() != 1)
+    mitkThrow() << "B-spline interpolation requires a scalar image!";
+  if (order > MaximumOrder)
+    mitkThrow() << "B-spline order " << order << " is not supported (0-" << MaximumOrder << ")";
+  if (dimension < 2 || dimension > 3 || image->GetDimension() < dimension)
+    mitkThrow() << "Image [" << ElxUtil::GetShape(image) << "] does not provide " << dimension << " dimensions";
+
+  Pointer interpolator(new ElxBSplineInterpolator());
+  interpolator->m_Dimension = dimension;
+  interpolator->m_Order = order;
+  std::size_t n = 1;
+  for (unsigned int i = 0; i < dimension; ++i)
+  {
+    interpolator->m_Size[i] = image->GetDimensions()[i];
+    interpolator->m_Stride[i] = n;
+    n *= image->GetDimensions()[i];
+  }
+
+  interpolator->m_Coefficients.resize(n);
+  mitk::ImageReadAccessor acc(image);
+  ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+    using PixelType = decltype(pixel);
+    const auto data = static_cast<const PixelType *>(acc.GetData());
+    std::copy(data, data + n, interpolator->m_Coefficients.begin());
+  });
+
+  interpolator->Prefilter();
+  return interpolator;
+}
+
+void m2::ElxBSplineInterpolator::Prefilter()
+{
+  const unsigned int size[3] = {static_cast<unsigned int>(m_Size[0]),
+                                static_cast<unsigned int>(m_Size[1]),
+                                static_cast<unsigned int>(m_Size[2])};
+  ComputeCoefficients(m_Coefficients.data(), 1, size, m_Dimension, m_Order);
+}
+
+void m2::ElxBSplineInterpolator::ComputeCoefficients(
+  double *data, unsigned int components, const unsigned int *size, unsigned int dimension, unsigned int order)
+{
+  const auto poles = GetPoles(order);
+  if (poles.empty())
+    return;
+
+  // the components are an axis of their own that is not filtered, like the axes beyond dimension
+  long long sizes[4] = {components, size[0], size[1], size[2]};
+  std::size_t strides[4];
+  std::size_t total = 1;
+  for (unsigned int d = 0; d < 4; ++d)
+  {
+    strides[d] = total;
+    total *= sizes[d];
+  }
+
+  for (unsigned int axis = 1; axis <= dimension; ++axis)
+  {
+    const auto n = static_cast<std::size_t>(sizes[axis]);
+    const auto stride = strides[axis];
+    const auto lines = total / n;
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      (lines + LineBlockSize - 1) / LineBlockSize,
+      [&](itk::SizeValueType block) {
+        std::vector<double> line(n);
+        const auto end = std::min<std::size_t>(lines, (block + 1) * LineBlockSize);
+        for (std::size_t l = block * LineBlockSize; l < end; ++l)
+        {
+          // offset of the first sample: line index over the remaining axes
+          std::size_t rest = l, offset = 0;
+          for (unsigned int d = 0; d < 4; ++d)
+          {
+            if (d == axis)
+              continue;
+            offset += (rest % sizes[d]) * strides[d];
+            rest /= sizes[d];
+          }
+          auto c = data + offset;
+          for (std::size_t k = 0; k < n; ++k)
+            line[k] = c[k * stride];
+          FilterLine(line.data(), n, poles);
+          for (std::size_t k = 0; k < n; ++k)
+            c[k * stride] = line[k];
+        }
+      },
+      nullptr);
+  }
+}
+
+long long m2::ElxBSplineInterpolator::MirrorIndex(long long index, long long size)
+{
+  return Mirror(index, size);
+}
+
+void m2::ElxBSplineInterpolator::ComputeWeights(double x, unsigned int order, long long &start, double *weights)
+{
+  double center = 0;
+  switch (order)
+  {
+    case 0:
+      center = GetSupportCenter<0>(x);
+      SetWeights<0>(x - center, weights);
+      break;
+    case 1:
+      center = GetSupportCenter<1>(x);
+      SetWeights<1>(x - center, weights);
+      break;
+    case 2:
+      center = GetSupportCenter<2>(x);
+      SetWeights<2>(x - center, weights);
+      break;
+    case 3:
+      center = GetSupportCenter<3>(x);
+      SetWeights<3>(x - center, weights);
+      break;
+    case 4:
+      center = GetSupportCenter<4>(x);
+      SetWeights<4>(x - center, weights);
+      break;
+    case 5:
+      center = GetSupportCenter<5>(x);
+      SetWeights<5>(x - center, weights);
+      break;
+    default:
+      mitkThrow() << "B-spline order " << order << " is not supported";
+  }
+  start = static_cast<long long>(center) - order / 2;
+}
+
+double m2::ElxBSplineInterpolator::Evaluate(const double *continuousIndex) const
+{
+  double weights[3][MaximumOrder + 1];
+  long long start[3];
+  for (unsigned int d = 0; d < m_Dimension; ++d)
+    ComputeWeights(continuousIndex[d], m_Order, start[d], weights[d]);
+  return Combine(weights, start);
+}
+
+void m2::ElxBSplineInterpolator::EvaluateBlock(const double *continuousIndices, std::size_t n, double *values) const
+{
+  switch (m_Order)
+  {
+    case 0:
+      return EvaluateBlock<0>(continuousIndices, n, values);
+    case 1:
+      return EvaluateBlock<1>(continuousIndices, n, values);
+    case 2:
+      return EvaluateBlock<2>(continuousIndices, n, values);
+    case 3:
+      return EvaluateBlock<3>(continuousIndices, n, values);
+    case 4:
+      return EvaluateBlock<4>(continuousIndices, n, values);
+    default:
+      return EvaluateBlock<5>(continuousIndices, n, values);
+  }
+}
+
+template <unsigned int VOrder>
+void m2::ElxBSplineInterpolator::EvaluateBlock(const double *continuousIndices, std::size_t n, double *values) const
+{
+  constexpr unsigned int k = VOrder + 1;
+  double x[PointBlockSize];
+  double centers[3][PointBlockSize];
+  double blockWeights[3][k][PointBlockSize];
+
+  for (std::size_t begin = 0; begin < n; begin += PointBlockSize)
+  {
+    const auto count = std::min(PointBlockSize, n - begin);
+
+    // weights of all points along one axis: the order is fixed and the loop has no branches,
+    // so the polynomial evaluation is vectorised by the compiler (one point per SIMD lane)
+    for (unsigned int d = 0; d < m_Dimension; ++d)
+    {
+      for (std::size_t p = 0; p < count; ++p)
+        x[p] = continuousIndices[(begin + p) * m_Dimension + d];
+      for (std::size_t p = 0; p < count; ++p)
+      {
+        centers[d][p] = GetSupportCenter<VOrder>(x[p]);
+        SetWeights<VOrder>(x[p] - centers[d][p], &blockWeights[d][0][p], PointBlockSize);
+      }
+    }
+
+    // the coefficients are gathered per point
+    double weights[3][MaximumOrder + 1];
+    long long start[3];
+    for (std::size_t p = 0; p < count; ++p)
+    {
+      for (unsigned int d = 0; d < m_Dimension; ++d)
+      {
+        start[d] = static_cast<long long>(centers[d][p]) - VOrder / 2;
+        for (unsigned int i = 0; i < k; ++i)
+          weights[d][i] = blockWeights[d][i][p];
+      }
+      values[begin + p] = Combine(weights, start);
+    }
+  }
+}
+
+double m2::ElxBSplineInterpolator::Combine(const double (*weights)[MaximumOrder + 1], const long long *start) const
+{
+  const auto k = m_Order + 1;
+  std::size_t offsets[3][MaximumOrder + 1];
+  const bool contiguous = start[0] >= 0 && start[0] + k <= m_Size[0];
+  for (unsigned int d = 0; d < m_Dimension; ++d)
+    for (unsigned int i = 0; i < k; ++i)
+      offsets[d][i] = static_cast<std::size_t>(Mirror(start[d] + i, m_Size[d])) * m_Stride[d];
+
+  // separable: reduce rows along x first, then along y (and z)
+  const auto c = m_Coefficients.data();
+  auto row = [&](std::size_t offset) {
+    double sum = 0;
+    if (contiguous)
+    {
+      // interior: consecutive coefficients
+      const auto r = c + offset + offsets[0][0];
+      for (unsigned int i = 0; i < k; ++i)
+        sum += weights[0][i] * r[i];
+    }
+    else
+    {
+      for (unsigned int i = 0; i < k; ++i)
+        sum += weights[0][i] * c[offset + offsets[0][i]];
+    }
+    return sum;
+  };
+
+  double value = 0;
+  if (m_Dimension == 2)
+  {
+    for (unsigned int j = 0; j < k; ++j)
+      value += weights[1][j] * row(offsets[1][j]);
+  }
+  else
+  {
+    for (unsigned int l = 0; l < k; ++l)
+    {
+      double plane = 0;
+      for (unsigned int j = 0; j < k; ++j)
+        plane += weights[1][j] * row(offsets[2][l] + offsets[1][j]);
+      value += weights[2][l] * plane;
+    }
+  }
+  return value;
+}
@@ -0,0 +1,146 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxChannelDeinterleave.h>
+#include <m2ElxUtil.h>
+
+#include <itkMultiThreaderBase.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkImageWriteAccessor.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+namespace
+{
+  /** Input bytes per block; the block is read from memory once and stays in the L2 cache for all channels. */
+  constexpr std::size_t BlockBytes = std::size_t(256) << 10;
+
+  template <class TComponent>
+  void DeinterleaveBlock(const TComponent *input,
+                         unsigned int numberOfComponents,
+                         const std::vector<unsigned int> &channels,
+                         void *const *outputs,
+                         std::size_t firstPixel,
+                         std::size_t lastPixel,
+                         m2::ElxChannelDeinterleave::InstructionSet instructionSet)
+  {
+    const auto n = lastPixel - firstPixel;
+    const auto block = input + firstPixel * numberOfComponents;
+    for (std::size_t k = 0; k < channels.size(); ++k)
+    {
+      const auto source = block + channels[k];
+      const auto target = static_cast<TComponent *>(outputs[k]) + firstPixel;
+      std::size_t i = 0;
+#ifdef M2AIA_ELASTIX_AVX2
+      if constexpr (sizeof(TComponent) >= 4)
+        if (instructionSet == m2::ElxChannelDeinterleave::InstructionSet::AVX2)
+          i = m2::ElxChannelDeinterleave::GatherAVX2(source, numberOfComponents, n, target);
+#else
+      (void)instructionSet;
+#endif
+      // remaining pixels of the block; SSE2 has no gathers
+      for (; i < n; ++i)
+        target[i] = source[i * numberOfComponents];
+    }
+  }
+} // namespace
+
+std::size_t m2::ElxChannelDeinterleave::GetPixelBlockSize(std::size_t componentSize, unsigned int numberOfComponents)
+{
+  const auto pixelBytes = std::max<std::size_t>(1, componentSize * numberOfComponents);
+  return std::max<std::size_t>(8, BlockBytes / pixelBytes) & ~std::size_t(7);
+}
+
+void m2::ElxChannelDeinterleave::Deinterleave(const void *input,
+                                              std::size_t componentSize,
+                                              unsigned int numberOfComponents,
+                                              const std::vector<unsigned int> &channels,
+                                              void *const *outputs,
+                                              std::size_t firstPixel,
+                                              std::size_t lastPixel,
+                                              InstructionSet instructionSet)
+{
+  instructionSet = std::min(instructionSet, ElxWarpKernel::GetInstructionSet());
+  switch (componentSize)
+  {
+    case 1:
+      DeinterleaveBlock(static_cast<const std::uint8_t *>(input), numberOfComponents, channels, outputs, firstPixel, lastPixel, instructionSet);
+      break;
+    case 2:
+      DeinterleaveBlock(static_cast<const std::uint16_t *>(input), numberOfComponents, channels, outputs, firstPixel, lastPixel, instructionSet);
+      break;
+    case 4:
+      DeinterleaveBlock(static_cast<const std::uint32_t *>(input), numberOfComponents, channels, outputs, firstPixel, lastPixel, instructionSet);
+      break;
+    case 8:
+      DeinterleaveBlock(static_cast<const std::uint64_t *>(input), numberOfComponents, channels, outputs, firstPixel, lastPixel, instructionSet);
+      break;
+    default:
+      mitkThrow() << "Component size of " << componentSize << " bytes is not supported!";
+  }
+}
+
+std::vector<mitk::Image::Pointer> m2::ElxChannelDeinterleave::ExtractChannels(const mitk::Image *image,
+                                                                              const std::vector<unsigned int> &channels,
+                                                                              InstructionSet instructionSet)
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+
+  const auto pixelType = image->GetPixelType();
+  const auto components = pixelType.GetNumberOfComponents();
+  for (auto channel : channels)
+    if (channel >= components)
+      mitkThrow() << "Channel " << channel << " exceeds the number of channels (" << components << ")";
+
+  std::size_t componentSize = 0;
+  std::vector<mitk::Image::Pointer> results;
+  ElxUtil::AccessByPixelTypeName(pixelType.GetComponentTypeAsString(), [&](auto pixel) {
+    using PixelType = decltype(pixel);
+    componentSize = sizeof(PixelType);
+    for (std::size_t k = 0; k < channels.size(); ++k)
+    {
+      auto result = mitk::Image::New();
+      result->Initialize(mitk::MakeScalarPixelType<PixelType>(), image->GetDimension(), image->GetDimensions());
+      result->SetClonedGeometry(image->GetGeometry());
+      results.push_back(result);
+    }
+  });
+
+  std::vector<std::unique_ptr<mitk::ImageWriteAccessor>> accessors;
+  std::vector<void *> outputs;
+  for (const auto &result : results)
+  {
+    accessors.emplace_back(new mitk::ImageWriteAccessor(result));
+    outputs.push_back(accessors.back()->GetData());
+  }
+  if (channels.empty())
+    return results;
+
+  mitk::ImageReadAccessor acc(image);
+  const auto input = acc.GetData();
+  const auto n = static_cast<std::size_t>(image->GetLargestPossibleRegion().GetNumberOfPixels());
+  const auto blockSize = GetPixelBlockSize(componentSize, components);
+  itk::MultiThreaderBase::New()->ParallelizeArray(
+    0,
+    (n + blockSize - 1) / blockSize,
+    [&](itk::SizeValueType block) {
+      const auto first = static_cast<std::size_t>(block) * blockSize;
+      Deinterleave(input, componentSize, components, channels, outputs.data(), first, std::min(n, first + blockSize), instructionSet);
+    },
+    nullptr);
+  return results;
+}
@@ -0,0 +1,74 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+// This file is compiled with AVX2 code generation (see CMakeLists.txt, M2AIA_ELASTIX_SIMD).
+// It is only entered after a runtime check of the CPU (ElxWarpKernel::GetInstructionSet).
+#ifdef M2AIA_ELASTIX_AVX2
+
+#include <m2ElxChannelDeinterleave.h>
+
+#include <immintrin.h>
+
+#include <cstdint>
+#include <limits>
+
+template <class TComponent>
+std::size_t m2::ElxChannelDeinterleave::GatherAVX2(const TComponent *input,
+                                                   unsigned int stride,
+                                                   std::size_t n,
+                                                   TComponent *output)
+{
+  // offsets of the gathers are 32 bit
+  if (n * stride > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+    return 0;
+
+  const auto s = static_cast<int>(stride);
+  if constexpr (sizeof(TComponent) == 4)
+  {
+    const auto input32 = reinterpret_cast<const int *>(input);
+    const __m256i step = _mm256_set1_epi32(8 * s);
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(s));
+    const auto m = n & ~std::size_t(7);
+    for (std::size_t i = 0; i < m; i += 8)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), _mm256_i32gather_epi32(input32, offsets, 4));
+      offsets = _mm256_add_epi32(offsets, step);
+    }
+    return m;
+  }
+  else
+  {
+    const auto input64 = reinterpret_cast<const long long *>(input);
+    const __m128i step = _mm_set1_epi32(4 * s);
+    __m128i offsets = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(s));
+    const auto m = n & ~std::size_t(3);
+    for (std::size_t i = 0; i < m; i += 4)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + i), _mm256_i32gather_epi64(input64, offsets, 8));
+      offsets = _mm_add_epi32(offsets, step);
+    }
+    return m;
+  }
+}
+
+template std::size_t m2::ElxChannelDeinterleave::GatherAVX2<std::uint32_t>(const std::uint32_t *,
+                                                                          unsigned int,
+                                                                          std::size_t,
+                                                                          std::uint32_t *);
+template std::size_t m2::ElxChannelDeinterleave::GatherAVX2<std::uint64_t>(const std::uint64_t *,
+                                                                          unsigned int,
+                                                                          std::size_t,
+                                                                          std::uint64_t *);
+
+#endif
@@ -0,0 +1,501 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxChannelFusion.h>
+#include <m2ElxUtil.h>
+
+#include <itkMultiThreaderBase.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkImageWriteAccessor.h>
+#include <vnl/algo/vnl_symmetric_eigensystem.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <locale>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+namespace
+{
+  /** Pixels per work item of the multithreaded passes. */
+  constexpr std::size_t PixelBlockSize = 4096;
+  /** Multiply-adds of the covariance accumulation (PCA) before pixels are subsampled. */
+  constexpr double CovarianceBudget = 8.0e9;
+  /** Multiply-adds of one NMF iteration; limits the pixel sample. */
+  constexpr double NMFIterationBudget = 4.0e6;
+  constexpr unsigned int NMFIterations = 100;
+
+  std::size_t GetNumberOfPixels(const mitk::Image *image)
+  {
+    return static_cast<std::size_t>(image->GetLargestPossibleRegion().GetNumberOfPixels());
+  }
+
+  void CheckChannels(const mitk::Image *image, const std::vector<unsigned int> &channels)
+  {
+    if (!image)
+      mitkThrow() << "Image data is null!";
+    const auto components = image->GetPixelType().GetNumberOfComponents();
+    for (auto channel : channels)
+      if (channel >= components)
+        mitkThrow() << "Channel " << channel << " exceeds the number of channels (" << components << ")";
+  }
+
+  /**
+   * Reads the channels of every stride-th pixel of the images into rows of a dense matrix (NMF sample).
+   */
+  std::vector<double> SamplePixels(const std::vector<const mitk::Image *> &images,
+                                   const std::vector<std::vector<unsigned int>> &channels,
+                                   std::size_t stride)
+  {
+    std::vector<double> samples;
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+      const auto components = images[i]->GetPixelType().GetNumberOfComponents();
+      const auto n = GetNumberOfPixels(images[i]);
+      mitk::ImageReadAccessor acc(images[i]);
+      m2::ElxUtil::AccessByPixelTypeName(images[i]->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+        using PixelType = decltype(pixel);
+        const auto input = static_cast<const PixelType *>(acc.GetData());
+        for (std::size_t p = 0; p < n; p += stride)
+          for (auto channel : channels[i])
+            samples.push_back(input[p * components + channel]);
+      });
+    }
+    return samples;
+  }
+
+  /**
+   * Nonnegative factorization X (n x c) ~ W (n x k) H (k x c) with the multiplicative updates of Lee and Seung.
+   * @return H
+   */
+  std::vector<double> FactorizeNonNegative(const std::vector<double> &X, std::size_t n, std::size_t c, std::size_t k)
+  {
+    constexpr double Epsilon = 1e-12;
+    std::mt19937 generator(0); // reproducible weights
+    std::uniform_real_distribution<double> distribution(0.1, 1.0);
+    std::vector<double> W(n * k), H(k * c);
+    for (auto &w : W)
+      w = distribution(generator);
+    for (auto &h : H)
+      h = distribution(generator);
+
+    std::vector<double> WtX(k * c), WtW(k * k), XHt(n * k), HHt(k * k);
+    for (unsigned int iteration = 0; iteration < NMFIterations; ++iteration)
+    {
+      // H <- H * (W'X) / (W'W H)
+      std::fill(WtX.begin(), WtX.end(), 0);
+      std::fill(WtW.begin(), WtW.end(), 0);
+      for (std::size_t p = 0; p < n; ++p)
+        for (std::size_t a = 0; a < k; ++a)
+        {
+          const auto w = W[p * k + a];
+          for (std::size_t j = 0; j < c; ++j)
+            WtX[a * c + j] += w * X[p * c + j];
+          for (std::size_t b = 0; b < k; ++b)
+            WtW[a * k + b] += w * W[p * k + b];
+        }
+      for (std::size_t a = 0; a < k; ++a)
+        for (std::size_t j = 0; j < c; ++j)
+        {
+          double denominator = 0;
+          for (std::size_t b = 0; b < k; ++b)
+            denominator += WtW[a * k + b] * H[b * c + j];
+          H[a * c + j] *= WtX[a * c + j] / (denominator + Epsilon);
+        }
+
+      // W <- W * (X H') / (W H H')
+      std::fill(XHt.begin(), XHt.end(), 0);
+      std::fill(HHt.begin(), HHt.end(), 0);
+      for (std::size_t a = 0; a < k; ++a)
+      {
+        for (std::size_t p = 0; p < n; ++p)
+          for (std::size_t j = 0; j < c; ++j)
+            XHt[p * k + a] += X[p * c + j] * H[a * c + j];
+        for (std::size_t b = 0; b < k; ++b)
+          for (std::size_t j = 0; j < c; ++j)
+            HHt[a * k + b] += H[a * c + j] * H[b * c + j];
+      }
+      for (std::size_t p = 0; p < n; ++p)
+        for (std::size_t a = 0; a < k; ++a)
+        {
+          double denominator = 0;
+          for (std::size_t b = 0; b < k; ++b)
+            denominator += W[p * k + b] * HHt[b * k + a];
+          W[p * k + a] *= XHt[p * k + a] / (denominator + Epsilon);
+        }
+    }
+
+    // factors are ordered by their contribution to X
+    std::vector<double> energy(k, 0);
+    for (std::size_t a = 0; a < k; ++a)
+    {
+      double w = 0, h = 0;
+      for (std::size_t p = 0; p < n; ++p)
+        w += W[p * k + a] * W[p * k + a];
+      for (std::size_t j = 0; j < c; ++j)
+        h += H[a * c + j] * H[a * c + j];
+      energy[a] = std::sqrt(w * h);
+    }
+    std::vector<std::size_t> order(k);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return energy[a] > energy[b]; });
+    std::vector<double> sorted(k * c);
+    for (std::size_t a = 0; a < k; ++a)
+      std::copy(H.begin() + order[a] * c, H.begin() + (order[a] + 1) * c, sorted.begin() + a * c);
+    return sorted;
+  }
+} // namespace
+
+std::string m2::ElxChannelFusion::GetMethodName(Method method)
+{
+  switch (method)
+  {
+    case Method::PCA:
+      return "PCA";
+    case Method::NMF:
+      return "NMF";
+    case Method::Weighted:
+      return "Weighted";
+    default:
+      return "None";
+  }
+}
+
+m2::ElxChannelFusion::Method m2::ElxChannelFusion::GetMethod(const std::string &name)
+{
+  for (auto method : {Method::None, Method::PCA, Method::NMF, Method::Weighted})
+    if (GetMethodName(method) == name)
+      return method;
+  mitkThrow() << "Unknown channel fusion method [" << name << "]";
+}
+
+std::string m2::ElxChannelFusion::Weights::ToString() const
+{
+  std::ostringstream os;
+  os.imbue(std::locale::classic());
+  os << std::setprecision(17) << "method " << GetMethodName(method) << "\n";
+  for (std::size_t i = 0; i < weights.size(); ++i)
+  {
+    os << "image " << i << " offset " << (i < offsets.size() ? offsets[i] : 0.0) << " variance "
+       << (i < explainedVariance.size() ? explainedVariance[i] : 0.0) << " weights " << weights[i].size();
+    for (auto w : weights[i])
+      os << " " << w;
+    os << "\n";
+  }
+  return os.str();
+}
+
+m2::ElxChannelFusion::Weights m2::ElxChannelFusion::Weights::Parse(const std::string &text)
+{
+  Weights result;
+  std::istringstream is(text);
+  is.imbue(std::locale::classic());
+  std::string key, name;
+  if (!(is >> key >> name) || key != "method")
+    mitkThrow() << "Channel fusion weights do not start with a method!";
+  result.method = GetMethod(name);
+
+  std::size_t index, size;
+  double offset, variance;
+  std::string offsetKey, varianceKey, weightsKey;
+  while (is >> key)
+  {
+    if (key != "image" || !(is >> index >> offsetKey >> offset >> varianceKey >> variance >> weightsKey >> size) ||
+        index != result.weights.size())
+      mitkThrow() << "Channel fusion weights of image " << result.weights.size() << " are invalid!";
+    std::vector<double> weights(size);
+    for (auto &w : weights)
+      if (!(is >> w))
+        mitkThrow() << "Channel fusion weights of image " << index << " are incomplete!";
+    result.weights.push_back(weights);
+    result.offsets.push_back(offset);
+    result.explainedVariance.push_back(variance);
+  }
+  return result;
+}
+
+m2::ElxChannelFusion::Statistics m2::ElxChannelFusion::ComputeStatistics(
+  const std::vector<const mitk::Image *> &images,
+  const std::vector<std::vector<unsigned int>> &channels,
+  std::size_t maximumSamples)
+{
+  if (images.empty() || images.size() != channels.size())
+    mitkThrow() << "Every image needs a list of channels!";
+  const auto c = channels.front().size();
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < images.size(); ++i)
+  {
+    CheckChannels(images[i], channels[i]);
+    if (channels[i].size() != c)
+      mitkThrow() << "The images provide different numbers of channels!";
+    total += GetNumberOfPixels(images[i]);
+  }
+  const std::size_t stride = maximumSamples && total > maximumSamples ? (total + maximumSamples - 1) / maximumSamples : 1;
+
+  // mean and centered co-moments (upper triangle) of each block, merged under a lock with the pairwise update of
+  // Chan et al.; raw sums of products would cancel catastrophically for channels with a large mean
+  std::vector<double> mean(c, 0), comoments(c * c, 0);
+  std::size_t samples = 0;
+  std::mutex mutex;
+  for (std::size_t i = 0; i < images.size(); ++i)
+  {
+    const auto components = images[i]->GetPixelType().GetNumberOfComponents();
+    const auto n = (GetNumberOfPixels(images[i]) + stride - 1) / stride;
+    mitk::ImageReadAccessor acc(images[i]);
+    ElxUtil::AccessByPixelTypeName(images[i]->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+      using PixelType = decltype(pixel);
+      const auto input = static_cast<const PixelType *>(acc.GetData());
+      const auto &selection = channels[i];
+      itk::MultiThreaderBase::New()->ParallelizeArray(
+        0,
+        (n + PixelBlockSize - 1) / PixelBlockSize,
+        [&](itk::SizeValueType block) {
+          const auto first = static_cast<std::size_t>(block) * PixelBlockSize;
+          const auto last = std::min(n, first + PixelBlockSize);
+          const auto count = last - first;
+          std::vector<double> x(c), blockMean(c, 0), blockComoments(c * c, 0);
+          for (auto s = first; s < last; ++s)
+          {
+            const auto values = input + s * stride * components;
+            for (std::size_t j = 0; j < c; ++j)
+              blockMean[j] += values[selection[j]];
+          }
+          for (std::size_t j = 0; j < c; ++j)
+            blockMean[j] /= count;
+          for (auto s = first; s < last; ++s)
+          {
+            const auto values = input + s * stride * components;
+            for (std::size_t j = 0; j < c; ++j)
+              x[j] = values[selection[j]] - blockMean[j];
+            for (std::size_t j = 0; j < c; ++j)
+            {
+              const auto xj = x[j];
+              auto row = blockComoments.data() + j * c;
+              for (auto l = j; l < c; ++l)
+                row[l] += xj * x[l];
+            }
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          const auto merged = samples + count;
+          const double factor = double(samples) * count / merged;
+          for (std::size_t j = 0; j < c; ++j)
+            x[j] = blockMean[j] - mean[j];
+          for (std::size_t j = 0; j < c; ++j)
+            for (auto l = j; l < c; ++l)
+              comoments[j * c + l] += blockComoments[j * c + l] + x[j] * x[l] * factor;
+          for (std::size_t j = 0; j < c; ++j)
+            mean[j] += x[j] * count / merged;
+          samples = merged;
+        },
+        nullptr);
+    });
+  }
+
+  Statistics statistics;
+  statistics.numberOfSamples = samples;
+  statistics.mean = mean;
+  statistics.covariance.assign(c * c, 0);
+  if (samples == 0)
+    return statistics;
+  const double normalization = samples > 1 ? samples - 1.0 : 1.0;
+  for (std::size_t j = 0; j < c; ++j)
+    for (auto l = j; l < c; ++l)
+      statistics.covariance[j * c + l] = statistics.covariance[l * c + j] = comoments[j * c + l] / normalization;
+  return statistics;
+}
+
+m2::ElxChannelFusion::Weights m2::ElxChannelFusion::Fit(const std::vector<const mitk::Image *> &images,
+                                                        const std::vector<std::vector<unsigned int>> &channels,
+                                                        const Parameters &parameters)
+{
+  if (images.empty() || images.size() != channels.size())
+    mitkThrow() << "Every image needs a list of channels!";
+  const auto c = channels.front().size();
+  if (c == 0)
+    mitkThrow() << "No channels selected for the channel fusion!";
+
+  Weights result;
+  result.method = parameters.method;
+  const auto k = std::max<std::size_t>(1, std::min<std::size_t>(parameters.numberOfImages, c));
+
+  if (parameters.method == Method::Weighted)
+  {
+    if (!parameters.channelWeights.empty() && parameters.channelWeights.size() != c)
+      mitkThrow() << "Number of channel weights (" << parameters.channelWeights.size()
+                  << ") does not match the number of channels (" << c << ")";
+    for (std::size_t i = 0; i < images.size(); ++i)
+      CheckChannels(images[i], channels[i]);
+    result.weights.push_back(parameters.channelWeights.empty() ? std::vector<double>(c, 1.0 / c)
+                                                                : parameters.channelWeights);
+    result.offsets.push_back(0);
+  }
+  else if (parameters.method == Method::PCA)
+  {
+    const auto maximumSamples = static_cast<std::size_t>(std::max(16384.0, 2 * CovarianceBudget / (double(c) * c)));
+    const auto statistics = ComputeStatistics(images, channels, maximumSamples);
+
+    // principal components of the correlation matrix: channels of different intensity ranges contribute equally
+    std::vector<double> sigma(c);
+    for (std::size_t j = 0; j < c; ++j)
+      sigma[j] = std::sqrt(std::max(0.0, statistics.covariance[j * c + j]));
+    vnl_matrix<double> correlation(c, c, 0);
+    double trace = 0;
+    for (std::size_t j = 0; j < c; ++j)
+      for (std::size_t l = 0; l < c; ++l)
+        if (sigma[j] > 0 && sigma[l] > 0)
+          correlation(j, l) = statistics.covariance[j * c + l] / (sigma[j] * sigma[l]);
+    for (std::size_t j = 0; j < c; ++j)
+      trace += correlation(j, j);
+
+    // eigenvalues are sorted in increasing order
+    vnl_symmetric_eigensystem<double> eigensystem(correlation);
+    for (std::size_t i = 0; i < k; ++i)
+    {
+      const auto column = static_cast<unsigned int>(c - 1 - i);
+      auto v = eigensystem.get_eigenvector(column);
+      // the sign is chosen so that the fused image increases with the intensities of the channels
+      if (v.sum() < 0)
+        v *= -1;
+      std::vector<double> weights(c, 0);
+      double offset = 0;
+      for (std::size_t j = 0; j < c; ++j)
+      {
+        if (sigma[j] > 0)
+          weights[j] = v[j] / sigma[j];
+        offset -= weights[j] * statistics.mean[j];
+      }
+      result.weights.push_back(weights);
+      result.offsets.push_back(offset);
+      result.explainedVariance.push_back(trace > 0 ? std::max(0.0, eigensystem.get_eigenvalue(column)) / trace : 0);
+    }
+  }
+  else if (parameters.method == Method::NMF)
+  {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+      CheckChannels(images[i], channels[i]);
+      if (channels[i].size() != c)
+        mitkThrow() << "The images provide different numbers of channels!";
+      total += GetNumberOfPixels(images[i]);
+    }
+    const auto maximumSamples =
+      static_cast<std::size_t>(std::min(4096.0, std::max(256.0, NMFIterationBudget / (double(c) * k))));
+    const std::size_t stride = std::max<std::size_t>(1, (total + maximumSamples - 1) / maximumSamples);
+    auto X = SamplePixels(images, channels, stride);
+    const auto n = X.size() / c;
+
+    // nonnegative channels of unit variance
+    std::vector<double> mean(c, 0), sigma(c, 0);
+    for (std::size_t p = 0; p < n; ++p)
+      for (std::size_t j = 0; j < c; ++j)
+      {
+        X[p * c + j] = std::max(0.0, X[p * c + j]);
+        mean[j] += X[p * c + j];
+      }
+    for (std::size_t j = 0; j < c; ++j)
+      mean[j] /= std::max<std::size_t>(1, n);
+    for (std::size_t p = 0; p < n; ++p)
+      for (std::size_t j = 0; j < c; ++j)
+        sigma[j] += (X[p * c + j] - mean[j]) * (X[p * c + j] - mean[j]);
+    for (std::size_t j = 0; j < c; ++j)
+    {
+      sigma[j] = std::sqrt(sigma[j] / std::max<std::size_t>(1, n));
+      for (std::size_t p = 0; p < n; ++p)
+        X[p * c + j] = sigma[j] > 0 ? X[p * c + j] / sigma[j] : 0;
+    }
+
+    // each fused image is the mean of the scaled channels weighted by their loadings
+    const auto H = FactorizeNonNegative(X, n, c, k);
+    for (std::size_t i = 0; i < k; ++i)
+    {
+      double sum = 0;
+      for (std::size_t j = 0; j < c; ++j)
+        sum += H[i * c + j];
+      std::vector<double> weights(c, 0);
+      for (std::size_t j = 0; j < c; ++j)
+        if (sigma[j] > 0 && sum > 0)
+          weights[j] = H[i * c + j] / sum / sigma[j];
+      result.weights.push_back(weights);
+      result.offsets.push_back(0);
+    }
+  }
+  else
+  {
+    mitkThrow() << "No channel fusion method selected!";
+  }
+  return result;
+}
+
+std::vector<mitk::Image::Pointer> m2::ElxChannelFusion::Apply(const mitk::Image *image,
+                                                              const std::vector<unsigned int> &channels,
+                                                              const Weights &weights)
+{
+  CheckChannels(image, channels);
+  const auto k = weights.weights.size();
+  const auto c = channels.size();
+  for (const auto &w : weights.weights)
+    if (w.size() != c)
+      mitkThrow() << "Number of fusion weights (" << w.size() << ") does not match the number of channels (" << c
+                  << ")";
+
+  std::vector<mitk::Image::Pointer> results;
+  std::vector<std::unique_ptr<mitk::ImageWriteAccessor>> accessors;
+  std::vector<float *> outputs;
+  for (std::size_t i = 0; i < k; ++i)
+  {
+    auto result = mitk::Image::New();
+    result->Initialize(mitk::MakeScalarPixelType<float>(), image->GetDimension(), image->GetDimensions());
+    result->SetClonedGeometry(image->GetGeometry());
+    accessors.emplace_back(new mitk::ImageWriteAccessor(result));
+    outputs.push_back(static_cast<float *>(accessors.back()->GetData()));
+    results.push_back(result);
+  }
+  if (k == 0)
+    return results;
+
+  const auto components = image->GetPixelType().GetNumberOfComponents();
+  const auto n = GetNumberOfPixels(image);
+  mitk::ImageReadAccessor acc(image);
+  ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+    using PixelType = decltype(pixel);
+    const auto input = static_cast<const PixelType *>(acc.GetData());
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      (n + PixelBlockSize - 1) / PixelBlockSize,
+      [&](itk::SizeValueType block) {
+        const auto first = static_cast<std::size_t>(block) * PixelBlockSize;
+        const auto last = std::min(n, first + PixelBlockSize);
+        for (auto p = first; p < last; ++p)
+        {
+          const auto values = input + p * components;
+          for (std::size_t i = 0; i < k; ++i)
+          {
+            const auto &w = weights.weights[i];
+            double v = i < weights.offsets.size() ? weights.offsets[i] : 0.0;
+            for (std::size_t j = 0; j < c; ++j)
+              v += w[j] * values[channels[j]];
+            outputs[i][p] = static_cast<float>(v);
+          }
+        }
+      },
+      nullptr);
+  });
+  return results;
+}
@@ -0,0 +1,309 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxChannelStatistics.h>
+#include <m2ElxUtil.h>
+
+#include <itkMultiThreaderBase.h>
+#include <mitkImageReadAccessor.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+  /** 128 MiB of float samples. */
+  constexpr std::size_t MaximumNumberOfValues = std::size_t(1) << 25;
+  constexpr std::size_t MaximumNumberOfSamples = 65536;
+
+  /**
+   * Histogram bin of value; values equal to the maximum fall into the last bin.
+   */
+  unsigned int GetBin(double value, double minimum, double binWidth, unsigned int bins)
+  {
+    if (!(binWidth > 0))
+      return 0;
+    return std::min(bins - 1, static_cast<unsigned int>((value - minimum) / binWidth));
+  }
+
+  double GetEntropy(const std::vector<double> &histogram, double total)
+  {
+    double entropy = 0;
+    for (auto count : histogram)
+      if (count > 0)
+        entropy -= count / total * std::log2(count / total);
+    return entropy;
+  }
+
+  /**
+   * Reference values at the world coordinates of the coarse grid (nearest neighbor, mean of the channels).
+   * Samples outside of the reference are marked in inside.
+   */
+  void SampleReference(const mitk::Image *image,
+                       const mitk::Image *reference,
+                       const unsigned int grid[3],
+                       unsigned int stride,
+                       std::vector<double> &values,
+                       std::vector<unsigned char> &inside)
+  {
+    const auto n = std::size_t(grid[0]) * grid[1] * grid[2];
+    values.assign(n, 0);
+    inside.assign(n, 0);
+
+    const auto components = reference->GetPixelType().GetNumberOfComponents();
+    long long size[3];
+    for (unsigned int i = 0; i < 3; ++i)
+      size[i] = i < reference->GetDimension() ? reference->GetDimension(i) : 1;
+    const auto imageGeometry = image->GetGeometry();
+    const auto referenceGeometry = reference->GetGeometry();
+
+    mitk::ImageReadAccessor acc(reference);
+    m2::ElxUtil::AccessByPixelTypeName(reference->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+      using PixelType = decltype(pixel);
+      const auto input = static_cast<const PixelType *>(acc.GetData());
+      itk::MultiThreaderBase::New()->ParallelizeArray(
+        0,
+        grid[1] * grid[2],
+        [&](itk::SizeValueType row) {
+          const auto y = static_cast<unsigned int>(row % grid[1]), z = static_cast<unsigned int>(row / grid[1]);
+          for (unsigned int x = 0; x < grid[0]; ++x)
+          {
+            mitk::Point3D index, world, referenceIndex;
+            index[0] = double(x) * stride;
+            index[1] = double(y) * stride;
+            index[2] = double(z) * stride;
+            imageGeometry->IndexToWorld(index, world);
+            referenceGeometry->WorldToIndex(world, referenceIndex);
+            long long r[3];
+            bool valid = true;
+            for (unsigned int i = 0; i < 3; ++i)
+            {
+              r[i] = static_cast<long long>(std::floor(referenceIndex[i] + 0.5));
+              valid = valid && r[i] >= 0 && r[i] < size[i];
+            }
+            if (!valid)
+              continue;
+
+            const auto sample = std::size_t(row) * grid[0] + x;
+            const auto p = (std::size_t(r[2]) * size[1] + std::size_t(r[1])) * size[0] + std::size_t(r[0]);
+            double value = 0;
+            for (unsigned int c = 0; c < components; ++c)
+              value += input[p * components + c];
+            values[sample] = value / components;
+            inside[sample] = 1;
+          }
+        },
+        nullptr);
+    });
+  }
+} // namespace
+
+std::size_t m2::ElxChannelStatistics::GetMaximumNumberOfValues()
+{
+  return MaximumNumberOfValues;
+}
+
+std::vector<m2::ElxChannelStatistics::Channel> m2::ElxChannelStatistics::Compute(const mitk::Image *image,
+                                                                                 const mitk::Image *reference,
+                                                                                 const Parameters &parameters)
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  const auto components = image->GetPixelType().GetNumberOfComponents();
+  const auto bins = std::max(2u, parameters.numberOfBins);
+
+  unsigned int size[3];
+  for (unsigned int i = 0; i < 3; ++i)
+    size[i] = i < image->GetDimension() ? image->GetDimension(i) : 1;
+
+  // coarse grid: the stride is increased until the samples of all channels fit into the buffer; the
+  // buffer bound holds for explicit strides, too
+  const auto maximumValues =
+    parameters.maximumNumberOfValues ? parameters.maximumNumberOfValues : MaximumNumberOfValues;
+  auto maximumSamples = std::max<std::size_t>(1, maximumValues / components);
+  if (parameters.stride == 0)
+    maximumSamples = std::min(MaximumNumberOfSamples, maximumSamples);
+  auto stride = std::max(1u, parameters.stride);
+  unsigned int grid[3];
+  auto updateGrid = [&]() {
+    for (unsigned int i = 0; i < 3; ++i)
+      grid[i] = (size[i] + stride - 1) / stride;
+    return std::size_t(grid[0]) * grid[1] * grid[2];
+  };
+  while (updateGrid() > maximumSamples)
+    ++stride;
+  const auto n = updateGrid();
+
+  // single pass over the vector image into a channel-major buffer
+  std::vector<float> samples(std::size_t(components) * n);
+  {
+    mitk::ImageReadAccessor acc(image);
+    ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+      using PixelType = decltype(pixel);
+      const auto input = static_cast<const PixelType *>(acc.GetData());
+      itk::MultiThreaderBase::New()->ParallelizeArray(
+        0,
+        grid[1] * grid[2],
+        [&](itk::SizeValueType row) {
+          const auto y = static_cast<unsigned int>(row % grid[1]) * stride;
+          const auto z = static_cast<unsigned int>(row / grid[1]) * stride;
+          for (unsigned int x = 0; x < grid[0]; ++x)
+          {
+            const auto p = (std::size_t(z) * size[1] + y) * size[0] + std::size_t(x) * stride;
+            const auto values = input + p * components;
+            const auto sample = std::size_t(row) * grid[0] + x;
+            for (unsigned int c = 0; c < components; ++c)
+              samples[c * n + sample] = static_cast<float>(values[c]);
+          }
+        },
+        nullptr);
+    });
+  }
+
+  // reference histogram (bins per sample and entropy) for the mutual information
+  std::vector<unsigned int> referenceBins;
+  std::vector<unsigned char> inside;
+  double referenceEntropy = 0;
+  std::size_t numberOfInside = 0;
+  if (reference)
+  {
+    std::vector<double> values;
+    SampleReference(image, reference, grid, stride, values, inside);
+    double minimum = std::numeric_limits<double>::max(), maximum = std::numeric_limits<double>::lowest();
+    for (std::size_t i = 0; i < n; ++i)
+      if (inside[i])
+      {
+        minimum = std::min(minimum, values[i]);
+        maximum = std::max(maximum, values[i]);
+        ++numberOfInside;
+      }
+    referenceBins.assign(n, 0);
+    std::vector<double> histogram(bins, 0);
+    for (std::size_t i = 0; i < n; ++i)
+      if (inside[i])
+      {
+        referenceBins[i] = GetBin(values[i], minimum, (maximum - minimum) / bins, bins);
+        ++histogram[referenceBins[i]];
+      }
+    if (numberOfInside)
+      referenceEntropy = GetEntropy(histogram, double(numberOfInside));
+    else
+      MITK_WARN << "The reference image does not overlap the image; the mutual information is not used.";
+  }
+
+  std::vector<Channel> result(components);
+  itk::MultiThreaderBase::New()->ParallelizeArray(
+    0,
+    components,
+    [&](itk::SizeValueType c) {
+      const auto v = samples.data() + c * n;
+      auto &channel = result[c];
+      channel.index = static_cast<unsigned int>(c);
+      channel.numberOfSamples = n;
+
+      double sum = 0, minimum = std::numeric_limits<double>::max(), maximum = std::numeric_limits<double>::lowest();
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        sum += v[i];
+        minimum = std::min<double>(minimum, v[i]);
+        maximum = std::max<double>(maximum, v[i]);
+      }
+      channel.mean = sum / n;
+      double squares = 0;
+      for (std::size_t i = 0; i < n; ++i)
+        squares += (v[i] - channel.mean) * (v[i] - channel.mean);
+      channel.variance = n > 1 ? squares / (n - 1) : 0;
+
+      const double binWidth = (maximum - minimum) / bins;
+      std::vector<double> histogram(bins, 0);
+      for (std::size_t i = 0; i < n; ++i)
+        ++histogram[GetBin(v[i], minimum, binWidth, bins)];
+      channel.entropy = GetEntropy(histogram, double(n));
+
+      // squared differences of neighbors along each axis of the coarse grid
+      double gradient = 0;
+      std::size_t pairs = 0;
+      for (unsigned int z = 0; z < grid[2]; ++z)
+        for (unsigned int y = 0; y < grid[1]; ++y)
+          for (unsigned int x = 0; x < grid[0]; ++x)
+          {
+            const auto i = (std::size_t(z) * grid[1] + y) * grid[0] + x;
+            const std::size_t neighbors[3] = {x + 1 < grid[0] ? i + 1 : i,
+                                              y + 1 < grid[1] ? i + grid[0] : i,
+                                              z + 1 < grid[2] ? i + std::size_t(grid[0]) * grid[1] : i};
+            for (auto j : neighbors)
+              if (j != i)
+              {
+                const double d = v[j] - v[i];
+                gradient += d * d;
+                ++pairs;
+              }
+          }
+      channel.gradientEnergy = pairs ? gradient / pairs : 0;
+
+      if (numberOfInside)
+      {
+        std::vector<double> joint(std::size_t(bins) * bins, 0), marginal(bins, 0), referenceMarginal(bins, 0);
+        for (std::size_t i = 0; i < n; ++i)
+          if (inside[i])
+          {
+            const auto b = GetBin(v[i], minimum, binWidth, bins);
+            ++joint[b * bins + referenceBins[i]];
+            ++marginal[b];
+            ++referenceMarginal[referenceBins[i]];
+          }
+        const double total = double(numberOfInside);
+        double information = 0;
+        for (unsigned int a = 0; a < bins; ++a)
+          for (unsigned int b = 0; b < bins; ++b)
+          {
+            const auto count = joint[a * bins + b];
+            if (count > 0)
+              information += count / total * std::log2(count * total / (marginal[a] * referenceMarginal[b]));
+          }
+        channel.mutualInformation = std::max(0.0, information);
+      }
+
+      // uncorrelated noise has a gradient energy of 2 * variance
+      const double coherence =
+        channel.variance > 0 ? std::min(1.0, std::max(0.0, 1 - channel.gradientEnergy / (2 * channel.variance))) : 0;
+      channel.score = channel.entropy / std::log2(double(bins)) * coherence *
+                      (1 + (referenceEntropy > 0 ? channel.mutualInformation / referenceEntropy : 0));
+    },
+    nullptr);
+
+  MITK_INFO << "Channel statistics of " << components << " channels on " << grid[0] << "x" << grid[1] << "x"
+            << grid[2] << " samples (stride " << stride << ")";
+  return result;
+}
+
+std::vector<m2::ElxChannelStatistics::Channel> m2::ElxChannelStatistics::Rank(std::vector<Channel> channels)
+{
+  std::stable_sort(
+    channels.begin(), channels.end(), [](const Channel &a, const Channel &b) { return a.score > b.score; });
+  return channels;
+}
+
+std::vector<unsigned int> m2::ElxChannelStatistics::Suggest(const std::vector<Channel> &channels, unsigned int count)
+{
+  std::vector<unsigned int> result;
+  for (const auto &channel : Rank(channels))
+  {
+    if (result.size() >= count || !(channel.score > 0))
+      break;
+    result.push_back(channel.index);
+  }
+  return result;
+}
@@ -0,0 +1,326 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include <m2ElxLazyWarpedImage.h>
+#include <m2ElxUtil.h>
+#include <mitkImageReadAccessor.h>
+#include <itkVectorImage.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  /**
+   * Single slice view of slice z of a stack; it shares the pixel buffer and the geometry of the stack
+   * (WarpSlices takes the x-y grid of all slices from the stack).
+   */
+  mitk::Image::Pointer CreateSliceView(const mitk::Image *stack, unsigned int z)
+  {
+    const unsigned int dims[3] = {stack->GetDimension(0), stack->GetDimension(1), 1};
+    auto view = mitk::Image::New();
+    view->Initialize(stack->GetPixelType(), 3, dims);
+    {
+      mitk::ImageReadAccessor acc(stack);
+      const auto offset = std::size_t(dims[0]) * dims[1] * stack->GetPixelType().GetSize() * z;
+      view->SetImportVolume(
+        const_cast<char *>(static_cast<const char *>(acc.GetData()) + offset), 0, 0, mitk::Image::ReferenceMemory);
+    }
+    auto transform = mitk::AffineTransform3D::New();
+    transform->SetMatrix(stack->GetGeometry()->GetIndexToWorldTransform()->GetMatrix());
+    transform->SetOffset(stack->GetGeometry()->GetIndexToWorldTransform()->GetOffset());
+    view->GetGeometry()->SetIndexToWorldTransform(transform);
+    return view;
+  }
+} // namespace
+
+m2::ElxLazyWarpedImage::Cache::Pointer m2::ElxLazyWarpedImage::Cache::New(std::size_t memoryBudget)
+{
+  return Pointer(new Cache(memoryBudget));
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::Cache::Get(const ElxLazyWarpedImage *image,
+                                                                     unsigned int slice)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+  {
+    if (it->image == image && it->slice == slice)
+    {
+      m_Entries.splice(m_Entries.begin(), m_Entries, it);
+      ++m_Hits;
+      return m_Entries.front().item;
+    }
+  }
+  ++m_Misses;
+  return nullptr;
+}
+
+void m2::ElxLazyWarpedImage::Cache::Add(const ElxLazyWarpedImage *image,
+                                        unsigned int slice,
+                                        ImageDataItemPointer item,
+                                        std::size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+  {
+    if (it->image == image && it->slice == slice)
+    {
+      m_MemoryUsage -= it->bytes;
+      m_Entries.erase(it);
+      break;
+    }
+  }
+  m_Entries.push_front({image, slice, item, bytes});
+  m_MemoryUsage += bytes;
+  Shrink();
+}
+
+void m2::ElxLazyWarpedImage::Cache::Remove(const ElxLazyWarpedImage *image)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (auto it = m_Entries.begin(); it != m_Entries.end();)
+  {
+    if (it->image == image)
+    {
+      m_MemoryUsage -= it->bytes;
+      it = m_Entries.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void m2::ElxLazyWarpedImage::Cache::SetMemoryBudget(std::size_t memoryBudget)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_MemoryBudget = memoryBudget;
+  Shrink();
+}
+
+std::size_t m2::ElxLazyWarpedImage::Cache::GetMemoryBudget() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_MemoryBudget;
+}
+
+std::size_t m2::ElxLazyWarpedImage::Cache::GetMemoryUsage() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_MemoryUsage;
+}
+
+void m2::ElxLazyWarpedImage::Cache::Clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Entries.clear();
+  m_MemoryUsage = 0;
+}
+
+unsigned long long m2::ElxLazyWarpedImage::Cache::GetNumberOfHits() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Hits;
+}
+
+unsigned long long m2::ElxLazyWarpedImage::Cache::GetNumberOfMisses() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Misses;
+}
+
+void m2::ElxLazyWarpedImage::Cache::Shrink()
+{
+  // the most recent entry may still be in use by the caller that added it
+  while (m_Entries.size() > 1 && m_MemoryUsage > m_MemoryBudget)
+  {
+    m_MemoryUsage -= m_Entries.back().bytes;
+    m_Entries.pop_back();
+  }
+}
+
+m2::ElxLazyWarpedImage::Pointer m2::ElxLazyWarpedImage::New(ElxWarpSession::Pointer session,
+                                                            const mitk::Image *source,
+                                                            const std::string &pixelType,
+                                                            int interpolationOrder,
+                                                            Cache::Pointer cache)
+{
+  if (!session)
+    mitkThrow() << "Warp session is null!";
+  if (!source)
+    mitkThrow() << "Image data is null!";
+  if (source->GetTimeSteps() > 1)
+    mitkThrow() << "Image [" << ElxUtil::GetShape(source) << "] has several time steps; warp it by WarpTimeSteps";
+  const auto dims = source->GetDimensions();
+  const bool slice = source->GetDimension() == 2 || (source->GetDimension() == 3 && dims[2] == 1);
+  if (source->GetDimension() > 3 || (session->GetDimension() == 3 && source->GetDimension() != 3))
+    mitkThrow() << "Image [" << ElxUtil::GetShape(source) << "] does not match the transformation dimension "
+                << session->GetDimension();
+
+  Pointer image = new ElxLazyWarpedImage();
+  image->UnRegister();
+  image->m_Session = session;
+  image->m_Source = source;
+  image->m_PixelType = pixelType;
+  image->m_InterpolationOrder = interpolationOrder;
+  image->m_Stack = session->GetDimension() == 2 && !slice;
+  image->m_Cache = cache ? cache : Cache::New();
+
+  // pixel type, size and geometry of the warped result (see ElxWarpSession::WarpMultiChannel)
+  const auto outputSize = session->GetOutputSize();
+  const unsigned int outputDims[3] = {
+    outputSize[0], outputSize[1], image->m_Stack ? dims[2] : (outputSize.size() == 3 ? outputSize[2] : 1u)};
+  const auto components = source->GetPixelType().GetNumberOfComponents();
+  ElxUtil::AccessByPixelTypeName(pixelType, [&](auto pixel) {
+    using PixelType = decltype(pixel);
+    if (components > 1)
+      image->Initialize(mitk::MakePixelType<itk::VectorImage<PixelType, 3>>(components), 3, outputDims);
+    else
+      image->Initialize(mitk::MakePixelType<PixelType, PixelType, 1>(), 3, outputDims);
+  });
+  image->GetGeometry()->SetIndexToWorldTransform(session->GetOutputIndexToWorldTransform(source));
+  return image;
+}
+
+m2::ElxLazyWarpedImage::~ElxLazyWarpedImage()
+{
+  if (m_Cache)
+    m_Cache->Remove(this);
+}
+
+mitk::Image::Pointer m2::ElxLazyWarpedImage::Materialize() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  mitk::Image::Pointer result;
+  if (m_Volume)
+  {
+    result = mitk::Image::New();
+    result->Initialize(GetPixelType(), 3, GetDimensions());
+    result->SetImportVolume(m_Volume->GetData(), 0, 0, mitk::Image::CopyMemory);
+  }
+  else if (m_Stack)
+  {
+    result = m_Session->WarpSlices(m_Source, m_PixelType, m_InterpolationOrder);
+  }
+  else
+  {
+    result = m_Session->WarpMultiChannel(m_Source, m_PixelType, m_InterpolationOrder);
+  }
+  result->SetClonedGeometry(GetGeometry());
+  return result;
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::GetSliceData(
+  int s, int t, int n, void *data, ImportMemoryManagementType) const
+{
+  if (data)
+    mitkThrow() << "Lazily warped images are read-only!";
+  if (!IsValidSlice(s, t, n))
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (auto item = m_Cache->Get(this, s))
+    return item;
+  auto item = WarpSlice(s);
+  m_Cache->Add(this, s, item, GetSliceSize());
+  return item;
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::GetVolumeData(
+  int t, int n, void *data, ImportMemoryManagementType) const
+{
+  if (data)
+    mitkThrow() << "Lazily warped images are read-only!";
+  if (!IsValidVolume(t, n))
+    return nullptr;
+
+  // callers expect the volume to stay valid as long as the image (e.g. renderers and accessors)
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (!m_Volume)
+    m_Volume = WarpVolume();
+  return m_Volume;
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::GetChannelData(int n,
+                                                                         void *data,
+                                                                         ImportMemoryManagementType) const
+{
+  // a single time step: the channel is the volume
+  return GetVolumeData(0, n, data);
+}
+
+bool m2::ElxLazyWarpedImage::IsSliceSet(int s, int t, int n) const
+{
+  return IsValidSlice(s, t, n);
+}
+
+bool m2::ElxLazyWarpedImage::IsVolumeSet(int t, int n) const
+{
+  return IsValidVolume(t, n);
+}
+
+bool m2::ElxLazyWarpedImage::IsChannelSet(int n) const
+{
+  return IsValidChannel(n);
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::WarpSlice(unsigned int z) const
+{
+  if (m_Volume)
+    return CreateItem(2, static_cast<const char *>(m_Volume->GetData()) + z * GetSliceSize());
+
+  mitk::Image::Pointer warped;
+  if (m_Session->GetDimension() == 3)
+    warped = m_Session->WarpRegion(
+      m_Source, m_PixelType, {0, 0, z}, {GetDimension(0), GetDimension(1), 1}, m_InterpolationOrder);
+  else if (m_Stack)
+    warped = m_Session->WarpSlices(CreateSliceView(m_Source, z), m_PixelType, m_InterpolationOrder);
+  else
+    warped = m_Session->WarpMultiChannel(m_Source, m_PixelType, m_InterpolationOrder);
+  mitk::ImageReadAccessor acc(warped);
+  return CreateItem(2, acc.GetData());
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::WarpVolume() const
+{
+  // a single slice is the volume
+  if (GetDimension(2) == 1)
+  {
+    auto item = m_Cache->Get(this, 0);
+    if (!item)
+      item = WarpSlice(0);
+    return CreateItem(3, item->GetData());
+  }
+
+  // the buffer of the result is taken over without a copy
+  const auto warped = m_Stack ? m_Session->WarpSlices(m_Source, m_PixelType, m_InterpolationOrder)
+                              : m_Session->WarpMultiChannel(m_Source, m_PixelType, m_InterpolationOrder);
+  return warped->GetChannelData();
+}
+
+mitk::Image::ImageDataItemPointer m2::ElxLazyWarpedImage::CreateItem(unsigned int dimension, const void *data) const
+{
+  unsigned int dims[3] = {GetDimension(0), GetDimension(1), GetDimension(2)};
+  ImageDataItemPointer item = new mitk::ImageDataItem(GetPixelType(), 0, dimension, dims, nullptr, true);
+  std::memcpy(item->GetData(), data, GetSliceSize() * (dimension == 3 ? dims[2] : 1));
+  return item;
+}
+
+std::size_t m2::ElxLazyWarpedImage::GetSliceSize() const
+{
+  return std::size_t(GetDimension(0)) * GetDimension(1) * GetPixelType().GetSize();
+}
@@ -1,29 +1,410 @@
 #include <algorithm>
 #include <clocale>
+#include <m2ElxChannelDeinterleave.h>
 #include <m2ElxDefaultParameterFiles.h>
 #include <m2ElxRegistrationHelper.h>
 #include <m2ElxUtil.h>
 #include <m2ElxConfig.h>
-
-#include <itkVectorIndexSelectionCastImageFilter.h>
-#include <itkExtractImageFilter.h>
+#include <m2ElxTransformEngine.h>
+#include <m2ElxTransformParameterMap.h>
 
 #include <mitkImage.h>
 #include <mitkImageCast.h>
 #include <mitkImageAccessByItk.h>
 #include <mitkImageReadAccessor.h>
 #include <mitkImageWriteAccessor.h>
+#include <mitkITKImageImport.h>
+#include <mitkProportionalTimeGeometry.h>
+#include <mitkSmartPointerProperty.h>
 #include <numeric>
 
+#include "itkDiscreteGaussianImageFilter.h"
 #include "itkDisplacementFieldTransform.h"
+#include "itkGaussianOperator.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkResampleImageFilter.h"
 #include "itkLinearInterpolateImageFunction.h"
+#include "itkMultiThreaderBase.h"
 #include "itkNearestNeighborInterpolateImageFunction.h"
+#include "itkTransformToDisplacementFieldFilter.h"
 #include <itkConstantPadImageFilter.h>
+#include <itkMath.h>
+#include <itkVectorImage.h>
 #include <Poco/Environment.h>
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+namespace
+{
+  /**
+   * Samples transform - identity on the grid of the reference.
+   */
+  template <unsigned int VDimension, class TPrecision = double>
+  typename m2::ElxTransformEngine::DisplacementFieldType<VDimension, TPrecision>::Pointer SampleDisplacementField(
+    const m2::ElxTransformEngine::TransformType<VDimension> *transform, const itk::ImageBase<VDimension> *reference)
+  {
+    using FieldType = m2::ElxTransformEngine::DisplacementFieldType<VDimension, TPrecision>;
+    auto filter = itk::TransformToDisplacementFieldFilter<FieldType, double>::New();
+    filter->SetTransform(transform);
+    filter->SetReferenceImage(reference);
+    filter->SetUseReferenceImage(true);
+    filter->Update();
+    return filter->GetOutput();
+  }
+
+  template <unsigned int VDimension>
+  mitk::Image::Pointer CreateDeformationField(const std::vector<std::string> &transformations)
+  {
+    auto reference = itk::Image<unsigned char, VDimension>::New();
+    m2::ElxTransformEngine::InitializeOutputGeometry<VDimension>(
+      m2::ElxTransformParameterMap::Parse(transformations.back()), reference);
+
+    // float32 components, like the field written by transformix
+    const auto transform = m2::ElxTransformEngine::CreateCoefficientGridTransform<VDimension>(transformations);
+    return mitk::GrabItkImageMemory(SampleDisplacementField<VDimension, float>(transform, reference).GetPointer());
+  }
+
+  /**
+   * Writes a transformation chain as TransformParameters.<i>.txt into directory. InitialTransformParametersFileName
+   * of every file is rewritten to its predecessor in directory, so the chain does not depend on the directories it
+   * was created in (e.g. removed registration directories). edit is applied to each parameter text before writing.
+   * @return The path of the last file of the chain.
+   */
+  std::string WriteTransformationChain(const std::string &directory,
+                                       const std::vector<std::string> &transformations,
+                                       const std::function<void(std::string &)> &edit = nullptr)
+  {
+    std::string transformationPath;
+    for (unsigned int i = 0; i < transformations.size(); ++i)
+    {
+      auto T = transformations[i];
+      if (edit)
+        edit(T);
+      const auto initialTransform = i == 0 ? std::string("NoInitialTransform") : transformationPath;
+      m2::ElxUtil::ReplaceParameter(T, "InitialTransformParametersFileName", "\"" + initialTransform + "\"");
+      transformationPath =
+        m2::ElxUtil::JoinPath({directory, "/", "TransformParameters." + std::to_string(i) + ".txt"});
+      std::ofstream(transformationPath) << T;
+    }
+    return transformationPath;
+  }
+
+  /**
+   * Restricts the output grid (Size, Index, Origin) of a transform parameter file to a region of pixels.
+   */
+  std::string RestrictOutputGrid(std::string parameters,
+                                 const std::vector<unsigned int> &index,
+                                 const std::vector<unsigned int> &size)
+  {
+    const auto p = m2::ElxTransformParameterMap::Parse(parameters);
+    const auto dimension = p.GetDimension();
+    if (index.size() != dimension || size.size() != dimension)
+      mitkThrow() << "Region dimension does not match the transformation dimension " << dimension;
+
+    const auto gridSize = p.GetDoubles("Size");
+    const auto spacing = p.GetDoubles("Spacing");
+    auto origin = p.GetDoubles("Origin");
+    auto direction = p.GetDoubles("Direction");
+    if (direction.size() != dimension * dimension || p.GetString("UseDirectionCosines", "true") == "false")
+    {
+      direction.assign(dimension * dimension, 0);
+      for (unsigned int i = 0; i < dimension; ++i)
+        direction[i * dimension + i] = 1;
+    }
+    if (gridSize.size() != dimension || spacing.size() != dimension || origin.size() != dimension)
+      mitkThrow() << "Transformation does not define a valid output grid!";
+
+    std::ostringstream sizeStream, originStream, indexStream;
+    sizeStream.imbue(std::locale::classic());
+    originStream.imbue(std::locale::classic());
+    originStream << std::setprecision(17);
+    for (unsigned int i = 0; i < dimension; ++i)
+    {
+      if (index[i] >= gridSize[i])
+        mitkThrow() << "Region index " << index[i] << " exceeds the grid size " << gridSize[i];
+      const auto s = std::min<double>(size[i], gridSize[i] - index[i]);
+
+      // direction is written column-major
+      double o = origin[i];
+      for (unsigned int j = 0; j < dimension; ++j)
+        o += direction[j * dimension + i] * spacing[j] * index[j];
+
+      sizeStream << (i ? " " : "") << static_cast<unsigned int>(s);
+      originStream << (i ? " " : "") << o;
+      indexStream << (i ? " " : "") << 0;
+    }
+
+    m2::ElxUtil::ReplaceParameter(parameters, "Size", sizeStream.str());
+    m2::ElxUtil::ReplaceParameter(parameters, "Index", indexStream.str());
+    m2::ElxUtil::ReplaceParameter(parameters, "Origin", originStream.str());
+    return parameters;
+  }
+
+  /**
+   * Grid (geometry only, no buffer) of the first VDimension axes of image.
+   */
+  template <unsigned int VDimension>
+  typename itk::Image<unsigned char, VDimension>::Pointer CreateReferenceGrid(const mitk::Image *image)
+  {
+    using ReferenceType = itk::Image<unsigned char, VDimension>;
+    const auto geometry = image->GetGeometry();
+    const auto matrix = geometry->GetIndexToWorldTransform()->GetMatrix();
+    typename ReferenceType::RegionType region;
+    typename ReferenceType::SpacingType spacing;
+    typename ReferenceType::PointType origin;
+    typename ReferenceType::DirectionType direction;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      region.SetSize(i, image->GetDimensions()[i]);
+      spacing[i] = geometry->GetSpacing()[i];
+      origin[i] = geometry->GetOrigin()[i];
+      for (unsigned int j = 0; j < VDimension; ++j)
+        direction[i][j] = matrix[i][j] / geometry->GetSpacing()[j];
+    }
+    auto reference = ReferenceType::New();
+    reference->SetRegions(region);
+    reference->SetSpacing(spacing);
+    reference->SetOrigin(origin);
+    reference->SetDirection(direction);
+    return reference;
+  }
+
+  /**
+   * Inverse of the transformations on the grid of movingImage. In-process chains are inverted exactly per pixel;
+   * otherwise forwardField (e.g. of transformix) is inverted and pixels outside of its grid are NaN.
+   */
+  template <unsigned int VDimension>
+  mitk::Image::Pointer CreateInverseDeformationField(const std::vector<std::string> &transformations,
+                                                     const mitk::Image *forwardField,
+                                                     const mitk::Image *movingImage)
+  {
+    const auto reference = CreateReferenceGrid<VDimension>(movingImage);
+    double residual = 0;
+    typename m2::ElxTransformEngine::DisplacementFieldType<VDimension>::Pointer inverse;
+    if (!forwardField)
+    {
+      inverse = m2::ElxTransformEngine::CreateInverseDisplacementField<VDimension>(
+        transformations, reference, 50, 1e-3, &residual);
+      MITK_INFO << "Inverted transformations on the moving image grid; maximum residual " << residual;
+    }
+    else
+    {
+      std::size_t outside = 0;
+      inverse = m2::ElxTransformEngine::InvertDisplacementField<VDimension>(
+        m2::ElxTransformEngine::ToDisplacementField<VDimension>(forwardField),
+        reference,
+        m2::ElxTransformEngine::CreateLinearPart<VDimension>(transformations),
+        50,
+        1e-3,
+        &residual,
+        &outside);
+      MITK_INFO << "Inverted deformation field on the moving image grid; maximum residual " << residual << ", "
+                << outside << " pixels outside of the forward field";
+    }
+    return mitk::GrabItkImageMemory(inverse.GetPointer());
+  }
+
+  /**
+   * Gaussian anti-aliasing of a scalar image before it is resampled onto a grid with outputSpacing
+   * (see ElxWarpOptions::GetAntiAliasingSigma). The image axes are assumed to be roughly aligned with the output grid.
+   */
+  template <unsigned int VDimension>
+  mitk::Image::Pointer SmoothForDownsampling(const mitk::Image *image, const std::vector<double> &outputSpacing)
+  {
+    mitk::Image::Pointer result = const_cast<mitk::Image *>(image);
+    AccessFixedDimensionByItk(const_cast<mitk::Image *>(image), ([&](auto itkImage) {
+      using InputImageType = typename std::remove_pointer<decltype(itkImage)>::type;
+      using RealType = typename std::conditional<std::is_same<typename InputImageType::PixelType, double>::value, double, float>::type;
+      using FilterType = itk::DiscreteGaussianImageFilter<InputImageType, itk::Image<RealType, VDimension>>;
+
+      const auto &spacing = itkImage->GetSpacing();
+      const auto sigma = m2::ElxWarpOptions::GetAntiAliasingSigma(std::vector<double>(spacing.Begin(), spacing.End()),
+                                                                  outputSpacing);
+      if (std::all_of(sigma.begin(), sigma.end(), [](double s) { return s == 0; }))
+        return;
+
+      typename FilterType::ArrayType variance;
+      unsigned int kernelWidth = 3;
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        variance[i] = sigma[i] * sigma[i];
+        kernelWidth = std::max(kernelWidth, 2 * static_cast<unsigned int>(std::ceil(4 * sigma[i] / spacing[i])) + 1);
+      }
+      auto filter = FilterType::New();
+      filter->SetInput(itkImage);
+      filter->SetVariance(variance);
+      filter->SetUseImageSpacing(true);
+      filter->SetMaximumKernelWidth(kernelWidth);
+      filter->Update();
+      std::ostringstream os;
+      for (unsigned int i = 0; i < VDimension; ++i)
+        os << (i ? " " : "") << sigma[i];
+      MITK_INFO << "Anti-aliasing before downsampling; sigma [" << os.str() << "] mm";
+      result = mitk::GrabItkImageMemory(filter->GetOutput());
+    }), VDimension);
+    return result;
+  }
+
+  /**
+   * Gaussian anti-aliasing of multi-component images and slice stacks before they are resampled onto a grid with
+   * outputSpacing. Like SmoothForDownsampling, the kernels are those of itk::DiscreteGaussianImageFilter (zero-flux
+   * boundary); they are applied separably to all components of a pixel at once. Axes without an output spacing
+   * (the slices of a stack warped by a 2D registration) are not smoothed.
+   */
+  mitk::Image::Pointer SmoothComponentsForDownsampling(const mitk::Image *image,
+                                                       const std::vector<double> &outputSpacing)
+  {
+    const auto dimension = std::min(3u, image->GetDimension());
+    const auto components = image->GetPixelType().GetNumberOfComponents();
+    const auto spacing = image->GetGeometry()->GetSpacing();
+    const std::vector<double> inputSpacing(spacing.Begin(), spacing.Begin() + dimension);
+    const auto sigma = m2::ElxWarpOptions::GetAntiAliasingSigma(inputSpacing, outputSpacing);
+    if (std::all_of(sigma.begin(), sigma.end(), [](double s) { return s == 0; }))
+      return const_cast<mitk::Image *>(image);
+
+    std::size_t size[3] = {1, 1, 1};
+    unsigned int kernelWidth = 3;
+    for (unsigned int i = 0; i < dimension; ++i)
+    {
+      size[i] = image->GetDimension(i);
+      kernelWidth = std::max(kernelWidth, 2 * static_cast<unsigned int>(std::ceil(4 * sigma[i] / spacing[i])) + 1);
+    }
+    const auto n = size[0] * size[1] * size[2] * components;
+
+    mitk::Image::Pointer result;
+    mitk::ImageReadAccessor acc(image);
+    m2::ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+      using PixelType = decltype(pixel);
+      using RealType = typename std::conditional<std::is_same<PixelType, double>::value, double, float>::type;
+      const auto input = static_cast<const PixelType *>(acc.GetData());
+      std::vector<RealType> data(input, input + n), smoothed(n);
+
+      for (unsigned int axis = 0; axis < dimension; ++axis)
+      {
+        if (sigma[axis] == 0)
+          continue;
+        itk::GaussianOperator<double, 1> op;
+        op.SetVariance(sigma[axis] * sigma[axis] / (spacing[axis] * spacing[axis]));
+        op.SetMaximumError(0.01);
+        op.SetMaximumKernelWidth(kernelWidth);
+        op.CreateDirectional();
+        const std::vector<RealType> weights(op.Begin(), op.End());
+        const auto radius = static_cast<long long>(weights.size() / 2);
+
+        // rows of the axis: all components of the lower axes are contiguous
+        std::size_t inner = components;
+        for (unsigned int i = 0; i < axis; ++i)
+          inner *= size[i];
+        const auto length = static_cast<long long>(size[axis]);
+        itk::MultiThreaderBase::New()->ParallelizeArray(
+          0,
+          n / inner,
+          [&](itk::SizeValueType row) {
+            const auto outer = row / size[axis];
+            const auto j = static_cast<long long>(row % size[axis]);
+            const auto out = smoothed.data() + row * inner;
+            std::fill_n(out, inner, RealType(0));
+            for (long long k = -radius; k <= radius; ++k)
+            {
+              const auto jk = std::min(std::max(j + k, 0LL), length - 1);
+              const auto in = data.data() + (outer * size[axis] + jk) * inner;
+              const auto w = weights[k + radius];
+              for (std::size_t q = 0; q < inner; ++q)
+                out[q] += w * in[q];
+            }
+          },
+          nullptr);
+        data.swap(smoothed);
+      }
+
+      result = mitk::Image::New();
+      if (components > 1)
+        result->Initialize(mitk::MakePixelType<itk::VectorImage<RealType, 3>>(components),
+                           image->GetDimension(),
+                           image->GetDimensions());
+      else
+        result->Initialize(mitk::MakePixelType<RealType, RealType, 1>(), image->GetDimension(), image->GetDimensions());
+      result->SetGeometry(image->GetGeometry()->Clone());
+      mitk::ImageWriteAccessor resultAcc(result);
+      std::copy(data.begin(), data.end(), static_cast<RealType *>(resultAcc.GetData()));
+    });
+
+    std::ostringstream os;
+    for (unsigned int i = 0; i < dimension; ++i)
+      os << (i ? " " : "") << sigma[i];
+    MITK_INFO << "Anti-aliasing of " << components << " components before downsampling; sigma [" << os.str()
+              << "] mm";
+    return result;
+  }
+
+  /**
+   * Image with another dimension or geometry that shares the pixel buffer of image (no copy).
+   * The source image is kept alive by the "m2aia.registration.source" property of the view.
+   */
+  mitk::Image::Pointer CreateImageView(const mitk::Image *image,
+                                       unsigned int dimension,
+                                       const unsigned int *dimensions,
+                                       const mitk::AffineTransform3D::MatrixType &matrix,
+                                       const mitk::AffineTransform3D::OutputVectorType &offset,
+                                       std::size_t byteOffset = 0)
+  {
+    auto view = mitk::Image::New();
+    view->Initialize(image->GetPixelType(), dimension, dimensions);
+    {
+      mitk::ImageReadAccessor acc(image);
+      const auto data = static_cast<const char *>(acc.GetData()) + byteOffset;
+      view->SetImportVolume(const_cast<char *>(data), 0, 0, mitk::Image::ReferenceMemory);
+    }
+    view->SetProperty("m2aia.registration.source", mitk::SmartPointerProperty::New(const_cast<mitk::Image *>(image)));
+
+    auto transform = mitk::AffineTransform3D::New();
+    transform->SetMatrix(matrix);
+    transform->SetOffset(offset);
+    view->GetGeometry()->SetIndexToWorldTransform(transform);
+    return view;
+  }
+
+  /**
+   * Converts a scalar float result of transformix to an integer pixel type (rounded and clamped).
+   */
+  mitk::Image::Pointer ConvertPixelType(const mitk::Image *image, const std::string &pixelType)
+  {
+    if (image->GetPixelType().GetComponentTypeAsString() == pixelType)
+      return const_cast<mitk::Image *>(image);
+
+    mitk::Image::Pointer result;
+    mitk::ImageReadAccessor acc(image);
+    m2::ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto inputPixel) {
+      using InputPixelType = decltype(inputPixel);
+      m2::ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+        using OutputPixelType = decltype(outputPixel);
+        result = mitk::Image::New();
+        result->Initialize(mitk::MakeScalarPixelType<OutputPixelType>(), image->GetDimension(), image->GetDimensions());
+        result->SetClonedGeometry(image->GetGeometry());
+        mitk::ImageWriteAccessor wAcc(result);
+        const auto n = image->GetLargestPossibleRegion().GetNumberOfPixels();
+        const auto input = static_cast<const InputPixelType *>(acc.GetData());
+        std::transform(input, input + n, static_cast<OutputPixelType *>(wAcc.GetData()), [](InputPixelType v) {
+          return m2::ElxUtil::CastPixel<OutputPixelType>(v);
+        });
+      });
+    });
+    return result;
+  }
+} // namespace
+
 m2::ElxRegistrationHelper::~ElxRegistrationHelper()
 {
   // for(auto dir : m_ListOFWorkingDirectories)
@@ -66,50 +447,24 @@ void m2::ElxRegistrationHelper::SymlinkOrWriteNrrd(mitk::Image::Pointer image, s
   }
 }
 
-mitk::Image::Pointer m2::ElxRegistrationHelper::ConvertForElastixProcessing(const mitk::Image *image) const
+mitk::Image::Pointer m2::ElxRegistrationHelper::ConvertForElastixProcessing(const mitk::Image *image,
+                                                                            unsigned int timeStep) const
 {
   if (image)
   {
     const auto dim = image->GetDimension();
-    // const auto dimensions = image->GetDimensions();
     const auto sizeZ = image->GetDimensions()[2];
-    auto geom3D = image->GetSlicedGeometry();
-    auto n = std::accumulate(image->GetDimensions(), image->GetDimensions() + 2, 1, std::multiplies<>()) *
-             image->GetPixelType().GetSize();
     if (dim == 3 && sizeZ == 1)
     {
-      auto output = mitk::Image::New();
-      AccessByItk(const_cast<mitk::Image *>(image), ([&](auto I)
-                                                     {
-                                                       using Image3DType = typename std::remove_pointer<decltype(I)>::type;
-                                                       using ImagePixelType = typename Image3DType::PixelType;
-                                                       using Image2DType = itk::Image<ImagePixelType, 2>;
-
-                                                       // Extract a 2D slice
-                                                       using ExtractFilterType = itk::ExtractImageFilter<Image3DType, Image2DType>;
-                                                       typename ExtractFilterType::Pointer extractFilter = ExtractFilterType::New();
-
-                                                       // Set the input image
-                                                       extractFilter->SetInput(I);
-
-                                                       // Define the region to extract (slice)
-                                                       typename Image3DType::RegionType inputRegion = I->GetLargestPossibleRegion();
-                                                       typename Image3DType::SizeType size = inputRegion.GetSize();
-                                                       size[2] = 0; // We are extracting a 2D slice along the z-axis
-
-                                                       typename Image3DType::IndexType start = inputRegion.GetIndex();
-                                                       start[2] = 0; // The slice index along the z-axis
-
-                                                       typename Image3DType::RegionType desiredRegion;
-                                                       desiredRegion.SetSize(size);
-                                                       desiredRegion.SetIndex(start);
-
-                                                       extractFilter->SetExtractionRegion(desiredRegion);
-                                                       extractFilter->SetDirectionCollapseToSubmatrix();
-                                                       extractFilter->Update();
-
-                                                       mitk::CastToMitkImage(extractFilter->GetOutput(), output); }));
-      return output;
+      // 2D view of the single slice; the direction is collapsed to the x-y submatrix (like itk::ExtractImageFilter)
+      const auto geometry = image->GetGeometry();
+      auto matrix = geometry->GetIndexToWorldTransform()->GetMatrix();
+      auto offset = geometry->GetIndexToWorldTransform()->GetOffset();
+      for (unsigned int i = 0; i < 2; ++i)
+        matrix[i][2] = matrix[2][i] = 0;
+      matrix[2][2] = 1;
+      offset[2] = 0;
+      return CreateImageView(image, 2, image->GetDimensions(), matrix, offset);
     }
     else if (dim == 2)
     {
@@ -123,67 +478,41 @@ mitk::Image::Pointer m2::ElxRegistrationHelper::ConvertForElastixProcessing(cons
     }
     else if (dim == 4)
     {
-      // 4D => 3D volume (4th dim is > 0)
-      // TODO: enable Selection of time step != 0
-      auto output = mitk::Image::New();
-      output->Initialize(image->GetPixelType(), 3, image->GetDimensions());
-      output->GetSlicedGeometry()->SetSpacing(geom3D->GetSpacing());
-      output->GetSlicedGeometry()->SetOrigin(geom3D->GetOrigin());
-      output->GetSlicedGeometry()->SetDirectionVector(geom3D->GetDirectionVector());
-      mitk::ImageReadAccessor iAcc(image);
-      mitk::ImageWriteAccessor oAcc(output);
-      std::copy((const char *)iAcc.GetData(), (const char *)iAcc.GetData() + n, (char *)oAcc.GetData());
-      MITK_WARN << "3D+t Images are not well supported! Time step 0 selected.";
-      return output;
+      // 4D => 3D volume of one time step (time steps are stored one after another)
+      if (timeStep >= image->GetTimeSteps())
+        mitkThrow() << "Time step " << timeStep << " exceeds the " << image->GetTimeSteps() << " time steps of the image";
+      const auto dims = image->GetDimensions();
+      const auto timeStepBytes =
+        std::accumulate(dims, dims + 3, std::size_t(1), std::multiplies<>()) * image->GetPixelType().GetSize();
+      const auto geometry = image->GetGeometry(timeStep);
+      auto view = CreateImageView(image,
+                                  3,
+                                  dims,
+                                  geometry->GetIndexToWorldTransform()->GetMatrix(),
+                                  geometry->GetIndexToWorldTransform()->GetOffset(),
+                                  timeStep * timeStepBytes);
+      // 2D+t: the single slice of the time step is converted as well
+      return sizeZ == 1 ? ConvertForElastixProcessing(view) : view;
     }
   }
   mitkThrow() << "Image data is null!";
 }
 
+unsigned int m2::ElxRegistrationHelper::GetNumberOfImageCopies() const
+{
+  return m_NumberOfImageCopies;
+}
+
 mitk::Image::Pointer m2::ElxRegistrationHelper::ConvertForM2aiaProcessing(const mitk::Image *image) const
 {
   if (image)
   {
-    // auto geom3D = image->GetSlicedGeometry();
-    // const auto N = std::accumulate(image->GetDimensions(), image->GetDimensions() + 2, 1, std::multiplies<>()) *
-    //  image->GetPixelType().GetSize();
     if (image->GetDimension() == 2)
     {
-      // Get the size of the 2D image
-      mitk::PixelType pixelType = image->GetPixelType();
-      unsigned int width = image->GetDimension(0);
-      unsigned int height = image->GetDimension(1);
-
-      // Create a new 3D image with the same width and height, but with a depth of 1
-      mitk::Image::Pointer outputImage3D = mitk::Image::New();
-      unsigned int dimensions[3] = {width, height, 1};
-      outputImage3D->Initialize(pixelType, 3, dimensions);
-
-      // Copy spacing, origin, and direction
-      mitk::Vector3D spacing = image->GetGeometry()->GetSpacing();
-      mitk::Point3D origin = image->GetGeometry()->GetOrigin();
-      auto directionMatrix = image->GetGeometry()->GetIndexToWorldTransform();
-
-      // Adjust the spacing and origin for the 3rd dimension
-      spacing[2] = 1.0; // Arbitrary spacing for the single slice in the 3rd dimension
-      origin[2] = 0.0;  // Set origin for the 3rd dimension
-
-      outputImage3D->SetSpacing(spacing);
-      outputImage3D->GetGeometry()->SetOrigin(origin);
-      outputImage3D->GetGeometry()->SetIndexToWorldTransform(directionMatrix);
-
-      // Create write access to the 3D image data
-      mitk::ImageWriteAccessor writeAccess(outputImage3D);
-      mitk::ImageReadAccessor readAccess(image);
-
-      // Get the raw data pointers
-      auto inputData = readAccess.GetData();
-      auto outputData = writeAccess.GetData();
-
-      // Copy the 2D image data to the first slice of the 3D image
-      std::memcpy(outputData, inputData, image->GetPixelType().GetSize() * width * height);
-
-      return outputImage3D;
+      // 3D view with a single slice and the geometry of the 2D image
+      const unsigned int dimensions[3] = {image->GetDimension(0), image->GetDimension(1), 1};
+      const auto transform = image->GetGeometry()->GetIndexToWorldTransform();
+      return CreateImageView(image, 3, dimensions, transform->GetMatrix(), transform->GetOffset());
     }
     else
     {
@@ -247,6 +576,7 @@ void m2::ElxRegistrationHelper::SetImageData(mitk::Image *fixed, mitk::Image *mo
 
   m_FixedImage = fixed;
   m_MovingImage = moving;
+  m_InverseDeformationField = nullptr; // sampled on the moving image grid
 
   // if masks were already set, check if geometries fit
   if (m_UseMasksForRegistration)
@@ -278,11 +608,34 @@ void m2::ElxRegistrationHelper::SetAdditionalBinarySearchPath(const std::string
   m_BinarySearchPath = ElxUtil::JoinPath({path});
 }
 
+void m2::ElxRegistrationHelper::SetUseInProcessTransforms(bool val)
+{
+  m_UseInProcessTransforms = val;
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+}
+
+void m2::ElxRegistrationHelper::SetMultiStartRigid(unsigned int numberOfRotations, bool includeFlips)
+{
+  m_NumberOfRigidStartRotations = std::max(1u, numberOfRotations);
+  m_RigidStartFlips = includeFlips;
+}
+
 void m2::ElxRegistrationHelper::SetChannelSelections(const std::vector<std::pair<unsigned int, unsigned int>> &channelSelections)
 {
   m_ChannelSelections = channelSelections;
 }
 
+void m2::ElxRegistrationHelper::SetChannelFusion(const ElxChannelFusion::Parameters &parameters)
+{
+  m_ChannelFusion = parameters;
+}
+
+m2::ElxChannelFusion::Weights m2::ElxRegistrationHelper::GetChannelFusionWeights() const
+{
+  return m_ChannelFusionWeights;
+}
+
 std::string m2::ElxRegistrationHelper::CreateWorkingDirectory() const
 {
   // Create a temporary directory if workdir not defined
@@ -303,6 +656,162 @@ std::string m2::ElxRegistrationHelper::CreateWorkingDirectory() const
   return workingDirectory;
 }
 
+std::string m2::ElxRegistrationHelper::CreateInitialRigidTransform(double angle, bool flip, unsigned int dimension) const
+{
+  const auto fixedData = ConvertForElastixProcessing(m_FixedImage);
+  const auto fixedGeometry = fixedData->GetGeometry();
+  const auto fixedCenter = m_FixedImage->GetGeometry()->GetCenter();
+  const auto movingCenter = m_MovingImage->GetGeometry()->GetCenter();
+  const auto spacing = fixedGeometry->GetSpacing();
+  const auto origin = fixedGeometry->GetOrigin();
+  const auto indexToWorld = fixedGeometry->GetIndexToWorldTransform()->GetMatrix();
+
+  // A = R(angle) * F maps fixed to moving points; R rotates about the z-axis, F flips the x-axis
+  const double c = std::cos(angle);
+  const double s = std::sin(angle);
+  const double f = flip ? -1.0 : 1.0;
+  std::vector<double> A(dimension * dimension, 0.0);
+  A[0] = c * f;
+  A[1] = -s;
+  A[dimension] = s * f;
+  A[dimension + 1] = c;
+  if (dimension == 3)
+    A[8] = 1.0;
+
+  std::ostringstream os;
+  os.imbue(std::locale::classic());
+  os << std::setprecision(12);
+  const auto writeVector = [&](const std::string &name, auto &&value) {
+    os << "(" << name;
+    for (unsigned int i = 0; i < dimension; ++i)
+      os << " " << value(i);
+    os << ")\n";
+  };
+
+  os << "(Transform \"AffineTransform\")\n";
+  os << "(NumberOfParameters " << dimension * dimension + dimension << ")\n";
+  os << "(TransformParameters";
+  for (auto a : A)
+    os << " " << a;
+  for (unsigned int i = 0; i < dimension; ++i)
+    os << " " << movingCenter[i] - fixedCenter[i];
+  os << ")\n";
+  os << "(InitialTransformParametersFileName \"NoInitialTransform\")\n";
+  os << "(HowToCombineTransforms \"Compose\")\n";
+  os << "(FixedImageDimension " << dimension << ")\n";
+  os << "(MovingImageDimension " << dimension << ")\n";
+  os << "(FixedInternalImagePixelType \"float\")\n";
+  os << "(MovingInternalImagePixelType \"float\")\n";
+  writeVector("Size", [&](unsigned int i) { return fixedData->GetDimension(i); });
+  writeVector("Index", [](unsigned int) { return 0; });
+  writeVector("Spacing", [&](unsigned int i) { return spacing[i]; });
+  writeVector("Origin", [&](unsigned int i) { return origin[i]; });
+  // elastix stores direction cosines column by column
+  os << "(Direction";
+  for (unsigned int col = 0; col < dimension; ++col)
+    for (unsigned int row = 0; row < dimension; ++row)
+      os << " " << indexToWorld[row][col] / spacing[col];
+  os << ")\n";
+  os << "(UseDirectionCosines \"true\")\n";
+  writeVector("CenterOfRotationPoint", [&](unsigned int i) { return fixedCenter[i]; });
+  os << "(ResampleInterpolator \"FinalLinearInterpolator\")\n";
+  os << "(Resampler \"DefaultResampler\")\n";
+  os << "(DefaultPixelValue 0)\n";
+  os << "(ResultImageFormat \"nrrd\")\n";
+  os << "(ResultImagePixelType \"float\")\n";
+  return os.str();
+}
+
+std::vector<std::string> m2::ElxRegistrationHelper::MultiStartRigidInitialization(
+  const std::string &exeElastix,
+  const std::string &workingDirectory,
+  const std::string &rigidParameters,
+  const std::vector<std::string> &imageArgs) const
+{
+  const unsigned int dimension = ElxTransformParameterMap::Parse(rigidParameters).GetDimension() == 3 ? 3 : 2;
+
+  // short, low-resolution version of the rigid stage
+  auto parameterText = rigidParameters;
+  ElxUtil::ReplaceParameter(parameterText, "NumberOfResolutions", "2");
+  ElxUtil::ReplaceParameter(parameterText, "ImagePyramidSchedule", dimension == 3 ? "8 8 8 4 4 4" : "8 8 4 4");
+  ElxUtil::ReplaceParameter(parameterText, "MaximumNumberOfIterations", "150");
+  ElxUtil::ReplaceParameter(parameterText, "NumberOfSpatialSamples", "4096");
+  ElxUtil::ReplaceParameter(parameterText, "AutomaticTransformInitialization", "\"false\"");
+  ElxUtil::ReplaceParameter(parameterText, "WriteResultImage", "\"false\"");
+
+  std::vector<std::pair<double, bool>> starts;
+  for (unsigned int r = 0; r < m_NumberOfRigidStartRotations; ++r)
+  {
+    const double angle = 2.0 * itk::Math::pi * r / m_NumberOfRigidStartRotations;
+    starts.emplace_back(angle, false);
+    if (m_RigidStartFlips)
+      starts.emplace_back(angle, true);
+  }
+
+  const unsigned int threads = m_NumberOfThreads > 0 ? m_NumberOfThreads : std::thread::hardware_concurrency();
+  const unsigned int threadsPerStart = std::max(1u, threads / static_cast<unsigned int>(starts.size()));
+
+  std::vector<std::string> startDirectories;
+  std::vector<std::future<double>> jobs;
+  for (unsigned int k = 0; k < starts.size(); ++k)
+  {
+    const auto startDirectory = ElxUtil::JoinPath({workingDirectory, "/", "start" + std::to_string(k)});
+    itksys::SystemTools::MakeDirectory(startDirectory);
+    startDirectories.push_back(startDirectory);
+
+    const auto initialTransformPath = ElxUtil::JoinPath({startDirectory, "/", "InitialTransform.txt"});
+    std::ofstream(initialTransformPath) << CreateInitialRigidTransform(starts[k].first, starts[k].second, dimension);
+    const auto parameterPath = ElxUtil::JoinPath({startDirectory, "/", "pp.txt"});
+    std::ofstream(parameterPath) << parameterText;
+
+    auto args = imageArgs;
+    args.insert(args.end(), {"-t0", initialTransformPath});
+    args.insert(args.end(), {"-p", parameterPath});
+    args.insert(args.end(), {"-out", startDirectory});
+    args.insert(args.end(), {"-threads", std::to_string(threadsPerStart)});
+
+    jobs.push_back(std::async(std::launch::async, [exeElastix, args, startDirectory]() {
+      m2::ElxUtil::run(exeElastix, args);
+      return ElxUtil::GetFinalMetricValue(ElxUtil::JoinPath({startDirectory, "/", "elastix.log"}));
+    }));
+  }
+
+  unsigned int best = 0;
+  double bestMetric = std::numeric_limits<double>::infinity();
+  for (unsigned int k = 0; k < jobs.size(); ++k)
+  {
+    double metric = std::numeric_limits<double>::infinity();
+    try
+    {
+      metric = jobs[k].get();
+    }
+    catch (std::exception &e)
+    {
+      MITK_WARN << "Rigid start " << k << " failed: " << e.what();
+    }
+    MITK_INFO << "Rigid start " << k << " [angle " << starts[k].first * 180.0 / itk::Math::pi
+              << (starts[k].second ? ", flipped" : "") << "]: final metric " << metric;
+    if (metric < bestMetric)
+    {
+      bestMetric = metric;
+      best = k;
+    }
+  }
+
+  if (!std::isfinite(bestMetric))
+    return {};
+
+  m_StatusFunction("Best rigid start: " + std::to_string(best) + " (metric " + std::to_string(bestMetric) + ")");
+
+  std::vector<std::string> chain;
+  for (const auto &name : {std::string("InitialTransform.txt"), std::string("TransformParameters.0.txt")})
+  {
+    auto ifs = std::ifstream(ElxUtil::JoinPath({startDirectories[best], "/", name}));
+    chain.emplace_back(std::string{std::istreambuf_iterator<char>{ifs}, {}});
+  }
+  return chain;
+}
+
 void m2::ElxRegistrationHelper::GetRegistration()
 {
   if (m_FixedImage.IsNull() || m_MovingImage.IsNull())
@@ -311,9 +820,13 @@ void m2::ElxRegistrationHelper::GetRegistration()
     return;
   }
 
-  const auto exeElastix = m2::ElxUtil::Executable("elastix");
+  const auto exeElastix = m2::ElxUtil::Executable("elastix", m_BinarySearchPath);
   if (exeElastix.empty())
     mitkThrow() << "Elastix executable not found!";
+  m_NumberOfImageCopies = 0;
+  m_ChannelFusionWeights = ElxChannelFusion::Weights();
+  if (m_MovingImage->GetTimeSteps() > 1)
+    MITK_WARN << "Only time step 0 of the moving image is registered; use GetTimeStepRegistration for all time steps.";
   MITK_INFO << "Use Elastix found at [" << exeElastix << "]";
   auto workingDirectory = CreateWorkingDirectory();
   MITK_INFO << workingDirectory << " " << itksys::SystemTools::PathExists(workingDirectory);
@@ -364,28 +877,67 @@ void m2::ElxRegistrationHelper::GetRegistration()
 
   std::vector<std::string> args;
   args.insert(args.end(), {"-out", workingDirectory});
+  if (m_NumberOfThreads > 0)
+    args.insert(args.end(), {"-threads", std::to_string(m_NumberOfThreads)});
+  // image, mask and point arguments follow (see the multi-start rigid initialization)
+  const auto firstInputArgument = args.size();
+
+  // FUSE CHANNELS: a few weighted sums of the channels replace the channel pairs
+  std::vector<mitk::Image::Pointer> fusedFixedImages, fusedMovingImages;
+  if (m_ChannelFusion.method != ElxChannelFusion::Method::None &&
+      m_FixedImage->GetPixelType().GetNumberOfComponents() > 1 &&
+      m_MovingImage->GetPixelType().GetNumberOfComponents() > 1)
+  {
+    std::vector<unsigned int> fixedChannels, movingChannels;
+    for (const auto &channelSelection : m_ChannelSelections)
+    {
+      fixedChannels.push_back(channelSelection.first);
+      movingChannels.push_back(channelSelection.second);
+    }
+    if (m_ChannelSelections.empty())
+    {
+      // all channels
+      const auto components = m_FixedImage->GetPixelType().GetNumberOfComponents();
+      if (m_MovingImage->GetPixelType().GetNumberOfComponents() != components)
+        mitkThrow() << "Channel fusion without channel selections requires the same channels in both images!";
+      fixedChannels.resize(components);
+      std::iota(fixedChannels.begin(), fixedChannels.end(), 0);
+      movingChannels = fixedChannels;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    m_ChannelFusionWeights = ElxChannelFusion::Fit(
+      {m_FixedImage.GetPointer(), m_MovingImage.GetPointer()}, {fixedChannels, movingChannels}, m_ChannelFusion);
+    fusedFixedImages = ElxChannelFusion::Apply(m_FixedImage, fixedChannels, m_ChannelFusionWeights);
+    fusedMovingImages = ElxChannelFusion::Apply(m_MovingImage, movingChannels, m_ChannelFusionWeights);
+    m_NumberOfImageCopies += static_cast<unsigned int>(fusedFixedImages.size() + fusedMovingImages.size());
+    MITK_INFO << "Channel fusion (" << ElxChannelFusion::GetMethodName(m_ChannelFusionWeights.method) << "): "
+              << fixedChannels.size() << " channels to " << fusedFixedImages.size() << " images in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s";
+  }
 
   // SAVE MOVING IMAGE(s) ON DISK
-  if (m_MovingImage->GetPixelType().GetNumberOfComponents() > 1)
-  {
-    mitk::Image::Pointer output;
-    unsigned int component = 0;
-    for (auto channelSelection : m_ChannelSelections)
-    {
-      AccessVectorPixelTypeByItk(m_MovingImage, ([&](auto itkImage)
-                                                 {
-          using SourceImageType = typename std::remove_pointer<decltype(itkImage)>::type;
-          using ScalarImageType = itk::Image<typename SourceImageType::ValueType::ComponentType, SourceImageType::ImageDimension>;
-          using IndexSelectionType = itk::VectorIndexSelectionCastImageFilter<SourceImageType, ScalarImageType>;
-          auto indexSelectionFilter = IndexSelectionType::New();
-          indexSelectionFilter->SetIndex(channelSelection.second);
-          indexSelectionFilter->SetInput(itkImage);
-          indexSelectionFilter->Update();
-          mitk::CastToMitkImage(indexSelectionFilter->GetOutput(), output); }));
-          const auto movingPath = ElxUtil::JoinPath({workingDirectory, "/", "moving" + std::to_string(channelSelection.second) + ".nrrd"});
-          SymlinkOrWriteNrrd(output, movingPath);
-          args.insert(args.end(), {"-m" + std::to_string(component), movingPath});
-          ++component;
+  if (!fusedMovingImages.empty())
+  {
+    for (unsigned int component = 0; component < fusedMovingImages.size(); ++component)
+    {
+      const auto movingPath = ElxUtil::JoinPath({workingDirectory, "/", "movingFused" + std::to_string(component) + ".nrrd"});
+      SymlinkOrWriteNrrd(fusedMovingImages[component], movingPath);
+      args.insert(args.end(), {"-m" + std::to_string(component), movingPath});
+    }
+  }
+  else if (m_MovingImage->GetPixelType().GetNumberOfComponents() > 1)
+  {
+    // all selected channels are extracted in one pass over the interleaved buffer
+    std::vector<unsigned int> channels;
+    for (const auto &channelSelection : m_ChannelSelections)
+      channels.push_back(channelSelection.second);
+    const auto outputs = ElxChannelDeinterleave::ExtractChannels(m_MovingImage, channels);
+    m_NumberOfImageCopies += static_cast<unsigned int>(outputs.size());
+    for (unsigned int component = 0; component < outputs.size(); ++component)
+    {
+      const auto movingPath = ElxUtil::JoinPath({workingDirectory, "/", "moving" + std::to_string(channels[component]) + ".nrrd"});
+      SymlinkOrWriteNrrd(outputs[component], movingPath);
+      args.insert(args.end(), {"-m" + std::to_string(component), movingPath});
     }
   }
   else
@@ -396,28 +948,27 @@ void m2::ElxRegistrationHelper::GetRegistration()
   }
 
   // SAVE FIXED IMAGE(s) ON DISK
-  if (m_FixedImage->GetPixelType().GetNumberOfComponents() > 1)
-  {
-    mitk::Image::Pointer output;
-    unsigned int component = 0;
-    for (auto channelSelection : m_ChannelSelections)
-    {
-      AccessVectorPixelTypeByItk(m_FixedImage, ([&](auto itkImage)
-                                                {
-          using SourceImageType = typename std::remove_pointer<decltype(itkImage)>::type;
-          using ScalarImageType = itk::Image<typename SourceImageType::ValueType::ComponentType, SourceImageType::ImageDimension>;
-          using IndexSelectionType = itk::VectorIndexSelectionCastImageFilter<SourceImageType, ScalarImageType>;
-          auto indexSelectionFilter = IndexSelectionType::New();
-          indexSelectionFilter->SetIndex(channelSelection.first);
-          indexSelectionFilter->SetInput(itkImage);
-          indexSelectionFilter->Update();
-          mitk::CastToMitkImage(indexSelectionFilter->GetOutput(), output); 
-        }));
-      const auto fixedPath = ElxUtil::JoinPath({workingDirectory, "/", "fixed" + std::to_string(channelSelection.first) + ".nrrd"});
-      // const auto movingPath = ElxUtil::JoinPath({workingDirectory, "/", "moving"+std::to_string(component)+".nrrd"});
-      SymlinkOrWriteNrrd(output, fixedPath);
+  if (!fusedFixedImages.empty())
+  {
+    for (unsigned int component = 0; component < fusedFixedImages.size(); ++component)
+    {
+      const auto fixedPath = ElxUtil::JoinPath({workingDirectory, "/", "fixedFused" + std::to_string(component) + ".nrrd"});
+      SymlinkOrWriteNrrd(fusedFixedImages[component], fixedPath);
+      args.insert(args.end(), {"-f" + std::to_string(component), fixedPath});
+    }
+  }
+  else if (m_FixedImage->GetPixelType().GetNumberOfComponents() > 1)
+  {
+    std::vector<unsigned int> channels;
+    for (const auto &channelSelection : m_ChannelSelections)
+      channels.push_back(channelSelection.first);
+    const auto outputs = ElxChannelDeinterleave::ExtractChannels(m_FixedImage, channels);
+    m_NumberOfImageCopies += static_cast<unsigned int>(outputs.size());
+    for (unsigned int component = 0; component < outputs.size(); ++component)
+    {
+      const auto fixedPath = ElxUtil::JoinPath({workingDirectory, "/", "fixed" + std::to_string(channels[component]) + ".nrrd"});
+      SymlinkOrWriteNrrd(outputs[component], fixedPath);
       args.insert(args.end(), {"-f" + std::to_string(component), fixedPath});
-      ++component;
     }
   }
   else
@@ -471,6 +1022,35 @@ void m2::ElxRegistrationHelper::GetRegistration()
     args.insert(args.end(), {"-fp", fixedPointsPath});
   }
 
+  // Multi-start rigid initialization: the full pipeline continues from the best start
+  std::vector<std::string> initialChain;
+  {
+    const auto firstParameterFile = ElxUtil::JoinPath({workingDirectory, "/", "pp0.txt"});
+    auto ifs = std::ifstream(firstParameterFile);
+    auto firstParameters = std::string{std::istreambuf_iterator<char>{ifs}, {}};
+    ifs.close();
+    const auto transform = ElxTransformParameterMap::Parse(firstParameters).GetTransformName();
+    if (m_NumberOfRigidStartRotations > 1 &&
+        (transform == "EulerTransform" || transform == "SimilarityTransform" || transform == "AffineTransform"))
+    {
+      m_StatusFunction("Multi-start rigid initialization ...");
+      const std::vector<std::string> imageArgs(args.begin() + firstInputArgument, args.end());
+      initialChain = MultiStartRigidInitialization(exeElastix, workingDirectory, firstParameters, imageArgs);
+      if (!initialChain.empty())
+      {
+        const auto initialTransformPath = ElxUtil::JoinPath({workingDirectory, "/", "InitialTransformParameters.txt"});
+        std::ofstream(initialTransformPath) << initialChain.back();
+        args.insert(args.end(), {"-t0", initialTransformPath});
+        ElxUtil::ReplaceParameter(firstParameters, "AutomaticTransformInitialization", "\"false\"");
+        std::ofstream(firstParameterFile) << firstParameters;
+      }
+      else
+      {
+        MITK_WARN << "Multi-start rigid initialization failed. Continue with the automatic initialization.";
+      }
+    }
+  }
+
   for (unsigned int i = 0; i < m_RegistrationParameters.size(); ++i)
   {
     const auto parameterFile = m2::ElxUtil::JoinPath({workingDirectory, "/", "pp" + std::to_string(i) + ".txt"});
@@ -491,6 +1071,8 @@ void m2::ElxRegistrationHelper::GetRegistration()
   
 
   MITK_INFO << "Registration finished.";
+  // the initial chain of the multi-start is part of the resulting transformation
+  m_Transformations.insert(m_Transformations.end(), initialChain.begin(), initialChain.end());
   for (unsigned int i = 0; i < m_RegistrationParameters.size(); ++i)
   {
     const auto transformationParameterFile =
@@ -511,14 +1093,163 @@ void m2::ElxRegistrationHelper::GetRegistration()
   }
 
   MITK_INFO << "Transformation parameters assimilated";
-  // try{
-  TransformixDeformationField(workingDirectory);
-  // }catch(std::exception& e){
-  MITK_INFO << "Registration OK!";
+  // the deformation field is generated on demand (GetDeformationField)
+  m_TransformCache->Clear();
+  m_DeformationField = nullptr;
+  m_InverseDeformationField = nullptr;
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+  MITK_INFO << "Registration OK! Image buffers copied for the registration input: " << m_NumberOfImageCopies;
   // }
   // RemoveWorkingDirectory(workingDirectory);
 }
 
+void m2::ElxRegistrationHelper::GetTimeStepRegistration(int referenceTimeStep, unsigned int numberOfCores)
+{
+  if (m_MovingImage.IsNull() || (m_FixedImage.IsNull() && referenceTimeStep < 0))
+  {
+    MITK_ERROR << "No image set for registration!";
+    return;
+  }
+
+  const auto timeSteps = m_MovingImage->GetTimeSteps();
+  if (referenceTimeStep >= static_cast<int>(timeSteps))
+    mitkThrow() << "Reference time step " << referenceTimeStep << " exceeds the " << timeSteps << " time steps";
+  // a fixed series with the same number of time steps is registered time step by time step
+  const bool fixedSeries = referenceTimeStep < 0 && timeSteps > 1 && m_FixedImage->GetTimeSteps() == timeSteps;
+
+  // concurrent elastix processes share the cores
+  const auto cores = numberOfCores > 0 ? numberOfCores : std::max(1u, std::thread::hardware_concurrency());
+  const auto concurrentJobs = std::min(timeSteps, cores);
+  const auto threadsPerJob = std::max(1u, cores / concurrentJobs);
+  MITK_INFO << "Registering " << timeSteps << " time steps, " << concurrentJobs << " jobs with " << threadsPerJob
+            << " threads each";
+  m_StatusFunction("Registering " + std::to_string(timeSteps) + " time steps ...");
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::vector<std::string>> transformations(timeSteps);
+  std::vector<std::string> errors(timeSteps);
+  std::atomic<unsigned int> next{0};
+  auto worker = [&]() {
+    for (auto t = next++; t < timeSteps; t = next++)
+    {
+      // the reference time step keeps its geometry (empty transformation chain)
+      if (static_cast<int>(t) == referenceTimeStep)
+        continue;
+      try
+      {
+        ElxRegistrationHelper job(*this);
+        job.m_FixedImage = referenceTimeStep >= 0 ? ConvertForElastixProcessing(m_MovingImage, referenceTimeStep)
+                           : fixedSeries          ? ConvertForElastixProcessing(m_FixedImage, t)
+                                                  : m_FixedImage;
+        job.m_MovingImage = ConvertForElastixProcessing(m_MovingImage, t);
+        job.m_NumberOfThreads = threadsPerJob;
+        // the jobs share the memory budget; a shared cache would be cleared by every finished registration
+        job.m_DeformationMemoryBudget = m_DeformationMemoryBudget / concurrentJobs;
+        job.m_TransformCache = ElxTransformCache::New(job.m_DeformationMemoryBudget);
+        job.m_WarpSession = nullptr;
+        job.m_GridWarpSession = nullptr;
+        job.m_Transformations.clear();
+        job.m_TimeStepTransformations.clear();
+        job.m_StatusFunction = [](std::string) {}; // the callback is not called from worker threads
+        if (!m_ExternalWorkingDirectory.empty())
+          job.m_ExternalWorkingDirectory =
+            ElxUtil::JoinPath({m_ExternalWorkingDirectory, "/", "timestep" + std::to_string(t)});
+        job.GetRegistration();
+        transformations[t] = job.m_Transformations;
+      }
+      catch (std::exception &e)
+      {
+        errors[t] = e.what();
+      }
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  for (unsigned int k = 0; k < concurrentJobs; ++k)
+    workers.push_back(std::async(std::launch::async, worker));
+  for (auto &w : workers)
+    w.get();
+
+  for (unsigned int t = 0; t < timeSteps; ++t)
+    if (!errors[t].empty())
+      mitkThrow() << "Registration of time step " << t << " failed: " << errors[t];
+
+  m_TimeStepTransformations = transformations;
+  const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  MITK_INFO << "Registration of " << timeSteps << " time steps finished in " << seconds << " s";
+  m_StatusFunction("Registered " + std::to_string(timeSteps) + " time steps");
+}
+
+std::vector<std::vector<std::string>> m2::ElxRegistrationHelper::GetTimeStepTransformations() const
+{
+  return m_TimeStepTransformations;
+}
+
+void m2::ElxRegistrationHelper::SetTimeStepTransformations(const std::vector<std::vector<std::string>> &transformations)
+{
+  m_TimeStepTransformations = transformations;
+}
+
+void m2::ElxRegistrationHelper::SetNumberOfThreads(unsigned int threads)
+{
+  m_NumberOfThreads = threads;
+}
+
+mitk::Image::Pointer m2::ElxRegistrationHelper::WarpTimeSteps(const mitk::Image *image,
+                                                              const std::string &pixelType,
+                                                              const unsigned char &interpolationOrder) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  const auto timeSteps = image->GetTimeSteps();
+  if (m_TimeStepTransformations.size() != timeSteps)
+    mitkThrow() << "Transformations of " << m_TimeStepTransformations.size() << " time steps are available, the image has "
+                << timeSteps;
+
+  const auto type = pixelType.empty() ? ElxUtil::GetPixelTypeName(image) : pixelType;
+  std::vector<mitk::Image::Pointer> warped(timeSteps);
+  for (unsigned int t = 0; t < timeSteps; ++t)
+  {
+    mitk::Image::Pointer data = const_cast<mitk::Image *>(image);
+    if (timeSteps > 1)
+      data = ConvertForM2aiaProcessing(ConvertForElastixProcessing(image, t));
+
+    if (m_TimeStepTransformations[t].empty())
+    {
+      // reference time step
+      warped[t] = ConvertPixelType(data, type);
+      continue;
+    }
+
+    ElxRegistrationHelper timeStepHelper;
+    timeStepHelper.m_BinarySearchPath = m_BinarySearchPath;
+    timeStepHelper.m_UseInProcessTransforms = m_UseInProcessTransforms;
+    timeStepHelper.m_DeformationRepresentation = m_DeformationRepresentation;
+    timeStepHelper.SetDeformationMemoryBudget(m_DeformationMemoryBudget);
+    timeStepHelper.SetTransformations(m_TimeStepTransformations[t]);
+    warped[t] = timeStepHelper.WarpImage(data, type, interpolationOrder);
+    if (!warped[t])
+      mitkThrow() << "Warping of time step " << t << " failed!";
+  }
+
+  for (const auto &w : warped)
+    for (unsigned int i = 0; i < 3; ++i)
+      if (w->GetDimensions()[i] != warped.front()->GetDimensions()[i])
+        mitkThrow() << "Warped time steps differ in size!";
+
+  auto timeGeometry = mitk::ProportionalTimeGeometry::New();
+  timeGeometry->Initialize(warped.front()->GetGeometry()->Clone(), timeSteps);
+  auto result = mitk::Image::New();
+  result->Initialize(warped.front()->GetPixelType(), *timeGeometry);
+  for (unsigned int t = 0; t < timeSteps; ++t)
+  {
+    mitk::ImageReadAccessor acc(warped[t]);
+    result->SetVolume(acc.GetData(), t);
+  }
+  return result;
+}
+
 void m2::ElxRegistrationHelper::SetStatusCallback(const std::function<void(std::string)> &callback)
 {
   m_StatusFunction = callback;
@@ -532,20 +1263,60 @@ std::vector<std::string> m2::ElxRegistrationHelper::GetTransformation() const
 void m2::ElxRegistrationHelper::SetTransformations(const std::vector<std::string> &transforms)
 {
   m_Transformations = transforms;
+  m_TransformCache->Clear();
+  m_DeformationField = nullptr;
+  m_InverseDeformationField = nullptr;
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+}
+
+void m2::ElxRegistrationHelper::SetDeformationRepresentation(ElxTransformEngine::DeformationRepresentation representation)
+{
+  m_DeformationRepresentation = representation;
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+}
+
+void m2::ElxRegistrationHelper::SetDeformationMemoryBudget(std::size_t bytes)
+{
+  m_DeformationMemoryBudget = bytes;
+  m_TransformCache->SetMemoryBudget(bytes);
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+}
+
+void m2::ElxRegistrationHelper::SetDeformationFieldRegion(const std::vector<unsigned int> &index,
+                                                          const std::vector<unsigned int> &size)
+{
+  if (index.size() != size.size())
+    mitkThrow() << "Region index and size differ in length!";
+  m_DeformationFieldRegionIndex = index;
+  m_DeformationFieldRegionSize = size;
+  m_DeformationField = nullptr;
+  m_InverseDeformationField = nullptr;
+  m_WarpSession = nullptr;
+  m_GridWarpSession = nullptr;
+}
+
+std::vector<std::string> m2::ElxRegistrationHelper::GetDeformationFieldTransformations() const
+{
+  auto transformations = m_Transformations;
+  if (!transformations.empty() && !m_DeformationFieldRegionSize.empty())
+    transformations.back() =
+      RestrictOutputGrid(transformations.back(), m_DeformationFieldRegionIndex, m_DeformationFieldRegionSize);
+  return transformations;
 }
 
 std::string m2::ElxRegistrationHelper::WriteTransformation(std::string workingDirectory) const
 {
-  std::string transformationPath;
-  for (unsigned int i = 0; i < m_Transformations.size(); ++i)
-  {
-    transformationPath = ElxUtil::JoinPath({workingDirectory, "/", "TransformParameters." + std::to_string(i) + ".txt"});
-    std::ofstream(transformationPath) << m_Transformations[i];
-  }
-  return transformationPath;
+  // the chain gets its own directory: the TransformParameters files of elastix in workingDirectory are referenced
+  // by absolute paths and must not be overwritten (the chain of a multi-start registration is longer)
+  const auto chainDirectory = ElxUtil::JoinPath({workingDirectory, "/", "TransformationChain"});
+  itksys::SystemTools::MakeDirectory(chainDirectory);
+  return WriteTransformationChain(chainDirectory, m_Transformations);
 }
 
-void m2::ElxRegistrationHelper::TransformixDeformationField(std::string workingDirectory)
+void m2::ElxRegistrationHelper::TransformixDeformationField(std::string workingDirectory) const
 {
   const auto exeTransformix = m2::ElxUtil::Executable("transformix", m_BinarySearchPath);
   if (exeTransformix.empty())
@@ -553,7 +1324,9 @@ void m2::ElxRegistrationHelper::TransformixDeformationField(std::string workingD
 
   const auto resultPath = ElxUtil::JoinPath({workingDirectory, "/", "result.nrrd"});
   const auto deformationFieldPath = ElxUtil::JoinPath({workingDirectory, "/", "deformationField.nrrd"});
-  auto transformationPath = WriteTransformation(workingDirectory);
+  const auto chainDirectory = ElxUtil::JoinPath({workingDirectory, "/", "TransformationChain"});
+  itksys::SystemTools::MakeDirectory(chainDirectory);
+  const auto transformationPath = WriteTransformationChain(chainDirectory, GetDeformationFieldTransformations());
 
   try
   {
@@ -578,6 +1351,7 @@ void m2::ElxRegistrationHelper::TransformixDeformationField(std::string workingD
     if (auto deformationField = dynamic_cast<mitk::Image *>(dataVector.front().GetPointer()))
     {
       m_DeformationField = deformationField;
+      m_InverseDeformationField = nullptr;
     }
     else
     {
@@ -592,14 +1366,228 @@ void m2::ElxRegistrationHelper::TransformixDeformationField(std::string workingD
 
 mitk::Image::Pointer m2::ElxRegistrationHelper::GetDeformationField() const
 {
+  if (m_DeformationField || m_Transformations.empty())
+    return m_DeformationField;
+
+  const auto transformations = GetDeformationFieldTransformations();
+  if (m_UseInProcessTransforms && ElxTransformEngine::CanTransform(transformations))
+  {
+    MITK_INFO << "Generate deformation field in-process";
+    if (ElxTransformEngine::GetDimension(transformations) == 3)
+      m_DeformationField = CreateDeformationField<3>(transformations);
+    else
+      m_DeformationField = CreateDeformationField<2>(transformations);
+  }
+  else
+  {
+    const auto workingDirectory = CreateWorkingDirectory();
+    TransformixDeformationField(workingDirectory);
+    RemoveWorkingDirectory(workingDirectory);
+  }
 
   return m_DeformationField;
 }
 
+bool m2::ElxRegistrationHelper::CanApplyToGeometry() const
+{
+  return ElxTransformEngine::CanTransform(m_Transformations) && ElxTransformEngine::IsLinear(m_Transformations);
+}
+
+void m2::ElxRegistrationHelper::ApplyToGeometry(mitk::BaseGeometry *geometry) const
+{
+  if (!geometry)
+    mitkThrow() << "Geometry is null!";
+  if (!CanApplyToGeometry())
+    mitkThrow() << "Only linear transformations can be applied to the geometry!";
+
+  // forward transformation (fixed -> moving): y = A x + o
+  mitk::Matrix3D a;
+  a.SetIdentity();
+  mitk::Vector3D o;
+  o.Fill(0);
+  if (ElxTransformEngine::GetDimension(m_Transformations) == 3)
+  {
+    const auto affine = ElxTransformEngine::CreateAffineTransform<3>(m_Transformations);
+    a = affine->GetMatrix();
+    o = affine->GetOffset();
+  }
+  else
+  {
+    const auto affine = ElxTransformEngine::CreateAffineTransform<2>(m_Transformations);
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      o[i] = affine->GetOffset()[i];
+      for (unsigned int j = 0; j < 2; ++j)
+        a[i][j] = affine->GetMatrix()[i][j];
+    }
+  }
+
+  // moving data is placed at T^-1(IndexToWorld(i)) = A^-1 (M i + t - o)
+  const mitk::Matrix3D aInverse(a.GetInverse());
+  const auto indexToWorld = geometry->GetIndexToWorldTransform();
+  auto aligned = mitk::AffineTransform3D::New();
+  aligned->SetMatrix(aInverse * indexToWorld->GetMatrix());
+  aligned->SetOffset(aInverse * (indexToWorld->GetOffset() - o));
+  geometry->SetIndexToWorldTransform(aligned);
+}
+
+mitk::Image::Pointer m2::ElxRegistrationHelper::CreateAlignedImage(const mitk::Image *image) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+
+  auto aligned = mitk::Image::New();
+  aligned->Initialize(image);
+  {
+    mitk::ImageReadAccessor acc(image);
+    aligned->SetImportChannel(const_cast<void *>(acc.GetData()), 0, mitk::Image::ReferenceMemory);
+  }
+  aligned->SetProperty("m2aia.registration.source", mitk::SmartPointerProperty::New(const_cast<mitk::Image *>(image)));
+
+  for (unsigned int t = 0; t < aligned->GetTimeSteps(); ++t)
+    ApplyToGeometry(aligned->GetGeometry(t));
+  return aligned;
+}
+
+mitk::Image::Pointer m2::ElxRegistrationHelper::GetInverseDeformationField() const
+{
+  if (m_InverseDeformationField)
+    return m_InverseDeformationField;
+
+  if (m_Transformations.empty())
+    mitkThrow() << "No transformations available!";
+  if (m_MovingImage.IsNull())
+    mitkThrow() << "The inverse deformation field is sampled on the moving image grid; no moving image is set!";
+
+  const auto movingImage = ConvertForElastixProcessing(m_MovingImage);
+  const auto transformations = GetDeformationFieldTransformations();
+  const bool inProcess = m_UseInProcessTransforms && ElxTransformEngine::CanTransform(transformations);
+  mitk::Image::Pointer forwardField;
+  if (!inProcess)
+  {
+    forwardField = GetDeformationField();
+    if (!forwardField)
+      mitkThrow() << "No deformation field available!";
+  }
+
+  if (ElxTransformParameterMap::Parse(transformations.back()).GetDimension() == 3)
+    m_InverseDeformationField = CreateInverseDeformationField<3>(transformations, forwardField, movingImage);
+  else
+    m_InverseDeformationField = CreateInverseDeformationField<2>(transformations, forwardField, movingImage);
+  return m_InverseDeformationField;
+}
+
+void m2::ElxRegistrationHelper::WarpPoints(std::vector<double> &x,
+                                           std::vector<double> &y,
+                                           std::vector<double> &z,
+                                           bool inverse) const
+{
+  if (x.size() != y.size() || x.size() != z.size())
+    mitkThrow() << "Coordinate arrays differ in length!";
+
+  if (!ElxTransformEngine::CanTransform(m_Transformations))
+    mitkThrow() << "The transformations can not be applied to points in-process!";
+
+  if (!inverse)
+  {
+    ElxTransformEngine::TransformPoints(m_Transformations, x.data(), y.data(), z.data(), x.size());
+    return;
+  }
+
+  // the linear part is inverted exactly, only the deformable residual is iterated per point
+  ElxTransformEngine::TransformPointsInverse(m_Transformations, x.data(), y.data(), z.data(), x.size());
+}
+
+mitk::PointSet::Pointer m2::ElxRegistrationHelper::WarpPoints(const mitk::PointSet *points, bool inverse) const
+{
+  if (!points)
+    mitkThrow() << "Point set is null!";
+
+  auto result = mitk::PointSet::New();
+  result->Expand(points->GetTimeSteps());
+
+  for (unsigned int t = 0; t < points->GetTimeSteps(); ++t)
+  {
+    const auto n = static_cast<std::size_t>(points->GetSize(t));
+    std::vector<mitk::PointSet::PointIdentifier> ids;
+    std::vector<double> x, y, z;
+    ids.reserve(n);
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+
+    for (auto it = points->Begin(t); it != points->End(t); ++it)
+    {
+      const auto p = points->GetPoint(it->Index(), t);
+      ids.push_back(it->Index());
+      x.push_back(p[0]);
+      y.push_back(p[1]);
+      z.push_back(p[2]);
+    }
+
+    WarpPoints(x, y, z, inverse);
+
+    for (std::size_t i = 0; i < ids.size(); ++i)
+    {
+      mitk::Point3D p;
+      p[0] = x[i];
+      p[1] = y[i];
+      p[2] = z[i];
+      result->InsertPoint(ids[i], p, t);
+    }
+  }
+  return result;
+}
+
 mitk::Image::Pointer m2::ElxRegistrationHelper::WarpImage(const mitk::Image *inputData,
                                                           const std::string &pixelType,
-                                                          const unsigned char &) const
+                                                          const unsigned char &interpolationOrder,
+                                                          const ElxWarpOptions &options) const
 {
+  if (interpolationOrder > ElxBSplineInterpolator::MaximumOrder)
+    mitkThrow() << "Interpolation order " << int(interpolationOrder) << " is not supported (0-"
+                << ElxBSplineInterpolator::MaximumOrder << ")";
+
+  // the result keeps the pixel type of the input unless a type is requested
+  const auto type = pixelType.empty() && inputData ? ElxUtil::GetPixelTypeName(inputData) : pixelType;
+
+  // the output grid of the last transformation is replaced by the grid of the options
+  auto transformations = m_Transformations;
+  if (!options.IsDefault() && !transformations.empty())
+    transformations.back() = options.ApplyToTransformation(transformations.back());
+
+  // anti-aliasing for a coarser output grid
+  std::vector<double> outputSpacing;
+  if (!options.IsDefault() && options.antiAliasing && interpolationOrder > 0 && !transformations.empty())
+    outputSpacing = ElxTransformParameterMap::Parse(transformations.back()).GetDoubles("Spacing");
+
+  // 2D transformations are applied to every slice of a 3D stack in place
+  if (inputData && inputData->GetDimension() == 3 && inputData->GetDimensions()[2] > 1)
+  {
+    auto session = GetWarpSession(options);
+    if (session && session->GetDimension() == 2)
+    {
+      // the slices are smoothed in-plane
+      mitk::Image::ConstPointer stack = inputData;
+      if (!outputSpacing.empty())
+        stack = SmoothComponentsForDownsampling(inputData, outputSpacing);
+      return session->WarpSlices(stack, type, interpolationOrder);
+    }
+  }
+
+  // multi-component images (e.g. spectra) are warped in a single pass over all components; like scalar images,
+  // single slices are warped as 2D views and the result gets the geometry and layout of the scalar path
+  if (inputData && inputData->GetPixelType().GetNumberOfComponents() > 1)
+  {
+    if (auto session = GetWarpSession(options))
+    {
+      auto data = ConvertForElastixProcessing(inputData);
+      if (!outputSpacing.empty())
+        data = SmoothComponentsForDownsampling(data, outputSpacing);
+      return ConvertWarpResult(session->WarpMultiChannel(data, type, interpolationOrder), inputData);
+    }
+  }
+
   auto data = ConvertForElastixProcessing(inputData);
   
   if (!CheckDimensions(data))
@@ -608,64 +1596,24 @@ mitk::Image::Pointer m2::ElxRegistrationHelper::WarpImage(const mitk::Image *inp
     << "Shape has to be [NxMx1]";
     return nullptr;
   }
+
+  if (!outputSpacing.empty() && data->GetPixelType().GetNumberOfComponents() == 1)
+  {
+    data = data->GetDimension() == 3 ? SmoothForDownsampling<3>(data, outputSpacing)
+                                     : SmoothForDownsampling<2>(data, outputSpacing);
+  }
   
-  
-  if (auto deformationField = GetDeformationField())
+  if (auto session = GetWarpSession(options))
   {
-    auto fixedData = ConvertForElastixProcessing(m_FixedImage);
-    if (!CheckDimensions(fixedData))
-      {
-        MITK_ERROR << "Image [" << m2::ElxUtil::GetShape(fixedData) << "]. This is yet not implemented.\n"
-                  << "Shape has to be [NxMx1]";
-        return nullptr;
-      }
-    using VectorImageType = itk::VectorImage<double, 2>;
-    auto itkDeformationField = VectorImageType::New();
-    mitk::CastToItkImage(deformationField, itkDeformationField);
-
-    mitk::Image::Pointer result = mitk::Image::New();
-    AccessTwoImagesFixedDimensionByItk(data, fixedData, ([&](auto itkMovingImage2D, auto itkFixedImage2D)
-    {
-      using ImageType = typename std::remove_pointer<decltype(itkMovingImage2D)>::type;      
-      using TransformType = itk::DisplacementFieldTransform<double, 2>;
-      auto transform = TransformType::New();
-      transform->SetDisplacementField(itkDeformationField);
-
-      using ResampleFilterType = itk::ResampleImageFilter<ImageType, ImageType>;
-      auto resampler = ResampleFilterType::New();
-      resampler->SetInput(itkMovingImage2D);
-      resampler->SetTransform(transform.GetPointer());
-      resampler->SetReferenceImage(itkFixedImage2D);
-      resampler->UseReferenceImageOn();
-
-      if (pixelType == "short" || pixelType == "unsigned_short" || 
-          pixelType == "char" || pixelType == "unsigned_char"  || 
-          pixelType == "int" || pixelType == "unsigned_int")
-      {
-        resampler->SetInterpolator(itk::NearestNeighborInterpolateImageFunction<ImageType>::New());
-      }else{
-        resampler->SetInterpolator(itk::LinearInterpolateImageFunction<ImageType>::New());
-      }
-      resampler->SetDefaultPixelValue(0);
-
-      resampler->Update();
-      mitk::CastToMitkImage(resampler->GetOutput(), result); 
-    }),2);
-    
+    MITK_INFO << "Warping image in-process with pixel type [" << type << "]";
+    mitk::Image::Pointer result;
     try
     {
-      result = ConvertForM2aiaProcessing(result);
-
-      if (result->GetDimensions()[2] == 1)
-      {
-        auto s = result->GetGeometry()->GetSpacing();
-        s[2] = inputData->GetGeometry()->GetSpacing()[2];
-        result->GetGeometry()->SetSpacing(s);
-      }
+      result = ConvertWarpResult(session->Warp(data, type, interpolationOrder), inputData);
     }
     catch (std::exception &e)
     {
-      MITK_ERROR << "Error loading warped image (deformation field): " << e.what();
+      MITK_ERROR << "Error warping image in-process: " << e.what();
     }
     return result;
   }
@@ -680,38 +1628,28 @@ mitk::Image::Pointer m2::ElxRegistrationHelper::WarpImage(const mitk::Image *inp
 
     mitk::IOUtil::Save(data, imagePath);
 
-    for (unsigned int i = 0; i < m_Transformations.size(); ++i)
-    {
-      auto transformationPath =
-          ElxUtil::JoinPath({workingDirectory, "/", "TransformParameters." + std::to_string(i) + ".txt"});
+    // transformix casts interpolated values without rounding: integer results are interpolated
+    // as float and rounded after loading (ConvertPixelType)
+    const bool round = ElxUtil::IsIntegerPixelType(type) && interpolationOrder > 0;
+    const auto resultType = round ? std::string("float") : type;
 
-      auto T = m_Transformations[i];
-
-      ElxUtil::ReplaceParameter(T, "ResultImagePixelType", "\"" + pixelType + "\"");
-      MITK_INFO << "Warping image with pixel type [" << pixelType << "]";
-      if (pixelType == "short" || pixelType == "unsigned_short" || 
-          pixelType == "char" || pixelType == "unsigned_char"  || 
-          pixelType == "int" || pixelType == "unsigned_int")
+    MITK_INFO << "Warping image with pixel type [" << type << "]";
+    const auto transformationPath = WriteTransformationChain(workingDirectory, transformations, [&](std::string &T) {
+      ElxUtil::ReplaceParameter(T, "ResultImagePixelType", "\"" + resultType + "\"");
+      if (interpolationOrder == 0)
       {
         ElxUtil::ReplaceParameter(T, "ResampleInterpolator", "\"FinalNearestNeighborInterpolator\"");
       }
-  
-      if (i == 0)
+      else if (interpolationOrder == 1)
       {
-        ElxUtil::ReplaceParameter(T, "InitialTransformParametersFileName", R"("NoInitialTransform")");
+        ElxUtil::ReplaceParameter(T, "ResampleInterpolator", "\"FinalLinearInterpolator\"");
       }
-      else if (i > 0)
+      else
       {
-        const auto initialTransform =
-            ElxUtil::JoinPath({workingDirectory, "/", "TransformParameters." + std::to_string(i - 1) + ".txt"});
-        ElxUtil::ReplaceParameter(T, "InitialTransformParametersFileName", "\"" + initialTransform + "\"");
+        ElxUtil::ReplaceParameter(T, "ResampleInterpolator", "\"FinalBSplineInterpolator\"");
+        ElxUtil::ReplaceParameter(T, "FinalBSplineInterpolationOrder", std::to_string(interpolationOrder));
       }
-
-      std::ofstream(transformationPath) << T;
-    }
-
-    const auto transformationPath = ElxUtil::JoinPath(
-        {workingDirectory, "/", "TransformParameters." + std::to_string(m_Transformations.size() - 1) + ".txt"});
+    });
 
     Poco::Process::Args args;
     args.insert(args.end(), {"-in", imagePath});
@@ -734,15 +1672,12 @@ mitk::Image::Pointer m2::ElxRegistrationHelper::WarpImage(const mitk::Image *inp
     {
       auto resultData = mitk::IOUtil::Load(resultPath).front();
       result = dynamic_cast<mitk::Image *>(resultData.GetPointer());
-
-      result = ConvertForM2aiaProcessing(result);
-
-      if (result->GetDimensions()[2] == 1)
+      if (round)
       {
-        auto s = result->GetGeometry()->GetSpacing();
-        s[2] = inputData->GetGeometry()->GetSpacing()[2];
-        result->GetGeometry()->SetSpacing(s);
+        result = ConvertPixelType(result, type);
+        ++m_NumberOfImageCopies;
       }
+      result = ConvertWarpResult(result, inputData);
     }
     catch (std::exception &e)
     {
@@ -754,6 +1689,212 @@ mitk::Image::Pointer m2::ElxRegistrationHelper::WarpImage(const mitk::Image *inp
   }
 }
 
+m2::ElxLazyWarpedImage::Pointer m2::ElxRegistrationHelper::CreateLazyWarpedImage(
+  const mitk::Image *image,
+  const std::string &pixelType,
+  const unsigned char &interpolationOrder,
+  ElxLazyWarpedImage::Cache::Pointer cache) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  if (interpolationOrder > ElxBSplineInterpolator::MaximumOrder)
+    mitkThrow() << "Interpolation order " << int(interpolationOrder) << " is not supported (0-"
+                << ElxBSplineInterpolator::MaximumOrder << ")";
+
+  auto session = GetWarpSession();
+  if (!session || image->GetTimeSteps() > 1)
+    return nullptr;
+
+  // the same input as WarpImage: stacks of 2D registrations are warped slice by slice, single slices as 2D views
+  const auto type = pixelType.empty() ? ElxUtil::GetPixelTypeName(image) : pixelType;
+  const bool stack = image->GetDimension() == 3 && image->GetDimensions()[2] > 1 && session->GetDimension() == 2;
+  mitk::Image::ConstPointer data = image;
+  if (!stack)
+    data = ConvertForElastixProcessing(image);
+  auto result = ElxLazyWarpedImage::New(session, data, type, interpolationOrder, cache);
+
+  // like ConvertWarpResult
+  if (result->GetDimensions()[2] == 1)
+  {
+    auto s = result->GetGeometry()->GetSpacing();
+    s[2] = image->GetGeometry()->GetSpacing()[2];
+    result->GetGeometry()->SetSpacing(s);
+  }
+  return result;
+}
+
+std::vector<mitk::Image::Pointer> m2::ElxRegistrationHelper::WarpChannels(
+  const std::vector<mitk::Image::ConstPointer> &channels,
+  const std::string &pixelType,
+  const unsigned char &interpolationOrder) const
+{
+  if (channels.empty())
+    return {};
+
+  if (auto session = GetWarpSession())
+  {
+    const auto type = pixelType.empty() ? ElxUtil::GetPixelTypeName(channels.front()) : pixelType;
+    return session->WarpChannels(channels, type, interpolationOrder);
+  }
+
+  // transformix: one run per channel
+  std::vector<mitk::Image::Pointer> result;
+  for (const auto &channel : channels)
+    result.push_back(WarpImage(channel, pixelType, interpolationOrder));
+  return result;
+}
+
+mitk::MultiLabelSegmentation::Pointer m2::ElxRegistrationHelper::WarpSegmentation(
+  const mitk::MultiLabelSegmentation *segmentation, bool smooth) const
+{
+  if (!segmentation)
+    mitkThrow() << "Segmentation is null!";
+  const auto numberOfGroups = segmentation->GetNumberOfGroups();
+  if (numberOfGroups == 0)
+    mitkThrow() << "Segmentation has no label groups!";
+
+  std::vector<mitk::Image::ConstPointer> groupImages;
+  for (mitk::MultiLabelSegmentation::GroupIndexType g = 0; g < numberOfGroups; ++g)
+    groupImages.push_back(segmentation->GetGroupImage(g));
+
+  // the groups share the geometry of the segmentation; 2D registrations of stacks are applied slice-wise
+  std::vector<mitk::Image::Pointer> warped;
+  auto session = GetWarpSession();
+  const auto dims = groupImages.front()->GetDimensions();
+  const bool stack = groupImages.front()->GetDimension() == 3 && dims[2] > 1;
+  if (session && !(stack && session->GetDimension() == 2))
+  {
+    warped = session->WarpLabels(groupImages, smooth);
+  }
+  else
+  {
+    if (smooth)
+      MITK_WARN << "Smooth label interpolation is not available; labels are warped with nearest neighbor interpolation";
+    for (const auto &groupImage : groupImages)
+      warped.push_back(WarpImage(groupImage, "", 0));
+  }
+
+  auto result = mitk::MultiLabelSegmentation::New();
+  result->InitializeByLabeledImage(warped.front());
+  result->ReplaceGroupLabels(0, segmentation->GetConstLabelsByValue(segmentation->GetLabelValuesByGroup(0)));
+  for (mitk::MultiLabelSegmentation::GroupIndexType g = 1; g < numberOfGroups; ++g)
+  {
+    const auto group = result->AddGroup(segmentation->GetConstLabelsByValue(segmentation->GetLabelValuesByGroup(g)));
+    result->UpdateGroupImage(group, warped[g]);
+  }
+  return result;
+}
+
+mitk::Image::Pointer m2::ElxRegistrationHelper::WarpSlices(
+  const mitk::Image *volume,
+  const std::vector<std::vector<std::string>> &sliceTransformations,
+  const std::string &pixelType,
+  const unsigned char &interpolationOrder) const
+{
+  if (!volume)
+    mitkThrow() << "Image data is null!";
+  if (sliceTransformations.empty())
+    mitkThrow() << "No transformations available!";
+
+  // identical chains (e.g. unregistered reference sections) share one session
+  std::map<std::vector<std::string>, ElxWarpSession::Pointer> sessionsByChain;
+  for (const auto &transformations : sliceTransformations)
+    sessionsByChain[transformations];
+  const auto memoryBudget = m_DeformationMemoryBudget / sessionsByChain.size();
+  for (auto &kv : sessionsByChain)
+  {
+    if (kv.first.empty() || !ElxTransformEngine::CanTransform(kv.first))
+      mitkThrow() << "Slice-wise warping requires transformations that can be evaluated in-process!";
+    kv.second =
+      ElxWarpSession::CreateFromTransformations(kv.first, m_DeformationRepresentation, memoryBudget, m_TransformCache.get());
+  }
+
+  std::vector<ElxWarpSession::Pointer> sessions;
+  for (const auto &transformations : sliceTransformations)
+    sessions.push_back(sessionsByChain[transformations]);
+
+  const auto type = pixelType.empty() ? ElxUtil::GetPixelTypeName(volume) : pixelType;
+  return ElxWarpSession::WarpSlices(sessions, volume, type, interpolationOrder);
+}
+
+m2::ElxResampleLUT::Pointer m2::ElxRegistrationHelper::CreateResampleLUT(const mitk::Image *movingImage) const
+{
+  auto session = GetWarpSession();
+  if (!session)
+    mitkThrow() << "A resampling table requires transformations that can be evaluated in-process!";
+  return session->CreateResampleLUT(movingImage);
+}
+
+m2::ElxWarpSession::Pointer m2::ElxRegistrationHelper::GetWarpSession() const
+{
+  if (m_WarpSession)
+    return m_WarpSession;
+
+  // an already generated full-size field is reused; no field is generated just for warping
+  if (m_DeformationField && m_DeformationFieldRegionSize.empty())
+    m_WarpSession = ElxWarpSession::CreateFromDeformationField(m_DeformationField);
+  else if (m_UseInProcessTransforms && ElxTransformEngine::CanTransform(m_Transformations))
+    m_WarpSession = ElxWarpSession::CreateFromTransformations(
+      m_Transformations, m_DeformationRepresentation, m_DeformationMemoryBudget, m_TransformCache.get());
+  return m_WarpSession;
+}
+
+void m2::ElxRegistrationHelper::WarpImageToFile(const std::string &inputPath,
+                                                const std::string &outputPath,
+                                                const std::string &type,
+                                                const unsigned char &interpolationOrder,
+                                                std::size_t memoryBudget,
+                                                const ElxWarpOptions &options) const
+{
+  if (m_Transformations.empty())
+    mitkThrow() << "No transformations available!";
+  if (!ElxTransformEngine::CanTransform(m_Transformations))
+    mitkThrow() << "Streaming warp requires transformations that can be evaluated in-process!";
+
+  auto transformations = m_Transformations;
+  if (!options.IsDefault())
+    transformations.back() = options.ApplyToTransformation(transformations.back());
+
+  // the coefficient grid is evaluated per tile; its memory does not depend on the output size
+  const auto session = ElxWarpSession::CreateFromTransformations(
+    transformations, ElxTransformEngine::DeformationRepresentation::CoefficientGrid, memoryBudget);
+  session->WarpToFile(inputPath, outputPath, type, interpolationOrder, memoryBudget);
+}
+
+m2::ElxWarpSession::Pointer m2::ElxRegistrationHelper::GetWarpSession(const ElxWarpOptions &options) const
+{
+  if (options.IsDefault())
+    return GetWarpSession();
+  if (m_Transformations.empty() || !m_UseInProcessTransforms || !ElxTransformEngine::CanTransform(m_Transformations))
+    return nullptr;
+
+  // the session is created from the transformations with the restricted output grid,
+  // a full-size deformation field is never sampled for it
+  auto transformations = m_Transformations;
+  transformations.back() = options.ApplyToTransformation(transformations.back());
+  if (!m_GridWarpSession || m_GridWarpSessionTransformation != transformations.back())
+  {
+    m_GridWarpSession = ElxWarpSession::CreateFromTransformations(
+      transformations, m_DeformationRepresentation, m_DeformationMemoryBudget, m_TransformCache.get());
+    m_GridWarpSessionTransformation = transformations.back();
+  }
+  return m_GridWarpSession;
+}
+
+mitk::Image::Pointer m2::ElxRegistrationHelper::ConvertWarpResult(mitk::Image::Pointer result,
+                                                                  const mitk::Image *inputData) const
+{
+  result = ConvertForM2aiaProcessing(result);
+
+  if (result->GetDimensions()[2] == 1)
+  {
+    auto s = result->GetGeometry()->GetSpacing();
+    s[2] = inputData->GetGeometry()->GetSpacing()[2];
+    result->GetGeometry()->SetSpacing(s);
+  }
+  return result;
+}
+
 void m2::ElxRegistrationHelper::SetRemoveWorkingDirectory(bool val)
 {
   m_RemoveWorkingDirectory = val;
@@ -0,0 +1,211 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxResampleLUT.h>
+#include <m2ElxUtil.h>
+
+#include <mitkImageReadAccessor.h>
+#include <mitkImageWriteAccessor.h>
+
+#include <itkMultiThreaderBase.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+  constexpr char Magic[8] = {'M', '2', 'A', 'I', 'A', 'L', 'U', 'T'};
+  constexpr std::uint32_t Version = 1;
+  constexpr std::size_t PixelBlockSize = 4096;
+
+  static_assert(sizeof(m2::ElxResampleLUT::Header) == 240, "Unexpected size of the resampling table header");
+
+  std::uint64_t NumberOfPixels(const std::uint64_t size[3])
+  {
+    return size[0] * size[1] * size[2];
+  }
+
+  std::size_t BufferSize(const m2::ElxResampleLUT::Header &header)
+  {
+    const auto n = NumberOfPixels(header.outputSize);
+    return sizeof(m2::ElxResampleLUT::Header) + n * sizeof(m2::ElxResampleLUT::IndexType) +
+           n * header.weightsPerPixel * (sizeof(m2::ElxResampleLUT::IndexType) + sizeof(m2::ElxResampleLUT::WeightType));
+  }
+} // namespace
+
+m2::ElxResampleLUT::Pointer m2::ElxResampleLUT::New(const Header &header)
+{
+  if (header.dimension < 2 || header.dimension > 3 || header.weightsPerPixel != (1u << header.dimension))
+    mitkThrow() << "Invalid resampling table header!";
+
+  const auto size = BufferSize(header);
+  std::shared_ptr<char> buffer(new char[size], std::default_delete<char[]>());
+  std::memcpy(buffer.get(), &header, sizeof(Header));
+  auto h = reinterpret_cast<Header *>(buffer.get());
+  std::memcpy(h->magic, Magic, sizeof(Magic));
+  h->version = Version;
+
+  Pointer lut(new ElxResampleLUT());
+  lut->SetBuffer(buffer, buffer.get(), size);
+
+  const auto n = lut->GetNumberOfPixels();
+  std::fill_n(lut->m_Nearest, n, GetOutsideIndex());
+  std::fill_n(lut->m_Indices, n * h->weightsPerPixel, IndexType(0));
+  std::fill_n(lut->m_Weights, n * h->weightsPerPixel, WeightType(0));
+  return lut;
+}
+
+m2::ElxResampleLUT::Pointer m2::ElxResampleLUT::Load(const std::string &path)
+{
+  namespace bip = boost::interprocess;
+  std::shared_ptr<bip::mapped_region> region;
+  try
+  {
+    bip::file_mapping file(path.c_str(), bip::read_only);
+    region = std::make_shared<bip::mapped_region>(file, bip::read_only);
+  }
+  catch (const bip::interprocess_exception &e)
+  {
+    mitkThrow() << "Resampling table [" << path << "] can not be mapped: " << e.what();
+  }
+
+  auto data = static_cast<char *>(region->get_address());
+  const auto size = region->get_size();
+  if (size < sizeof(Header) || std::memcmp(data, Magic, sizeof(Magic)) != 0)
+    mitkThrow() << "File [" << path << "] is not a resampling table!";
+
+  const auto header = reinterpret_cast<const Header *>(data);
+  if (header->version != Version)
+    mitkThrow() << "Resampling table [" << path << "] has the unsupported version " << header->version;
+  if (size < BufferSize(*header))
+    mitkThrow() << "Resampling table [" << path << "] is truncated!";
+
+  Pointer lut(new ElxResampleLUT());
+  lut->SetBuffer(region, data, size);
+  return lut;
+}
+
+void m2::ElxResampleLUT::Save(const std::string &path) const
+{
+  std::ofstream f(path, std::ios::binary | std::ios::trunc);
+  if (!f)
+    mitkThrow() << "Resampling table [" << path << "] can not be written!";
+  f.write(m_Data, BufferSize(*m_Header));
+  if (!f)
+    mitkThrow() << "Resampling table [" << path << "] can not be written!";
+}
+
+void m2::ElxResampleLUT::SetBuffer(std::shared_ptr<void> owner, char *data, std::size_t size)
+{
+  m_Owner = owner;
+  m_Data = data;
+  m_Size = size;
+  m_Header = reinterpret_cast<Header *>(data);
+  const auto n = GetNumberOfPixels();
+  m_Nearest = reinterpret_cast<IndexType *>(data + sizeof(Header));
+  m_Indices = m_Nearest + n;
+  m_Weights = reinterpret_cast<WeightType *>(m_Indices + n * m_Header->weightsPerPixel);
+}
+
+std::uint64_t m2::ElxResampleLUT::GetNumberOfPixels() const
+{
+  return NumberOfPixels(m_Header->outputSize);
+}
+
+mitk::Image::Pointer m2::ElxResampleLUT::Apply(const mitk::Image *image, bool nearest, double defaultPixelValue) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+
+  const auto &header = *m_Header;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const auto size = i < image->GetDimension() ? image->GetDimensions()[i] : 1u;
+    if (size != header.inputSize[i])
+      mitkThrow() << "Image [" << ElxUtil::GetShape(image) << "] does not match the grid of the resampling table ["
+                  << header.inputSize[0] << ", " << header.inputSize[1] << ", " << header.inputSize[2] << "]";
+  }
+
+  unsigned int dims[3];
+  mitk::Matrix3D matrix;
+  mitk::Vector3D offset;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    dims[i] = static_cast<unsigned int>(header.outputSize[i]);
+    offset[i] = header.origin[i];
+    for (unsigned int j = 0; j < 3; ++j)
+      matrix[i][j] = header.direction[i * 3 + j] * header.spacing[j];
+  }
+
+  const auto components = image->GetPixelType().GetNumberOfComponents();
+  const auto n = GetNumberOfPixels();
+  const auto k = nearest ? 1u : header.weightsPerPixel;
+
+  auto result = mitk::Image::New();
+  ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+    using PixelType = decltype(pixel);
+    if (components > 1)
+      result->Initialize(mitk::MakePixelType<itk::VectorImage<PixelType, 3>>(components), 3, dims);
+    else
+      result->Initialize(mitk::MakePixelType<PixelType, PixelType, 1>(), 3, dims);
+
+    mitk::ImageReadAccessor inAcc(image);
+    mitk::ImageWriteAccessor outAcc(result);
+    const auto input = static_cast<const PixelType *>(inAcc.GetData());
+    const auto output = static_cast<PixelType *>(outAcc.GetData());
+    const auto defaultValue = ElxUtil::CastPixel<PixelType>(defaultPixelValue);
+
+    const auto blocks = (n + PixelBlockSize - 1) / PixelBlockSize;
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      blocks,
+      [&](itk::SizeValueType block) {
+        const auto begin = block * PixelBlockSize;
+        const auto end = std::min<std::uint64_t>(n, begin + PixelBlockSize);
+        for (auto p = begin; p < end; ++p)
+        {
+          auto dst = output + p * components;
+          if (m_Nearest[p] == GetOutsideIndex())
+          {
+            std::fill_n(dst, components, defaultValue);
+          }
+          else if (nearest)
+          {
+            std::copy_n(input + m_Nearest[p] * components, components, dst);
+          }
+          else
+          {
+            for (unsigned int c = 0; c < components; ++c)
+            {
+              double value = 0;
+              for (unsigned int j = 0; j < k; ++j)
+                value += GetWeights(j)[p] * input[GetIndices(j)[p] * components + c];
+              dst[c] = ElxUtil::CastPixel<PixelType>(value);
+            }
+          }
+        }
+      },
+      nullptr);
+  });
+
+  auto transform = mitk::AffineTransform3D::New();
+  transform->SetMatrix(matrix);
+  transform->SetOffset(offset);
+  result->GetGeometry()->SetIndexToWorldTransform(transform);
+  return result;
+}
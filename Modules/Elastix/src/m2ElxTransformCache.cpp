@@ -0,0 +1,93 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxTransformCache.h>
+
+m2::ElxTransformCache::Pointer m2::ElxTransformCache::New(std::size_t memoryBudget)
+{
+  return Pointer(new ElxTransformCache(memoryBudget));
+}
+
+itk::Object::Pointer m2::ElxTransformCache::Get(const std::vector<std::string> &transformations,
+                                                const std::string &grid)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+  {
+    if (it->grid == grid && it->transformations == transformations)
+    {
+      m_Entries.splice(m_Entries.begin(), m_Entries, it);
+      return m_Entries.front().object;
+    }
+  }
+  return nullptr;
+}
+
+void m2::ElxTransformCache::Add(const std::vector<std::string> &transformations,
+                                const std::string &grid,
+                                itk::Object::Pointer object,
+                                std::size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+  {
+    if (it->grid == grid && it->transformations == transformations)
+    {
+      m_MemoryUsage -= it->bytes;
+      m_Entries.erase(it);
+      break;
+    }
+  }
+  if (bytes > m_MemoryBudget)
+    return;
+
+  m_Entries.push_front({transformations, grid, object, bytes});
+  m_MemoryUsage += bytes;
+  Shrink();
+}
+
+void m2::ElxTransformCache::SetMemoryBudget(std::size_t memoryBudget)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_MemoryBudget = memoryBudget;
+  Shrink();
+}
+
+std::size_t m2::ElxTransformCache::GetMemoryBudget() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_MemoryBudget;
+}
+
+std::size_t m2::ElxTransformCache::GetMemoryUsage() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_MemoryUsage;
+}
+
+void m2::ElxTransformCache::Clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Entries.clear();
+  m_MemoryUsage = 0;
+}
+
+void m2::ElxTransformCache::Shrink()
+{
+  while (!m_Entries.empty() && m_MemoryUsage > m_MemoryBudget)
+  {
+    m_MemoryUsage -= m_Entries.back().bytes;
+    m_Entries.pop_back();
+  }
+}
@@ -0,0 +1,1110 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxTransformEngine.h>
+#include <mitkException.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkLogMacros.h>
+
+#include <itkAffineTransform.h>
+#include <itkBSplineTransform.h>
+#include <itkEuler2DTransform.h>
+#include <itkEuler3DTransform.h>
+#include <itkImage.h>
+#include <itkImageRegionConstIteratorWithIndex.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkMultiThreaderBase.h>
+#include <itkSimilarity2DTransform.h>
+#include <itkSimilarity3DTransform.h>
+#include <itkTransformToDisplacementFieldFilter.h>
+#include <itkTranslationTransform.h>
+#include <itkVectorLinearInterpolateImageFunction.h>
+#include <vnl/algo/vnl_svd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <locale>
+#include <mutex>
+#include <sstream>
+
+namespace
+{
+  bool IsBSplineTransform(const std::string &name)
+  {
+    return name == "BSplineTransform" || name == "RecursiveBSplineTransform";
+  }
+
+  bool IsSupportedTransform(const m2::ElxTransformParameterMap &p)
+  {
+    const auto name = p.GetTransformName();
+    if (IsBSplineTransform(name))
+    {
+      const auto order = p.GetDouble("BSplineTransformSplineOrder", 3);
+      return order >= 1 && order <= 3 && p.GetString("UseCyclicTransform", "false") != "true";
+    }
+    return name == "TranslationTransform" || name == "EulerTransform" || name == "SimilarityTransform" ||
+           name == "AffineTransform";
+  }
+
+  std::vector<double> GetValues(const m2::ElxTransformParameterMap &p, const std::string &name, unsigned int n)
+  {
+    auto values = p.GetDoubles(name);
+    if (values.size() != n)
+      mitkThrow() << "Parameter (" << name << ") has " << values.size() << " values; expected " << n;
+    return values;
+  }
+
+  /**
+   * Elastix writes direction cosines column by column; returns the matrix element (row, col).
+   * An empty list or UseDirectionCosines "false" results in the identity.
+   */
+  template <unsigned int VDimension>
+  itk::Matrix<double, VDimension, VDimension> GetDirection(const m2::ElxTransformParameterMap &p,
+                                                           const std::string &name)
+  {
+    itk::Matrix<double, VDimension, VDimension> direction;
+    direction.SetIdentity();
+    if (!p.Has(name) || p.GetString("UseDirectionCosines", "true") == "false")
+      return direction;
+
+    const auto values = GetValues(p, name, VDimension * VDimension);
+    for (unsigned int col = 0; col < VDimension; ++col)
+      for (unsigned int row = 0; row < VDimension; ++row)
+        direction[row][col] = values[col * VDimension + row];
+    return direction;
+  }
+
+  template <class TTransform>
+  void SetCenter(TTransform *transform, const m2::ElxTransformParameterMap &p, unsigned int dimension)
+  {
+    typename TTransform::InputPointType center;
+    center.Fill(0);
+    if (p.Has("CenterOfRotationPoint"))
+    {
+      const auto values = GetValues(p, "CenterOfRotationPoint", dimension);
+      std::copy(values.begin(), values.end(), center.Begin());
+    }
+    transform->SetCenter(center);
+  }
+
+  template <class TTransform>
+  void SetParameters(TTransform *transform, const m2::ElxTransformParameterMap &p)
+  {
+    const auto values = GetValues(p, "TransformParameters", transform->GetNumberOfParameters());
+    typename TTransform::ParametersType parameters(values.size());
+    std::copy(values.begin(), values.end(), parameters.begin());
+    transform->SetParametersByValue(parameters);
+  }
+
+  template <unsigned int VDimension, unsigned int VSplineOrder>
+  typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer CreateBSplineTransform(
+    const m2::ElxTransformParameterMap &p)
+  {
+    using BSplineTransformType = itk::BSplineTransform<double, VDimension, VSplineOrder>;
+    auto transform = BSplineTransformType::New();
+
+    const auto size = GetValues(p, "GridSize", VDimension);
+    const auto spacing = GetValues(p, "GridSpacing", VDimension);
+    const auto origin = GetValues(p, "GridOrigin", VDimension);
+    const auto index = p.Has("GridIndex") ? GetValues(p, "GridIndex", VDimension) : std::vector<double>(VDimension, 0);
+    const auto direction = GetDirection<VDimension>(p, "GridDirection");
+
+    // ITK layout of the coefficient grid: size, origin, spacing, direction (row-major)
+    typename BSplineTransformType::FixedParametersType fixedParameters(VDimension * (VDimension + 3));
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      // ITK coefficient grids start at index 0; shift the origin by the elastix grid index
+      double o = origin[i];
+      for (unsigned int j = 0; j < VDimension; ++j)
+        o += direction[i][j] * spacing[j] * index[j];
+
+      fixedParameters[i] = size[i];
+      fixedParameters[VDimension + i] = o;
+      fixedParameters[2 * VDimension + i] = spacing[i];
+      for (unsigned int j = 0; j < VDimension; ++j)
+        fixedParameters[3 * VDimension + i * VDimension + j] = direction[i][j];
+    }
+    transform->SetFixedParameters(fixedParameters);
+
+    // the coefficients have to be copied; BSplineTransform::SetParameters only references the array
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  template <unsigned int VDimension>
+  typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer CreateEulerTransform(
+    const m2::ElxTransformParameterMap &p);
+
+  template <>
+  m2::ElxTransformEngine::TransformType<2>::Pointer CreateEulerTransform<2>(
+    const m2::ElxTransformParameterMap &p)
+  {
+    auto transform = itk::Euler2DTransform<double>::New();
+    SetCenter(transform.GetPointer(), p, 2);
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  template <>
+  m2::ElxTransformEngine::TransformType<3>::Pointer CreateEulerTransform<3>(
+    const m2::ElxTransformParameterMap &p)
+  {
+    auto transform = itk::Euler3DTransform<double>::New();
+    transform->SetComputeZYX(p.GetString("ComputeZYX", "false") == "true");
+    SetCenter(transform.GetPointer(), p, 3);
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  template <unsigned int VDimension>
+  typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer CreateSimilarityTransform(
+    const m2::ElxTransformParameterMap &p);
+
+  template <>
+  m2::ElxTransformEngine::TransformType<2>::Pointer CreateSimilarityTransform<2>(
+    const m2::ElxTransformParameterMap &p)
+  {
+    // parameters: scale, angle, translation
+    auto transform = itk::Similarity2DTransform<double>::New();
+    SetCenter(transform.GetPointer(), p, 2);
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  template <>
+  m2::ElxTransformEngine::TransformType<3>::Pointer CreateSimilarityTransform<3>(
+    const m2::ElxTransformParameterMap &p)
+  {
+    // parameters: versor, translation, scale
+    auto transform = itk::Similarity3DTransform<double>::New();
+    SetCenter(transform.GetPointer(), p, 3);
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  bool IsLinearTransform(const std::string &name)
+  {
+    return name == "TranslationTransform" || name == "EulerTransform" || name == "SimilarityTransform" ||
+           name == "AffineTransform";
+  }
+
+  /**
+   * Writes the linear transform as y = M x + o.
+   */
+  template <unsigned int VDimension>
+  void GetMatrixOffset(const m2::ElxTransformEngine::TransformType<VDimension> *transform,
+                       itk::Matrix<double, VDimension, VDimension> &matrix,
+                       itk::Vector<double, VDimension> &offset)
+  {
+    using MatrixOffsetType = itk::MatrixOffsetTransformBase<double, VDimension, VDimension>;
+    using TranslationType = itk::TranslationTransform<double, VDimension>;
+    if (auto t = dynamic_cast<const MatrixOffsetType *>(transform))
+    {
+      matrix = t->GetMatrix();
+      offset = t->GetOffset();
+    }
+    else if (auto t = dynamic_cast<const TranslationType *>(transform))
+    {
+      matrix.SetIdentity();
+      offset = t->GetOffset();
+    }
+    else
+    {
+      mitkThrow() << "Transform [" << transform->GetNameOfClass() << "] is not linear!";
+    }
+  }
+
+  /**
+   * Returns T1(T0(x)) as single affine transform.
+   */
+  template <unsigned int VDimension>
+  void ComposeLinear(typename m2::ElxTransformEngine::AffineTransformType<VDimension> *composed,
+                     const m2::ElxTransformEngine::TransformType<VDimension> *next)
+  {
+    itk::Matrix<double, VDimension, VDimension> m1;
+    itk::Vector<double, VDimension> o1;
+    GetMatrixOffset<VDimension>(next, m1, o1);
+
+    const auto m0 = composed->GetMatrix();
+    const auto o0 = composed->GetOffset();
+    composed->SetMatrix(m1 * m0);
+    composed->SetOffset(m1 * o0 + o1);
+  }
+
+  /**
+   * Composite transform of the chain with consecutive linear stages combined into one affine transform each.
+   */
+  template <unsigned int VDimension>
+  typename m2::ElxTransformEngine::CompositeTransformType<VDimension>::Pointer CreateCombinedCompositeTransform(
+    const std::vector<std::string> &transformations)
+  {
+    using AffineType = m2::ElxTransformEngine::AffineTransformType<VDimension>;
+    std::vector<typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer> stages;
+    typename AffineType::Pointer linear;
+    for (const auto &t : transformations)
+    {
+      const auto p = m2::ElxTransformParameterMap::Parse(t);
+      auto transform = m2::ElxTransformEngine::CreateTransform<VDimension>(p);
+      if (IsLinearTransform(p.GetTransformName()))
+      {
+        if (!linear)
+        {
+          linear = AffineType::New();
+          linear->SetIdentity();
+          stages.push_back(linear.GetPointer());
+        }
+        ComposeLinear<VDimension>(linear, transform);
+      }
+      else
+      {
+        linear = nullptr;
+        stages.push_back(transform);
+      }
+    }
+
+    // itk::CompositeTransform applies the transform added last first
+    auto composite = m2::ElxTransformEngine::CompositeTransformType<VDimension>::New();
+    for (auto it = stages.rbegin(); it != stages.rend(); ++it)
+      composite->AddTransform(*it);
+    return composite;
+  }
+
+  /**
+   * Description of the grid a field is sampled on (part of the cache key, see ElxTransformCache).
+   */
+  template <unsigned int VDimension>
+  std::string GetGridKey(const itk::ImageBase<VDimension> *reference, std::size_t componentSize)
+  {
+    std::ostringstream key;
+    key.imbue(std::locale::classic());
+    key.precision(17);
+    key << VDimension << ':' << componentSize << ':' << reference->GetLargestPossibleRegion()
+        << reference->GetSpacing() << reference->GetOrigin() << reference->GetDirection();
+    return key.str();
+  }
+
+  constexpr std::size_t PointBlockSize = 4096;
+
+  template <unsigned int VDimension>
+  void TransformPointsLinear(const m2::ElxTransformEngine::AffineTransformType<VDimension> *affine,
+                             double *x[VDimension],
+                             std::size_t n)
+  {
+    const auto &matrix = affine->GetMatrix();
+    const auto &offset = affine->GetOffset();
+    double m[VDimension][VDimension];
+    double o[VDimension];
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      o[i] = offset[i];
+      for (unsigned int j = 0; j < VDimension; ++j)
+        m[i][j] = matrix[i][j];
+    }
+
+    const auto blocks = (n + PointBlockSize - 1) / PointBlockSize;
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      blocks,
+      [&](itk::SizeValueType block) {
+        const auto begin = block * PointBlockSize;
+        const auto end = std::min(n, begin + PointBlockSize);
+        // structure of arrays: the inner loop has no dependencies and is vectorised by the compiler
+        for (auto k = begin; k < end; ++k)
+        {
+          double in[VDimension];
+          for (unsigned int i = 0; i < VDimension; ++i)
+            in[i] = x[i][k];
+          for (unsigned int i = 0; i < VDimension; ++i)
+          {
+            double v = o[i];
+            for (unsigned int j = 0; j < VDimension; ++j)
+              v += m[i][j] * in[j];
+            x[i][k] = v;
+          }
+        }
+      },
+      nullptr);
+  }
+
+  template <unsigned int VDimension>
+  void TransformPoints(const std::vector<std::string> &transformations, double *x[VDimension], std::size_t n)
+  {
+    if (m2::ElxTransformEngine::IsLinear(transformations))
+      TransformPointsLinear<VDimension>(m2::ElxTransformEngine::CreateAffineTransform<VDimension>(transformations), x, n);
+    else
+      m2::ElxTransformEngine::TransformPoints<VDimension>(
+        CreateCombinedCompositeTransform<VDimension>(transformations).GetPointer(), x, n);
+  }
+
+  /**
+   * Linear part y = M x + o of a forward map and M^-1.
+   */
+  template <unsigned int VDimension>
+  struct LinearPart
+  {
+    itk::Matrix<double, VDimension, VDimension> matrix;
+    itk::Matrix<double, VDimension, VDimension> inverseMatrix;
+    itk::Vector<double, VDimension> offset;
+  };
+
+  template <unsigned int VDimension>
+  LinearPart<VDimension> GetLinearPart(const itk::Matrix<double, VDimension, VDimension> &matrix,
+                                       const itk::Vector<double, VDimension> &offset)
+  {
+    LinearPart<VDimension> part;
+    part.matrix = matrix;
+    part.offset = offset;
+    try
+    {
+      part.inverseMatrix = matrix.GetInverse();
+    }
+    catch (const itk::ExceptionObject &)
+    {
+      mitkThrow() << "The linear part of the transformation is not invertible!";
+    }
+    return part;
+  }
+
+  /**
+   * Least squares fit of the linear part of the forward map x -> x + u(x) over all pixels of the field.
+   * Coordinates are centered for the normal equations.
+   */
+  template <unsigned int VDimension>
+  LinearPart<VDimension> FitLinearPart(const m2::ElxTransformEngine::DisplacementFieldType<VDimension> *field)
+  {
+    using FieldType = m2::ElxTransformEngine::DisplacementFieldType<VDimension>;
+    const auto region = field->GetLargestPossibleRegion();
+    itk::ContinuousIndex<double, VDimension> centerIndex;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      centerIndex[i] = region.GetIndex(i) + 0.5 * (static_cast<double>(region.GetSize(i)) - 1);
+    typename FieldType::PointType center;
+    field->TransformContinuousIndexToPhysicalPoint(centerIndex, center);
+
+    vnl_matrix<double> normal(VDimension + 1, VDimension + 1, 0.0), rhs(VDimension + 1, VDimension, 0.0);
+    std::mutex mutex;
+    itk::MultiThreaderBase::New()->template ParallelizeImageRegion<VDimension>(
+      region,
+      [&](const typename FieldType::RegionType &tile) {
+        vnl_matrix<double> tileNormal(VDimension + 1, VDimension + 1, 0.0), tileRhs(VDimension + 1, VDimension, 0.0);
+        itk::ImageRegionConstIteratorWithIndex<FieldType> it(field, tile);
+        typename FieldType::PointType x;
+        double h[VDimension + 1];
+        for (; !it.IsAtEnd(); ++it)
+        {
+          field->TransformIndexToPhysicalPoint(it.GetIndex(), x);
+          for (unsigned int i = 0; i < VDimension; ++i)
+            h[i] = x[i] - center[i];
+          h[VDimension] = 1;
+          const auto &u = it.Get();
+          for (unsigned int a = 0; a <= VDimension; ++a)
+          {
+            for (unsigned int b = 0; b <= VDimension; ++b)
+              tileNormal(a, b) += h[a] * h[b];
+            for (unsigned int j = 0; j < VDimension; ++j)
+              tileRhs(a, j) += h[a] * (x[j] + u[j]);
+          }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        normal += tileNormal;
+        rhs += tileRhs;
+      },
+      nullptr);
+
+    const auto solution = vnl_svd<double>(normal).solve(rhs);
+    itk::Matrix<double, VDimension, VDimension> matrix;
+    itk::Vector<double, VDimension> offset;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      offset[i] = solution(VDimension, i);
+      for (unsigned int j = 0; j < VDimension; ++j)
+      {
+        matrix[i][j] = solution(j, i);
+        offset[i] -= solution(j, i) * center[j];
+      }
+    }
+    return GetLinearPart<VDimension>(matrix, offset);
+  }
+
+  enum class InversionState
+  {
+    Converged,
+    NotConverged,
+    Outside
+  };
+
+  /**
+   * Solves M x + o + r(x) = y for x. The linear part is inverted exactly, only the residual r is iterated:
+   * x_{k+1} = M^-1 (y - o - r(x_k)), starting at x_0 = M^-1 (y - o).
+   * residual(x, r) returns false if r is not known at x.
+   * @param update Receives the length of the last update.
+   */
+  template <unsigned int VDimension, class TResidual>
+  InversionState InvertPoint(const LinearPart<VDimension> &linear,
+                             const TResidual &residual,
+                             const itk::Vector<double, VDimension> &y,
+                             unsigned int maximumNumberOfIterations,
+                             double tolerance,
+                             itk::Vector<double, VDimension> &x,
+                             double &update)
+  {
+    const auto b = y - linear.offset;
+    x = linear.inverseMatrix * b;
+    itk::Vector<double, VDimension> r;
+    update = 0;
+    for (unsigned int k = 0; k < maximumNumberOfIterations; ++k)
+    {
+      if (!residual(x, r))
+        return InversionState::Outside;
+      const itk::Vector<double, VDimension> next = linear.inverseMatrix * (b - r);
+      update = (next - x).GetNorm();
+      x = next;
+      if (update <= tolerance)
+        return InversionState::Converged;
+    }
+    return InversionState::NotConverged;
+  }
+
+  /**
+   * Residual r(x) = T(x) - (M x + o) of a transformation chain; defined everywhere.
+   */
+  template <unsigned int VDimension>
+  std::function<bool(const itk::Vector<double, VDimension> &, itk::Vector<double, VDimension> &)> GetChainResidual(
+    const m2::ElxTransformEngine::TransformType<VDimension> *transform, const LinearPart<VDimension> &linear)
+  {
+    return [transform, &linear](const itk::Vector<double, VDimension> &x, itk::Vector<double, VDimension> &r) {
+      typename m2::ElxTransformEngine::TransformType<VDimension>::InputPointType p;
+      for (unsigned int i = 0; i < VDimension; ++i)
+        p[i] = x[i];
+      const auto q = transform->TransformPoint(p);
+      const auto a = linear.matrix * x;
+      for (unsigned int i = 0; i < VDimension; ++i)
+        r[i] = q[i] - a[i] - linear.offset[i];
+      return true;
+    };
+  }
+
+  template <unsigned int VDimension>
+  void TransformPointsInverse(const std::vector<std::string> &transformations,
+                              double *x[VDimension],
+                              std::size_t n,
+                              unsigned int maximumNumberOfIterations,
+                              double tolerance)
+  {
+    const auto affine = m2::ElxTransformEngine::CreateLinearPart<VDimension>(transformations);
+    const auto linear = GetLinearPart<VDimension>(affine->GetMatrix(), affine->GetOffset());
+    const auto transform = CreateCombinedCompositeTransform<VDimension>(transformations);
+    const auto residual = GetChainResidual<VDimension>(transform, linear);
+
+    std::atomic<std::size_t> notConverged{0};
+    const auto blocks = (n + PointBlockSize - 1) / PointBlockSize;
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      blocks,
+      [&](itk::SizeValueType block) {
+        const auto begin = block * PointBlockSize;
+        const auto end = std::min(n, begin + PointBlockSize);
+        itk::Vector<double, VDimension> y, p;
+        double update;
+        for (auto k = begin; k < end; ++k)
+        {
+          for (unsigned int i = 0; i < VDimension; ++i)
+            y[i] = x[i][k];
+          if (InvertPoint<VDimension>(linear, residual, y, maximumNumberOfIterations, tolerance, p, update) !=
+              InversionState::Converged)
+            ++notConverged;
+          for (unsigned int i = 0; i < VDimension; ++i)
+            x[i][k] = p[i];
+        }
+      },
+      nullptr);
+
+    if (notConverged)
+      mitkThrow() << "Inversion of " << notConverged << " of " << n << " points did not converge within "
+                  << maximumNumberOfIterations << " iterations; the transformation is not invertible there.";
+  }
+} // namespace
+
+bool m2::ElxTransformEngine::CanTransform(const std::vector<std::string> &transformations)
+{
+  try
+  {
+    const auto dimension = GetDimension(transformations);
+    if (dimension != 2 && dimension != 3)
+      return false;
+
+    for (unsigned int i = 0; i < transformations.size(); ++i)
+    {
+      const auto p = ElxTransformParameterMap::Parse(transformations[i]);
+      if (!IsSupportedTransform(p))
+        return false;
+      // the first transformation is not combined with any initial transform
+      if (i > 0 && p.GetString("HowToCombineTransforms", "Compose") != "Compose")
+        return false;
+    }
+  }
+  catch (std::exception &)
+  {
+    return false;
+  }
+  return true;
+}
+
+unsigned int m2::ElxTransformEngine::GetDimension(const std::vector<std::string> &transformations)
+{
+  if (transformations.empty())
+    mitkThrow() << "No transformations available!";
+
+  const auto dimension = ElxTransformParameterMap::Parse(transformations.front()).GetDimension();
+  for (const auto &t : transformations)
+    if (ElxTransformParameterMap::Parse(t).GetDimension() != dimension)
+      mitkThrow() << "Transformations with different dimensions can not be combined!";
+  return dimension;
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer m2::ElxTransformEngine::CreateTransform(
+  const ElxTransformParameterMap &p)
+{
+  if (p.GetDimension() != VDimension)
+    mitkThrow() << "Transform dimension " << p.GetDimension() << " does not match " << VDimension;
+
+  const auto name = p.GetTransformName();
+  if (!IsSupportedTransform(p))
+    mitkThrow() << "Transform [" << name << "] is not supported in-process!";
+
+  if (name == "TranslationTransform")
+  {
+    auto transform = itk::TranslationTransform<double, VDimension>::New();
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  if (name == "EulerTransform")
+    return CreateEulerTransform<VDimension>(p);
+
+  if (name == "SimilarityTransform")
+    return CreateSimilarityTransform<VDimension>(p);
+
+  if (name == "AffineTransform")
+  {
+    // parameters: matrix (row-major), translation
+    auto transform = itk::AffineTransform<double, VDimension>::New();
+    SetCenter(transform.GetPointer(), p, VDimension);
+    SetParameters(transform.GetPointer(), p);
+    return transform.GetPointer();
+  }
+
+  // (Recursive)BSplineTransform
+  switch (static_cast<unsigned int>(p.GetDouble("BSplineTransformSplineOrder", 3)))
+  {
+    case 1:
+      return CreateBSplineTransform<VDimension, 1>(p);
+    case 2:
+      return CreateBSplineTransform<VDimension, 2>(p);
+    default:
+      return CreateBSplineTransform<VDimension, 3>(p);
+  }
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::CompositeTransformType<VDimension>::Pointer m2::ElxTransformEngine::
+  CreateCompositeTransform(const std::vector<std::string> &transformations)
+{
+  auto composite = CompositeTransformType<VDimension>::New();
+
+  // elastix: T(x) = T_n(...T_1(T_0(x)))
+  // itk::CompositeTransform applies the transform added last first
+  for (auto it = transformations.rbegin(); it != transformations.rend(); ++it)
+    composite->AddTransform(CreateTransform<VDimension>(ElxTransformParameterMap::Parse(*it)));
+
+  return composite;
+}
+
+bool m2::ElxTransformEngine::IsLinear(const std::vector<std::string> &transformations)
+{
+  return std::all_of(transformations.begin(), transformations.end(), [](const std::string &t) {
+    return IsLinearTransform(ElxTransformParameterMap::Parse(t).GetTransformName());
+  });
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::AffineTransformType<VDimension>::Pointer m2::ElxTransformEngine::
+  CreateAffineTransform(const std::vector<std::string> &transformations)
+{
+  auto affine = AffineTransformType<VDimension>::New();
+  affine->SetIdentity();
+  for (const auto &t : transformations)
+  {
+    const auto p = ElxTransformParameterMap::Parse(t);
+    if (!IsLinearTransform(p.GetTransformName()))
+      mitkThrow() << "Transform [" << p.GetTransformName() << "] is not linear!";
+    ComposeLinear<VDimension>(affine, CreateTransform<VDimension>(p));
+  }
+  return affine;
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::AffineTransformType<VDimension>::Pointer m2::ElxTransformEngine::CreateLinearPart(
+  const std::vector<std::string> &transformations)
+{
+  auto affine = AffineTransformType<VDimension>::New();
+  affine->SetIdentity();
+  for (const auto &t : transformations)
+  {
+    const auto p = ElxTransformParameterMap::Parse(t);
+    if (IsLinearTransform(p.GetTransformName()))
+      ComposeLinear<VDimension>(affine, CreateTransform<VDimension>(p));
+  }
+  return affine;
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::TransformType<VDimension>::Pointer m2::ElxTransformEngine::CreateFlattenedTransform(
+  const std::vector<std::string> &transformations,
+  const itk::ImageBase<VDimension> *reference,
+  ElxTransformCache *cache)
+{
+  if (IsLinear(transformations))
+    return CreateAffineTransform<VDimension>(transformations).GetPointer();
+
+  if (!reference)
+    mitkThrow() << "A reference grid is required to flatten a deformable transformation chain!";
+
+  return CreateDisplacementFieldTransform<VDimension, double>(transformations, reference, cache).GetPointer();
+}
+
+m2::ElxTransformEngine::DeformationRepresentation m2::ElxTransformEngine::SelectDeformationRepresentation(
+  std::size_t numberOfPixels, unsigned int dimension, std::size_t memoryBudget)
+{
+  const auto components = numberOfPixels * dimension;
+  if (components * sizeof(double) <= memoryBudget)
+    return DeformationRepresentation::DisplacementField;
+  if (components * sizeof(float) <= memoryBudget)
+    return DeformationRepresentation::CompactDisplacementField;
+  return DeformationRepresentation::CoefficientGrid;
+}
+
+template <unsigned int VDimension, class TPrecision>
+typename m2::ElxTransformEngine::DisplacementFieldTransformType<VDimension, TPrecision>::Pointer m2::
+  ElxTransformEngine::CreateDisplacementFieldTransform(const std::vector<std::string> &transformations,
+                                                       const itk::ImageBase<VDimension> *reference,
+                                                       ElxTransformCache *cache)
+{
+  using FieldTransformType = DisplacementFieldTransformType<VDimension, TPrecision>;
+  if (!reference)
+    mitkThrow() << "A reference grid is required to sample a displacement field!";
+
+  const auto grid = cache ? GetGridKey<VDimension>(reference, sizeof(TPrecision)) : std::string();
+  if (cache)
+    if (auto cached = dynamic_cast<FieldTransformType *>(cache->Get(transformations, grid).GetPointer()))
+      return cached;
+
+  using FilterType = itk::TransformToDisplacementFieldFilter<DisplacementFieldType<VDimension, TPrecision>, double>;
+  auto filter = FilterType::New();
+  filter->SetTransform(CreateCombinedCompositeTransform<VDimension>(transformations));
+  filter->SetReferenceImage(reference);
+  filter->SetUseReferenceImage(true);
+  filter->Update();
+
+  auto transform = FieldTransformType::New();
+  transform->SetDisplacementField(filter->GetOutput());
+  if (cache)
+    cache->Add(transformations,
+               grid,
+               transform.GetPointer(),
+               reference->GetLargestPossibleRegion().GetNumberOfPixels() * VDimension * sizeof(TPrecision));
+  return transform;
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::CompositeTransformType<VDimension>::Pointer m2::ElxTransformEngine::
+  CreateCoefficientGridTransform(const std::vector<std::string> &transformations)
+{
+  return CreateCombinedCompositeTransform<VDimension>(transformations);
+}
+
+void m2::ElxTransformEngine::TransformPoints(
+  const std::vector<std::string> &transformations, double *x, double *y, double *z, std::size_t n)
+{
+  if (n == 0)
+    return;
+
+  if (GetDimension(transformations) == 3)
+  {
+    if (!z)
+      mitkThrow() << "3D transformations require z coordinates!";
+    double *xyz[3] = {x, y, z};
+    ::TransformPoints<3>(transformations, xyz, n);
+  }
+  else
+  {
+    double *xy[2] = {x, y};
+    ::TransformPoints<2>(transformations, xy, n);
+  }
+}
+
+void m2::ElxTransformEngine::TransformPointsInverse(const std::vector<std::string> &transformations,
+                                                    double *x,
+                                                    double *y,
+                                                    double *z,
+                                                    std::size_t n,
+                                                    unsigned int maximumNumberOfIterations,
+                                                    double tolerance)
+{
+  if (n == 0)
+    return;
+
+  if (GetDimension(transformations) == 3)
+  {
+    if (!z)
+      mitkThrow() << "3D transformations require z coordinates!";
+    double *xyz[3] = {x, y, z};
+    ::TransformPointsInverse<3>(transformations, xyz, n, maximumNumberOfIterations, tolerance);
+  }
+  else
+  {
+    double *xy[2] = {x, y};
+    ::TransformPointsInverse<2>(transformations, xy, n, maximumNumberOfIterations, tolerance);
+  }
+}
+
+template <unsigned int VDimension>
+void m2::ElxTransformEngine::TransformPoints(const TransformType<VDimension> *transform,
+                                             double *x[VDimension],
+                                             std::size_t n)
+{
+  const auto blocks = (n + PointBlockSize - 1) / PointBlockSize;
+  itk::MultiThreaderBase::New()->ParallelizeArray(
+    0,
+    blocks,
+    [&](itk::SizeValueType block) {
+      const auto begin = block * PointBlockSize;
+      const auto end = std::min(n, begin + PointBlockSize);
+      typename TransformType<VDimension>::InputPointType p;
+      for (auto k = begin; k < end; ++k)
+      {
+        for (unsigned int i = 0; i < VDimension; ++i)
+          p[i] = x[i][k];
+        const auto q = transform->TransformPoint(p);
+        for (unsigned int i = 0; i < VDimension; ++i)
+          x[i][k] = q[i];
+      }
+    },
+    nullptr);
+}
+
+template <unsigned int VDimension, class TPrecision>
+typename m2::ElxTransformEngine::DisplacementFieldType<VDimension, TPrecision>::Pointer m2::ElxTransformEngine::
+  ToDisplacementField(const mitk::Image *image)
+{
+  using FieldType = DisplacementFieldType<VDimension, TPrecision>;
+  if (!image)
+    mitkThrow() << "Deformation field is null!";
+
+  const auto components = image->GetPixelType().GetNumberOfComponents();
+  const auto bitsPerComponent = image->GetPixelType().GetBpe() / components;
+  if (components != VDimension || (bitsPerComponent != 32 && bitsPerComponent != 64))
+    mitkThrow() << "Deformation field has to provide " << VDimension << " float or double components!";
+
+  const auto geometry = image->GetGeometry();
+  const auto matrix = geometry->GetIndexToWorldTransform()->GetMatrix();
+  typename FieldType::RegionType region;
+  typename FieldType::SpacingType spacing;
+  typename FieldType::PointType origin;
+  typename FieldType::DirectionType direction;
+  for (unsigned int i = 0; i < VDimension; ++i)
+  {
+    region.SetSize(i, image->GetDimensions()[i]);
+    spacing[i] = geometry->GetSpacing()[i];
+    origin[i] = geometry->GetOrigin()[i];
+    for (unsigned int j = 0; j < VDimension; ++j)
+      direction[i][j] = matrix[i][j] / geometry->GetSpacing()[j];
+  }
+
+  auto field = FieldType::New();
+  field->SetRegions(region);
+  field->SetSpacing(spacing);
+  field->SetOrigin(origin);
+  field->SetDirection(direction);
+  field->Allocate();
+
+  mitk::ImageReadAccessor acc(image);
+  const auto n = region.GetNumberOfPixels() * VDimension;
+  auto out = reinterpret_cast<TPrecision *>(field->GetBufferPointer());
+  if (bitsPerComponent == 32)
+    std::copy_n(static_cast<const float *>(acc.GetData()), n, out);
+  else
+    std::copy_n(static_cast<const double *>(acc.GetData()), n, out);
+  return field;
+}
+
+namespace
+{
+  /**
+   * Samples the inverse on the grid of reference: every pixel y is inverted by InvertPoint. Pixels whose
+   * iteration leaves the domain of the residual are set to NaN.
+   */
+  template <unsigned int VDimension, class TResidual>
+  typename m2::ElxTransformEngine::DisplacementFieldType<VDimension>::Pointer SampleInverse(
+    const LinearPart<VDimension> &linear,
+    const TResidual &residual,
+    const itk::ImageBase<VDimension> *reference,
+    unsigned int maximumNumberOfIterations,
+    double tolerance,
+    double *maximumResidual,
+    std::size_t *numberOfOutsidePixels)
+  {
+    using FieldType = m2::ElxTransformEngine::DisplacementFieldType<VDimension>;
+    const auto region = reference->GetLargestPossibleRegion();
+    auto inverse = FieldType::New();
+    inverse->CopyInformation(reference);
+    inverse->SetRegions(region);
+    inverse->Allocate();
+
+    const auto &spacing = reference->GetSpacing();
+    const auto absoluteTolerance = tolerance * *std::min_element(spacing.Begin(), spacing.End());
+
+    std::mutex mutex;
+    double maxResidual = 0;
+    std::size_t notConverged = 0, outside = 0;
+    itk::MultiThreaderBase::New()->template ParallelizeImageRegion<VDimension>(
+      region,
+      [&](const typename FieldType::RegionType &tile) {
+        double tileResidual = 0;
+        std::size_t tileNotConverged = 0, tileOutside = 0;
+        itk::ImageRegionIteratorWithIndex<FieldType> it(inverse, tile);
+        typename FieldType::PointType point;
+        typename FieldType::PixelType v;
+        itk::Vector<double, VDimension> y, x;
+        double update;
+        for (; !it.IsAtEnd(); ++it)
+        {
+          reference->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+          for (unsigned int i = 0; i < VDimension; ++i)
+            y[i] = point[i];
+          const auto state =
+            InvertPoint<VDimension>(linear, residual, y, maximumNumberOfIterations, absoluteTolerance, x, update);
+          if (state == InversionState::Outside)
+          {
+            v.Fill(std::numeric_limits<double>::quiet_NaN());
+            ++tileOutside;
+          }
+          else
+          {
+            for (unsigned int i = 0; i < VDimension; ++i)
+              v[i] = x[i] - y[i];
+            if (state == InversionState::NotConverged)
+              ++tileNotConverged;
+            tileResidual = std::max(tileResidual, update);
+          }
+          it.Set(v);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        maxResidual = std::max(maxResidual, tileResidual);
+        notConverged += tileNotConverged;
+        outside += tileOutside;
+      },
+      nullptr);
+
+    if (notConverged)
+      mitkThrow() << "Inversion of " << notConverged << " pixels did not converge within " << maximumNumberOfIterations
+                  << " iterations (maximum update " << maxResidual
+                  << "); the transformation is not invertible there.";
+
+    if (maximumResidual)
+      *maximumResidual = maxResidual;
+    if (numberOfOutsidePixels)
+      *numberOfOutsidePixels = outside;
+    return inverse;
+  }
+} // namespace
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::DisplacementFieldType<VDimension>::Pointer m2::ElxTransformEngine::
+  CreateInverseDisplacementField(const std::vector<std::string> &transformations,
+                                 const itk::ImageBase<VDimension> *reference,
+                                 unsigned int maximumNumberOfIterations,
+                                 double tolerance,
+                                 double *maximumResidual)
+{
+  if (!reference)
+    mitkThrow() << "A reference grid is required to sample the inverse transformation!";
+
+  const auto affine = CreateLinearPart<VDimension>(transformations);
+  const auto linear = GetLinearPart<VDimension>(affine->GetMatrix(), affine->GetOffset());
+  const auto transform = CreateCombinedCompositeTransform<VDimension>(transformations);
+  return SampleInverse<VDimension>(linear,
+                                   GetChainResidual<VDimension>(transform, linear),
+                                   reference,
+                                   maximumNumberOfIterations,
+                                   tolerance,
+                                   maximumResidual,
+                                   nullptr);
+}
+
+template <unsigned int VDimension>
+typename m2::ElxTransformEngine::DisplacementFieldType<VDimension>::Pointer m2::ElxTransformEngine::
+  InvertDisplacementField(const DisplacementFieldType<VDimension> *field,
+                          const itk::ImageBase<VDimension> *reference,
+                          const AffineTransformType<VDimension> *linearPart,
+                          unsigned int maximumNumberOfIterations,
+                          double tolerance,
+                          double *maximumResidual,
+                          std::size_t *numberOfOutsidePixels)
+{
+  using FieldType = DisplacementFieldType<VDimension>;
+  using InterpolatorType = itk::VectorLinearInterpolateImageFunction<FieldType, double>;
+
+  if (!field)
+    mitkThrow() << "Displacement field is null!";
+  if (!reference)
+    mitkThrow() << "A reference grid is required to sample the inverse displacement field!";
+
+  const auto linear = linearPart ? GetLinearPart<VDimension>(linearPart->GetMatrix(), linearPart->GetOffset())
+                                 : FitLinearPart<VDimension>(field);
+
+  auto interpolator = InterpolatorType::New();
+  interpolator->SetInputImage(field);
+
+  // the field is only known on its grid: points outside are rejected, not clamped
+  const auto region = field->GetLargestPossibleRegion();
+  itk::ContinuousIndex<double, VDimension> lower, upper;
+  for (unsigned int i = 0; i < VDimension; ++i)
+  {
+    lower[i] = region.GetIndex(i);
+    upper[i] = region.GetIndex(i) + static_cast<double>(region.GetSize(i)) - 1;
+  }
+
+  const auto residual = [&](const itk::Vector<double, VDimension> &x, itk::Vector<double, VDimension> &r) {
+    typename FieldType::PointType p;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      p[i] = x[i];
+    itk::ContinuousIndex<double, VDimension> ci;
+    field->TransformPhysicalPointToContinuousIndex(p, ci);
+    for (unsigned int i = 0; i < VDimension; ++i)
+      if (ci[i] < lower[i] || ci[i] > upper[i])
+        return false;
+    const auto u = interpolator->EvaluateAtContinuousIndex(ci);
+    const auto a = linear.matrix * x;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      r[i] = x[i] + u[i] - a[i] - linear.offset[i];
+    return true;
+  };
+
+  // the tolerance is relative to the grid of the forward field
+  const auto &spacing = field->GetSpacing();
+  const auto &referenceSpacing = reference->GetSpacing();
+  const auto scale = *std::min_element(spacing.Begin(), spacing.End()) /
+                     *std::min_element(referenceSpacing.Begin(), referenceSpacing.End());
+  return SampleInverse<VDimension>(linear,
+                                   residual,
+                                   reference,
+                                   maximumNumberOfIterations,
+                                   tolerance * scale,
+                                   maximumResidual,
+                                   numberOfOutsidePixels);
+}
+
+template <unsigned int VDimension>
+void m2::ElxTransformEngine::InitializeOutputGeometry(const ElxTransformParameterMap &p,
+                                                      itk::ImageBase<VDimension> *image)
+{
+  const auto size = GetValues(p, "Size", VDimension);
+  const auto spacing = GetValues(p, "Spacing", VDimension);
+  const auto origin = GetValues(p, "Origin", VDimension);
+  const auto index = p.Has("Index") ? GetValues(p, "Index", VDimension) : std::vector<double>(VDimension, 0);
+
+  typename itk::ImageBase<VDimension>::RegionType region;
+  typename itk::ImageBase<VDimension>::SpacingType itkSpacing;
+  typename itk::ImageBase<VDimension>::PointType itkOrigin;
+  for (unsigned int i = 0; i < VDimension; ++i)
+  {
+    region.SetIndex(i, static_cast<itk::IndexValueType>(index[i]));
+    region.SetSize(i, static_cast<itk::SizeValueType>(size[i]));
+    itkSpacing[i] = spacing[i];
+    itkOrigin[i] = origin[i];
+  }
+
+  image->SetRegions(region);
+  image->SetSpacing(itkSpacing);
+  image->SetOrigin(itkOrigin);
+  image->SetDirection(GetDirection<VDimension>(p, "Direction"));
+}
+
+template m2::ElxTransformEngine::TransformType<2>::Pointer m2::ElxTransformEngine::CreateTransform<2>(
+  const ElxTransformParameterMap &);
+template m2::ElxTransformEngine::TransformType<3>::Pointer m2::ElxTransformEngine::CreateTransform<3>(
+  const ElxTransformParameterMap &);
+template m2::ElxTransformEngine::CompositeTransformType<2>::Pointer m2::ElxTransformEngine::CreateCompositeTransform<2>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::CompositeTransformType<3>::Pointer m2::ElxTransformEngine::CreateCompositeTransform<3>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::AffineTransformType<2>::Pointer m2::ElxTransformEngine::CreateAffineTransform<2>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::AffineTransformType<3>::Pointer m2::ElxTransformEngine::CreateAffineTransform<3>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::AffineTransformType<2>::Pointer m2::ElxTransformEngine::CreateLinearPart<2>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::AffineTransformType<3>::Pointer m2::ElxTransformEngine::CreateLinearPart<3>(
+  const std::vector<std::string> &);
+template m2::ElxTransformEngine::TransformType<2>::Pointer m2::ElxTransformEngine::CreateFlattenedTransform<2>(
+  const std::vector<std::string> &, const itk::ImageBase<2> *, ElxTransformCache *);
+template m2::ElxTransformEngine::TransformType<3>::Pointer m2::ElxTransformEngine::CreateFlattenedTransform<3>(
+  const std::vector<std::string> &, const itk::ImageBase<3> *, ElxTransformCache *);
+template m2::ElxTransformEngine::DisplacementFieldTransformType<2, double>::Pointer m2::ElxTransformEngine::
+  CreateDisplacementFieldTransform<2, double>(const std::vector<std::string> &,
+                                            const itk::ImageBase<2> *,
+                                            ElxTransformCache *);
+template m2::ElxTransformEngine::DisplacementFieldTransformType<3, double>::Pointer m2::ElxTransformEngine::
+  CreateDisplacementFieldTransform<3, double>(const std::vector<std::string> &,
+                                            const itk::ImageBase<3> *,
+                                            ElxTransformCache *);
+template m2::ElxTransformEngine::DisplacementFieldTransformType<2, float>::Pointer m2::ElxTransformEngine::
+  CreateDisplacementFieldTransform<2, float>(const std::vector<std::string> &,
+                                            const itk::ImageBase<2> *,
+                                            ElxTransformCache *);
+template m2::ElxTransformEngine::DisplacementFieldTransformType<3, float>::Pointer m2::ElxTransformEngine::
+  CreateDisplacementFieldTransform<3, float>(const std::vector<std::string> &,
+                                            const itk::ImageBase<3> *,
+                                            ElxTransformCache *);
+template m2::ElxTransformEngine::CompositeTransformType<2>::Pointer m2::ElxTransformEngine::
+  CreateCoefficientGridTransform<2>(const std::vector<std::string> &);
+template m2::ElxTransformEngine::CompositeTransformType<3>::Pointer m2::ElxTransformEngine::
+  CreateCoefficientGridTransform<3>(const std::vector<std::string> &);
+template void m2::ElxTransformEngine::TransformPoints<2>(const TransformType<2> *, double *[2], std::size_t);
+template void m2::ElxTransformEngine::TransformPoints<3>(const TransformType<3> *, double *[3], std::size_t);
+template m2::ElxTransformEngine::DisplacementFieldType<2, double>::Pointer m2::ElxTransformEngine::
+  ToDisplacementField<2, double>(const mitk::Image *);
+template m2::ElxTransformEngine::DisplacementFieldType<3, double>::Pointer m2::ElxTransformEngine::
+  ToDisplacementField<3, double>(const mitk::Image *);
+template m2::ElxTransformEngine::DisplacementFieldType<2, float>::Pointer m2::ElxTransformEngine::
+  ToDisplacementField<2, float>(const mitk::Image *);
+template m2::ElxTransformEngine::DisplacementFieldType<3, float>::Pointer m2::ElxTransformEngine::
+  ToDisplacementField<3, float>(const mitk::Image *);
+template m2::ElxTransformEngine::DisplacementFieldType<2>::Pointer m2::ElxTransformEngine::
+  CreateInverseDisplacementField<2>(const std::vector<std::string> &, const itk::ImageBase<2> *, unsigned int, double, double *);
+template m2::ElxTransformEngine::DisplacementFieldType<3>::Pointer m2::ElxTransformEngine::
+  CreateInverseDisplacementField<3>(const std::vector<std::string> &, const itk::ImageBase<3> *, unsigned int, double, double *);
+template m2::ElxTransformEngine::DisplacementFieldType<2>::Pointer m2::ElxTransformEngine::InvertDisplacementField<2>(
+  const DisplacementFieldType<2> *, const itk::ImageBase<2> *, const AffineTransformType<2> *, unsigned int, double, double *, std::size_t *);
+template m2::ElxTransformEngine::DisplacementFieldType<3>::Pointer m2::ElxTransformEngine::InvertDisplacementField<3>(
+  const DisplacementFieldType<3> *, const itk::ImageBase<3> *, const AffineTransformType<3> *, unsigned int, double, double *, std::size_t *);
+template void m2::ElxTransformEngine::InitializeOutputGeometry<2>(const ElxTransformParameterMap &,
+                                                                  itk::ImageBase<2> *);
+template void m2::ElxTransformEngine::InitializeOutputGeometry<3>(const ElxTransformParameterMap &,
+                                                                  itk::ImageBase<3> *);
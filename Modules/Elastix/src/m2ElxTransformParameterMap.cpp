@@ -0,0 +1,113 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxTransformParameterMap.h>
+#include <mitkException.h>
+
+#include <locale>
+#include <sstream>
+
+m2::ElxTransformParameterMap m2::ElxTransformParameterMap::Parse(const std::string &text)
+{
+  ElxTransformParameterMap map;
+  std::istringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line))
+  {
+    // strip comments
+    const auto comment = line.find("//");
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    const auto open = line.find('(');
+    const auto close = line.rfind(')');
+    if (open == std::string::npos || close == std::string::npos || close < open)
+      continue;
+
+    std::vector<std::string> tokens;
+    std::string token;
+    bool quoted = false;
+    for (auto c : line.substr(open + 1, close - open - 1))
+    {
+      if (c == '"')
+      {
+        quoted = !quoted;
+      }
+      else if (!quoted && (c == ' ' || c == '\t' || c == '\r'))
+      {
+        if (!token.empty())
+          tokens.push_back(token);
+        token.clear();
+      }
+      else
+      {
+        token += c;
+      }
+    }
+    if (!token.empty())
+      tokens.push_back(token);
+
+    if (tokens.empty())
+      continue;
+    map.m_Parameters[tokens.front()] = std::vector<std::string>(tokens.begin() + 1, tokens.end());
+  }
+  return map;
+}
+
+bool m2::ElxTransformParameterMap::Has(const std::string &name) const
+{
+  return m_Parameters.find(name) != m_Parameters.end();
+}
+
+std::vector<std::string> m2::ElxTransformParameterMap::GetStrings(const std::string &name) const
+{
+  auto it = m_Parameters.find(name);
+  if (it == m_Parameters.end())
+    return {};
+  return it->second;
+}
+
+std::string m2::ElxTransformParameterMap::GetString(const std::string &name, const std::string &defaultValue) const
+{
+  auto it = m_Parameters.find(name);
+  if (it == m_Parameters.end() || it->second.empty())
+    return defaultValue;
+  return it->second.front();
+}
+
+std::vector<double> m2::ElxTransformParameterMap::GetDoubles(const std::string &name) const
+{
+  std::vector<double> values;
+  for (const auto &s : GetStrings(name))
+  {
+    std::istringstream is(s);
+    is.imbue(std::locale::classic());
+    double v;
+    if (!(is >> v))
+      mitkThrow() << "Parameter (" << name << ") contains the non-numeric value [" << s << "]";
+    values.push_back(v);
+  }
+  return values;
+}
+
+double m2::ElxTransformParameterMap::GetDouble(const std::string &name, double defaultValue) const
+{
+  const auto values = GetDoubles(name);
+  return values.empty() ? defaultValue : values.front();
+}
+
+unsigned int m2::ElxTransformParameterMap::GetDimension() const
+{
+  return static_cast<unsigned int>(GetDouble("FixedImageDimension", 2));
+}
@@ -17,6 +17,8 @@ See LICENSE.txt for details.
 #include <m2ElxUtil.h>
 #include <mitkException.h>
 #include <Poco/Environment.h>
+#include <fstream>
+#include <limits>
 #ifdef _WIN32
 #  include <windows.h>
 #elif defined(__APPLE__)
@@ -148,4 +150,28 @@ std::string m2::ElxUtil::JoinPath(std::vector<std::string> &&args)
   return itksys::SystemTools::CollapseFullPath(itksys::SystemTools::JoinPath(args));
 }
 
+double m2::ElxUtil::GetFinalMetricValue(const std::string &logFilePath)
+{
+  std::ifstream logFile(logFilePath);
+  const std::regex finalMetric{"Final metric value\\s*=\\s*([-+0-9.eE]+)"};
+  double value = std::numeric_limits<double>::infinity();
+  std::string line;
+  std::smatch match;
+  while (std::getline(logFile, line))
+  {
+    if (std::regex_search(line, match, finalMetric))
+    {
+      try
+      {
+        value = std::stod(match[1].str());
+      }
+      catch (std::exception &)
+      {
+        value = std::numeric_limits<double>::infinity();
+      }
+    }
+  }
+  return value;
+}
+
 
@@ -0,0 +1,255 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxWarpKernel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define M2AIA_ELASTIX_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(M2AIA_ELASTIX_AVX2) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace
+{
+  using Parameters2D = m2::ElxWarpKernel::Parameters2D;
+
+  template <class TOutput>
+  TOutput CastPixel(double value, bool round)
+  {
+    // same clamping as itk::ResampleImageFilter::CastPixelWithBoundsChecking
+    if (std::is_integral<TOutput>::value)
+    {
+      if (round)
+        value = std::round(value);
+      value = std::min<double>(std::max<double>(value, std::numeric_limits<TOutput>::lowest()),
+                               std::numeric_limits<TOutput>::max());
+    }
+    return static_cast<TOutput>(value);
+  }
+
+  /**
+   * Interpolates the input at a continuous index like Nearest/LinearInterpolateImageFunction (2D).
+   * @return false if the index is outside of the buffer (itk::InterpolateImageFunction::IsInsideBuffer).
+   */
+  template <class TInput>
+  bool InterpolateAt(const Parameters2D &p, const TInput *input, double cx, double cy, double &value)
+  {
+    const auto w = static_cast<long long>(p.inputSize[0]);
+    const auto h = static_cast<long long>(p.inputSize[1]);
+    if (!(cx >= -0.5 && cx < w - 0.5 && cy >= -0.5 && cy < h - 0.5))
+      return false;
+
+    if (p.nearest)
+    {
+      const auto ix = static_cast<long long>(std::floor(cx + 0.5));
+      const auto iy = static_cast<long long>(std::floor(cy + 0.5));
+      value = input[iy * w + ix];
+      return true;
+    }
+
+    // LinearInterpolateImageFunction::EvaluateOptimized: the special cases of the ITK implementation
+    // (zero distance, upper neighbor outside) are reproduced exactly by the clamping below
+    const auto b0 = std::max(static_cast<long long>(std::floor(cx)), 0ll);
+    const auto b1 = std::max(static_cast<long long>(std::floor(cy)), 0ll);
+    const double d0 = std::max(cx - static_cast<double>(b0), 0.0);
+    const double d1 = std::max(cy - static_cast<double>(b1), 0.0);
+    const auto n0 = std::min(b0 + 1, w - 1);
+    const auto n1 = std::min(b1 + 1, h - 1);
+
+    const double v00 = input[b1 * w + b0];
+    const double v10 = input[b1 * w + n0];
+    const double v01 = input[n1 * w + b0];
+    const double v11 = input[n1 * w + n0];
+    const double valx0 = v00 + (v10 - v00) * d0;
+    const double valx1 = v01 + (v11 - v01) * d0;
+    value = valx0 + (valx1 - valx0) * d1;
+    return true;
+  }
+
+  /**
+   * Continuous input index of an output pixel (ImageBase::TransformIndexToPhysicalPoint,
+   * DisplacementFieldTransform<float, 2>::TransformPoint, ImageBase::TransformPhysicalPointToContinuousIndex).
+   */
+  void ContinuousIndex(const Parameters2D &p, unsigned int x, unsigned int y, double &cx, double &cy)
+  {
+    const auto &m = p.outputIndexToPhysical;
+    const auto &pi = p.inputPhysicalToIndex;
+    const double px = p.outputOrigin[0] + m[0][0] * x + m[0][1] * y;
+    const double py = p.outputOrigin[1] + m[1][0] * x + m[1][1] * y;
+    const auto k = (static_cast<std::size_t>(y) * p.outputSize[0] + x) * 2;
+    const float qx = static_cast<float>(px) + p.displacement[k];
+    const float qy = static_cast<float>(py) + p.displacement[k + 1];
+    const double vx = static_cast<double>(qx) - p.inputOrigin[0];
+    const double vy = static_cast<double>(qy) - p.inputOrigin[1];
+    cx = pi[0][0] * vx + pi[0][1] * vy;
+    cy = pi[1][0] * vx + pi[1][1] * vy;
+  }
+
+#ifdef M2AIA_ELASTIX_SSE2
+  /**
+   * Transforms two pixels at a time; the interpolation itself is done per pixel (SSE2 has no gathers).
+   */
+  template <class TInput>
+  unsigned int InterpolateRowSSE2(
+    const Parameters2D &p, const TInput *input, unsigned int row, double *values, unsigned char *inside)
+  {
+    const auto &m = p.outputIndexToPhysical;
+    const auto &pi = p.inputPhysicalToIndex;
+    const __m128d o0 = _mm_set1_pd(p.outputOrigin[0]), o1 = _mm_set1_pd(p.outputOrigin[1]);
+    const __m128d m00 = _mm_set1_pd(m[0][0]), m01 = _mm_set1_pd(m[0][1]);
+    const __m128d m10 = _mm_set1_pd(m[1][0]), m11 = _mm_set1_pd(m[1][1]);
+    const __m128d i0 = _mm_set1_pd(p.inputOrigin[0]), i1 = _mm_set1_pd(p.inputOrigin[1]);
+    const __m128d p00 = _mm_set1_pd(pi[0][0]), p01 = _mm_set1_pd(pi[0][1]);
+    const __m128d p10 = _mm_set1_pd(pi[1][0]), p11 = _mm_set1_pd(pi[1][1]);
+    const __m128d y = _mm_set1_pd(row);
+    const __m128d my0 = _mm_mul_pd(m01, y), my1 = _mm_mul_pd(m11, y);
+    const float *displacement = p.displacement + static_cast<std::size_t>(row) * p.outputSize[0] * 2;
+
+    const auto n = p.outputSize[0] & ~1u;
+    alignas(16) double cx[2], cy[2];
+    for (unsigned int x = 0; x < n; x += 2)
+    {
+      const __m128d xi = _mm_set_pd(x + 1, x);
+      const __m128d px = _mm_add_pd(_mm_add_pd(o0, _mm_mul_pd(m00, xi)), my0);
+      const __m128d py = _mm_add_pd(_mm_add_pd(o1, _mm_mul_pd(m10, xi)), my1);
+
+      // dx0 dy0 dx1 dy1
+      const __m128 d = _mm_loadu_ps(displacement + 2 * x);
+      const __m128 qx = _mm_add_ps(_mm_cvtpd_ps(px), _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 0, 2, 0)));
+      const __m128 qy = _mm_add_ps(_mm_cvtpd_ps(py), _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 1, 3, 1)));
+      const __m128d vx = _mm_sub_pd(_mm_cvtps_pd(qx), i0);
+      const __m128d vy = _mm_sub_pd(_mm_cvtps_pd(qy), i1);
+      _mm_store_pd(cx, _mm_add_pd(_mm_mul_pd(p00, vx), _mm_mul_pd(p01, vy)));
+      _mm_store_pd(cy, _mm_add_pd(_mm_mul_pd(p10, vx), _mm_mul_pd(p11, vy)));
+
+      for (unsigned int k = 0; k < 2; ++k)
+        inside[x + k] = InterpolateAt(p, input, cx[k], cy[k], values[x + k]);
+    }
+    return n;
+  }
+#endif
+
+  bool CpuSupportsAVX2()
+  {
+#if defined(M2AIA_ELASTIX_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2");
+#elif defined(M2AIA_ELASTIX_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6)
+      return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+  }
+} // namespace
+
+m2::ElxWarpKernel::InstructionSet m2::ElxWarpKernel::GetInstructionSet()
+{
+  static const bool avx2 = CpuSupportsAVX2();
+  if (avx2)
+    return InstructionSet::AVX2;
+#ifdef M2AIA_ELASTIX_SSE2
+  return InstructionSet::SSE2;
+#else
+  return InstructionSet::Scalar;
+#endif
+}
+
+std::string m2::ElxWarpKernel::GetInstructionSetName(InstructionSet instructionSet)
+{
+  switch (instructionSet)
+  {
+    case InstructionSet::AVX2:
+      return "AVX2";
+    case InstructionSet::SSE2:
+      return "SSE2";
+    default:
+      return "Scalar";
+  }
+}
+
+bool m2::ElxWarpKernel::IsSupportedInputType(const std::string &componentType)
+{
+  return componentType == "float" || componentType == "unsigned_short";
+}
+
+template <class TInput, class TOutput>
+void m2::ElxWarpKernel::Warp2D(const Parameters2D &parameters,
+                               const TInput *input,
+                               TOutput *output,
+                               unsigned int firstRow,
+                               unsigned int lastRow,
+                               InstructionSet instructionSet)
+{
+  instructionSet = std::min(instructionSet, GetInstructionSet());
+  const auto w = parameters.outputSize[0];
+  const auto defaultValue = CastPixel<TOutput>(parameters.defaultPixelValue, parameters.round);
+  std::vector<double> values(w);
+  std::vector<unsigned char> inside(w);
+
+  for (auto y = firstRow; y < lastRow; ++y)
+  {
+    unsigned int x = 0;
+#ifdef M2AIA_ELASTIX_AVX2
+    if (instructionSet == InstructionSet::AVX2)
+      x = InterpolateRowAVX2(parameters, input, y, values.data(), inside.data());
+#endif
+#ifdef M2AIA_ELASTIX_SSE2
+    if (instructionSet == InstructionSet::SSE2)
+      x = InterpolateRowSSE2(parameters, input, y, values.data(), inside.data());
+#endif
+    // remaining pixels of the row
+    for (; x < w; ++x)
+    {
+      double cx, cy;
+      ContinuousIndex(parameters, x, y, cx, cy);
+      inside[x] = InterpolateAt(parameters, input, cx, cy, values[x]);
+    }
+
+    auto row = output + static_cast<std::size_t>(y) * w;
+    for (x = 0; x < w; ++x)
+      row[x] = inside[x] ? CastPixel<TOutput>(values[x], parameters.round) : defaultValue;
+  }
+}
+
+#define M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, TOutput)                                                                \
+  template void m2::ElxWarpKernel::Warp2D<TInput, TOutput>(                                                            \
+    const Parameters2D &, const TInput *, TOutput *, unsigned int, unsigned int, InstructionSet);
+
+#define M2_ELX_WARP_KERNEL_INSTANTIATE_OUTPUTS(TInput)                                                                 \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, float)                                                                        \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, double)                                                                       \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, char)                                                                         \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, unsigned char)                                                                \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, short)                                                                        \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, unsigned short)                                                               \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, int)                                                                          \
+  M2_ELX_WARP_KERNEL_INSTANTIATE(TInput, unsigned int)
+
+M2_ELX_WARP_KERNEL_INSTANTIATE_OUTPUTS(float)
+M2_ELX_WARP_KERNEL_INSTANTIATE_OUTPUTS(unsigned short)
@@ -0,0 +1,134 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+// This file is compiled with AVX2 code generation (see CMakeLists.txt, M2AIA_ELASTIX_SIMD).
+// It is only entered after a runtime check of the CPU (ElxWarpKernel::GetInstructionSet).
+#ifdef M2AIA_ELASTIX_AVX2
+
+#include <m2ElxWarpKernel.h>
+
+#include <immintrin.h>
+
+#include <limits>
+#include <type_traits>
+
+namespace
+{
+  /**
+   * Loads 4 input values at 32 bit offsets. Floats are gathered; there is no gather for 16 bit values.
+   */
+  inline __m256d Load(const float *input, __m128i offsets)
+  {
+    return _mm256_cvtps_pd(_mm_i32gather_ps(input, offsets, 4));
+  }
+
+  inline __m256d Load(const unsigned short *input, __m128i offsets)
+  {
+    alignas(16) int o[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(o), offsets);
+    return _mm256_set_pd(input[o[3]], input[o[2]], input[o[1]], input[o[0]]);
+  }
+} // namespace
+
+template <class TInput>
+unsigned int m2::ElxWarpKernel::InterpolateRowAVX2(
+  const Parameters2D &p, const TInput *input, unsigned int row, double *values, unsigned char *inside)
+{
+  // offsets into the input buffer are 32 bit
+  const auto w = p.inputSize[0], h = p.inputSize[1];
+  if (static_cast<unsigned long long>(w) * h > static_cast<unsigned long long>(std::numeric_limits<int>::max()))
+    return 0;
+
+  const auto &m = p.outputIndexToPhysical;
+  const auto &pi = p.inputPhysicalToIndex;
+  const __m256d o0 = _mm256_set1_pd(p.outputOrigin[0]), o1 = _mm256_set1_pd(p.outputOrigin[1]);
+  const __m256d m00 = _mm256_set1_pd(m[0][0]), m01 = _mm256_set1_pd(m[0][1]);
+  const __m256d m10 = _mm256_set1_pd(m[1][0]), m11 = _mm256_set1_pd(m[1][1]);
+  const __m256d i0 = _mm256_set1_pd(p.inputOrigin[0]), i1 = _mm256_set1_pd(p.inputOrigin[1]);
+  const __m256d p00 = _mm256_set1_pd(pi[0][0]), p01 = _mm256_set1_pd(pi[0][1]);
+  const __m256d p10 = _mm256_set1_pd(pi[1][0]), p11 = _mm256_set1_pd(pi[1][1]);
+  const __m256d y = _mm256_set1_pd(row);
+  const __m256d my0 = _mm256_mul_pd(m01, y), my1 = _mm256_mul_pd(m11, y);
+
+  const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0), half = _mm256_set1_pd(0.5);
+  const __m256d lower = _mm256_set1_pd(-0.5);
+  const __m256d upper0 = _mm256_set1_pd(w - 0.5), upper1 = _mm256_set1_pd(h - 0.5);
+  const __m256d last0 = _mm256_set1_pd(w - 1.0), last1 = _mm256_set1_pd(h - 1.0);
+  const __m128i stride = _mm_set1_epi32(static_cast<int>(w));
+
+  const float *displacement = p.displacement + static_cast<std::size_t>(row) * p.outputSize[0] * 2;
+  const auto n = p.outputSize[0] & ~3u;
+  for (unsigned int x = 0; x < n; x += 4)
+  {
+    const __m256d xi = _mm256_set_pd(x + 3, x + 2, x + 1, x);
+    const __m256d px = _mm256_add_pd(_mm256_add_pd(o0, _mm256_mul_pd(m00, xi)), my0);
+    const __m256d py = _mm256_add_pd(_mm256_add_pd(o1, _mm256_mul_pd(m10, xi)), my1);
+
+    // dx0 dy0 dx1 dy1 | dx2 dy2 dx3 dy3
+    const __m256 d = _mm256_loadu_ps(displacement + 2 * x);
+    const __m128 lo = _mm256_castps256_ps128(d), hi = _mm256_extractf128_ps(d, 1);
+    const __m128 qx = _mm_add_ps(_mm256_cvtpd_ps(px), _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128 qy = _mm_add_ps(_mm256_cvtpd_ps(py), _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+    const __m256d vx = _mm256_sub_pd(_mm256_cvtps_pd(qx), i0);
+    const __m256d vy = _mm256_sub_pd(_mm256_cvtps_pd(qy), i1);
+    __m256d cx = _mm256_add_pd(_mm256_mul_pd(p00, vx), _mm256_mul_pd(p01, vy));
+    __m256d cy = _mm256_add_pd(_mm256_mul_pd(p10, vx), _mm256_mul_pd(p11, vy));
+
+    // itk::InterpolateImageFunction::IsInsideBuffer; outside lanes read pixel 0 and are discarded
+    const __m256d mask = _mm256_and_pd(
+      _mm256_and_pd(_mm256_cmp_pd(cx, lower, _CMP_GE_OQ), _mm256_cmp_pd(cx, upper0, _CMP_LT_OQ)),
+      _mm256_and_pd(_mm256_cmp_pd(cy, lower, _CMP_GE_OQ), _mm256_cmp_pd(cy, upper1, _CMP_LT_OQ)));
+    const int insideBits = _mm256_movemask_pd(mask);
+    for (unsigned int k = 0; k < 4; ++k)
+      inside[x + k] = (insideBits >> k) & 1;
+    if (!insideBits)
+      continue;
+    cx = _mm256_and_pd(cx, mask);
+    cy = _mm256_and_pd(cy, mask);
+
+    if (p.nearest)
+    {
+      const __m128i ix = _mm256_cvttpd_epi32(_mm256_floor_pd(_mm256_add_pd(cx, half)));
+      const __m128i iy = _mm256_cvttpd_epi32(_mm256_floor_pd(_mm256_add_pd(cy, half)));
+      _mm256_storeu_pd(values + x, Load(input, _mm_add_epi32(ix, _mm_mullo_epi32(iy, stride))));
+      continue;
+    }
+
+    // same clamping as the scalar kernel (LinearInterpolateImageFunction::EvaluateOptimized)
+    const __m256d b0 = _mm256_max_pd(_mm256_floor_pd(cx), zero);
+    const __m256d b1 = _mm256_max_pd(_mm256_floor_pd(cy), zero);
+    const __m256d d0 = _mm256_max_pd(_mm256_sub_pd(cx, b0), zero);
+    const __m256d d1 = _mm256_max_pd(_mm256_sub_pd(cy, b1), zero);
+    const __m128i x0 = _mm256_cvttpd_epi32(b0);
+    const __m128i x1 = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_add_pd(b0, one), last0));
+    const __m128i r0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(b1), stride);
+    const __m128i r1 = _mm_mullo_epi32(_mm256_cvttpd_epi32(_mm256_min_pd(_mm256_add_pd(b1, one), last1)), stride);
+
+    const __m256d v00 = Load(input, _mm_add_epi32(r0, x0));
+    const __m256d v10 = Load(input, _mm_add_epi32(r0, x1));
+    const __m256d v01 = Load(input, _mm_add_epi32(r1, x0));
+    const __m256d v11 = Load(input, _mm_add_epi32(r1, x1));
+    const __m256d valx0 = _mm256_add_pd(v00, _mm256_mul_pd(_mm256_sub_pd(v10, v00), d0));
+    const __m256d valx1 = _mm256_add_pd(v01, _mm256_mul_pd(_mm256_sub_pd(v11, v01), d0));
+    _mm256_storeu_pd(values + x, _mm256_add_pd(valx0, _mm256_mul_pd(_mm256_sub_pd(valx1, valx0), d1)));
+  }
+  return n;
+}
+
+template unsigned int m2::ElxWarpKernel::InterpolateRowAVX2<float>(
+  const Parameters2D &, const float *, unsigned int, double *, unsigned char *);
+template unsigned int m2::ElxWarpKernel::InterpolateRowAVX2<unsigned short>(
+  const Parameters2D &, const unsigned short *, unsigned int, double *, unsigned char *);
+
+#endif
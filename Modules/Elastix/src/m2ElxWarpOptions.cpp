@@ -0,0 +1,134 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxTransformParameterMap.h>
+#include <m2ElxUtil.h>
+#include <m2ElxWarpOptions.h>
+#include <mitkException.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <locale>
+#include <sstream>
+
+bool m2::ElxWarpOptions::IsDefault() const
+{
+  return regionOrigin.empty() && regionSize.empty() && spacing.empty() && downsampleFactor == 1;
+}
+
+std::string m2::ElxWarpOptions::ApplyToTransformation(const std::string &parameters) const
+{
+  const auto p = ElxTransformParameterMap::Parse(parameters);
+  const auto dimension = p.GetDimension();
+  if (regionOrigin.size() != regionSize.size())
+    mitkThrow() << "Region origin and size differ in length!";
+  if (!regionOrigin.empty() && regionOrigin.size() < dimension)
+    mitkThrow() << "Region does not provide " << dimension << " dimensions";
+  if (!spacing.empty() && spacing.size() < dimension)
+    mitkThrow() << "Output spacing does not provide " << dimension << " dimensions";
+  if (!(downsampleFactor > 0))
+    mitkThrow() << "Downsample factor has to be positive!";
+
+  const auto gridSize = p.GetDoubles("Size");
+  const auto gridSpacing = p.GetDoubles("Spacing");
+  auto gridIndex = p.GetDoubles("Index");
+  auto origin = p.GetDoubles("Origin");
+  auto direction = p.GetDoubles("Direction");
+  if (direction.size() != dimension * dimension || p.GetString("UseDirectionCosines", "true") == "false")
+  {
+    direction.assign(dimension * dimension, 0);
+    for (unsigned int i = 0; i < dimension; ++i)
+      direction[i * dimension + i] = 1;
+  }
+  if (gridIndex.size() != dimension)
+    gridIndex.assign(dimension, 0);
+  if (gridSize.size() != dimension || gridSpacing.size() != dimension || origin.size() != dimension)
+    mitkThrow() << "Transformation does not define a valid output grid!";
+
+  // direction is written column-major: D(i, j) = direction[j * dimension + i]
+  auto D = [&](unsigned int i, unsigned int j) { return direction[j * dimension + i]; };
+
+  std::vector<double> first(dimension, 0), extent(gridSize), outputSpacing(dimension);
+  if (!regionOrigin.empty())
+  {
+    for (unsigned int j = 0; j < dimension; ++j)
+    {
+      // lower edge of the region as continuous index (pixel centers are at integer positions)
+      double start = regionOrigin[j] - 0.5, length = regionSize[j];
+      if (physicalRegion)
+      {
+        // the direction is orthonormal
+        start = 0;
+        for (unsigned int i = 0; i < dimension; ++i)
+          start += D(i, j) * (regionOrigin[i] - origin[i]);
+        start = start / gridSpacing[j] - gridIndex[j];
+        length /= gridSpacing[j];
+      }
+      // all pixels overlapping the region, clipped to the grid
+      constexpr double Epsilon = 1e-6;
+      const auto lower = std::max(0.0, std::floor(start + 0.5 + Epsilon));
+      const auto upper = std::min(gridSize[j], std::ceil(start + length + 0.5 - Epsilon));
+      if (!(upper > lower))
+        mitkThrow() << "Region does not overlap the output grid along axis " << j;
+      first[j] = lower;
+      extent[j] = upper - lower;
+    }
+  }
+
+  std::ostringstream sizeStream, indexStream, originStream, spacingStream;
+  for (auto s : {&sizeStream, &indexStream, &originStream, &spacingStream})
+    s->imbue(std::locale::classic());
+  originStream << std::setprecision(17);
+  spacingStream << std::setprecision(17);
+
+  for (unsigned int j = 0; j < dimension; ++j)
+  {
+    outputSpacing[j] = spacing.empty() ? gridSpacing[j] * downsampleFactor : spacing[j];
+    if (!(outputSpacing[j] > 0))
+      mitkThrow() << "Output spacing has to be positive!";
+  }
+
+  for (unsigned int i = 0; i < dimension; ++i)
+  {
+    // the first output pixel starts at the lower edge of the region
+    double o = origin[i];
+    for (unsigned int j = 0; j < dimension; ++j)
+      o += D(i, j) * (gridSpacing[j] * (gridIndex[j] + first[j] - 0.5) + 0.5 * outputSpacing[j]);
+
+    const auto size = std::max(1.0, std::ceil(extent[i] * gridSpacing[i] / outputSpacing[i] - 1e-6));
+    sizeStream << (i ? " " : "") << static_cast<unsigned int>(size);
+    indexStream << (i ? " " : "") << 0;
+    originStream << (i ? " " : "") << o;
+    spacingStream << (i ? " " : "") << outputSpacing[i];
+  }
+
+  auto result = parameters;
+  ElxUtil::ReplaceParameter(result, "Size", sizeStream.str());
+  ElxUtil::ReplaceParameter(result, "Index", indexStream.str());
+  ElxUtil::ReplaceParameter(result, "Origin", originStream.str());
+  ElxUtil::ReplaceParameter(result, "Spacing", spacingStream.str());
+  return result;
+}
+
+std::vector<double> m2::ElxWarpOptions::GetAntiAliasingSigma(const std::vector<double> &inputSpacing,
+                                                             const std::vector<double> &outputSpacing)
+{
+  // the Gaussian reduces the bandwidth of the input to the Nyquist limit of the output grid
+  std::vector<double> sigma(inputSpacing.size(), 0);
+  for (std::size_t i = 0; i < sigma.size() && i < outputSpacing.size(); ++i)
+    if (outputSpacing[i] > inputSpacing[i])
+      sigma[i] = 0.5 * std::sqrt(outputSpacing[i] * outputSpacing[i] - inputSpacing[i] * inputSpacing[i]);
+  return sigma;
+}
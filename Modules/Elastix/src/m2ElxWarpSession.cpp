@@ -0,0 +1,1880 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#include <m2ElxBSplineInterpolator.h>
+#include <m2ElxUtil.h>
+#include <m2ElxWarpKernel.h>
+#include <m2ElxWarpSession.h>
+
+#include <mitkImageAccessByItk.h>
+#include <mitkITKImageImport.h>
+#include <mitkImageCast.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkImageWriteAccessor.h>
+
+#include <itkImageFileReader.h>
+#include <itkImageIOFactory.h>
+#include <itkImageRegionConstIteratorWithOnlyIndex.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkMultiThreaderBase.h>
+#include <itkResampleImageFilter.h>
+#include <itkSignedMaurerDistanceMapImageFilter.h>
+#include <itkVectorImage.h>
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <type_traits>
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+  constexpr std::size_t InterpolationBlockSize = 4096;
+
+  double SecondsSince(const Clock::time_point &start)
+  {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  /**
+   * Nearest neighbor (order 0) or linear (order 1) interpolator; higher orders are evaluated by ElxBSplineInterpolator.
+   */
+  template <class TImage>
+  typename itk::InterpolateImageFunction<TImage, double>::Pointer CreateInterpolator(unsigned int order)
+  {
+    if (order == 0)
+      return itk::NearestNeighborInterpolateImageFunction<TImage>::New().GetPointer();
+    return itk::LinearInterpolateImageFunction<TImage>::New().GetPointer();
+  }
+
+  template <unsigned int VDimension, class TPrecision>
+  mitk::Image::Pointer Resample(const mitk::Image *image,
+                                const itk::Transform<TPrecision, VDimension, VDimension> *transform,
+                                const itk::ImageBase<VDimension> *reference,
+                                unsigned int interpolationOrder,
+                                double defaultPixelValue,
+                                const std::string &pixelType)
+  {
+    mitk::Image::Pointer result;
+    AccessFixedDimensionByItk(const_cast<mitk::Image *>(image), ([&](auto itkImage) {
+      using InputImageType = typename std::remove_pointer<decltype(itkImage)>::type;
+      m2::ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+        using OutputPixelType = decltype(outputPixel);
+        // ResampleImageFilter truncates interpolated values; integer results are resampled as double and rounded
+        const bool round = std::is_integral<OutputPixelType>::value && interpolationOrder > 0;
+        using ResampleImageType = itk::Image<double, VDimension>;
+        using ResampleFilterType = itk::ResampleImageFilter<InputImageType, ResampleImageType, double, TPrecision>;
+        using OutputImageType = itk::Image<OutputPixelType, VDimension>;
+        if (round)
+        {
+          auto resampler = ResampleFilterType::New();
+          resampler->SetInput(itkImage);
+          resampler->SetTransform(transform);
+          resampler->SetOutputParametersFromImage(reference);
+          resampler->SetInterpolator(CreateInterpolator<InputImageType>(interpolationOrder));
+          resampler->SetDefaultPixelValue(defaultPixelValue);
+          resampler->Update();
+
+          auto output = OutputImageType::New();
+          output->CopyInformation(resampler->GetOutput());
+          output->SetRegions(resampler->GetOutput()->GetLargestPossibleRegion());
+          output->Allocate();
+          const auto n = output->GetLargestPossibleRegion().GetNumberOfPixels();
+          std::transform(resampler->GetOutput()->GetBufferPointer(),
+                         resampler->GetOutput()->GetBufferPointer() + n,
+                         output->GetBufferPointer(),
+                         m2::ElxUtil::CastPixel<OutputPixelType>);
+          result = mitk::GrabItkImageMemory(output.GetPointer());
+          return;
+        }
+
+        using DirectFilterType = itk::ResampleImageFilter<InputImageType, OutputImageType, double, TPrecision>;
+        auto resampler = DirectFilterType::New();
+        resampler->SetInput(itkImage);
+        resampler->SetTransform(transform);
+        resampler->SetOutputParametersFromImage(reference);
+        resampler->SetInterpolator(CreateInterpolator<InputImageType>(interpolationOrder));
+        resampler->SetDefaultPixelValue(m2::ElxUtil::CastPixel<OutputPixelType>(defaultPixelValue));
+        resampler->Update();
+        mitk::CastToMitkImage(resampler->GetOutput(), result);
+      });
+    }), VDimension);
+    return result;
+  }
+
+  template <unsigned int VDimension>
+  itk::LightObject::Pointer CreateTransform(const std::vector<std::string> &transformations,
+                                            const itk::ImageBase<VDimension> *reference,
+                                            m2::ElxTransformEngine::DeformationRepresentation representation,
+                                            std::size_t memoryBudget,
+                                            m2::ElxTransformCache *cache)
+  {
+    using Engine = m2::ElxTransformEngine;
+    using Representation = Engine::DeformationRepresentation;
+
+    // one transform for the whole chain: a single resampling step, independent of the chain length
+    if (Engine::IsLinear(transformations))
+      return Engine::CreateAffineTransform<VDimension>(transformations).GetPointer();
+
+    if (representation == Representation::Automatic)
+      representation = Engine::SelectDeformationRepresentation(
+        reference->GetLargestPossibleRegion().GetNumberOfPixels(), VDimension, memoryBudget);
+
+    switch (representation)
+    {
+      case Representation::CoefficientGrid:
+        MITK_INFO << "Warp session: BSpline coefficient grid";
+        return Engine::CreateCoefficientGridTransform<VDimension>(transformations).GetPointer();
+      case Representation::CompactDisplacementField:
+        MITK_INFO << "Warp session: float32 displacement field";
+        return Engine::CreateDisplacementFieldTransform<VDimension, float>(transformations, reference, cache)
+          .GetPointer();
+      default:
+        MITK_INFO << "Warp session: double displacement field";
+        return Engine::CreateDisplacementFieldTransform<VDimension, double>(transformations, reference, cache)
+          .GetPointer();
+    }
+  }
+
+  /**
+   * Displacement field transform with float32 components (half the memory of double); the field is not
+   * converted to double. Spacing, origin and direction (including z) are taken from the field image.
+   */
+  template <unsigned int VDimension>
+  void InitializeFromDeformationField(const mitk::Image *deformationField,
+                                      itk::LightObject::Pointer &transform,
+                                      itk::LightObject::Pointer &reference)
+  {
+    auto field = m2::ElxTransformEngine::ToDisplacementField<VDimension, float>(deformationField);
+    auto fieldTransform = m2::ElxTransformEngine::DisplacementFieldTransformType<VDimension, float>::New();
+    fieldTransform->SetDisplacementField(field);
+    transform = fieldTransform.GetPointer();
+    reference = field.GetPointer();
+  }
+
+  /**
+   * Same size, origin, spacing and direction; sampled fields and their reference grids may be different objects.
+   */
+  template <unsigned int VDimension>
+  bool IsSameGrid(const itk::ImageBase<VDimension> *a, const itk::ImageBase<VDimension> *b)
+  {
+    constexpr double Tolerance = 1e-6;
+    if (a->GetLargestPossibleRegion() != b->GetLargestPossibleRegion())
+      return false;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      if (std::abs(a->GetSpacing()[i] - b->GetSpacing()[i]) > Tolerance * b->GetSpacing()[i] ||
+          std::abs(a->GetOrigin()[i] - b->GetOrigin()[i]) > Tolerance * b->GetSpacing()[i])
+        return false;
+      for (unsigned int j = 0; j < VDimension; ++j)
+        if (std::abs(a->GetDirection()[i][j] - b->GetDirection()[i][j]) > Tolerance)
+          return false;
+    }
+    return true;
+  }
+
+  /**
+   * Float32 field of a 2D displacement field transform sampled on the reference grid, as read by ElxWarpKernel.
+   * Float fields are shared; double fields are converted once if the copy fits into the memory budget next to
+   * the double field. Returns nullptr for other transforms.
+   */
+  m2::ElxTransformEngine::DisplacementFieldType<2, float>::ConstPointer CreateKernelField(
+    const itk::LightObject *transform, const itk::ImageBase<2> *reference, std::size_t memoryBudget)
+  {
+    using FloatFieldType = m2::ElxTransformEngine::DisplacementFieldType<2, float>;
+    if (auto floatTransform = dynamic_cast<const m2::ElxTransformEngine::DisplacementFieldTransformType<2, float> *>(transform))
+    {
+      const auto field = floatTransform->GetDisplacementField();
+      if (!field || !IsSameGrid<2>(field, reference))
+        return nullptr;
+      return field;
+    }
+
+    const auto doubleTransform = dynamic_cast<const m2::ElxTransformEngine::DisplacementFieldTransformType<2, double> *>(transform);
+    if (!doubleTransform)
+      return nullptr;
+    const auto source = doubleTransform->GetDisplacementField();
+    if (!source || !IsSameGrid<2>(source, reference))
+      return nullptr;
+    const auto n = source->GetLargestPossibleRegion().GetNumberOfPixels();
+    if (n * 2 * (sizeof(double) + sizeof(float)) > memoryBudget)
+      return nullptr;
+
+    auto field = FloatFieldType::New();
+    field->CopyInformation(source);
+    field->SetRegions(source->GetLargestPossibleRegion());
+    field->Allocate();
+    std::transform(source->GetBufferPointer(),
+                   source->GetBufferPointer() + n,
+                   field->GetBufferPointer(),
+                   [](const auto &v) {
+                     FloatFieldType::PixelType result;
+                     result.CastFrom(v);
+                     return result;
+                   });
+    return field.GetPointer();
+  }
+
+  /**
+   * Physical point to continuous index mapping of an input image.
+   */
+  template <unsigned int VDimension>
+  struct InputGrid
+  {
+    itk::Matrix<double, VDimension, VDimension> physicalToIndex;
+    itk::Vector<double, VDimension> origin;
+    itk::SizeValueType size[VDimension];
+    std::size_t stride[VDimension];
+  };
+
+  template <unsigned int VDimension>
+  InputGrid<VDimension> GetInputGrid(const mitk::Image *image)
+  {
+    InputGrid<VDimension> grid;
+    const auto geometry = image->GetGeometry();
+    const auto matrix = geometry->GetIndexToWorldTransform()->GetMatrix();
+    itk::Matrix<double, VDimension, VDimension> indexToPhysical;
+    std::size_t stride = 1;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      for (unsigned int j = 0; j < VDimension; ++j)
+        indexToPhysical[i][j] = matrix[i][j];
+      grid.origin[i] = geometry->GetOrigin()[i];
+      grid.size[i] = image->GetDimensions()[i];
+      grid.stride[i] = stride;
+      stride *= grid.size[i];
+    }
+    grid.physicalToIndex = indexToPhysical.GetInverse();
+    return grid;
+  }
+
+  /**
+   * Grid of a buffered region of an ITK image; indices are relative to the start of the region.
+   */
+  template <unsigned int VDimension>
+  InputGrid<VDimension> GetInputGrid(const itk::ImageBase<VDimension> *image, const itk::ImageRegion<VDimension> &region)
+  {
+    InputGrid<VDimension> grid;
+    grid.physicalToIndex = image->GetPhysicalPointToIndex();
+    std::size_t stride = 1;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      grid.origin[i] = image->GetOrigin()[i];
+      grid.size[i] = region.GetSize(i);
+      grid.stride[i] = stride;
+      stride *= grid.size[i];
+    }
+    return grid;
+  }
+
+  /**
+   * Bounds of itk::InterpolateImageFunction::IsInsideBuffer (and ElxWarpKernel): [-0.5, size - 0.5).
+   */
+  inline bool IsInsideBuffer(double continuousIndex, itk::SizeValueType size)
+  {
+    return continuousIndex >= -0.5 && continuousIndex < size - 0.5;
+  }
+
+  /**
+   * Source pixels and interpolation weights of the output pixels of one tile (structure of arrays).
+   * Output pixels outside of the input image are not listed.
+   */
+  struct TileMapping
+  {
+    unsigned int weightsPerPixel = 1;
+    std::vector<std::size_t> output;
+    std::vector<std::size_t> input;
+    std::vector<double> weights;
+  };
+
+  /**
+   * Continuous input indices of the output pixels of one tile (VDimension values per pixel, in iteration order).
+   */
+  template <unsigned int VDimension, class TPrecision>
+  void ComputeContinuousIndices(const itk::Transform<TPrecision, VDimension, VDimension> *transform,
+                                const itk::ImageBase<VDimension> *reference,
+                                const itk::ImageRegion<VDimension> &tile,
+                                const InputGrid<VDimension> &grid,
+                                std::vector<double> &indices)
+  {
+    indices.resize(tile.GetNumberOfPixels() * VDimension);
+    typename itk::ImageBase<VDimension>::PointType p;
+    typename itk::Transform<TPrecision, VDimension, VDimension>::InputPointType tp;
+    auto ci = indices.data();
+    itk::ImageRegionConstIteratorWithOnlyIndex<itk::ImageBase<VDimension>> it(reference, tile);
+    for (; !it.IsAtEnd(); ++it, ci += VDimension)
+    {
+      reference->TransformIndexToPhysicalPoint(it.GetIndex(), p);
+      for (unsigned int i = 0; i < VDimension; ++i)
+        tp[i] = p[i];
+      const auto q = transform->TransformPoint(tp);
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        double v = 0;
+        for (unsigned int j = 0; j < VDimension; ++j)
+          v += grid.physicalToIndex[i][j] * (q[j] - grid.origin[j]);
+        ci[i] = v;
+      }
+    }
+  }
+
+  /**
+   * Source pixels and interpolation weights from the continuous indices of a tile.
+   * The input buffer starts at inputStart and has the size and strides of grid; output offsets
+   * are relative to outputBuffer. Buffers that contain the bounding box of all inside indices give
+   * the same result as the whole input image. Order 0 is nearest neighbor and order 1 linear; for
+   * B-spline orders (2-5) the (order + 1)^VDimension weights of the coefficients are listed, with
+   * mirrored indices (see ElxBSplineInterpolator), which requires the buffer to be the whole image.
+   */
+  template <unsigned int VDimension>
+  void MapContinuousIndices(const itk::ImageBase<VDimension> *reference,
+                            const itk::ImageRegion<VDimension> &tile,
+                            const std::vector<double> &indices,
+                            const itk::ImageRegion<VDimension> &outputBuffer,
+                            const itk::Index<VDimension> &inputStart,
+                            const InputGrid<VDimension> &grid,
+                            unsigned int order,
+                            TileMapping &mapping)
+  {
+    const auto n = tile.GetNumberOfPixels();
+    mapping.weightsPerPixel = 1;
+    for (unsigned int i = 0; i < VDimension && order > 0; ++i)
+      mapping.weightsPerPixel *= order + 1;
+    mapping.output.clear();
+    mapping.input.clear();
+    mapping.weights.clear();
+    mapping.output.reserve(n);
+    mapping.input.reserve(n * mapping.weightsPerPixel);
+    mapping.weights.reserve(n * mapping.weightsPerPixel);
+
+    double ci[VDimension];
+    auto source = indices.data();
+    itk::ImageRegionConstIteratorWithOnlyIndex<itk::ImageBase<VDimension>> it(reference, tile);
+    for (; !it.IsAtEnd(); ++it, source += VDimension)
+    {
+      bool inside = true;
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        ci[i] = source[i] - inputStart[i];
+        inside = inside && IsInsideBuffer(ci[i], grid.size[i]);
+      }
+      if (!inside)
+        continue;
+
+      const auto index = it.GetIndex();
+      std::size_t outputOffset = 0, outputStride = 1;
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        outputOffset += (index[i] - outputBuffer.GetIndex(i)) * outputStride;
+        outputStride *= outputBuffer.GetSize(i);
+      }
+      mapping.output.push_back(outputOffset);
+
+      if (order == 0)
+      {
+        std::size_t offset = 0;
+        for (unsigned int i = 0; i < VDimension; ++i)
+        {
+          const auto k = static_cast<itk::IndexValueType>(std::floor(ci[i] + 0.5));
+          offset += std::min<itk::IndexValueType>(std::max<itk::IndexValueType>(k, 0), grid.size[i] - 1) * grid.stride[i];
+        }
+        mapping.input.push_back(offset);
+        mapping.weights.push_back(1.0);
+        continue;
+      }
+
+      if (order > 1)
+      {
+        // tensor product of the weights per axis; x runs fastest
+        const auto k = order + 1;
+        long long start[VDimension];
+        double axisWeights[VDimension][m2::ElxBSplineInterpolator::MaximumOrder + 1];
+        std::size_t axisOffsets[VDimension][m2::ElxBSplineInterpolator::MaximumOrder + 1];
+        for (unsigned int i = 0; i < VDimension; ++i)
+        {
+          m2::ElxBSplineInterpolator::ComputeWeights(ci[i], order, start[i], axisWeights[i]);
+          for (unsigned int j = 0; j < k; ++j)
+            axisOffsets[i][j] = static_cast<std::size_t>(
+                                  m2::ElxBSplineInterpolator::MirrorIndex(start[i] + j, grid.size[i])) *
+                                grid.stride[i];
+        }
+        for (unsigned int corner = 0; corner < mapping.weightsPerPixel; ++corner)
+        {
+          double w = 1;
+          std::size_t offset = 0;
+          for (unsigned int i = 0, rest = corner; i < VDimension; ++i, rest /= k)
+          {
+            w *= axisWeights[i][rest % k];
+            offset += axisOffsets[i][rest % k];
+          }
+          mapping.input.push_back(offset);
+          mapping.weights.push_back(w);
+        }
+        continue;
+      }
+
+      itk::IndexValueType base[VDimension];
+      double fraction[VDimension];
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        base[i] = static_cast<itk::IndexValueType>(std::floor(ci[i]));
+        fraction[i] = ci[i] - base[i];
+      }
+      for (unsigned int corner = 0; corner < mapping.weightsPerPixel; ++corner)
+      {
+        double w = 1;
+        std::size_t offset = 0;
+        for (unsigned int i = 0; i < VDimension; ++i)
+        {
+          const bool upper = (corner >> i) & 1;
+          const auto k = std::min<itk::IndexValueType>(std::max<itk::IndexValueType>(base[i] + upper, 0), grid.size[i] - 1);
+          w *= upper ? fraction[i] : 1.0 - fraction[i];
+          offset += k * grid.stride[i];
+        }
+        mapping.input.push_back(offset);
+        mapping.weights.push_back(w);
+      }
+    }
+  }
+
+  template <unsigned int VDimension, class TPrecision>
+  void ComputeMapping(const itk::Transform<TPrecision, VDimension, VDimension> *transform,
+                      const itk::ImageBase<VDimension> *reference,
+                      const itk::ImageRegion<VDimension> &tile,
+                      const InputGrid<VDimension> &grid,
+                      unsigned int order,
+                      TileMapping &mapping)
+  {
+    std::vector<double> indices;
+    ComputeContinuousIndices<VDimension, TPrecision>(transform, reference, tile, grid, indices);
+    itk::Index<VDimension> start;
+    start.Fill(0);
+    MapContinuousIndices<VDimension>(
+      reference, tile, indices, reference->GetLargestPossibleRegion(), start, grid, order, mapping);
+  }
+
+  /**
+   * B-spline coefficients of all components of an image (interleaved, double), see
+   * ElxBSplineInterpolator::ComputeCoefficients. For 2D transformations the slices of a stack are filtered separately.
+   */
+  std::vector<double> ComputeCoefficients(const mitk::Image *image, unsigned int dimension, unsigned int order)
+  {
+    const auto components = image->GetPixelType().GetNumberOfComponents();
+    unsigned int size[3] = {1, 1, 1};
+    std::size_t n = components;
+    for (unsigned int i = 0; i < image->GetDimension() && i < 3; ++i)
+    {
+      size[i] = image->GetDimensions()[i];
+      n *= size[i];
+    }
+    std::vector<double> coefficients(n);
+    mitk::ImageReadAccessor acc(image);
+    m2::ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+      using PixelType = decltype(pixel);
+      const auto data = static_cast<const PixelType *>(acc.GetData());
+      std::copy(data, data + n, coefficients.begin());
+    });
+    m2::ElxBSplineInterpolator::ComputeCoefficients(coefficients.data(), components, size, dimension, order);
+    return coefficients;
+  }
+
+  /**
+   * Tiles of at most side pixels per axis that cover the region.
+   */
+  template <unsigned int VDimension>
+  std::vector<itk::ImageRegion<VDimension>> SplitRegion(const itk::ImageRegion<VDimension> &region, itk::SizeValueType side)
+  {
+    std::vector<itk::ImageRegion<VDimension>> tiles;
+    itk::ImageRegion<VDimension> tile;
+    itk::Index<VDimension> position = region.GetIndex();
+    while (true)
+    {
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        tile.SetIndex(i, position[i]);
+        tile.SetSize(i, std::min<itk::SizeValueType>(side, region.GetUpperIndex()[i] + 1 - position[i]));
+      }
+      tiles.push_back(tile);
+      unsigned int axis = 0;
+      for (; axis < VDimension; ++axis)
+      {
+        position[axis] += side;
+        if (position[axis] <= region.GetUpperIndex()[axis])
+          break;
+        position[axis] = region.GetIndex(axis);
+      }
+      if (axis == VDimension)
+        break;
+    }
+    return tiles;
+  }
+
+  /**
+   * Applies the mapping to interleaved components, blocked by components to keep the working set small.
+   */
+  template <class TInput, class TOutput>
+  void ApplyMapping(const TileMapping &mapping, const TInput *input, TOutput *output, unsigned int components)
+  {
+    constexpr unsigned int BlockSize = 64;
+    const auto k = mapping.weightsPerPixel;
+    const auto n = mapping.output.size();
+    for (unsigned int c0 = 0; c0 < components; c0 += BlockSize)
+    {
+      const auto c1 = std::min(components, c0 + BlockSize);
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        const auto *w = &mapping.weights[i * k];
+        const auto *src = &mapping.input[i * k];
+        auto *dst = output + mapping.output[i] * components;
+        for (auto c = c0; c < c1; ++c)
+        {
+          double value = 0;
+          for (unsigned int j = 0; j < k; ++j)
+            value += w[j] * input[src[j] * components + c];
+          dst[c] = m2::ElxUtil::CastPixel<TOutput>(value);
+        }
+      }
+    }
+  }
+
+  /**
+   * IndexToWorld transform of an output region in the M2aia layout; the z-axis of 2D transformations is taken
+   * from the input.
+   */
+  template <unsigned int VDimension>
+  mitk::AffineTransform3D::Pointer CreateOutputTransform(const itk::ImageBase<VDimension> *reference,
+                                                         const itk::Index<VDimension> &index,
+                                                         const mitk::Image *input)
+  {
+    typename itk::ImageBase<VDimension>::PointType origin;
+    reference->TransformIndexToPhysicalPoint(index, origin);
+    mitk::Matrix3D matrix = input->GetGeometry()->GetIndexToWorldTransform()->GetMatrix();
+    mitk::Vector3D offset = input->GetGeometry()->GetOrigin().GetVectorFromOrigin();
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      offset[i] = origin[i];
+      for (unsigned int j = 0; j < VDimension; ++j)
+        matrix[i][j] = reference->GetDirection()[i][j] * reference->GetSpacing()[j];
+      for (unsigned int j = VDimension; j < 3; ++j)
+        matrix[i][j] = matrix[j][i] = 0;
+    }
+    auto transform = mitk::AffineTransform3D::New();
+    transform->SetMatrix(matrix);
+    transform->SetOffset(offset);
+    return transform;
+  }
+
+  /**
+   * Output image in the M2aia layout (3D; slices of the input for 2D transformations, see WarpSlices).
+   */
+  template <class TOutput, unsigned int VDimension>
+  mitk::Image::Pointer CreateOutputImage(const itk::ImageBase<VDimension> *reference,
+                                         const itk::ImageRegion<VDimension> &region,
+                                         unsigned int components,
+                                         const mitk::Image *input,
+                                         double defaultPixelValue,
+                                         unsigned int slices = 1)
+  {
+    const auto &size = region.GetSize();
+    unsigned int dims[3] = {1, 1, slices};
+    for (unsigned int i = 0; i < VDimension; ++i)
+      dims[i] = size[i];
+
+    auto image = mitk::Image::New();
+    if (components > 1)
+      image->Initialize(mitk::MakePixelType<itk::VectorImage<TOutput, 3>>(components), 3, dims);
+    else
+      image->Initialize(mitk::MakePixelType<TOutput, TOutput, 1>(), 3, dims);
+    image->GetGeometry()->SetIndexToWorldTransform(
+      CreateOutputTransform<VDimension>(reference, region.GetIndex(), input));
+
+    mitk::ImageWriteAccessor acc(image);
+    std::fill_n(static_cast<TOutput *>(acc.GetData()),
+                static_cast<std::size_t>(dims[0]) * dims[1] * dims[2] * components,
+                m2::ElxUtil::CastPixel<TOutput>(defaultPixelValue));
+    return image;
+  }
+
+  /** Pixels added around the bounding box of a label; the distance map of a label is known within. */
+  constexpr itk::IndexValueType LabelMargin = 2;
+
+  /**
+   * One label of a label image: its bounding box in the input grid (expanded by LabelMargin and clipped)
+   * and, for smooth interpolation, the signed distance to the label boundary within the box.
+   */
+  template <unsigned int VDimension>
+  struct LabelBox
+  {
+    double value = 0;
+    itk::ImageRegion<VDimension> box;
+    std::vector<float> distance;
+  };
+
+  template <unsigned int VDimension, class TLabel>
+  std::vector<LabelBox<VDimension>> GetLabelBoxes(const TLabel *labels, const InputGrid<VDimension> &grid, bool smooth)
+  {
+    using Bounds = std::pair<itk::Index<VDimension>, itk::Index<VDimension>>;
+    std::map<TLabel, Bounds> bounds;
+    std::mutex boundsMutex;
+
+    // bounding boxes of all labels in one pass over the image, in parallel over blocks of rows
+    constexpr itk::SizeValueType RowBlockSize = 64;
+    itk::SizeValueType rows = 1;
+    for (unsigned int i = 1; i < VDimension; ++i)
+      rows *= grid.size[i];
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      (rows + RowBlockSize - 1) / RowBlockSize,
+      [&](itk::SizeValueType block) {
+        std::map<TLabel, Bounds> local;
+        const auto lastRow = std::min(rows, (block + 1) * RowBlockSize);
+        for (auto row = block * RowBlockSize; row < lastRow; ++row)
+        {
+          itk::Index<VDimension> index;
+          auto r = row;
+          for (unsigned int i = 1; i < VDimension; ++i)
+          {
+            index[i] = r % grid.size[i];
+            r /= grid.size[i];
+          }
+          const auto line = labels + row * grid.size[0];
+          for (itk::SizeValueType x = 0; x < grid.size[0]; ++x)
+          {
+            if (line[x] == 0)
+              continue;
+            index[0] = x;
+            auto it = local.find(line[x]);
+            if (it == local.end())
+            {
+              local.emplace(line[x], Bounds(index, index));
+              continue;
+            }
+            for (unsigned int i = 0; i < VDimension; ++i)
+            {
+              it->second.first[i] = std::min(it->second.first[i], index[i]);
+              it->second.second[i] = std::max(it->second.second[i], index[i]);
+            }
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(boundsMutex);
+        for (const auto &kv : local)
+        {
+          auto it = bounds.find(kv.first);
+          if (it == bounds.end())
+          {
+            bounds.insert(kv);
+            continue;
+          }
+          for (unsigned int i = 0; i < VDimension; ++i)
+          {
+            it->second.first[i] = std::min(it->second.first[i], kv.second.first[i]);
+            it->second.second[i] = std::max(it->second.second[i], kv.second.second[i]);
+          }
+        }
+      },
+      nullptr);
+
+    std::vector<LabelBox<VDimension>> boxes;
+    for (const auto &kv : bounds)
+    {
+      LabelBox<VDimension> label;
+      label.value = kv.first;
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        const auto lower = std::max<itk::IndexValueType>(kv.second.first[i] - LabelMargin, 0);
+        const auto upper = std::min<itk::IndexValueType>(kv.second.second[i] + LabelMargin, grid.size[i] - 1);
+        label.box.SetIndex(i, lower);
+        label.box.SetSize(i, upper - lower + 1);
+      }
+      boxes.push_back(std::move(label));
+    }
+    if (!smooth)
+      return boxes;
+
+    // signed distance maps within the boxes, one label per work unit
+    using MaskType = itk::Image<unsigned char, VDimension>;
+    using DistanceType = itk::Image<float, VDimension>;
+    itk::MultiThreaderBase::New()->ParallelizeArray(
+      0,
+      boxes.size(),
+      [&](itk::SizeValueType i) {
+        auto &label = boxes[i];
+        typename MaskType::RegionType maskRegion;
+        maskRegion.SetSize(label.box.GetSize());
+        auto mask = MaskType::New();
+        mask->SetRegions(maskRegion);
+        mask->Allocate();
+
+        std::size_t foreground = 0;
+        itk::ImageRegionIteratorWithIndex<MaskType> it(mask, maskRegion);
+        for (; !it.IsAtEnd(); ++it)
+        {
+          std::size_t offset = 0;
+          for (unsigned int d = 0; d < VDimension; ++d)
+            offset += (label.box.GetIndex(d) + it.GetIndex()[d]) * grid.stride[d];
+          const bool inside = labels[offset] == static_cast<TLabel>(label.value);
+          it.Set(inside);
+          foreground += inside;
+        }
+
+        // a label that fills its (clipped) box has no boundary inside of it
+        if (foreground == maskRegion.GetNumberOfPixels())
+        {
+          label.distance.assign(foreground, -1.0f);
+          return;
+        }
+
+        auto filter = itk::SignedMaurerDistanceMapImageFilter<MaskType, DistanceType>::New();
+        filter->SetInput(mask);
+        filter->SetUseImageSpacing(false);
+        filter->SetSquaredDistance(false);
+        filter->SetInsideIsPositive(false);
+        filter->SetBackgroundValue(0);
+        filter->SetNumberOfWorkUnits(1);
+        filter->Update();
+
+        // boundary pixels of the label are 0 and their outer neighbors 1: the zero level is moved halfway between
+        const auto distance = filter->GetOutput()->GetBufferPointer();
+        label.distance.resize(maskRegion.GetNumberOfPixels());
+        std::transform(distance, distance + label.distance.size(), label.distance.begin(), [](float d) {
+          return d - 0.5f;
+        });
+      },
+      nullptr);
+    return boxes;
+  }
+
+  /**
+   * Linearly interpolated signed distance of a label at a continuous input index.
+   * @return false if the index is outside of the box of the label (i.e. outside of the label).
+   */
+  template <unsigned int VDimension>
+  bool InterpolateDistance(const LabelBox<VDimension> &label, const double *ci, double &distance)
+  {
+    double local[VDimension];
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      local[i] = ci[i] - label.box.GetIndex(i);
+      if (local[i] < 0 || local[i] > label.box.GetSize(i) - 1.0)
+        return false;
+    }
+
+    distance = 0;
+    for (unsigned int corner = 0; corner < (1u << VDimension); ++corner)
+    {
+      double w = 1;
+      std::size_t offset = 0, stride = 1;
+      for (unsigned int i = 0; i < VDimension; ++i)
+      {
+        const auto base = static_cast<itk::SizeValueType>(local[i]);
+        const bool upper = (corner >> i) & 1;
+        const auto k = std::min<itk::SizeValueType>(base + upper, label.box.GetSize(i) - 1);
+        const double fraction = local[i] - base;
+        w *= upper ? fraction : 1.0 - fraction;
+        offset += k * stride;
+        stride *= label.box.GetSize(i);
+      }
+      distance += w * label.distance[offset];
+    }
+    return true;
+  }
+} // namespace
+
+m2::ElxWarpSession::Pointer m2::ElxWarpSession::CreateFromTransformations(
+  const std::vector<std::string> &transformations,
+  ElxTransformEngine::DeformationRepresentation representation,
+  std::size_t memoryBudget,
+  ElxTransformCache *cache)
+{
+  const auto start = Clock::now();
+  Pointer session(new ElxWarpSession());
+  const auto parameters = ElxTransformParameterMap::Parse(transformations.back());
+  session->m_Dimension = ElxTransformEngine::GetDimension(transformations);
+  session->m_Interpolator = parameters.GetString("ResampleInterpolator", "FinalBSplineInterpolator");
+  session->m_SplineOrder = static_cast<unsigned int>(parameters.GetDouble("FinalBSplineInterpolationOrder", 3));
+  session->m_DefaultPixelValue = parameters.GetDouble("DefaultPixelValue", 0);
+
+  // geometry only, the buffer is never allocated
+  if (session->m_Dimension == 3)
+  {
+    auto reference = itk::Image<unsigned char, 3>::New();
+    ElxTransformEngine::InitializeOutputGeometry<3>(parameters, reference);
+    session->m_Transform = CreateTransform<3>(transformations, reference, representation, memoryBudget, cache);
+    session->m_Reference = reference.GetPointer();
+  }
+  else
+  {
+    auto reference = itk::Image<unsigned char, 2>::New();
+    ElxTransformEngine::InitializeOutputGeometry<2>(parameters, reference);
+    session->m_Transform = CreateTransform<2>(transformations, reference, representation, memoryBudget, cache);
+    session->m_Reference = reference.GetPointer();
+    session->m_KernelField = CreateKernelField(session->m_Transform, reference, memoryBudget);
+  }
+
+  session->m_SetupTime = SecondsSince(start);
+  MITK_INFO << "Warp session prepared in " << session->m_SetupTime << " s";
+  return session;
+}
+
+m2::ElxWarpSession::Pointer m2::ElxWarpSession::CreateFromDeformationField(const mitk::Image *deformationField)
+{
+  if (!deformationField)
+    mitkThrow() << "Deformation field is null!";
+
+  // the number of components defines the dimension; 2D fields may be stored with a single slice
+  const auto dimension = deformationField->GetPixelType().GetNumberOfComponents();
+  if ((dimension != 2 && dimension != 3) || deformationField->GetDimension() < dimension ||
+      (dimension == 2 && deformationField->GetDimension() == 3 && deformationField->GetDimensions()[2] != 1))
+    mitkThrow() << "Deformation field [" << ElxUtil::GetShape(deformationField) << "] with " << dimension
+                << " components is not supported.";
+
+  const auto start = Clock::now();
+  Pointer session(new ElxWarpSession());
+  session->m_Dimension = dimension;
+  session->m_Interpolator = "FinalLinearInterpolator";
+  if (dimension == 3)
+    InitializeFromDeformationField<3>(deformationField, session->m_Transform, session->m_Reference);
+  else
+  {
+    InitializeFromDeformationField<2>(deformationField, session->m_Transform, session->m_Reference);
+    session->m_KernelField = CreateKernelField(session->m_Transform,
+                                               dynamic_cast<const itk::ImageBase<2> *>(session->m_Reference.GetPointer()),
+                                               std::numeric_limits<std::size_t>::max());
+  }
+
+  session->m_SetupTime = SecondsSince(start);
+  MITK_INFO << "Warp session prepared in " << session->m_SetupTime << " s";
+  return session;
+}
+
+unsigned int m2::ElxWarpSession::GetInterpolationOrder(const std::string &pixelType, int interpolationOrder) const
+{
+  if (interpolationOrder > static_cast<int>(ElxBSplineInterpolator::MaximumOrder))
+    mitkThrow() << "Interpolation order " << interpolationOrder << " is not supported (0-"
+                << ElxBSplineInterpolator::MaximumOrder << ")";
+  if (interpolationOrder >= 0)
+    return interpolationOrder;
+
+  // settings of the transform parameter file
+  if (m_Interpolator == "FinalNearestNeighborInterpolator")
+    return 0;
+  if (m_Interpolator == "FinalLinearInterpolator")
+    return 1;
+  return std::min(m_SplineOrder, ElxBSplineInterpolator::MaximumOrder);
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpWithKernel(const mitk::Image *image,
+                                                        const std::string &pixelType,
+                                                        unsigned int interpolationOrder) const
+{
+  // 2D scalar float/uint16 images warped by the displacement field of the output grid
+  if (m_Dimension != 2 || !m_KernelField || interpolationOrder > 1)
+    return nullptr;
+  const bool nearest = interpolationOrder == 0;
+  const auto inputType = image->GetPixelType().GetComponentTypeAsString();
+  if (image->GetPixelType().GetNumberOfComponents() != 1 || !ElxWarpKernel::IsSupportedInputType(inputType))
+    return nullptr;
+
+  const auto field = m_KernelField.GetPointer();
+  const auto &region = field->GetLargestPossibleRegion();
+  const auto &indexToPhysical = field->GetIndexToPhysicalPoint();
+  const auto grid = GetInputGrid<2>(image);
+
+  ElxWarpKernel::Parameters2D parameters;
+  parameters.displacement = reinterpret_cast<const float *>(field->GetBufferPointer());
+  parameters.nearest = nearest;
+  parameters.round = true;
+  parameters.defaultPixelValue = m_DefaultPixelValue;
+  for (unsigned int i = 0; i < 2; ++i)
+  {
+    parameters.outputSize[i] = region.GetSize(i);
+    parameters.outputOrigin[i] = field->GetOrigin()[i];
+    parameters.inputSize[i] = grid.size[i];
+    parameters.inputOrigin[i] = grid.origin[i];
+    for (unsigned int j = 0; j < 2; ++j)
+    {
+      parameters.outputIndexToPhysical[i][j] = indexToPhysical[i][j];
+      parameters.inputPhysicalToIndex[i][j] = grid.physicalToIndex[i][j];
+    }
+  }
+
+  constexpr unsigned int RowBlockSize = 16;
+  const auto rows = parameters.outputSize[1];
+  const auto instructionSet = ElxWarpKernel::GetInstructionSet();
+  mitk::Image::Pointer result;
+  mitk::ImageReadAccessor acc(image);
+  ElxUtil::AccessByPixelTypeName(inputType, [&](auto inputPixel) {
+    using InputPixelType = decltype(inputPixel);
+    // the kernel is instantiated for the supported input types only
+    if constexpr (std::is_same<InputPixelType, float>::value || std::is_same<InputPixelType, unsigned short>::value)
+    {
+      ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+        using OutputImageType = itk::Image<decltype(outputPixel), 2>;
+        auto output = OutputImageType::New();
+        output->SetRegions(region);
+        output->SetOrigin(field->GetOrigin());
+        output->SetSpacing(field->GetSpacing());
+        output->SetDirection(field->GetDirection());
+        output->Allocate();
+
+        const auto input = static_cast<const InputPixelType *>(acc.GetData());
+        itk::MultiThreaderBase::New()->ParallelizeArray(
+          0,
+          (rows + RowBlockSize - 1) / RowBlockSize,
+          [&](itk::SizeValueType block) {
+            const auto first = static_cast<unsigned int>(block) * RowBlockSize;
+            ElxWarpKernel::Warp2D(parameters,
+                                  input,
+                                  output->GetBufferPointer(),
+                                  first,
+                                  std::min(rows, first + RowBlockSize),
+                                  instructionSet);
+          },
+          nullptr);
+        result = mitk::GrabItkImageMemory(output.GetPointer());
+      });
+    }
+  });
+  return result;
+}
+
+template <unsigned int VDimension>
+mitk::Image::Pointer m2::ElxWarpSession::WarpBSplineImpl(const mitk::Image *image,
+                                                         const std::string &pixelType,
+                                                         unsigned int interpolationOrder) const
+{
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  const auto transformDouble = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer());
+  const auto transformFloat = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer());
+  if (!reference || (!transformDouble && !transformFloat))
+    mitkThrow() << "Warp session is not initialized!";
+
+  // coefficients are computed once for the image (parallel recursive prefilter)
+  const auto interpolator = ElxBSplineInterpolator::New(image, VDimension, interpolationOrder);
+  const auto grid = GetInputGrid<VDimension>(image);
+  const auto &outputRegion = reference->GetLargestPossibleRegion();
+
+  mitk::Image::Pointer result;
+  ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+    using OutputPixelType = decltype(outputPixel);
+    using OutputImageType = itk::Image<OutputPixelType, VDimension>;
+    auto output = OutputImageType::New();
+    output->SetRegions(outputRegion);
+    output->SetOrigin(reference->GetOrigin());
+    output->SetSpacing(reference->GetSpacing());
+    output->SetDirection(reference->GetDirection());
+    output->Allocate();
+    output->FillBuffer(ElxUtil::CastPixel<OutputPixelType>(m_DefaultPixelValue));
+
+    itk::MultiThreaderBase::New()->template ParallelizeImageRegion<VDimension>(
+      outputRegion,
+      [&](const itk::ImageRegion<VDimension> &tile) {
+        // continuous indices of the inside pixels are interpolated in blocks (vectorised weights)
+        std::vector<double> indices;
+        std::vector<itk::Index<VDimension>> targets;
+        std::vector<double> values(InterpolationBlockSize);
+        indices.reserve(InterpolationBlockSize * VDimension);
+        targets.reserve(InterpolationBlockSize);
+        const auto flush = [&]() {
+          interpolator->EvaluateBlock(indices.data(), targets.size(), values.data());
+          for (std::size_t k = 0; k < targets.size(); ++k)
+            output->SetPixel(targets[k], ElxUtil::CastPixel<OutputPixelType>(values[k]));
+          indices.clear();
+          targets.clear();
+        };
+
+        typename itk::ImageBase<VDimension>::PointType p;
+        itk::Point<float, VDimension> pf;
+        itk::Point<double, VDimension> q;
+        double ci[VDimension];
+        itk::ImageRegionConstIteratorWithOnlyIndex<itk::ImageBase<VDimension>> it(reference, tile);
+        for (; !it.IsAtEnd(); ++it)
+        {
+          reference->TransformIndexToPhysicalPoint(it.GetIndex(), p);
+          if (transformDouble)
+          {
+            q = transformDouble->TransformPoint(p);
+          }
+          else
+          {
+            pf.CastFrom(p);
+            q.CastFrom(transformFloat->TransformPoint(pf));
+          }
+
+          bool inside = true;
+          for (unsigned int i = 0; i < VDimension; ++i)
+          {
+            double v = 0;
+            for (unsigned int j = 0; j < VDimension; ++j)
+              v += grid.physicalToIndex[i][j] * (q[j] - grid.origin[j]);
+            ci[i] = v;
+            inside = inside && IsInsideBuffer(v, grid.size[i]);
+          }
+          if (!inside)
+            continue;
+          indices.insert(indices.end(), ci, ci + VDimension);
+          targets.push_back(it.GetIndex());
+          if (targets.size() == InterpolationBlockSize)
+            flush();
+        }
+        flush();
+      },
+      nullptr);
+    result = mitk::GrabItkImageMemory(output.GetPointer());
+  });
+  return result;
+}
+
+template <unsigned int VDimension>
+mitk::Image::Pointer m2::ElxWarpSession::WarpImpl(const mitk::Image *image,
+                                                  const std::string &pixelType,
+                                                  unsigned int interpolationOrder) const
+{
+  if (interpolationOrder > 1)
+    return WarpBSplineImpl<VDimension>(image, pixelType, interpolationOrder);
+
+  if (auto result = WarpWithKernel(image, pixelType, interpolationOrder))
+    return result;
+
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  if (auto transform = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer()))
+    return Resample<VDimension, double>(
+      image, transform, reference, interpolationOrder, m_DefaultPixelValue, pixelType);
+  if (auto transform = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer()))
+    return Resample<VDimension, float>(
+      image, transform, reference, interpolationOrder, m_DefaultPixelValue, pixelType);
+  mitkThrow() << "Warp session is not initialized!";
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::Warp(const mitk::Image *image,
+                                              const std::string &pixelType,
+                                              int interpolationOrder) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  if (image->GetDimension() != m_Dimension)
+    mitkThrow() << "Image [" << ElxUtil::GetShape(image) << "] does not match the transformation dimension "
+                << m_Dimension;
+
+  const auto order = GetInterpolationOrder(pixelType, interpolationOrder);
+  const auto start = Clock::now();
+  auto result = m_Dimension == 3 ? WarpImpl<3>(image, pixelType, order) : WarpImpl<2>(image, pixelType, order);
+  AddWarpTime(SecondsSince(start));
+  return result;
+}
+
+template <unsigned int VDimension>
+std::vector<mitk::Image::Pointer> m2::ElxWarpSession::WarpComponentsImpl(const std::vector<mitk::Image::ConstPointer> &images,
+                                                                         const std::string &pixelType,
+                                                                         int interpolationOrder,
+                                                                         const std::vector<unsigned int> &regionIndex,
+                                                                         const std::vector<unsigned int> &regionSize) const
+{
+  const auto first = images.front().GetPointer();
+  for (const auto &image : images)
+  {
+    if (!image)
+      mitkThrow() << "Image data is null!";
+    const auto dims = image->GetDimensions();
+    const bool matches = VDimension == 3 ? image->GetDimension() == 3
+                                         : image->GetDimension() == 2 || (image->GetDimension() == 3 && dims[2] == 1);
+    if (!matches)
+      mitkThrow() << "Image [" << ElxUtil::GetShape(image) << "] does not match the transformation dimension "
+                  << VDimension;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      if (dims[i] != first->GetDimensions()[i])
+        mitkThrow() << "All channels have to share one geometry!";
+  }
+
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  const auto transformDouble = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer());
+  const auto transformFloat = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer());
+  if (!reference || (!transformDouble && !transformFloat))
+    mitkThrow() << "Warp session is not initialized!";
+
+  const auto order = GetInterpolationOrder(pixelType, interpolationOrder);
+  const auto grid = GetInputGrid<VDimension>(first);
+
+  // the output region (default: the whole output grid)
+  auto region = reference->GetLargestPossibleRegion();
+  if (!regionSize.empty())
+  {
+    if (regionIndex.size() != VDimension || regionSize.size() != VDimension)
+      mitkThrow() << "Region does not provide " << VDimension << " dimensions";
+    itk::ImageRegion<VDimension> requested;
+    for (unsigned int i = 0; i < VDimension; ++i)
+    {
+      requested.SetIndex(i, region.GetIndex(i) + regionIndex[i]);
+      requested.SetSize(i, regionSize[i]);
+    }
+    if (!region.IsInside(requested))
+      mitkThrow() << "Region exceeds the output grid!";
+    region = requested;
+  }
+
+  std::vector<mitk::Image::Pointer> outputs;
+  std::vector<std::unique_ptr<mitk::ImageReadAccessor>> inputAccessors;
+  std::vector<std::unique_ptr<mitk::ImageWriteAccessor>> outputAccessors;
+  // B-spline orders interpolate the coefficients of all components with the weights of the shared mapping
+  std::vector<std::vector<double>> coefficients;
+  for (const auto &image : images)
+  {
+    const auto components = image->GetPixelType().GetNumberOfComponents();
+    ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+      using OutputPixelType = decltype(outputPixel);
+      outputs.push_back(
+        CreateOutputImage<OutputPixelType, VDimension>(reference, region, components, image, m_DefaultPixelValue));
+    });
+    inputAccessors.emplace_back(new mitk::ImageReadAccessor(image));
+    outputAccessors.emplace_back(new mitk::ImageWriteAccessor(outputs.back()));
+    if (order > 1)
+      coefficients.push_back(ComputeCoefficients(image, VDimension, order));
+  }
+
+  // parts of at most 4096 pixels bound the mapping of B-spline orders ((order + 1)^VDimension weights per pixel)
+  const itk::SizeValueType side = VDimension == 3 ? 16 : 64;
+  itk::Index<VDimension> inputStart;
+  inputStart.Fill(0);
+  itk::MultiThreaderBase::New()->template ParallelizeImageRegion<VDimension>(
+    region,
+    [&](const itk::ImageRegion<VDimension> &tile) {
+      std::vector<double> indices;
+      TileMapping mapping;
+      for (const auto &part : SplitRegion<VDimension>(tile, side))
+      {
+        // the mapping of the part is computed once and applied to all channels
+        if (transformDouble)
+          ComputeContinuousIndices<VDimension, double>(transformDouble, reference, part, grid, indices);
+        else
+          ComputeContinuousIndices<VDimension, float>(transformFloat, reference, part, grid, indices);
+        MapContinuousIndices<VDimension>(reference, part, indices, region, inputStart, grid, order, mapping);
+
+        for (std::size_t i = 0; i < images.size(); ++i)
+        {
+          const auto components = images[i]->GetPixelType().GetNumberOfComponents();
+          ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+            using OutputPixelType = decltype(outputPixel);
+            const auto output = static_cast<OutputPixelType *>(outputAccessors[i]->GetData());
+            if (order > 1)
+            {
+              ApplyMapping(mapping, coefficients[i].data(), output, components);
+              return;
+            }
+            ElxUtil::AccessByPixelTypeName(images[i]->GetPixelType().GetComponentTypeAsString(), [&](auto inputPixel) {
+              using InputPixelType = decltype(inputPixel);
+              ApplyMapping(
+                mapping, static_cast<const InputPixelType *>(inputAccessors[i]->GetData()), output, components);
+            });
+          });
+        }
+      }
+    },
+    nullptr);
+  return outputs;
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpMultiChannel(const mitk::Image *image,
+                                                          const std::string &pixelType,
+                                                          int interpolationOrder) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  return WarpChannels({mitk::Image::ConstPointer(image)}, pixelType, interpolationOrder).front();
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpRegion(const mitk::Image *image,
+                                                    const std::string &pixelType,
+                                                    const std::vector<unsigned int> &index,
+                                                    const std::vector<unsigned int> &size,
+                                                    int interpolationOrder) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  if (size.empty())
+    mitkThrow() << "Region size is empty!";
+  const std::vector<mitk::Image::ConstPointer> images{mitk::Image::ConstPointer(image)};
+  return m_Dimension == 3 ? WarpComponentsImpl<3>(images, pixelType, interpolationOrder, index, size).front()
+                          : WarpComponentsImpl<2>(images, pixelType, interpolationOrder, index, size).front();
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpSlices(const mitk::Image *volume,
+                                                    const std::string &pixelType,
+                                                    int interpolationOrder) const
+{
+  return WarpSlicesImpl({this}, volume, pixelType, interpolationOrder);
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpSlices(const std::vector<Pointer> &sessions,
+                                                    const mitk::Image *volume,
+                                                    const std::string &pixelType,
+                                                    int interpolationOrder)
+{
+  std::vector<const ElxWarpSession *> sliceSessions;
+  for (const auto &session : sessions)
+  {
+    if (!session)
+      mitkThrow() << "Warp session is null!";
+    sliceSessions.push_back(session.get());
+  }
+  return WarpSlicesImpl(sliceSessions, volume, pixelType, interpolationOrder);
+}
+
+mitk::Image::Pointer m2::ElxWarpSession::WarpSlicesImpl(const std::vector<const ElxWarpSession *> &sessions,
+                                                        const mitk::Image *volume,
+                                                        const std::string &pixelType,
+                                                        int interpolationOrder)
+{
+  if (!volume)
+    mitkThrow() << "Image data is null!";
+  if (volume->GetDimension() != 2 && volume->GetDimension() != 3)
+    mitkThrow() << "Image [" << ElxUtil::GetShape(volume) << "] is not a stack of 2D slices";
+  const unsigned int slices = volume->GetDimension() == 3 ? volume->GetDimensions()[2] : 1;
+  if (sessions.empty() || (sessions.size() != 1 && sessions.size() != slices))
+    mitkThrow() << "Expected 1 or " << slices << " warp sessions, got " << sessions.size();
+
+  using TransformDoubleType = itk::Transform<double, 2, 2>;
+  using TransformFloatType = itk::Transform<float, 2, 2>;
+  std::vector<const itk::ImageBase<2> *> references;
+  std::vector<const TransformDoubleType *> transformsDouble;
+  std::vector<const TransformFloatType *> transformsFloat;
+  for (const auto session : sessions)
+  {
+    const auto reference = dynamic_cast<const itk::ImageBase<2> *>(session->m_Reference.GetPointer());
+    if (session->m_Dimension != 2 || !reference)
+      mitkThrow() << "Slice-wise warping requires 2D transformations!";
+    if (!references.empty() && reference->GetLargestPossibleRegion() != references.front()->GetLargestPossibleRegion())
+      mitkThrow() << "All slice transformations have to share one output grid!";
+    references.push_back(reference);
+    transformsDouble.push_back(dynamic_cast<const TransformDoubleType *>(session->m_Transform.GetPointer()));
+    transformsFloat.push_back(dynamic_cast<const TransformFloatType *>(session->m_Transform.GetPointer()));
+    if (!transformsDouble.back() && !transformsFloat.back())
+      mitkThrow() << "Warp session is not initialized!";
+  }
+
+  // interpolation settings and the output geometry (x-y) are taken from the first session
+  const auto first = sessions.front();
+  const auto order = first->GetInterpolationOrder(pixelType, interpolationOrder);
+
+  const auto start = Clock::now();
+  const auto &region = references.front()->GetLargestPossibleRegion();
+  const auto components = volume->GetPixelType().GetNumberOfComponents();
+  const auto grid = GetInputGrid<2>(volume);
+  // B-spline orders interpolate the coefficients of each slice (the prefilter does not cross slices)
+  std::vector<double> coefficients;
+  if (order > 1)
+    coefficients = ComputeCoefficients(volume, 2, order);
+
+  // the result volume is allocated once; every slice is written in place
+  mitk::Image::Pointer result;
+  ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+    result = CreateOutputImage<decltype(outputPixel), 2>(
+      references.front(), region, components, volume, first->m_DefaultPixelValue, slices);
+  });
+  mitk::ImageReadAccessor inputAccessor(volume);
+  mitk::ImageWriteAccessor outputAccessor(result);
+  const std::size_t inputSliceSize = grid.size[0] * grid.size[1] * components;
+  const std::size_t outputSliceSize = region.GetNumberOfPixels() * components;
+
+  // work items are blocks of rows per transformation; a single transformation is mapped once and applied to all slices
+  constexpr itk::SizeValueType RowBlockSize = 16;
+  const auto rows = region.GetSize(1);
+  const auto blocks = (rows + RowBlockSize - 1) / RowBlockSize;
+  const bool shared = sessions.size() == 1;
+  itk::Index<2> inputStart;
+  inputStart.Fill(0);
+  itk::MultiThreaderBase::New()->ParallelizeArray(
+    0,
+    sessions.size() * blocks,
+    [&](itk::SizeValueType item) {
+      const auto s = item / blocks;
+      const auto block = item % blocks;
+      auto tile = region;
+      tile.SetIndex(1, region.GetIndex(1) + static_cast<itk::IndexValueType>(block * RowBlockSize));
+      tile.SetSize(1, std::min(RowBlockSize, rows - block * RowBlockSize));
+
+      const std::size_t firstSlice = shared ? 0 : s;
+      const std::size_t lastSlice = shared ? slices : s + 1;
+      std::vector<double> indices;
+      TileMapping mapping;
+      // parts of at most 64 x 16 pixels bound the mapping of B-spline orders
+      for (const auto &part : SplitRegion<2>(tile, 64))
+      {
+        if (transformsDouble[s])
+          ComputeContinuousIndices<2, double>(transformsDouble[s], references[s], part, grid, indices);
+        else
+          ComputeContinuousIndices<2, float>(transformsFloat[s], references[s], part, grid, indices);
+        MapContinuousIndices<2>(references[s], part, indices, region, inputStart, grid, order, mapping);
+
+        ElxUtil::AccessByPixelTypeName(pixelType, [&](auto outputPixel) {
+          using OutputPixelType = decltype(outputPixel);
+          const auto output = static_cast<OutputPixelType *>(outputAccessor.GetData());
+          if (order > 1)
+          {
+            for (auto z = firstSlice; z < lastSlice; ++z)
+              ApplyMapping(mapping, coefficients.data() + z * inputSliceSize, output + z * outputSliceSize, components);
+            return;
+          }
+          ElxUtil::AccessByPixelTypeName(volume->GetPixelType().GetComponentTypeAsString(), [&](auto inputPixel) {
+            using InputPixelType = decltype(inputPixel);
+            const auto input = static_cast<const InputPixelType *>(inputAccessor.GetData());
+            for (auto z = firstSlice; z < lastSlice; ++z)
+              ApplyMapping(mapping, input + z * inputSliceSize, output + z * outputSliceSize, components);
+          });
+        });
+      }
+    },
+    nullptr);
+
+  first->AddWarpTime(SecondsSince(start));
+  return result;
+}
+
+mitk::AffineTransform3D::Pointer m2::ElxWarpSession::GetOutputIndexToWorldTransform(const mitk::Image *image) const
+{
+  if (!image)
+    mitkThrow() << "Image data is null!";
+  if (auto reference = dynamic_cast<const itk::ImageBase<3> *>(m_Reference.GetPointer()))
+    return CreateOutputTransform<3>(reference, reference->GetLargestPossibleRegion().GetIndex(), image);
+  if (auto reference2D = dynamic_cast<const itk::ImageBase<2> *>(m_Reference.GetPointer()))
+    return CreateOutputTransform<2>(reference2D, reference2D->GetLargestPossibleRegion().GetIndex(), image);
+  mitkThrow() << "Warp session is not initialized!";
+}
+
+std::vector<unsigned int> m2::ElxWarpSession::GetOutputSize() const
+{
+  std::vector<unsigned int> size;
+  if (auto reference = dynamic_cast<const itk::ImageBase<3> *>(m_Reference.GetPointer()))
+    for (unsigned int i = 0; i < 3; ++i)
+      size.push_back(reference->GetLargestPossibleRegion().GetSize(i));
+  else if (auto reference2D = dynamic_cast<const itk::ImageBase<2> *>(m_Reference.GetPointer()))
+    for (unsigned int i = 0; i < 2; ++i)
+      size.push_back(reference2D->GetLargestPossibleRegion().GetSize(i));
+  return size;
+}
+
+std::vector<mitk::Image::Pointer> m2::ElxWarpSession::WarpChannels(
+  const std::vector<mitk::Image::ConstPointer> &channels, const std::string &pixelType, int interpolationOrder) const
+{
+  if (channels.empty())
+    return {};
+
+  const auto start = Clock::now();
+  auto result = m_Dimension == 3 ? WarpComponentsImpl<3>(channels, pixelType, interpolationOrder)
+                                 : WarpComponentsImpl<2>(channels, pixelType, interpolationOrder);
+  AddWarpTime(SecondsSince(start));
+  return result;
+}
+
+template <unsigned int VDimension>
+std::vector<mitk::Image::Pointer> m2::ElxWarpSession::WarpLabelsImpl(
+  const std::vector<mitk::Image::ConstPointer> &labelImages, bool smooth) const
+{
+  const auto first = labelImages.front().GetPointer();
+  for (const auto &image : labelImages)
+  {
+    if (!image)
+      mitkThrow() << "Image data is null!";
+    const auto dims = image->GetDimensions();
+    const bool matches = VDimension == 3 ? image->GetDimension() == 3
+                                         : image->GetDimension() == 2 || (image->GetDimension() == 3 && dims[2] == 1);
+    if (!matches)
+      mitkThrow() << "Image [" << ElxUtil::GetShape(image) << "] does not match the transformation dimension "
+                  << VDimension;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      if (dims[i] != first->GetDimensions()[i])
+        mitkThrow() << "All label images have to share one geometry!";
+    if (image->GetPixelType().GetNumberOfComponents() != 1 ||
+        !ElxUtil::IsIntegerPixelType(ElxUtil::GetPixelTypeName(image)))
+      mitkThrow() << "Label images have to be scalar integer images!";
+  }
+
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  const auto transformDouble = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer());
+  const auto transformFloat = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer());
+  if (!reference || (!transformDouble && !transformFloat))
+    mitkThrow() << "Warp session is not initialized!";
+
+  const auto grid = GetInputGrid<VDimension>(first);
+  const auto &region = reference->GetLargestPossibleRegion();
+
+  std::vector<std::vector<LabelBox<VDimension>>> labels;
+  std::vector<mitk::Image::Pointer> outputs;
+  std::vector<std::unique_ptr<mitk::ImageReadAccessor>> inputAccessors;
+  std::vector<std::unique_ptr<mitk::ImageWriteAccessor>> outputAccessors;
+  for (const auto &image : labelImages)
+  {
+    inputAccessors.emplace_back(new mitk::ImageReadAccessor(image));
+    ElxUtil::AccessByPixelTypeName(ElxUtil::GetPixelTypeName(image), [&](auto labelPixel) {
+      using LabelPixelType = decltype(labelPixel);
+      labels.push_back(GetLabelBoxes<VDimension>(
+        static_cast<const LabelPixelType *>(inputAccessors.back()->GetData()), grid, smooth));
+      // background everywhere; only label pixels are written
+      outputs.push_back(CreateOutputImage<LabelPixelType, VDimension>(reference, region, 1, image, 0));
+    });
+    outputAccessors.emplace_back(new mitk::ImageWriteAccessor(outputs.back()));
+  }
+
+  constexpr itk::SizeValueType TileSize = VDimension == 3 ? 32 : 64;
+  const auto tiles = SplitRegion<VDimension>(region, TileSize);
+  std::atomic<std::size_t> skippedTiles{0};
+  itk::MultiThreaderBase::New()->ParallelizeArray(
+    0,
+    tiles.size(),
+    [&](itk::SizeValueType t) {
+      const auto &tile = tiles[t];
+      std::vector<double> indices;
+      if (transformDouble)
+        ComputeContinuousIndices<VDimension, double>(transformDouble, reference, tile, grid, indices);
+      else
+        ComputeContinuousIndices<VDimension, float>(transformFloat, reference, tile, grid, indices);
+
+      // input footprint of the tile (incl. the upper linear neighbor)
+      itk::IndexValueType lower[VDimension], upper[VDimension];
+      std::fill_n(lower, VDimension, std::numeric_limits<itk::IndexValueType>::max());
+      std::fill_n(upper, VDimension, std::numeric_limits<itk::IndexValueType>::lowest());
+      for (std::size_t k = 0; k < indices.size(); k += VDimension)
+      {
+        bool inside = true;
+        for (unsigned int i = 0; i < VDimension; ++i)
+          inside = inside && IsInsideBuffer(indices[k + i], grid.size[i]);
+        if (!inside)
+          continue;
+        for (unsigned int i = 0; i < VDimension; ++i)
+        {
+          const auto f = static_cast<itk::IndexValueType>(std::floor(indices[k + i]));
+          lower[i] = std::min(lower[i], f);
+          upper[i] = std::max(upper[i], f + 1);
+        }
+      }
+
+      for (std::size_t g = 0; g < labelImages.size(); ++g)
+      {
+        // only labels whose box overlaps the footprint can appear in the tile
+        std::vector<const LabelBox<VDimension> *> candidates;
+        for (const auto &label : labels[g])
+        {
+          bool overlaps = true;
+          for (unsigned int i = 0; i < VDimension; ++i)
+            overlaps = overlaps && label.box.GetIndex(i) <= upper[i] &&
+                       label.box.GetIndex(i) + static_cast<itk::IndexValueType>(label.box.GetSize(i)) > lower[i];
+          if (overlaps)
+            candidates.push_back(&label);
+        }
+        if (candidates.empty())
+        {
+          ++skippedTiles;
+          continue;
+        }
+
+        ElxUtil::AccessByPixelTypeName(ElxUtil::GetPixelTypeName(labelImages[g]), [&](auto labelPixel) {
+          using LabelPixelType = decltype(labelPixel);
+          const auto input = static_cast<const LabelPixelType *>(inputAccessors[g]->GetData());
+          const auto output = static_cast<LabelPixelType *>(outputAccessors[g]->GetData());
+          auto ci = indices.data();
+          itk::ImageRegionConstIteratorWithOnlyIndex<itk::ImageBase<VDimension>> it(reference, tile);
+          for (; !it.IsAtEnd(); ++it, ci += VDimension)
+          {
+            bool inside = true;
+            for (unsigned int i = 0; i < VDimension; ++i)
+              inside = inside && IsInsideBuffer(ci[i], grid.size[i]);
+            if (!inside)
+              continue;
+
+            LabelPixelType value = 0;
+            if (smooth)
+            {
+              // the label with the smallest interpolated distance, if the point is inside of it
+              double best = 0;
+              for (const auto label : candidates)
+              {
+                double distance;
+                if (InterpolateDistance(*label, ci, distance) && distance < best)
+                {
+                  best = distance;
+                  value = static_cast<LabelPixelType>(label->value);
+                }
+              }
+            }
+            else
+            {
+              std::size_t offset = 0;
+              for (unsigned int i = 0; i < VDimension; ++i)
+              {
+                const auto k = static_cast<itk::IndexValueType>(std::floor(ci[i] + 0.5));
+                offset += std::min<itk::IndexValueType>(std::max<itk::IndexValueType>(k, 0), grid.size[i] - 1) *
+                          grid.stride[i];
+              }
+              value = input[offset];
+            }
+            if (value == 0)
+              continue;
+
+            const auto index = it.GetIndex();
+            std::size_t outputOffset = 0, outputStride = 1;
+            for (unsigned int i = 0; i < VDimension; ++i)
+            {
+              outputOffset += (index[i] - region.GetIndex(i)) * outputStride;
+              outputStride *= region.GetSize(i);
+            }
+            output[outputOffset] = value;
+          }
+        });
+      }
+    },
+    nullptr);
+
+  MITK_INFO << "Label warp: " << labelImages.size() << " label images, " << tiles.size() << " tiles, "
+            << skippedTiles.load() << " tile/image pairs without labels skipped";
+  return outputs;
+}
+
+std::vector<mitk::Image::Pointer> m2::ElxWarpSession::WarpLabels(const std::vector<mitk::Image::ConstPointer> &labelImages,
+                                                                 bool smooth) const
+{
+  if (labelImages.empty())
+    return {};
+
+  const auto start = Clock::now();
+  auto result = m_Dimension == 3 ? WarpLabelsImpl<3>(labelImages, smooth) : WarpLabelsImpl<2>(labelImages, smooth);
+  AddWarpTime(SecondsSince(start));
+  return result;
+}
+
+template <unsigned int VDimension>
+m2::ElxResampleLUT::Pointer m2::ElxWarpSession::CreateResampleLUTImpl(const mitk::Image *movingImage) const
+{
+  const auto dims = movingImage->GetDimensions();
+  const bool matches = VDimension == 3 ? movingImage->GetDimension() == 3
+                                       : movingImage->GetDimension() == 2 ||
+                                           (movingImage->GetDimension() == 3 && dims[2] == 1);
+  if (!matches)
+    mitkThrow() << "Image [" << ElxUtil::GetShape(movingImage) << "] does not match the transformation dimension "
+                << VDimension;
+
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  const auto transformDouble = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer());
+  const auto transformFloat = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer());
+  if (!reference || (!transformDouble && !transformFloat))
+    mitkThrow() << "Warp session is not initialized!";
+
+  // the output grid in 3D; the z-axis of 2D transformations is taken from the moving image
+  ElxResampleLUT::Header header{};
+  header.dimension = VDimension;
+  header.weightsPerPixel = 1u << VDimension;
+  const auto geometry = movingImage->GetGeometry();
+  const auto &size = reference->GetLargestPossibleRegion().GetSize();
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    header.inputSize[i] = i < movingImage->GetDimension() ? dims[i] : 1;
+    header.outputSize[i] = i < VDimension ? size[i] : 1;
+    header.origin[i] = i < VDimension ? reference->GetOrigin()[i] : geometry->GetOrigin()[i];
+    header.spacing[i] = i < VDimension ? reference->GetSpacing()[i] : geometry->GetSpacing()[i];
+    for (unsigned int j = 0; j < 3; ++j)
+      header.direction[i * 3 + j] = i < VDimension && j < VDimension ? reference->GetDirection()[i][j] : double(i == j);
+  }
+  auto lut = ElxResampleLUT::New(header);
+
+  const auto grid = GetInputGrid<VDimension>(movingImage);
+  itk::MultiThreaderBase::New()->template ParallelizeImageRegion<VDimension>(
+    reference->GetLargestPossibleRegion(),
+    [&](const itk::ImageRegion<VDimension> &tile) {
+      TileMapping linear, nearest;
+      if (transformDouble)
+      {
+        ComputeMapping<VDimension, double>(transformDouble, reference, tile, grid, 1, linear);
+        ComputeMapping<VDimension, double>(transformDouble, reference, tile, grid, 0, nearest);
+      }
+      else
+      {
+        ComputeMapping<VDimension, float>(transformFloat, reference, tile, grid, 1, linear);
+        ComputeMapping<VDimension, float>(transformFloat, reference, tile, grid, 0, nearest);
+      }
+
+      // tiles are disjoint, every thread writes its own output pixels
+      const auto k = linear.weightsPerPixel;
+      for (std::size_t i = 0; i < nearest.output.size(); ++i)
+        lut->GetNearestIndices()[nearest.output[i]] = nearest.input[i];
+      for (std::size_t i = 0; i < linear.output.size(); ++i)
+        for (unsigned int j = 0; j < k; ++j)
+        {
+          lut->GetIndices(j)[linear.output[i]] = linear.input[i * k + j];
+          lut->GetWeights(j)[linear.output[i]] = static_cast<ElxResampleLUT::WeightType>(linear.weights[i * k + j]);
+        }
+    },
+    nullptr);
+  return lut;
+}
+
+m2::ElxResampleLUT::Pointer m2::ElxWarpSession::CreateResampleLUT(const mitk::Image *movingImage) const
+{
+  if (!movingImage)
+    mitkThrow() << "Image data is null!";
+
+  const auto start = Clock::now();
+  auto lut = m_Dimension == 3 ? CreateResampleLUTImpl<3>(movingImage) : CreateResampleLUTImpl<2>(movingImage);
+  MITK_INFO << "Resampling table of " << lut->GetNumberOfPixels() << " pixels computed in " << SecondsSince(start)
+            << " s";
+  return lut;
+}
+
+template <unsigned int VDimension>
+void m2::ElxWarpSession::WarpToFileImpl(const std::string &inputPath,
+                                        const std::string &outputPath,
+                                        const std::string &pixelType,
+                                        int interpolationOrder,
+                                        std::size_t memoryBudget) const
+{
+  const auto reference = dynamic_cast<const itk::ImageBase<VDimension> *>(m_Reference.GetPointer());
+  const auto transformDouble = dynamic_cast<const itk::Transform<double, VDimension, VDimension> *>(m_Transform.GetPointer());
+  const auto transformFloat = dynamic_cast<const itk::Transform<float, VDimension, VDimension> *>(m_Transform.GetPointer());
+  if (!reference || (!transformDouble && !transformFloat))
+    mitkThrow() << "Warp session is not initialized!";
+
+  auto inputIO = itk::ImageIOFactory::CreateImageIO(inputPath.c_str(), itk::IOFileModeEnum::ReadMode);
+  if (!inputIO)
+    mitkThrow() << "Can not read [" << inputPath << "]";
+  inputIO->SetFileName(inputPath);
+  inputIO->ReadImageInformation();
+  auto inputType = inputIO->GetComponentTypeAsString(inputIO->GetComponentType());
+  if (inputType != "double" && !ElxUtil::IsIntegerPixelType(inputType))
+    inputType = "float";
+  const auto outputType = pixelType.empty() ? inputType : pixelType;
+  const auto components = inputIO->GetNumberOfComponents();
+
+  // only the order 0 and 1 have a bounded support; B-spline coefficients depend on the whole image
+  const auto order = GetInterpolationOrder(outputType, interpolationOrder);
+  if (order > 1)
+    mitkThrow() << "Interpolation order " << order
+                << " is not supported by the streaming warp: B-spline coefficients depend on the whole image (use 0 or 1)";
+  const bool nearest = order == 0;
+
+  // the output file is written tile by tile (e.g. MetaImage .mha/.mhd without compression)
+  auto outputIO = itk::ImageIOFactory::CreateImageIO(outputPath.c_str(), itk::IOFileModeEnum::WriteMode);
+  if (!outputIO)
+    mitkThrow() << "Can not write [" << outputPath << "]";
+  outputIO->SetFileName(outputPath);
+  outputIO->SetUseCompression(false);
+  outputIO->SetUseStreamedWriting(true);
+  if (!outputIO->CanStreamWrite())
+    mitkThrow() << "The format of [" << outputPath << "] can not be written in tiles; use .mha";
+  if (itksys::SystemTools::FileExists(outputPath))
+    itksys::SystemTools::RemoveFile(outputPath);
+
+  const auto &outputRegion = reference->GetLargestPossibleRegion();
+  outputIO->SetNumberOfDimensions(VDimension);
+  for (unsigned int i = 0; i < VDimension; ++i)
+  {
+    outputIO->SetDimensions(i, outputRegion.GetSize(i));
+    outputIO->SetSpacing(i, reference->GetSpacing()[i]);
+    outputIO->SetOrigin(i, reference->GetOrigin()[i]);
+    std::vector<double> axis(VDimension);
+    for (unsigned int j = 0; j < VDimension; ++j)
+      axis[j] = reference->GetDirection()[j][i];
+    outputIO->SetDirection(i, axis);
+  }
+
+  ElxUtil::AccessByPixelTypeName(inputType, [&](auto inputPixel) {
+    using InputPixelType = decltype(inputPixel);
+    using InputImageType = itk::VectorImage<InputPixelType, VDimension>;
+    using ReaderType = itk::ImageFileReader<InputImageType>;
+
+    ElxUtil::AccessByPixelTypeName(outputType, [&](auto outputPixel) {
+      using OutputPixelType = decltype(outputPixel);
+      outputIO->SetPixelTypeInfo(static_cast<const OutputPixelType *>(nullptr));
+      if (components > 1)
+      {
+        outputIO->SetPixelType(itk::IOPixelEnum::VECTOR);
+        outputIO->SetNumberOfComponents(components);
+      }
+
+      auto informationReader = ReaderType::New();
+      informationReader->SetFileName(inputPath);
+      informationReader->UpdateOutputInformation();
+      const auto inputInformation = informationReader->GetOutput();
+      const auto &inputRegion = inputInformation->GetLargestPossibleRegion();
+      const auto fullGrid = GetInputGrid<VDimension>(inputInformation, inputRegion);
+
+      // inputs that can not be read in parts are read once
+      typename InputImageType::Pointer fullInput;
+      if (!inputIO->CanStreamRead())
+      {
+        MITK_WARN << "[" << inputPath << "] can not be read in parts; the whole image is loaded";
+        informationReader->Update();
+        fullInput = informationReader->GetOutput();
+      }
+
+      // bytes per output pixel: continuous index, mapping and output value
+      const auto weights = nearest ? 1u : (1u << VDimension);
+      const double pixelBytes = VDimension * sizeof(double) + sizeof(std::size_t) +
+                                weights * (sizeof(std::size_t) + sizeof(double)) + components * sizeof(OutputPixelType);
+      const auto workers = std::max(1u, itk::MultiThreaderBase::GetGlobalDefaultNumberOfThreads());
+      // half of the budget of a worker for the output side of a tile, half for its input bounding box
+      const double tileBudget = static_cast<double>(memoryBudget) / workers;
+      const double inputBudget = 0.5 * tileBudget;
+      constexpr itk::SizeValueType MinimumTileSize = 16;
+      const auto side = std::max<itk::SizeValueType>(
+        MinimumTileSize, static_cast<itk::SizeValueType>(std::pow(0.5 * tileBudget / pixelBytes, 1.0 / VDimension)));
+
+      const auto tiles = SplitRegion<VDimension>(outputRegion, side);
+
+      std::mutex writeMutex;
+      std::atomic<std::size_t> inputBytes{0}, tileCount{0};
+      std::function<void(const itk::ImageRegion<VDimension> &)> process = [&](const itk::ImageRegion<VDimension> &t) {
+        std::vector<double> indices;
+        if (transformDouble)
+          ComputeContinuousIndices<VDimension, double>(transformDouble, reference, t, fullGrid, indices);
+        else
+          ComputeContinuousIndices<VDimension, float>(transformFloat, reference, t, fullGrid, indices);
+
+        // bounding box of all indices inside of the input (incl. the upper linear neighbor)
+        itk::IndexValueType lower[VDimension], upper[VDimension];
+        std::fill_n(lower, VDimension, std::numeric_limits<itk::IndexValueType>::max());
+        std::fill_n(upper, VDimension, std::numeric_limits<itk::IndexValueType>::lowest());
+        bool any = false;
+        for (std::size_t k = 0; k < indices.size(); k += VDimension)
+        {
+          bool inside = true;
+          for (unsigned int i = 0; i < VDimension; ++i)
+            inside = inside && IsInsideBuffer(indices[k + i], fullGrid.size[i]);
+          if (!inside)
+            continue;
+          any = true;
+          for (unsigned int i = 0; i < VDimension; ++i)
+          {
+            const auto f = static_cast<itk::IndexValueType>(std::floor(indices[k + i]));
+            lower[i] = std::min(lower[i], std::max<itk::IndexValueType>(f, 0));
+            upper[i] = std::max(upper[i], std::min<itk::IndexValueType>(f + 1, fullGrid.size[i] - 1));
+          }
+        }
+
+        std::vector<OutputPixelType> buffer(t.GetNumberOfPixels() * components,
+                                            ElxUtil::CastPixel<OutputPixelType>(m_DefaultPixelValue));
+        if (any)
+        {
+          itk::ImageRegion<VDimension> box;
+          for (unsigned int i = 0; i < VDimension; ++i)
+          {
+            box.SetIndex(i, lower[i]);
+            box.SetSize(i, static_cast<itk::SizeValueType>(upper[i] - lower[i] + 1));
+          }
+
+          // strongly compressed or rotated tiles are split until the input box fits into the budget
+          const double boxBytes = static_cast<double>(box.GetNumberOfPixels()) * components * sizeof(InputPixelType);
+          unsigned int longest = 0;
+          for (unsigned int i = 1; i < VDimension; ++i)
+            if (t.GetSize(i) > t.GetSize(longest))
+              longest = i;
+          if (!fullInput && boxBytes > inputBudget && t.GetSize(longest) >= 2 * MinimumTileSize)
+          {
+            auto first = t, second = t;
+            first.SetSize(longest, t.GetSize(longest) / 2);
+            second.SetIndex(longest, t.GetIndex(longest) + first.GetSize(longest));
+            second.SetSize(longest, t.GetSize(longest) - first.GetSize(longest));
+            process(first);
+            process(second);
+            return;
+          }
+
+          typename InputImageType::Pointer input = fullInput;
+          if (!input)
+          {
+            auto reader = ReaderType::New();
+            reader->SetFileName(inputPath);
+            reader->UpdateOutputInformation();
+            reader->GetOutput()->SetRequestedRegion(box);
+            reader->Update();
+            input = reader->GetOutput();
+            inputBytes += input->GetBufferedRegion().GetNumberOfPixels() * components * sizeof(InputPixelType);
+          }
+
+          // the buffered region may be larger than the requested box (file images start at index 0)
+          const auto &buffered = input->GetBufferedRegion();
+          const auto start = buffered.GetIndex();
+          TileMapping mapping;
+          MapContinuousIndices<VDimension>(reference,
+                                           t,
+                                           indices,
+                                           t,
+                                           start,
+                                           GetInputGrid<VDimension>(input.GetPointer(), buffered),
+                                           nearest ? 0 : 1,
+                                           mapping);
+          ApplyMapping(mapping, input->GetBufferPointer(), buffer.data(), components);
+        }
+
+        itk::ImageIORegion ioRegion(VDimension);
+        for (unsigned int i = 0; i < VDimension; ++i)
+        {
+          ioRegion.SetIndex(i, t.GetIndex(i) - outputRegion.GetIndex(i));
+          ioRegion.SetSize(i, t.GetSize(i));
+        }
+        std::lock_guard<std::mutex> lock(writeMutex);
+        outputIO->SetIORegion(ioRegion);
+        outputIO->Write(buffer.data());
+        ++tileCount;
+      };
+
+      // every worker processes one tile at a time: at most `workers` tiles are held in memory
+      itk::MultiThreaderBase::New()->ParallelizeArray(
+        0, tiles.size(), [&](itk::SizeValueType i) { process(tiles[i]); }, nullptr);
+
+      MITK_INFO << "Streaming warp: " << tileCount.load() << " tiles of up to " << side << " pixels per axis, "
+                << inputBytes.load() / double(1 << 20) << " MiB input read";
+    });
+  });
+}
+
+void m2::ElxWarpSession::WarpToFile(const std::string &inputPath,
+                                    const std::string &outputPath,
+                                    const std::string &pixelType,
+                                    int interpolationOrder,
+                                    std::size_t memoryBudget) const
+{
+  const auto start = Clock::now();
+  if (m_Dimension == 3)
+    WarpToFileImpl<3>(inputPath, outputPath, pixelType, interpolationOrder, memoryBudget);
+  else
+    WarpToFileImpl<2>(inputPath, outputPath, pixelType, interpolationOrder, memoryBudget);
+  AddWarpTime(SecondsSince(start));
+}
+
+void m2::ElxWarpSession::AddWarpTime(double seconds) const
+{
+  std::lock_guard<std::mutex> lock(m_TimingMutex);
+  m_WarpTime += seconds;
+  ++m_NumberOfWarps;
+  MITK_DEBUG << "Warp " << m_NumberOfWarps << ": " << seconds << " s (setup " << m_SetupTime << " s, total warp "
+             << m_WarpTime << " s)";
+}
+
+double m2::ElxWarpSession::GetWarpTime() const
+{
+  std::lock_guard<std::mutex> lock(m_TimingMutex);
+  return m_WarpTime;
+}
+
+unsigned int m2::ElxWarpSession::GetNumberOfWarps() const
+{
+  std::lock_guard<std::mutex> lock(m_TimingMutex);
+  return m_NumberOfWarps;
+}
@@ -1,2 +1,13 @@
 set(MODULE_TESTS
+  m2ElxBSplineInterpolatorTest.cpp
+  m2ElxChannelDeinterleaveTest.cpp
+  m2ElxChannelFusionTest.cpp
+  m2ElxChannelStatisticsTest.cpp
+  m2ElxLazyWarpedImageTest.cpp
+  m2ElxRegistrationHelperTest.cpp
+  m2ElxResampleLUTTest.cpp
+  m2ElxTransformEngineTest.cpp
+  m2ElxWarpKernelTest.cpp
+  m2ElxWarpOptionsTest.cpp
+  m2ElxWarpSessionTest.cpp
 )
@@ -0,0 +1,141 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxBSplineInterpolator.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkBSplineInterpolateImageFunction.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+class m2ElxBSplineInterpolatorTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxBSplineInterpolatorTestSuite);
+  MITK_TEST(Evaluate_2D_MatchesBSplineInterpolateImageFunction);
+  MITK_TEST(Evaluate_3D_MatchesBSplineInterpolateImageFunction);
+  MITK_TEST(Evaluate_ShortAxes_MatchesBSplineInterpolateImageFunction);
+  MITK_TEST(New_UnsupportedOrder_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  template <unsigned int VDimension>
+  static typename itk::Image<double, VDimension>::Pointer CreateImage(const unsigned int *size)
+  {
+    using ImageType = itk::Image<double, VDimension>;
+    auto image = ImageType::New();
+    typename ImageType::RegionType region;
+    for (unsigned int d = 0; d < VDimension; ++d)
+      region.SetSize(d, size[d]);
+    image->SetRegions(region);
+    image->Allocate();
+    itk::ImageRegionIteratorWithIndex<ImageType> it(image, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      double value = 100 * std::sin(0.9 * i[0] + 0.3) + 40 * std::cos(1.3 * i[1]);
+      if (VDimension == 3)
+        value += 25 * std::sin(0.7 * i[VDimension - 1]);
+      it.Set(value);
+    }
+    return image;
+  }
+
+  /**
+   * Compares Evaluate and EvaluateBlock of all orders with itk::BSplineInterpolateImageFunction on a lattice of
+   * continuous indices that covers the image including its borders.
+   */
+  template <unsigned int VDimension>
+  void Check(const unsigned int *size)
+  {
+    using ImageType = itk::Image<double, VDimension>;
+    const auto itkImage = CreateImage<VDimension>(size);
+    const auto image = m2::ElxTestData::ToMitkImage(itkImage.GetPointer());
+
+    std::vector<double> indices;
+    const unsigned int steps = 7;
+    std::size_t n = 1;
+    for (unsigned int d = 0; d < VDimension; ++d)
+      n *= steps;
+    for (std::size_t p = 0; p < n; ++p)
+    {
+      auto rest = p;
+      for (unsigned int d = 0; d < VDimension; ++d)
+      {
+        indices.push_back((size[d] - 1) * double(rest % steps) / (steps - 1));
+        rest /= steps;
+      }
+    }
+
+    for (unsigned int order = 0; order <= m2::ElxBSplineInterpolator::MaximumOrder; ++order)
+    {
+      auto reference = itk::BSplineInterpolateImageFunction<ImageType, double, double>::New();
+      reference->SetSplineOrder(order);
+      reference->SetInputImage(itkImage);
+      const auto interpolator = m2::ElxBSplineInterpolator::New(image, VDimension, order);
+
+      std::vector<double> values(n);
+      interpolator->EvaluateBlock(indices.data(), n, values.data());
+      for (std::size_t p = 0; p < n; ++p)
+      {
+        itk::ContinuousIndex<double, VDimension> index;
+        for (unsigned int d = 0; d < VDimension; ++d)
+          index[d] = indices[p * VDimension + d];
+        const auto expected = reference->EvaluateAtContinuousIndex(index);
+        const auto message = "order " + std::to_string(order) + ", point " + std::to_string(p);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE(message, expected, interpolator->Evaluate(&indices[p * VDimension]), 1e-6);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE(message, expected, values[p], 1e-6);
+      }
+    }
+  }
+
+public:
+  void Evaluate_2D_MatchesBSplineInterpolateImageFunction()
+  {
+    const unsigned int size[] = {23, 17};
+    Check<2>(size);
+  }
+
+  void Evaluate_3D_MatchesBSplineInterpolateImageFunction()
+  {
+    const unsigned int size[] = {9, 8, 6};
+    Check<3>(size);
+  }
+
+  void Evaluate_ShortAxes_MatchesBSplineInterpolateImageFunction()
+  {
+    // supports of order 4 and 5 are wider than the period of the mirror boundary
+    const unsigned int size2[] = {2, 3};
+    Check<2>(size2);
+    const unsigned int size3[] = {3, 2};
+    Check<2>(size3);
+    const unsigned int single[] = {3, 1};
+    Check<2>(single);
+  }
+
+  void New_UnsupportedOrder_Throws()
+  {
+    const unsigned int size[] = {5, 5};
+    const auto image = m2::ElxTestData::ToMitkImage(CreateImage<2>(size).GetPointer());
+    CPPUNIT_ASSERT_THROW(m2::ElxBSplineInterpolator::New(image, 2, m2::ElxBSplineInterpolator::MaximumOrder + 1),
+                         mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxBSplineInterpolator)
@@ -0,0 +1,112 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include <m2ElxChannelDeinterleave.h>
+#include <mitkITKImageImport.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkVectorImage.h>
+#include <itkVectorIndexSelectionCastImageFilter.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+class m2ElxChannelDeinterleaveTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxChannelDeinterleaveTestSuite);
+  MITK_TEST(ExtractChannels_Float_MatchesVectorIndexSelection);
+  MITK_TEST(ExtractChannels_Double_MatchesVectorIndexSelection);
+  MITK_TEST(ExtractChannels_UInt16_MatchesVectorIndexSelection);
+  MITK_TEST(ExtractChannels_InvalidChannel_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  // the number of pixels is not a multiple of the gather width
+  static constexpr unsigned int Width = 37;
+  static constexpr unsigned int Height = 29;
+  static constexpr unsigned int Components = 7;
+
+  template <class TPixel>
+  static typename itk::VectorImage<TPixel, 2>::Pointer CreateImage()
+  {
+    auto image = itk::VectorImage<TPixel, 2>::New();
+    typename itk::VectorImage<TPixel, 2>::RegionType region;
+    region.SetSize(0, Width);
+    region.SetSize(1, Height);
+    image->SetRegions(region);
+    image->SetNumberOfComponentsPerPixel(Components);
+    image->Allocate();
+    const auto n = std::size_t(Width) * Height * Components;
+    for (std::size_t i = 0; i < n; ++i)
+      image->GetBufferPointer()[i] = static_cast<TPixel>(1000 + 900 * std::sin(0.01 * i));
+    return image;
+  }
+
+  /**
+   * Compares the channels of every instruction set bitwise with itk::VectorIndexSelectionCastImageFilter.
+   */
+  template <class TPixel>
+  void Check()
+  {
+    using VectorImageType = itk::VectorImage<TPixel, 2>;
+    using ScalarImageType = itk::Image<TPixel, 2>;
+    const auto itkImage = CreateImage<TPixel>();
+    const auto image = mitk::ImportItkImage(itkImage);
+    // unordered and repeated channels
+    const std::vector<unsigned int> channels = {6, 0, 3, 3, 1};
+
+    std::vector<typename ScalarImageType::Pointer> expected;
+    for (auto channel : channels)
+    {
+      auto filter = itk::VectorIndexSelectionCastImageFilter<VectorImageType, ScalarImageType>::New();
+      filter->SetIndex(channel);
+      filter->SetInput(itkImage);
+      filter->Update();
+      expected.push_back(filter->GetOutput());
+    }
+
+    // instruction sets that are not available fall back to a supported one
+    using Set = m2::ElxChannelDeinterleave::InstructionSet;
+    const auto bytes = std::size_t(Width) * Height * sizeof(TPixel);
+    for (auto set : {Set::Scalar, Set::SSE2, Set::AVX2})
+    {
+      const auto outputs = m2::ElxChannelDeinterleave::ExtractChannels(image, channels, set);
+      CPPUNIT_ASSERT_EQUAL(channels.size(), outputs.size());
+      for (std::size_t i = 0; i < channels.size(); ++i)
+      {
+        CPPUNIT_ASSERT(outputs[i]->GetPixelType().GetNumberOfComponents() == 1);
+        mitk::ImageReadAccessor acc(outputs[i]);
+        CPPUNIT_ASSERT_EQUAL(0, std::memcmp(acc.GetData(), expected[i]->GetBufferPointer(), bytes));
+      }
+    }
+  }
+
+public:
+  void ExtractChannels_Float_MatchesVectorIndexSelection() { Check<float>(); }
+  void ExtractChannels_Double_MatchesVectorIndexSelection() { Check<double>(); }
+  void ExtractChannels_UInt16_MatchesVectorIndexSelection() { Check<unsigned short>(); }
+
+  void ExtractChannels_InvalidChannel_Throws()
+  {
+    const auto itkImage = CreateImage<float>();
+    const auto image = mitk::ImportItkImage(itkImage);
+    CPPUNIT_ASSERT_THROW(m2::ElxChannelDeinterleave::ExtractChannels(image, {Components}), mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxChannelDeinterleave)
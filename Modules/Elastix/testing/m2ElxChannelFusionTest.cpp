@@ -0,0 +1,189 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxChannelFusion.h>
+#include <mitkITKImageImport.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkVectorImage.h>
+
+#include <cmath>
+
+class m2ElxChannelFusionTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxChannelFusionTestSuite);
+  MITK_TEST(ComputeStatistics_LargeMean_MatchesCenteredReference);
+  MITK_TEST(Fit_PCA_OrdersComponentsByVariance);
+  MITK_TEST(Apply_Weighted_IsMeanOfChannels);
+  MITK_TEST(Weights_ToStringParse_RoundTrip);
+  MITK_TEST(GetMethod_UnknownName_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  // more pixels than one block of ComputeStatistics, so blocks are merged
+  static constexpr unsigned int Width = 128;
+  static constexpr unsigned int Height = 96;
+
+  /**
+   * Correlated channels: a common signal s plus an independent signal t.
+   */
+  static double GetValue(unsigned int x, unsigned int y, unsigned int channel)
+  {
+    const double s = 10 * std::sin(0.1 * x) * std::cos(0.07 * y);
+    const double t = 3 * std::cos(0.13 * x + 0.2 * y);
+    switch (channel)
+    {
+      case 0:
+        return s;
+      case 1:
+        return 2 * s + t;
+      default:
+        return -s + 0.5 * t;
+    }
+  }
+
+  template <class TPixel>
+  static typename itk::VectorImage<TPixel, 2>::Pointer CreateImage(double offset)
+  {
+    auto image = itk::VectorImage<TPixel, 2>::New();
+    typename itk::VectorImage<TPixel, 2>::RegionType region;
+    region.SetSize(0, Width);
+    region.SetSize(1, Height);
+    image->SetRegions(region);
+    image->SetNumberOfComponentsPerPixel(3);
+    image->Allocate();
+    auto buffer = image->GetBufferPointer();
+    for (unsigned int y = 0; y < Height; ++y)
+      for (unsigned int x = 0; x < Width; ++x)
+        for (unsigned int c = 0; c < 3; ++c)
+          buffer[(std::size_t(y) * Width + x) * 3 + c] = static_cast<TPixel>(offset * (c + 1) + GetValue(x, y, c));
+    return image;
+  }
+
+public:
+  void ComputeStatistics_LargeMean_MatchesCenteredReference()
+  {
+    // a mean of 1e6 and more against a variance of about 100: raw sums of products would cancel
+    const double offset = 1e6;
+    const auto itkImage = CreateImage<double>(offset);
+    const auto image = mitk::ImportItkImage(itkImage);
+    const auto statistics = m2::ElxChannelFusion::ComputeStatistics({image.GetPointer()}, {{0, 1, 2}});
+
+    const std::size_t n = std::size_t(Width) * Height;
+    CPPUNIT_ASSERT_EQUAL(n, statistics.numberOfSamples);
+    long double mean[3] = {0, 0, 0};
+    for (unsigned int y = 0; y < Height; ++y)
+      for (unsigned int x = 0; x < Width; ++x)
+        for (unsigned int c = 0; c < 3; ++c)
+          mean[c] += GetValue(x, y, c);
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+      mean[c] /= n;
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(double(offset * (c + 1) + mean[c]), statistics.mean[c], 1e-6);
+    }
+    for (unsigned int j = 0; j < 3; ++j)
+      for (unsigned int l = 0; l < 3; ++l)
+      {
+        long double covariance = 0;
+        for (unsigned int y = 0; y < Height; ++y)
+          for (unsigned int x = 0; x < Width; ++x)
+            covariance += (GetValue(x, y, j) - mean[j]) * (GetValue(x, y, l) - mean[l]);
+        covariance /= n - 1;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(double(covariance), statistics.covariance[j * 3 + l], 1e-7);
+      }
+  }
+
+  void Fit_PCA_OrdersComponentsByVariance()
+  {
+    const auto itkImage = CreateImage<float>(1000);
+    const auto image = mitk::ImportItkImage(itkImage);
+    m2::ElxChannelFusion::Parameters parameters;
+    parameters.method = m2::ElxChannelFusion::Method::PCA;
+    parameters.numberOfImages = 3;
+    const auto weights = m2::ElxChannelFusion::Fit({image.GetPointer()}, {{0, 1, 2}}, parameters);
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), weights.weights.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), weights.explainedVariance.size());
+    double total = 0;
+    for (std::size_t i = 0; i < 3; ++i)
+    {
+      total += weights.explainedVariance[i];
+      if (i > 0)
+        CPPUNIT_ASSERT(weights.explainedVariance[i] <= weights.explainedVariance[i - 1]);
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, total, 1e-6);
+    // the channels share one dominant signal
+    CPPUNIT_ASSERT(weights.explainedVariance[0] > 0.7);
+
+    // the fused images are centered
+    const auto fused = m2::ElxChannelFusion::Apply(image, {0, 1, 2}, weights);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), fused.size());
+    for (const auto &f : fused)
+    {
+      const auto values = m2::ElxTestData::GetValues(f);
+      double sum = 0;
+      for (auto v : values)
+        sum += v;
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, sum / values.size(), 1e-3);
+    }
+  }
+
+  void Apply_Weighted_IsMeanOfChannels()
+  {
+    const auto itkImage = CreateImage<float>(1000);
+    const auto image = mitk::ImportItkImage(itkImage);
+    m2::ElxChannelFusion::Parameters parameters;
+    parameters.method = m2::ElxChannelFusion::Method::Weighted;
+    const auto weights = m2::ElxChannelFusion::Fit({image.GetPointer()}, {{0, 2}}, parameters);
+    const auto fused = m2::ElxChannelFusion::Apply(image, {0, 2}, weights);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), fused.size());
+
+    const auto values = m2::ElxTestData::GetValues(fused.front());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(Width) * Height, values.size());
+    const auto buffer = itkImage->GetBufferPointer();
+    for (std::size_t i = 0; i < values.size(); ++i)
+      CPPUNIT_ASSERT_DOUBLES_EQUAL((double(buffer[i * 3]) + buffer[i * 3 + 2]) / 2, values[i], 1e-3);
+  }
+
+  void Weights_ToStringParse_RoundTrip()
+  {
+    m2::ElxChannelFusion::Weights weights;
+    weights.method = m2::ElxChannelFusion::Method::PCA;
+    weights.weights = {{0.1, -0.25, 1.0 / 3}, {2.5e-7, 4, -1e6}};
+    weights.offsets = {-12.5, 0.75};
+    weights.explainedVariance = {0.8, 0.15};
+
+    const auto parsed = m2::ElxChannelFusion::Weights::Parse(weights.ToString());
+    CPPUNIT_ASSERT(parsed.method == weights.method);
+    CPPUNIT_ASSERT(parsed.weights == weights.weights);
+    CPPUNIT_ASSERT(parsed.offsets == weights.offsets);
+    CPPUNIT_ASSERT(parsed.explainedVariance == weights.explainedVariance);
+  }
+
+  void GetMethod_UnknownName_Throws()
+  {
+    for (auto method : {m2::ElxChannelFusion::Method::None,
+                        m2::ElxChannelFusion::Method::PCA,
+                        m2::ElxChannelFusion::Method::NMF,
+                        m2::ElxChannelFusion::Method::Weighted})
+      CPPUNIT_ASSERT(m2::ElxChannelFusion::GetMethod(m2::ElxChannelFusion::GetMethodName(method)) == method);
+    CPPUNIT_ASSERT_THROW(m2::ElxChannelFusion::GetMethod("ICA"), mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxChannelFusion)
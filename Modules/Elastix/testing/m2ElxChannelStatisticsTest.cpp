@@ -0,0 +1,154 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include <m2ElxChannelStatistics.h>
+#include <mitkITKImageImport.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkVectorImage.h>
+
+#include <cmath>
+#include <cstdint>
+
+class m2ElxChannelStatisticsTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxChannelStatisticsTestSuite);
+  MITK_TEST(Rank_FlatNoisyStructured_StructuredFirst);
+  MITK_TEST(Compute_Reference_MatchingChannelHasHighestMutualInformation);
+  MITK_TEST(Compute_SmallBuffer_BoundsSamplesTimesChannels);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  static constexpr unsigned int Width = 96;
+  static constexpr unsigned int Height = 80;
+
+  enum Channel : unsigned int
+  {
+    Flat,
+    Noisy,
+    Structured,
+    Components
+  };
+
+  static double GetStructure(unsigned int x, unsigned int y)
+  {
+    return 100 + 50 * std::sin(0.1 * x) * std::cos(0.12 * y);
+  }
+
+  /**
+   * Flat, uniform noise (deterministic linear congruential generator) and a smooth structure.
+   */
+  static itk::VectorImage<float, 2>::Pointer CreateImage()
+  {
+    auto image = itk::VectorImage<float, 2>::New();
+    itk::VectorImage<float, 2>::RegionType region;
+    region.SetSize(0, Width);
+    region.SetSize(1, Height);
+    image->SetRegions(region);
+    image->SetNumberOfComponentsPerPixel(Components);
+    image->Allocate();
+    auto buffer = image->GetBufferPointer();
+    std::uint32_t state = 12345;
+    for (unsigned int y = 0; y < Height; ++y)
+      for (unsigned int x = 0; x < Width; ++x)
+      {
+        const auto p = (std::size_t(y) * Width + x) * Components;
+        state = state * 1664525u + 1013904223u;
+        buffer[p + Flat] = 5;
+        buffer[p + Noisy] = static_cast<float>(100.0 * (state >> 8) / (1u << 24));
+        buffer[p + Structured] = static_cast<float>(GetStructure(x, y));
+      }
+    return image;
+  }
+
+public:
+  void Rank_FlatNoisyStructured_StructuredFirst()
+  {
+    const auto image = mitk::ImportItkImage(CreateImage());
+    m2::ElxChannelStatistics::Parameters parameters;
+    parameters.stride = 1;
+    const auto channels = m2::ElxChannelStatistics::Compute(image, nullptr, parameters);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(Components), channels.size());
+    for (unsigned int c = 0; c < Components; ++c)
+    {
+      CPPUNIT_ASSERT_EQUAL(c, channels[c].index);
+      CPPUNIT_ASSERT_EQUAL(std::size_t(Width) * Height, channels[c].numberOfSamples);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, channels[c].mutualInformation, 0.0);
+    }
+
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(5.0, channels[Flat].mean, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, channels[Flat].variance, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, channels[Flat].entropy, 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, channels[Flat].score, 0.0);
+
+    // noise: gradient energy close to 2 * variance; structure: neighbors are close
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(2.0, channels[Noisy].gradientEnergy / channels[Noisy].variance, 0.1);
+    CPPUNIT_ASSERT(channels[Structured].gradientEnergy < 0.05 * channels[Structured].variance);
+    CPPUNIT_ASSERT(channels[Noisy].score < 0.25 * channels[Structured].score);
+
+    const auto ranked = m2::ElxChannelStatistics::Rank(channels);
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(Structured), ranked[0].index);
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(Flat), ranked.back().index);
+
+    // channels without a positive score are not suggested
+    const auto suggested = m2::ElxChannelStatistics::Suggest(channels, 5);
+    CPPUNIT_ASSERT(!suggested.empty() && suggested.size() < Components);
+    CPPUNIT_ASSERT_EQUAL(static_cast<unsigned int>(Structured), suggested.front());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), m2::ElxChannelStatistics::Suggest(channels, 1).size());
+  }
+
+  void Compute_Reference_MatchingChannelHasHighestMutualInformation()
+  {
+    const auto image = mitk::ImportItkImage(CreateImage());
+    auto itkReference = itk::Image<float, 2>::New();
+    itk::Image<float, 2>::RegionType region;
+    region.SetSize(0, Width);
+    region.SetSize(1, Height);
+    itkReference->SetRegions(region);
+    itkReference->Allocate();
+    for (unsigned int y = 0; y < Height; ++y)
+      for (unsigned int x = 0; x < Width; ++x)
+        itkReference->GetBufferPointer()[std::size_t(y) * Width + x] = static_cast<float>(-GetStructure(x, y));
+    const auto reference = mitk::ImportItkImage(itkReference);
+
+    const auto withoutReference = m2::ElxChannelStatistics::Compute(image);
+    const auto channels = m2::ElxChannelStatistics::Compute(image, reference);
+    CPPUNIT_ASSERT(channels[Structured].mutualInformation > 1.0);
+    CPPUNIT_ASSERT(channels[Noisy].mutualInformation < 0.5 * channels[Structured].mutualInformation);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, channels[Flat].mutualInformation, 1e-9);
+    CPPUNIT_ASSERT(channels[Structured].score > withoutReference[Structured].score);
+  }
+
+  void Compute_SmallBuffer_BoundsSamplesTimesChannels()
+  {
+    const auto image = mitk::ImportItkImage(CreateImage());
+    m2::ElxChannelStatistics::Parameters parameters;
+    parameters.maximumNumberOfValues = 1000;
+    // the automatic and an explicit stride are both increased until the buffer fits
+    for (unsigned int stride : {0u, 1u})
+    {
+      parameters.stride = stride;
+      const auto channels = m2::ElxChannelStatistics::Compute(image, nullptr, parameters);
+      CPPUNIT_ASSERT(channels[0].numberOfSamples > 0);
+      CPPUNIT_ASSERT(channels[0].numberOfSamples * Components <= parameters.maximumNumberOfValues);
+    }
+
+    const auto channels = m2::ElxChannelStatistics::Compute(image);
+    CPPUNIT_ASSERT(channels[0].numberOfSamples * Components <= m2::ElxChannelStatistics::GetMaximumNumberOfValues());
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxChannelStatistics)
@@ -0,0 +1,189 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxLazyWarpedImage.h>
+#include <m2ElxRegistrationHelper.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+class m2ElxLazyWarpedImageTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxLazyWarpedImageTestSuite);
+  MITK_TEST(CreateLazyWarpedImage_SingleSlice_MatchesWarpImage);
+  MITK_TEST(CreateLazyWarpedImage_Stack_WarpsRequestedSlicesOnly);
+  MITK_TEST(Cache_Budget_DropsLeastRecentlyUsedSlices);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  static constexpr unsigned int Slices = 3;
+
+  m2::ElxRegistrationHelper m_Helper;
+
+  /**
+   * Stack of the moving image pattern with an offset per slice.
+   */
+  static mitk::Image::Pointer CreateStack()
+  {
+    using StackType = itk::Image<float, 3>;
+    const auto reference = m2::ElxTestData::CreateMovingImage<itk::Image<float, 2>>();
+    auto stack = StackType::New();
+    StackType::RegionType region;
+    StackType::SpacingType spacing;
+    StackType::PointType origin;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      region.SetSize(i, reference->GetLargestPossibleRegion().GetSize(i));
+      spacing[i] = reference->GetSpacing()[i];
+      origin[i] = reference->GetOrigin()[i];
+    }
+    region.SetSize(2, Slices);
+    spacing[2] = 2;
+    origin[2] = 0;
+    stack->SetRegions(region);
+    stack->SetSpacing(spacing);
+    stack->SetOrigin(origin);
+    stack->Allocate();
+    itk::ImageRegionIteratorWithIndex<StackType> it(stack, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      it.Set(static_cast<float>(100 * i[2] + 1000 + 500 * std::sin(0.15 * i[0]) * std::cos(0.1 * i[1])));
+    }
+    return m2::ElxTestData::ToMitkImage(stack.GetPointer());
+  }
+
+  static std::vector<double> GetSliceValues(const mitk::Image *image, unsigned int z)
+  {
+    const auto item = image->GetSliceData(z);
+    const auto data = static_cast<const float *>(item->GetData());
+    return std::vector<double>(data, data + std::size_t(image->GetDimension(0)) * image->GetDimension(1));
+  }
+
+  static void CheckGeometry(const mitk::Image *expected, const mitk::Image *image)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      CPPUNIT_ASSERT_EQUAL(expected->GetDimension(i), image->GetDimension(i));
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->GetGeometry()->GetOrigin()[i], image->GetGeometry()->GetOrigin()[i], 1e-9);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(
+        expected->GetGeometry()->GetSpacing()[i], image->GetGeometry()->GetSpacing()[i], 1e-9);
+    }
+  }
+
+public:
+  void setUp() override
+  {
+    m_Helper.SetTransformations({m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                                 m2::ElxTestData::CreateBSplineTransformation(2.0)});
+  }
+
+  void CreateLazyWarpedImage_SingleSlice_MatchesWarpImage()
+  {
+    const auto image = m2::ElxTestData::ToMitkImage(
+      m2::ElxTestData::CreateMovingImage<itk::Image<float, 2>>().GetPointer());
+    const auto expected = m_Helper.WarpImage(image, "float", 1);
+    const auto cache = m2::ElxLazyWarpedImage::Cache::New();
+    const auto lazy = m_Helper.CreateLazyWarpedImage(image, "float", 1, cache);
+    CPPUNIT_ASSERT(lazy.IsNotNull());
+    CheckGeometry(expected, lazy);
+    CPPUNIT_ASSERT_EQUAL(std::string("float"), lazy->GetPixelType().GetComponentTypeAsString());
+    // nothing is warped before the pixels are accessed
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), cache->GetMemoryUsage());
+
+    const auto values = m2::ElxTestData::GetValues(expected);
+    CPPUNIT_ASSERT(m2::ElxTestData::GetMaximumDifference(values, GetSliceValues(lazy, 0)) < 1e-2);
+    CPPUNIT_ASSERT_EQUAL(values.size() * sizeof(float), cache->GetMemoryUsage());
+    // the volume (e.g. of an ImageReadAccessor) and regular copies have the same pixels
+    CPPUNIT_ASSERT(m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(lazy)) < 1e-2);
+    CPPUNIT_ASSERT(m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(lazy->Materialize())) <
+                   1e-2);
+    CPPUNIT_ASSERT(m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(lazy->Clone())) < 1e-2);
+  }
+
+  void CreateLazyWarpedImage_Stack_WarpsRequestedSlicesOnly()
+  {
+    const auto stack = CreateStack();
+    const auto expected = m_Helper.WarpImage(stack, "float", 1);
+    const auto cache = m2::ElxLazyWarpedImage::Cache::New();
+    const auto lazy = m_Helper.CreateLazyWarpedImage(stack, "float", 1, cache);
+    CPPUNIT_ASSERT(lazy.IsNotNull());
+    CheckGeometry(expected, lazy);
+
+    const auto values = m2::ElxTestData::GetValues(expected);
+    const std::size_t sliceSize = values.size() / Slices;
+    for (unsigned int z : {2u, 0u})
+    {
+      const std::vector<double> slice(values.begin() + z * sliceSize, values.begin() + (z + 1) * sliceSize);
+      CPPUNIT_ASSERT_MESSAGE("slice " + std::to_string(z),
+                             m2::ElxTestData::GetMaximumDifference(slice, GetSliceValues(lazy, z)) == 0);
+    }
+    CPPUNIT_ASSERT_EQUAL(2 * sliceSize * sizeof(float), cache->GetMemoryUsage());
+    CPPUNIT_ASSERT_EQUAL(0ull, cache->GetNumberOfHits());
+    CPPUNIT_ASSERT_EQUAL(2ull, cache->GetNumberOfMisses());
+
+    // cached slices are not warped again
+    const auto item = lazy->GetSliceData(2);
+    CPPUNIT_ASSERT(item == lazy->GetSliceData(2));
+    CPPUNIT_ASSERT_EQUAL(2ull, cache->GetNumberOfHits());
+
+    CPPUNIT_ASSERT_EQUAL(0.0, m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(lazy)));
+    // slices of the volume are copied from it
+    CPPUNIT_ASSERT_EQUAL(0.0, m2::ElxTestData::GetMaximumDifference(
+                                std::vector<double>(values.begin() + sliceSize, values.begin() + 2 * sliceSize),
+                                GetSliceValues(lazy, 1)));
+    // the image is read-only
+    float pixels[1] = {0};
+    CPPUNIT_ASSERT_THROW(lazy->GetSliceData(0, 0, 0, pixels), mitk::Exception);
+  }
+
+  void Cache_Budget_DropsLeastRecentlyUsedSlices()
+  {
+    const auto stack = CreateStack();
+    const auto cache = m2::ElxLazyWarpedImage::Cache::New();
+    auto lazy = m_Helper.CreateLazyWarpedImage(stack, "float", 0, cache);
+    const std::size_t sliceBytes = std::size_t(lazy->GetDimension(0)) * lazy->GetDimension(1) * sizeof(float);
+    cache->SetMemoryBudget(sliceBytes * 3 / 2);
+
+    lazy->GetSliceData(0);
+    lazy->GetSliceData(1);
+    CPPUNIT_ASSERT_EQUAL(sliceBytes, cache->GetMemoryUsage());
+    lazy->GetSliceData(1);
+    CPPUNIT_ASSERT_EQUAL(1ull, cache->GetNumberOfHits());
+    lazy->GetSliceData(0);
+    CPPUNIT_ASSERT_EQUAL(3ull, cache->GetNumberOfMisses());
+
+    // the most recent slice is kept even if it exceeds the budget
+    cache->SetMemoryBudget(1);
+    CPPUNIT_ASSERT_EQUAL(sliceBytes, cache->GetMemoryUsage());
+
+    // a shared cache drops the slices of released images
+    cache->SetMemoryBudget(sliceBytes * 4);
+    auto other = m_Helper.CreateLazyWarpedImage(stack, "float", 0, cache);
+    other->GetSliceData(2);
+    CPPUNIT_ASSERT_EQUAL(2 * sliceBytes, cache->GetMemoryUsage());
+    lazy = nullptr;
+    CPPUNIT_ASSERT_EQUAL(sliceBytes, cache->GetMemoryUsage());
+    cache->Clear();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), cache->GetMemoryUsage());
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxLazyWarpedImage)
@@ -0,0 +1,309 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxRegistrationHelper.h>
+#include <mitkImageReadAccessor.h>
+#include <mitkProportionalTimeGeometry.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkMath.h>
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+  /**
+   * Exposes protected members of the helper.
+   */
+  class TestHelper : public m2::ElxRegistrationHelper
+  {
+  public:
+    using m2::ElxRegistrationHelper::ConvertForElastixProcessing;
+    using m2::ElxRegistrationHelper::ConvertForM2aiaProcessing;
+    using m2::ElxRegistrationHelper::CreateInitialRigidTransform;
+  };
+} // namespace
+
+class m2ElxRegistrationHelperTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxRegistrationHelperTestSuite);
+  MITK_TEST(CreateInitialRigidTransform_RotatesAboutCenters);
+  MITK_TEST(CreateAlignedImage_Linear_SharesBufferAndMapsOntoFixedSpace);
+  MITK_TEST(GetDeformationField_Region_MatchesFullField);
+  MITK_TEST(ConvertForProcessing_Views_ShareBuffers);
+  MITK_TEST(WarpTimeSteps_ChainPerTimeStep_MatchesWarpImage);
+  MITK_TEST(WarpTimeSteps_MissingTransformations_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  using ImageType = itk::Image<float, 2>;
+  static constexpr unsigned int TimeSteps = 3;
+
+  /**
+   * Time step t on the output grid of the test transformations (64 x 48, spacing 1, origin 0).
+   */
+  static mitk::Image::Pointer CreateFrame(unsigned int t)
+  {
+    auto image = ImageType::New();
+    ImageType::RegionType region;
+    region.SetSize(0, 64);
+    region.SetSize(1, 48);
+    image->SetRegions(region);
+    image->Allocate();
+    itk::ImageRegionIteratorWithIndex<ImageType> it(image, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      it.Set(static_cast<float>(1000 + 500 * std::sin(0.15 * i[0] + 0.3 * t) * std::cos(0.1 * i[1])));
+    }
+    return m2::ElxTestData::ToMitkImage(image.GetPointer());
+  }
+
+  /**
+   * 2D+t image of the frames (time steps are stored one after another).
+   */
+  static mitk::Image::Pointer CreateTimeSeries(const std::vector<mitk::Image::Pointer> &frames)
+  {
+    auto timeGeometry = mitk::ProportionalTimeGeometry::New();
+    timeGeometry->Initialize(frames.front()->GetGeometry()->Clone(), frames.size());
+    auto result = mitk::Image::New();
+    result->Initialize(frames.front()->GetPixelType(), *timeGeometry);
+    for (unsigned int t = 0; t < frames.size(); ++t)
+    {
+      mitk::ImageReadAccessor acc(frames[t]);
+      result->SetVolume(acc.GetData(), t);
+    }
+    return result;
+  }
+
+  static std::vector<double> GetTimeStepValues(const mitk::Image *image, unsigned int t)
+  {
+    const auto n = std::size_t(image->GetDimension(0)) * image->GetDimension(1);
+    std::vector<float> values(n);
+    mitk::ImageReadAccessor acc(image, image->GetVolumeData(t));
+    std::memcpy(values.data(), acc.GetData(), n * sizeof(float));
+    return std::vector<double>(values.begin(), values.end());
+  }
+
+  std::vector<std::vector<std::string>> m_TimeStepTransformations;
+
+public:
+  void setUp() override
+  {
+    // time step 0 is the reference and keeps its geometry
+    m_TimeStepTransformations = {{},
+                                 {m2::ElxTestData::CreateEulerTransformation(0.05, 1.5, -2.0)},
+                                 {m2::ElxTestData::CreateAffineTransformation(0.1, 1.02, -1.0, 0.5),
+                                  m2::ElxTestData::CreateBSplineTransformation(1.5)}};
+  }
+
+  void CreateInitialRigidTransform_RotatesAboutCenters()
+  {
+    const auto fixed = CreateFrame(0);
+    const auto moving = m2::ElxTestData::ToMitkImage(m2::ElxTestData::CreateMovingImage<ImageType>().GetPointer());
+    TestHelper helper;
+    helper.SetImageData(fixed, moving);
+    const auto fixedCenter = fixed->GetGeometry()->GetCenter();
+    const auto movingCenter = moving->GetGeometry()->GetCenter();
+
+    for (double angle : {0.0, 0.5 * itk::Math::pi, 2.0})
+      for (bool flip : {false, true})
+      {
+        const auto transform =
+          m2::ElxTransformEngine::CreateCompositeTransform<2>({helper.CreateInitialRigidTransform(angle, flip, 2)});
+        const double offset[2] = {3, 2};
+        itk::Point<double, 2> center, point;
+        for (unsigned int i = 0; i < 2; ++i)
+        {
+          center[i] = fixedCenter[i];
+          point[i] = fixedCenter[i] + offset[i];
+        }
+
+        // the fixed center maps onto the moving center; offsets are flipped along x, then rotated
+        const auto mappedCenter = transform->TransformPoint(center);
+        const auto mappedPoint = transform->TransformPoint(point);
+        const double f = flip ? -1 : 1;
+        const double expected[2] = {std::cos(angle) * f * offset[0] - std::sin(angle) * offset[1],
+                                    std::sin(angle) * f * offset[0] + std::cos(angle) * offset[1]};
+        const auto message = "angle " + std::to_string(angle) + (flip ? ", flipped" : "");
+        for (unsigned int i = 0; i < 2; ++i)
+        {
+          CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE(message, movingCenter[i], mappedCenter[i], 1e-6);
+          CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE(message, movingCenter[i] + expected[i], mappedPoint[i], 1e-6);
+        }
+      }
+  }
+
+  void CreateAlignedImage_Linear_SharesBufferAndMapsOntoFixedSpace()
+  {
+    const auto moving = m2::ElxTestData::ToMitkImage(m2::ElxTestData::CreateMovingImage<ImageType>().GetPointer());
+    const std::vector<std::string> transformations = {m2::ElxTestData::CreateEulerTransformation(0.3, 4.0, -2.5),
+                                                      m2::ElxTestData::CreateAffineTransformation(0.1, 1.05, 1.0, 0.5)};
+    m2::ElxRegistrationHelper helper;
+    helper.SetTransformations(transformations);
+    CPPUNIT_ASSERT(helper.CanApplyToGeometry());
+    const auto aligned = helper.CreateAlignedImage(moving);
+    {
+      mitk::ImageReadAccessor movingAcc(moving), alignedAcc(aligned);
+      CPPUNIT_ASSERT(movingAcc.GetData() == alignedAcc.GetData());
+    }
+
+    // the chain maps the aligned position of every pixel onto its position in the moving image
+    const auto transform = m2::ElxTransformEngine::CreateCompositeTransform<2>(transformations);
+    for (const auto &i : std::vector<std::array<double, 2>>{{0, 0}, {109, 0}, {37, 58}, {109, 95}})
+    {
+      mitk::Point3D index, alignedWorld, movingWorld;
+      index[0] = i[0];
+      index[1] = i[1];
+      index[2] = 0;
+      aligned->GetGeometry()->IndexToWorld(index, alignedWorld);
+      moving->GetGeometry()->IndexToWorld(index, movingWorld);
+      itk::Point<double, 2> point;
+      point[0] = alignedWorld[0];
+      point[1] = alignedWorld[1];
+      const auto mapped = transform->TransformPoint(point);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(movingWorld[0], mapped[0], 1e-6);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(movingWorld[1], mapped[1], 1e-6);
+    }
+
+    helper.SetTransformations({transformations.front(), m2::ElxTestData::CreateBSplineTransformation(2.0)});
+    CPPUNIT_ASSERT(!helper.CanApplyToGeometry());
+    CPPUNIT_ASSERT_THROW(helper.CreateAlignedImage(moving), mitk::Exception);
+  }
+
+  void GetDeformationField_Region_MatchesFullField()
+  {
+    m2::ElxRegistrationHelper helper;
+    helper.SetTransformations({m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                               m2::ElxTestData::CreateBSplineTransformation(2.0)});
+    const auto full = helper.GetDeformationField();
+    CPPUNIT_ASSERT(full.IsNotNull());
+    CPPUNIT_ASSERT_EQUAL(64u, full->GetDimension(0));
+    CPPUNIT_ASSERT_EQUAL(48u, full->GetDimension(1));
+
+    const unsigned int index[2] = {10, 5}, size[2] = {20, 12};
+    helper.SetDeformationFieldRegion({index[0], index[1]}, {size[0], size[1]});
+    const auto region = helper.GetDeformationField();
+    CPPUNIT_ASSERT(region.IsNotNull() && region != full);
+    CPPUNIT_ASSERT_EQUAL(size[0], region->GetDimension(0));
+    CPPUNIT_ASSERT_EQUAL(size[1], region->GetDimension(1));
+
+    // the region starts at the world position of its first pixel in the full grid
+    mitk::Point3D first, fullOrigin;
+    first[0] = index[0];
+    first[1] = index[1];
+    first[2] = 0;
+    full->GetGeometry()->IndexToWorld(first, fullOrigin);
+    for (unsigned int i = 0; i < 2; ++i)
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(fullOrigin[i], region->GetGeometry()->GetOrigin()[i], 1e-9);
+
+    const auto fullValues = m2::ElxTestData::GetValues(full);
+    const auto regionValues = m2::ElxTestData::GetValues(region);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(size[0]) * size[1] * 2, regionValues.size());
+    for (unsigned int y = 0; y < size[1]; ++y)
+      for (unsigned int x = 0; x < size[0]; ++x)
+        for (unsigned int c = 0; c < 2; ++c)
+          CPPUNIT_ASSERT_DOUBLES_EQUAL(fullValues[((std::size_t(y) + index[1]) * 64 + x + index[0]) * 2 + c],
+                                       regionValues[(std::size_t(y) * size[0] + x) * 2 + c],
+                                       1e-4);
+
+    // empty vectors select the whole grid again
+    helper.SetDeformationFieldRegion({}, {});
+    CPPUNIT_ASSERT_EQUAL(64u, helper.GetDeformationField()->GetDimension(0));
+  }
+
+  void ConvertForProcessing_Views_ShareBuffers()
+  {
+    TestHelper helper;
+    const auto frame = CreateFrame(0);
+    const auto slice = helper.ConvertForM2aiaProcessing(frame);
+    CPPUNIT_ASSERT_EQUAL(3u, slice->GetDimension());
+    CPPUNIT_ASSERT_EQUAL(1u, slice->GetDimension(2));
+    const auto view = helper.ConvertForElastixProcessing(slice);
+    CPPUNIT_ASSERT_EQUAL(2u, view->GetDimension());
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(frame->GetGeometry()->GetOrigin()[i], view->GetGeometry()->GetOrigin()[i], 1e-9);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(frame->GetGeometry()->GetSpacing()[i], view->GetGeometry()->GetSpacing()[i], 1e-9);
+    }
+    {
+      mitk::ImageReadAccessor frameAcc(frame), sliceAcc(slice), viewAcc(view);
+      CPPUNIT_ASSERT(sliceAcc.GetData() == frameAcc.GetData());
+      CPPUNIT_ASSERT(viewAcc.GetData() == frameAcc.GetData());
+    }
+
+    // a time step of a 2D+t image is a 2D view at its offset in the buffer
+    const auto series = CreateTimeSeries({CreateFrame(0), CreateFrame(1), CreateFrame(2)});
+    const auto timeStep = helper.ConvertForElastixProcessing(series, 2);
+    CPPUNIT_ASSERT_EQUAL(2u, timeStep->GetDimension());
+    {
+      mitk::ImageReadAccessor seriesAcc(series), timeStepAcc(timeStep);
+      const auto bytes = std::size_t(64) * 48 * sizeof(float);
+      CPPUNIT_ASSERT(timeStepAcc.GetData() == static_cast<const char *>(seriesAcc.GetData()) + 2 * bytes);
+    }
+    CPPUNIT_ASSERT_EQUAL(0.0,
+                         m2::ElxTestData::GetMaximumDifference(m2::ElxTestData::GetValues(CreateFrame(2)),
+                                                               m2::ElxTestData::GetValues(timeStep)));
+
+    CPPUNIT_ASSERT_EQUAL(0u, helper.GetNumberOfImageCopies());
+    CPPUNIT_ASSERT_THROW(helper.ConvertForElastixProcessing(series, 3), mitk::Exception);
+    CPPUNIT_ASSERT_THROW(helper.ConvertForElastixProcessing(nullptr), mitk::Exception);
+  }
+
+  void WarpTimeSteps_ChainPerTimeStep_MatchesWarpImage()
+  {
+    std::vector<mitk::Image::Pointer> frames;
+    for (unsigned int t = 0; t < TimeSteps; ++t)
+      frames.push_back(CreateFrame(t));
+    const auto series = CreateTimeSeries(frames);
+
+    m2::ElxRegistrationHelper helper;
+    helper.SetTimeStepTransformations(m_TimeStepTransformations);
+    const auto warped = helper.WarpTimeSteps(series, "float", 1);
+    CPPUNIT_ASSERT(warped.IsNotNull());
+    CPPUNIT_ASSERT_EQUAL(TimeSteps, warped->GetTimeSteps());
+    CPPUNIT_ASSERT_EQUAL(64u, warped->GetDimension(0));
+    CPPUNIT_ASSERT_EQUAL(48u, warped->GetDimension(1));
+
+    CPPUNIT_ASSERT_EQUAL(0.0,
+                         m2::ElxTestData::GetMaximumDifference(m2::ElxTestData::GetValues(frames[0]),
+                                                               GetTimeStepValues(warped, 0)));
+    for (unsigned int t = 1; t < TimeSteps; ++t)
+    {
+      m2::ElxRegistrationHelper timeStepHelper;
+      timeStepHelper.SetTransformations(m_TimeStepTransformations[t]);
+      const auto expected = m2::ElxTestData::GetValues(timeStepHelper.WarpImage(frames[t], "float", 1));
+      const auto difference = m2::ElxTestData::GetMaximumDifference(expected, GetTimeStepValues(warped, t));
+      CPPUNIT_ASSERT_MESSAGE("time step " + std::to_string(t), difference < 1e-3);
+    }
+  }
+
+  void WarpTimeSteps_MissingTransformations_Throws()
+  {
+    const auto series = CreateTimeSeries({CreateFrame(0), CreateFrame(1)});
+    m2::ElxRegistrationHelper helper;
+    helper.SetTimeStepTransformations(m_TimeStepTransformations);
+    CPPUNIT_ASSERT_THROW(helper.WarpTimeSteps(series, "float", 1), mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxRegistrationHelper)
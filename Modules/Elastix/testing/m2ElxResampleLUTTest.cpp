@@ -0,0 +1,149 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxResampleLUT.h>
+#include <m2ElxWarpSession.h>
+#include <mitkIOUtil.h>
+#include <mitkITKImageImport.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkVectorImage.h>
+#include <itksys/SystemTools.hxx>
+
+#include <cstring>
+
+class m2ElxResampleLUTTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxResampleLUTTestSuite);
+  MITK_TEST(Apply_Linear_MatchesResampleImageFilter);
+  MITK_TEST(Apply_Nearest_MatchesResampleImageFilter);
+  MITK_TEST(Apply_MultiChannel_MatchesWarpMultiChannel);
+  MITK_TEST(SaveLoad_RoundTrip_KeepsTableAndResult);
+  MITK_TEST(Apply_OtherGrid_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  using ImageType = itk::Image<float, 2>;
+  using VectorImageType = itk::VectorImage<float, 2>;
+
+  std::vector<std::string> m_Transformations;
+  m2::ElxWarpSession::Pointer m_Session;
+  ImageType::Pointer m_Moving;
+  mitk::Image::Pointer m_MovingImage;
+  m2::ElxResampleLUT::Pointer m_Table;
+  std::string m_Directory;
+
+public:
+  void setUp() override
+  {
+    m_Transformations = {m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                         m2::ElxTestData::CreateBSplineTransformation(2.0)};
+    m_Session = m2::ElxWarpSession::CreateFromTransformations(
+      m_Transformations, m2::ElxTransformEngine::DeformationRepresentation::DisplacementField, std::size_t(1) << 30);
+    m_Moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    m_MovingImage = m2::ElxTestData::ToMitkImage(m_Moving.GetPointer());
+    m_Table = m_Session->CreateResampleLUT(m_MovingImage);
+    m_Directory = mitk::IOUtil::CreateTemporaryDirectory();
+  }
+
+  void tearDown() override
+  {
+    m_Table = nullptr;
+    m_Session = nullptr;
+    itksys::SystemTools::RemoveADirectory(m_Directory);
+  }
+
+  void Apply_Linear_MatchesResampleImageFilter()
+  {
+    const auto reference = m2::ElxTestData::Resample(m_Moving.GetPointer(), m_Transformations, 1);
+    const auto values = m2::ElxTestData::GetValues(m_Table->Apply(m_MovingImage));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(
+      0.0, m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(reference.GetPointer())), 1e-2);
+  }
+
+  void Apply_Nearest_MatchesResampleImageFilter()
+  {
+    const auto reference = m2::ElxTestData::Resample(m_Moving.GetPointer(), m_Transformations, 0);
+    const auto values = m2::ElxTestData::GetValues(m_Table->Apply(m_MovingImage, true));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(
+      0.0, m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(reference.GetPointer())), 1e-6);
+  }
+
+  void Apply_MultiChannel_MatchesWarpMultiChannel()
+  {
+    // 3 channels of the moving grid with different offsets
+    auto vectorImage = VectorImageType::New();
+    vectorImage->CopyInformation(m_Moving);
+    vectorImage->SetRegions(m_Moving->GetLargestPossibleRegion());
+    vectorImage->SetNumberOfComponentsPerPixel(3);
+    vectorImage->Allocate();
+    const auto n = m_Moving->GetLargestPossibleRegion().GetNumberOfPixels();
+    for (std::size_t i = 0; i < n; ++i)
+      for (unsigned int c = 0; c < 3; ++c)
+        vectorImage->GetBufferPointer()[i * 3 + c] = m_Moving->GetBufferPointer()[i] + 100.0f * c;
+    const auto image = mitk::ImportItkImage(vectorImage);
+
+    for (bool nearest : {false, true})
+    {
+      const auto expected = m2::ElxTestData::GetValues(m_Session->WarpMultiChannel(image, "float", nearest ? 0 : 1));
+      const auto values = m2::ElxTestData::GetValues(m_Table->Apply(image, nearest));
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, m2::ElxTestData::GetMaximumDifference(values, expected), 1e-2);
+    }
+  }
+
+  void SaveLoad_RoundTrip_KeepsTableAndResult()
+  {
+    const auto path = m_Directory + "/table.lut";
+    m_Table->Save(path);
+    const auto loaded = m2::ElxResampleLUT::Load(path);
+
+    CPPUNIT_ASSERT_EQUAL(0, std::memcmp(&m_Table->GetHeader(), &loaded->GetHeader(), sizeof(m2::ElxResampleLUT::Header)));
+    const auto n = m_Table->GetNumberOfPixels();
+    CPPUNIT_ASSERT_EQUAL(n, loaded->GetNumberOfPixels());
+    const m2::ElxResampleLUT &table = *m_Table;
+    CPPUNIT_ASSERT_EQUAL(
+      0, std::memcmp(table.GetNearestIndices(), loaded->GetNearestIndices(), n * sizeof(m2::ElxResampleLUT::IndexType)));
+    for (unsigned int corner = 0; corner < m_Table->GetWeightsPerPixel(); ++corner)
+    {
+      CPPUNIT_ASSERT_EQUAL(
+        0, std::memcmp(table.GetIndices(corner), loaded->GetIndices(corner), n * sizeof(m2::ElxResampleLUT::IndexType)));
+      CPPUNIT_ASSERT_EQUAL(
+        0, std::memcmp(table.GetWeights(corner), loaded->GetWeights(corner), n * sizeof(m2::ElxResampleLUT::WeightType)));
+    }
+
+    for (bool nearest : {false, true})
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0,
+                                   m2::ElxTestData::GetMaximumDifference(
+                                     m2::ElxTestData::GetValues(m_Table->Apply(m_MovingImage, nearest)),
+                                     m2::ElxTestData::GetValues(loaded->Apply(m_MovingImage, nearest))),
+                                   0.0);
+  }
+
+  void Apply_OtherGrid_Throws()
+  {
+    auto other = ImageType::New();
+    ImageType::RegionType region;
+    region.SetSize(0, 10);
+    region.SetSize(1, 10);
+    other->SetRegions(region);
+    other->Allocate(true);
+    CPPUNIT_ASSERT_THROW(m_Table->Apply(m2::ElxTestData::ToMitkImage(other.GetPointer())), mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxResampleLUT)
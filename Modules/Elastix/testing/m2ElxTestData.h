@@ -0,0 +1,226 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+#pragma once
+
+#include <m2ElxTransformEngine.h>
+#include <m2ElxTransformParameterMap.h>
+#include <m2ElxUtil.h>
+#include <mitkImage.h>
+#include <mitkImageCast.h>
+#include <mitkImageReadAccessor.h>
+
+#include <itkBSplineInterpolateImageFunction.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkResampleImageFilter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Synthetic 2D transformations and images shared by the tests of the Elastix module.
+ *
+ * All transformations resample onto a 64 x 48 grid (spacing 1, origin 0). The moving images cover the
+ * moving space of the transformations with a margin, so no output pixel maps outside of them.
+ */
+namespace m2
+{
+  namespace ElxTestData
+  {
+    inline std::string GetCommonParameters()
+    {
+      return "(FixedImageDimension 2)\n"
+             "(MovingImageDimension 2)\n"
+             "(FixedInternalImagePixelType \"float\")\n"
+             "(MovingInternalImagePixelType \"float\")\n"
+             "(HowToCombineTransforms \"Compose\")\n"
+             "(InitialTransformParametersFileName \"NoInitialTransform\")\n"
+             "(Size 64 48)\n"
+             "(Index 0 0)\n"
+             "(Spacing 1.0000000000 1.0000000000)\n"
+             "(Origin 0.0000000000 0.0000000000)\n"
+             "(Direction 1 0 0 1)\n"
+             "(UseDirectionCosines \"true\")\n"
+             "(Resampler \"DefaultResampler\")\n"
+             "(ResampleInterpolator \"FinalLinearInterpolator\")\n"
+             "(FinalBSplineInterpolationOrder 3)\n"
+             "(DefaultPixelValue 0)\n"
+             "(ResultImageFormat \"nrrd\")\n"
+             "(ResultImagePixelType \"float\")\n"
+             "(CompressResultImage \"false\")\n";
+    }
+
+    /**
+     * Rotation by angle (radians) and isotropic scale about the center of the output grid, followed by a translation.
+     */
+    inline std::string CreateAffineTransformation(double angle, double scale, double tx, double ty)
+    {
+      std::ostringstream os;
+      os.precision(17);
+      os << "(Transform \"AffineTransform\")\n"
+         << "(NumberOfParameters 6)\n"
+         << "(TransformParameters " << scale * std::cos(angle) << " " << -scale * std::sin(angle) << " "
+         << scale * std::sin(angle) << " " << scale * std::cos(angle) << " " << tx << " " << ty << ")\n"
+         << "(CenterOfRotationPoint 31.5 23.5)\n"
+         << GetCommonParameters();
+      return os.str();
+    }
+
+    /**
+     * Rotation by angle (radians) about the center of the output grid, followed by a translation.
+     */
+    inline std::string CreateEulerTransformation(double angle, double tx, double ty)
+    {
+      std::ostringstream os;
+      os.precision(17);
+      os << "(Transform \"EulerTransform\")\n"
+         << "(NumberOfParameters 3)\n"
+         << "(TransformParameters " << angle << " " << tx << " " << ty << ")\n"
+         << "(CenterOfRotationPoint 31.5 23.5)\n"
+         << GetCommonParameters();
+      return os.str();
+    }
+
+    /**
+     * Cubic B-spline with smooth coefficients of the given amplitude on a 9 x 8 grid (spacing 16, origin -32).
+     */
+    inline std::string CreateBSplineTransformation(double amplitude)
+    {
+      constexpr unsigned int GridSize[2] = {9, 8};
+      const auto n = GridSize[0] * GridSize[1];
+      std::ostringstream os;
+      os.precision(17);
+      os << "(Transform \"BSplineTransform\")\n"
+         << "(NumberOfParameters " << 2 * n << ")\n"
+         << "(TransformParameters";
+      for (unsigned int k = 0; k < n; ++k)
+        os << " " << amplitude * std::sin(0.7 * k);
+      for (unsigned int k = 0; k < n; ++k)
+        os << " " << amplitude * std::cos(0.5 * k);
+      os << ")\n"
+         << "(GridSize " << GridSize[0] << " " << GridSize[1] << ")\n"
+         << "(GridIndex 0 0)\n"
+         << "(GridSpacing 16.0000000000 16.0000000000)\n"
+         << "(GridOrigin -32.0000000000 -32.0000000000)\n"
+         << "(GridDirection 1 0 0 1)\n"
+         << "(BSplineTransformSplineOrder 3)\n"
+         << "(UseCyclicTransform \"false\")\n"
+         << GetCommonParameters();
+      return os.str();
+    }
+
+    /**
+     * Moving image of 110 x 96 pixels (spacing 0.9, origin -20) with a smooth pattern.
+     */
+    template <class TImage>
+    typename TImage::Pointer CreateMovingImage()
+    {
+      auto image = TImage::New();
+      typename TImage::RegionType region;
+      region.SetSize(0, 110);
+      region.SetSize(1, 96);
+      image->SetRegions(region);
+      typename TImage::SpacingType spacing;
+      spacing.Fill(0.9);
+      image->SetSpacing(spacing);
+      typename TImage::PointType origin;
+      origin.Fill(-20);
+      image->SetOrigin(origin);
+      image->Allocate();
+      itk::ImageRegionIteratorWithIndex<TImage> it(image, region);
+      for (; !it.IsAtEnd(); ++it)
+      {
+        const auto &i = it.GetIndex();
+        it.Set(static_cast<typename TImage::PixelType>(1000 + 500 * std::sin(0.15 * i[0]) * std::cos(0.1 * i[1])));
+      }
+      return image;
+    }
+
+    template <class TImage>
+    mitk::Image::Pointer ToMitkImage(const TImage *image)
+    {
+      mitk::Image::Pointer result;
+      mitk::CastToMitkImage(image, result);
+      return result;
+    }
+
+    /**
+     * Resamples image with itk::ResampleImageFilter and the composite transform of the chain onto its output grid.
+     * Order 0 is nearest neighbor, order 1 linear, higher orders use itk::BSplineInterpolateImageFunction.
+     */
+    template <class TImage>
+    typename TImage::Pointer Resample(const TImage *image,
+                                      const std::vector<std::string> &transformations,
+                                      unsigned int order)
+    {
+      auto reference = itk::Image<unsigned char, 2>::New();
+      m2::ElxTransformEngine::InitializeOutputGeometry<2>(
+        m2::ElxTransformParameterMap::Parse(transformations.back()), reference);
+      auto resampler = itk::ResampleImageFilter<TImage, TImage>::New();
+      resampler->SetInput(image);
+      resampler->SetTransform(m2::ElxTransformEngine::CreateCompositeTransform<2>(transformations));
+      resampler->SetOutputParametersFromImage(reference);
+      if (order == 0)
+        resampler->SetInterpolator(itk::NearestNeighborInterpolateImageFunction<TImage>::New());
+      else if (order == 1)
+        resampler->SetInterpolator(itk::LinearInterpolateImageFunction<TImage>::New());
+      else
+      {
+        auto interpolator = itk::BSplineInterpolateImageFunction<TImage, double, double>::New();
+        interpolator->SetSplineOrder(order);
+        resampler->SetInterpolator(interpolator);
+      }
+      resampler->Update();
+      return resampler->GetOutput();
+    }
+
+    /**
+     * All pixel values (all components) of an image as double.
+     */
+    inline std::vector<double> GetValues(const mitk::Image *image)
+    {
+      std::size_t n = image->GetPixelType().GetNumberOfComponents();
+      for (unsigned int i = 0; i < image->GetDimension(); ++i)
+        n *= image->GetDimension(i);
+      std::vector<double> values(n);
+      mitk::ImageReadAccessor acc(image);
+      m2::ElxUtil::AccessByPixelTypeName(image->GetPixelType().GetComponentTypeAsString(), [&](auto pixel) {
+        using PixelType = decltype(pixel);
+        const auto data = static_cast<const PixelType *>(acc.GetData());
+        values.assign(data, data + n);
+      });
+      return values;
+    }
+
+    template <class TImage>
+    std::vector<double> GetValues(const TImage *image)
+    {
+      const auto data = image->GetBufferPointer();
+      return std::vector<double>(data, data + image->GetLargestPossibleRegion().GetNumberOfPixels());
+    }
+
+    inline double GetMaximumDifference(const std::vector<double> &a, const std::vector<double> &b)
+    {
+      double maximum = a.size() == b.size() ? 0 : HUGE_VAL;
+      for (std::size_t i = 0; i < a.size() && i < b.size(); ++i)
+        maximum = std::max(maximum, std::abs(a[i] - b[i]));
+      return maximum;
+    }
+  } // namespace ElxTestData
+} // namespace m2
@@ -0,0 +1,199 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxRegistrationHelper.h>
+#include <m2ElxTransformEngine.h>
+#include <m2ElxWarpSession.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkMath.h>
+
+class m2ElxTransformEngineTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxTransformEngineTestSuite);
+  MITK_TEST(Warp_Affine_MatchesResampleImageFilter);
+  MITK_TEST(Warp_BSpline_MatchesResampleImageFilterForAllRepresentations);
+  MITK_TEST(Warp_Chain_MatchesResampleImageFilter);
+  MITK_TEST(SelectDeformationRepresentation_Budget_PicksSmallerRepresentations);
+  MITK_TEST(Warp_AutomaticSmallBudget_MatchesResampleImageFilter);
+  MITK_TEST(TransformPoints_Chain_MatchesCompositeTransform);
+  MITK_TEST(TransformPointsInverse_RotatedChain_RecoversPoints);
+  MITK_TEST(WarpImage_InProcess_MatchesTransformix);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  using ImageType = itk::Image<float, 2>;
+  using Representation = m2::ElxTransformEngine::DeformationRepresentation;
+
+  ImageType::Pointer m_Moving;
+  std::string m_Affine;
+  std::string m_BSpline;
+
+  /**
+   * Maximum difference of the in-process warp (linear interpolation) to itk::ResampleImageFilter.
+   */
+  double GetWarpDifference(const std::vector<std::string> &transformations,
+                           Representation representation,
+                           std::size_t memoryBudget = std::size_t(1) << 30)
+  {
+    const auto session = m2::ElxWarpSession::CreateFromTransformations(transformations, representation, memoryBudget);
+    const auto warped = session->Warp(m2::ElxTestData::ToMitkImage(m_Moving.GetPointer()), "float", 1);
+    const auto reference = m2::ElxTestData::Resample(m_Moving.GetPointer(), transformations, 1);
+    return m2::ElxTestData::GetMaximumDifference(m2::ElxTestData::GetValues(warped),
+                                                 m2::ElxTestData::GetValues(reference.GetPointer()));
+  }
+
+public:
+  void setUp() override
+  {
+    m_Moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    m_Affine = m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5);
+    m_BSpline = m2::ElxTestData::CreateBSplineTransformation(2.0);
+  }
+
+  void tearDown() override { m_Moving = nullptr; }
+
+  void Warp_Affine_MatchesResampleImageFilter()
+  {
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::CanTransform({m_Affine}));
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::IsLinear({m_Affine}));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference({m_Affine}, Representation::Automatic), 1e-3);
+  }
+
+  void Warp_BSpline_MatchesResampleImageFilterForAllRepresentations()
+  {
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::CanTransform({m_BSpline}));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference({m_BSpline}, Representation::DisplacementField), 1e-3);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference({m_BSpline}, Representation::CoefficientGrid), 1e-3);
+    // float displacements: about 1e-5 pixels, times the largest gradient of the image
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(
+      0.0, GetWarpDifference({m_BSpline}, Representation::CompactDisplacementField), 5e-2);
+  }
+
+  void Warp_Chain_MatchesResampleImageFilter()
+  {
+    const std::vector<std::string> chain = {m_Affine, m_BSpline};
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::CanTransform(chain));
+    CPPUNIT_ASSERT(!m2::ElxTransformEngine::IsLinear(chain));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference(chain, Representation::DisplacementField), 1e-3);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference(chain, Representation::CoefficientGrid), 1e-3);
+  }
+
+  void SelectDeformationRepresentation_Budget_PicksSmallerRepresentations()
+  {
+    // 64 x 48 output pixels with 2 components
+    const std::size_t n = 64 * 48;
+    const auto field = n * 2 * sizeof(double);
+    const auto compact = n * 2 * sizeof(float);
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::SelectDeformationRepresentation(n, 2, field) ==
+                   Representation::DisplacementField);
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::SelectDeformationRepresentation(n, 2, field - 1) ==
+                   Representation::CompactDisplacementField);
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::SelectDeformationRepresentation(n, 2, compact) ==
+                   Representation::CompactDisplacementField);
+    CPPUNIT_ASSERT(m2::ElxTransformEngine::SelectDeformationRepresentation(n, 2, compact - 1) ==
+                   Representation::CoefficientGrid);
+  }
+
+  void Warp_AutomaticSmallBudget_MatchesResampleImageFilter()
+  {
+    // a budget below the float field selects the coefficient grid, which is exact
+    const std::vector<std::string> chain = {m_Affine, m_BSpline};
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, GetWarpDifference(chain, Representation::Automatic, 1024), 1e-3);
+  }
+
+  void TransformPoints_Chain_MatchesCompositeTransform()
+  {
+    const std::vector<std::string> chain = {m_Affine, m_BSpline};
+    const auto composite = m2::ElxTransformEngine::CreateCompositeTransform<2>(chain);
+
+    std::vector<double> x, y;
+    for (unsigned int j = 0; j < 48; j += 3)
+      for (unsigned int i = 0; i < 64; i += 3)
+      {
+        x.push_back(i + 0.25);
+        y.push_back(j - 0.5);
+      }
+    const auto expectedX = x, expectedY = y;
+    m2::ElxTransformEngine::TransformPoints(chain, x.data(), y.data(), nullptr, x.size());
+
+    for (std::size_t k = 0; k < x.size(); ++k)
+    {
+      ImageType::PointType p;
+      p[0] = expectedX[k];
+      p[1] = expectedY[k];
+      const auto q = composite->TransformPoint(p);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(q[0], x[k], 1e-9);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(q[1], y[k], 1e-9);
+    }
+  }
+
+  void TransformPointsInverse_RotatedChain_RecoversPoints()
+  {
+    // a rotation by 90 degrees, where a fixed-point iteration on the whole chain diverges
+    const std::vector<std::string> chain = {m2::ElxTestData::CreateEulerTransformation(itk::Math::pi_over_2, 3.0, -2.0),
+                                            m_BSpline};
+    std::vector<double> x, y;
+    for (unsigned int j = 0; j < 48; j += 4)
+      for (unsigned int i = 0; i < 64; i += 4)
+      {
+        x.push_back(i);
+        y.push_back(j);
+      }
+    const auto expectedX = x, expectedY = y;
+    m2::ElxTransformEngine::TransformPoints(chain, x.data(), y.data(), nullptr, x.size());
+    m2::ElxTransformEngine::TransformPointsInverse(chain, x.data(), y.data(), nullptr, x.size());
+
+    for (std::size_t k = 0; k < x.size(); ++k)
+    {
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedX[k], x[k], 1e-4);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedY[k], y[k], 1e-4);
+    }
+  }
+
+  void WarpImage_InProcess_MatchesTransformix()
+  {
+    try
+    {
+      m2::ElxUtil::Executable("transformix");
+    }
+    catch (const mitk::Exception &)
+    {
+      MITK_WARN << "transformix is not available; the comparison with transformix is skipped";
+      return;
+    }
+
+    const std::vector<std::string> chain = {m_Affine, m_BSpline};
+    const auto moving = m2::ElxTestData::ToMitkImage(m_Moving.GetPointer());
+    m2::ElxRegistrationHelper inProcess, transformix;
+    inProcess.SetTransformations(chain);
+    transformix.SetTransformations(chain);
+    transformix.SetUseInProcessTransforms(false);
+    transformix.SetRemoveWorkingDirectory(true);
+
+    const auto expected = transformix.WarpImage(moving, "float", 1);
+    const auto warped = inProcess.WarpImage(moving, "float", 1);
+    CPPUNIT_ASSERT(expected.IsNotNull() && warped.IsNotNull());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0,
+                                 m2::ElxTestData::GetMaximumDifference(m2::ElxTestData::GetValues(warped),
+                                                                       m2::ElxTestData::GetValues(expected)),
+                                 1e-2);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxTransformEngine)
@@ -0,0 +1,188 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxTransformEngine.h>
+#include <m2ElxWarpKernel.h>
+#include <m2ElxWarpSession.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkResampleImageFilter.h>
+
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class m2ElxWarpKernelTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxWarpKernelTestSuite);
+  MITK_TEST(Warp2D_FloatLinear_MatchesResampleImageFilter);
+  MITK_TEST(Warp2D_FloatNearest_MatchesResampleImageFilter);
+  MITK_TEST(Warp2D_UInt16Linear_MatchesResampleImageFilter);
+  MITK_TEST(Warp2D_UInt16Nearest_MatchesResampleImageFilter);
+  MITK_TEST(Warp_TransformationSession_UsesKernel);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  using FieldTransformType = m2::ElxTransformEngine::DisplacementFieldTransformType<2, float>;
+  using FieldType = m2::ElxTransformEngine::DisplacementFieldType<2, float>;
+
+  // odd sizes, so the vectorised paths have to handle the remainder of each row
+  static constexpr unsigned int Width = 67;
+  static constexpr unsigned int Height = 53;
+
+  template <class TImage>
+  static typename TImage::Pointer CreateImage()
+  {
+    auto image = TImage::New();
+    typename TImage::RegionType region;
+    region.SetSize(0, Width);
+    region.SetSize(1, Height);
+    image->SetRegions(region);
+    typename TImage::SpacingType spacing;
+    spacing[0] = 0.8;
+    spacing[1] = 1.2;
+    image->SetSpacing(spacing);
+    image->Allocate();
+    itk::ImageRegionIteratorWithIndex<TImage> it(image, region);
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      it.Set(static_cast<typename TImage::PixelType>(1000 + 900 * std::sin(0.05 * i[0]) * std::cos(0.03 * i[1])));
+    }
+    return image;
+  }
+
+  /**
+   * Smooth field on the grid of the image; pixels near the border map outside of the input.
+   */
+  static FieldType::Pointer CreateField()
+  {
+    const auto geometry = CreateImage<itk::Image<float, 2>>();
+    auto field = FieldType::New();
+    field->CopyInformation(geometry);
+    field->SetRegions(geometry->GetLargestPossibleRegion());
+    field->Allocate();
+    itk::ImageRegionIteratorWithIndex<FieldType> it(field, field->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      FieldType::PixelType v;
+      v[0] = 3.5f * std::sin(0.11f * i[1]) + 0.3f;
+      v[1] = 2.5f * std::cos(0.17f * i[0]) - 0.2f;
+      it.Set(v);
+    }
+    return field;
+  }
+
+  /**
+   * Warps with every instruction set and compares the result with itk::ResampleImageFilter. Pixels may only
+   * differ where ITK evaluates the field between grid nodes due to rounding of the continuous index.
+   */
+  template <class TPixel>
+  void Check(bool nearest)
+  {
+    using ImageType = itk::Image<TPixel, 2>;
+    const auto input = CreateImage<ImageType>();
+    const auto field = CreateField();
+    auto transform = FieldTransformType::New();
+    transform->SetDisplacementField(field);
+
+    auto resampler = itk::ResampleImageFilter<ImageType, ImageType, double, float>::New();
+    resampler->SetInput(input);
+    resampler->SetTransform(transform);
+    resampler->SetOutputParametersFromImage(field);
+    if (nearest)
+      resampler->SetInterpolator(itk::NearestNeighborInterpolateImageFunction<ImageType>::New());
+    else
+      resampler->SetInterpolator(itk::LinearInterpolateImageFunction<ImageType>::New());
+    resampler->Update();
+    const auto reference = resampler->GetOutput();
+
+    m2::ElxWarpKernel::Parameters2D parameters;
+    parameters.displacement = reinterpret_cast<const float *>(field->GetBufferPointer());
+    parameters.nearest = nearest;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      parameters.outputSize[i] = i == 0 ? Width : Height;
+      parameters.outputOrigin[i] = field->GetOrigin()[i];
+      parameters.inputSize[i] = i == 0 ? Width : Height;
+      parameters.inputOrigin[i] = input->GetOrigin()[i];
+      for (unsigned int j = 0; j < 2; ++j)
+      {
+        parameters.outputIndexToPhysical[i][j] = field->GetIndexToPhysicalPoint()[i][j];
+        parameters.inputPhysicalToIndex[i][j] = input->GetPhysicalPointToIndex()[i][j];
+      }
+    }
+
+    const auto n = std::size_t(Width) * Height;
+    const double tolerance = std::is_integral<TPixel>::value ? 1 : 1e-3;
+    // instruction sets that are not available fall back to a supported one
+    using Set = m2::ElxWarpKernel::InstructionSet;
+    for (auto set : {Set::Scalar, Set::SSE2, Set::AVX2})
+    {
+      std::vector<TPixel> output(n);
+      m2::ElxWarpKernel::Warp2D(parameters, input->GetBufferPointer(), output.data(), 0, Height, set);
+
+      std::size_t differences = 0;
+      for (std::size_t i = 0; i < n; ++i)
+        differences += std::abs(double(output[i]) - double(reference->GetBufferPointer()[i])) > tolerance;
+      CPPUNIT_ASSERT_MESSAGE(m2::ElxWarpKernel::GetInstructionSetName(set) + ": " + std::to_string(differences) +
+                               " pixels differ",
+                             differences <= n / 100);
+    }
+  }
+
+public:
+  void Warp2D_FloatLinear_MatchesResampleImageFilter() { Check<float>(false); }
+  void Warp2D_FloatNearest_MatchesResampleImageFilter() { Check<float>(true); }
+  void Warp2D_UInt16Linear_MatchesResampleImageFilter() { Check<unsigned short>(false); }
+  void Warp2D_UInt16Nearest_MatchesResampleImageFilter() { Check<unsigned short>(true); }
+
+  void Warp_TransformationSession_UsesKernel()
+  {
+    using Representation = m2::ElxTransformEngine::DeformationRepresentation;
+    using ImageType = itk::Image<float, 2>;
+    const std::vector<std::string> chain = {m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                                            m2::ElxTestData::CreateBSplineTransformation(2.0)};
+    const auto moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    const auto image = m2::ElxTestData::ToMitkImage(moving.GetPointer());
+    const auto reference = m2::ElxTestData::GetValues(m2::ElxTestData::Resample(moving.GetPointer(), chain, 1).GetPointer());
+
+    // the field is sampled on a separate reference grid; double fields are converted to float once
+    for (auto representation : {Representation::DisplacementField, Representation::CompactDisplacementField})
+    {
+      const auto session = m2::ElxWarpSession::CreateFromTransformations(chain, representation, std::size_t(1) << 30);
+      CPPUNIT_ASSERT(session->UsesWarpKernel());
+      const auto values = m2::ElxTestData::GetValues(session->Warp(image, "float", 1));
+      // float displacements: about 1e-5 pixels, times the largest gradient of the image
+      CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, m2::ElxTestData::GetMaximumDifference(values, reference), 5e-2);
+    }
+
+    CPPUNIT_ASSERT(!m2::ElxWarpSession::CreateFromTransformations(chain, Representation::CoefficientGrid, std::size_t(1) << 30)
+                      ->UsesWarpKernel());
+    // no room for the float copy next to the double field
+    CPPUNIT_ASSERT(!m2::ElxWarpSession::CreateFromTransformations(chain, Representation::DisplacementField, 64 * 48 * 16)
+                      ->UsesWarpKernel());
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxWarpKernel)
@@ -0,0 +1,217 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxRegistrationHelper.h>
+#include <m2ElxWarpOptions.h>
+#include <mitkITKImageImport.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <itkVectorImage.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+class m2ElxWarpOptionsTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxWarpOptionsTestSuite);
+  MITK_TEST(ApplyToTransformation_Downsample_ScalesSpacingAndSize);
+  MITK_TEST(ApplyToTransformation_Region_CoversPixelsAndClips);
+  MITK_TEST(GetAntiAliasingSigma_CoarserAxesOnly);
+  MITK_TEST(WarpImage_MultiComponent_SmoothsEveryComponent);
+  MITK_TEST(WarpImage_Stack_SmoothsEverySlice);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  std::vector<std::string> m_Transformations;
+  m2::ElxWarpOptions m_Options;
+
+  /**
+   * Pattern of the moving image plus stripes of two pixels that alias on a coarser grid.
+   */
+  static double GetValue(long long x, long long y, unsigned int c)
+  {
+    return (c + 1) * (1000 + 500 * std::sin(0.15 * x) * std::cos(0.1 * y)) + (x / 2 % 2 ? 200.0 : 0.0);
+  }
+
+  static mitk::Image::Pointer CreateComponentImage(unsigned int c)
+  {
+    using ImageType = itk::Image<float, 2>;
+    auto image = m2::ElxTestData::CreateMovingImage<ImageType>();
+    itk::ImageRegionIteratorWithIndex<ImageType> it(image, image->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it)
+      it.Set(static_cast<float>(GetValue(it.GetIndex()[0], it.GetIndex()[1], c)));
+    return m2::ElxTestData::ToMitkImage(image.GetPointer());
+  }
+
+  static std::string GetParameter(const std::string &transformation, const std::string &name)
+  {
+    const auto p = m2::ElxTransformParameterMap::Parse(transformation).GetDoubles(name);
+    std::string result;
+    for (auto v : p)
+      result += (result.empty() ? "" : " ") + std::to_string(v);
+    return result;
+  }
+
+public:
+  void setUp() override
+  {
+    m_Transformations = {m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                         m2::ElxTestData::CreateBSplineTransformation(2.0)};
+    m_Options = m2::ElxWarpOptions();
+    m_Options.downsampleFactor = 3;
+  }
+
+  void ApplyToTransformation_Downsample_ScalesSpacingAndSize()
+  {
+    m2::ElxWarpOptions options;
+    options.downsampleFactor = 2;
+    const auto transformation = options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters());
+    CPPUNIT_ASSERT_EQUAL(std::string("32.000000 24.000000"), GetParameter(transformation, "Size"));
+    CPPUNIT_ASSERT_EQUAL(std::string("2.000000 2.000000"), GetParameter(transformation, "Spacing"));
+    // the output pixels cover the fixed grid edge to edge
+    CPPUNIT_ASSERT_EQUAL(std::string("0.500000 0.500000"), GetParameter(transformation, "Origin"));
+    CPPUNIT_ASSERT_EQUAL(std::string("0.000000 0.000000"), GetParameter(transformation, "Index"));
+
+    options.spacing = {4, 3};
+    const auto spacing = options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters());
+    CPPUNIT_ASSERT_EQUAL(std::string("16.000000 16.000000"), GetParameter(spacing, "Size"));
+    CPPUNIT_ASSERT_EQUAL(std::string("4.000000 3.000000"), GetParameter(spacing, "Spacing"));
+    CPPUNIT_ASSERT_EQUAL(std::string("1.500000 1.000000"), GetParameter(spacing, "Origin"));
+  }
+
+  void ApplyToTransformation_Region_CoversPixelsAndClips()
+  {
+    m2::ElxWarpOptions options;
+    // partially covered pixels are included
+    options.regionOrigin = {10, 5};
+    options.regionSize = {20.5, 8};
+    const auto region = options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters());
+    CPPUNIT_ASSERT_EQUAL(std::string("21.000000 8.000000"), GetParameter(region, "Size"));
+    CPPUNIT_ASSERT_EQUAL(std::string("10.000000 5.000000"), GetParameter(region, "Origin"));
+    CPPUNIT_ASSERT_EQUAL(std::string("1.000000 1.000000"), GetParameter(region, "Spacing"));
+
+    // clipped to the grid
+    options.regionOrigin = {60, -10};
+    options.regionSize = {10, 20};
+    const auto clipped = options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters());
+    CPPUNIT_ASSERT_EQUAL(std::string("4.000000 10.000000"), GetParameter(clipped, "Size"));
+    CPPUNIT_ASSERT_EQUAL(std::string("60.000000 0.000000"), GetParameter(clipped, "Origin"));
+
+    // the same region in mm: its origin is the lower edge of the first pixel
+    options.physicalRegion = true;
+    options.regionOrigin = {9.5, 4.5};
+    options.regionSize = {20.5, 8};
+    CPPUNIT_ASSERT_EQUAL(region, options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters()));
+
+    options.physicalRegion = false;
+    options.regionOrigin = {100, 0};
+    options.regionSize = {5, 5};
+    CPPUNIT_ASSERT_THROW(options.ApplyToTransformation(m2::ElxTestData::GetCommonParameters()), mitk::Exception);
+  }
+
+  void GetAntiAliasingSigma_CoarserAxesOnly()
+  {
+    // axes that are not downsampled or without an output spacing are not smoothed
+    const auto sigma = m2::ElxWarpOptions::GetAntiAliasingSigma({1, 1, 2}, {3, 0.5});
+    CPPUNIT_ASSERT_EQUAL(std::size_t(3), sigma.size());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(std::sqrt(2.0), sigma[0], 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, sigma[1], 0.0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, sigma[2], 0.0);
+  }
+
+  void WarpImage_MultiComponent_SmoothsEveryComponent()
+  {
+    auto itkImage = itk::VectorImage<float, 2>::New();
+    const auto reference = m2::ElxTestData::CreateMovingImage<itk::Image<float, 2>>();
+    itkImage->CopyInformation(reference);
+    itkImage->SetRegions(reference->GetLargestPossibleRegion());
+    itkImage->SetNumberOfComponentsPerPixel(2);
+    itkImage->Allocate();
+    const auto &size = reference->GetLargestPossibleRegion().GetSize();
+    for (unsigned int y = 0; y < size[1]; ++y)
+      for (unsigned int x = 0; x < size[0]; ++x)
+        for (unsigned int c = 0; c < 2; ++c)
+          itkImage->GetBufferPointer()[(std::size_t(y) * size[0] + x) * 2 + c] = static_cast<float>(GetValue(x, y, c));
+    const auto image = mitk::ImportItkImage(itkImage);
+
+    m2::ElxRegistrationHelper helper;
+    helper.SetTransformations(m_Transformations);
+    const auto warped = m2::ElxTestData::GetValues(helper.WarpImage(image, "float", 1, m_Options));
+    for (unsigned int c = 0; c < 2; ++c)
+    {
+      const auto expected =
+        m2::ElxTestData::GetValues(helper.WarpImage(CreateComponentImage(c), "float", 1, m_Options));
+      CPPUNIT_ASSERT_EQUAL(2 * expected.size(), warped.size());
+      double difference = 0;
+      for (std::size_t i = 0; i < expected.size(); ++i)
+        difference = std::max(difference, std::abs(expected[i] - warped[i * 2 + c]));
+      CPPUNIT_ASSERT_MESSAGE("component " + std::to_string(c), difference < 1e-2);
+    }
+
+    // the stripes alias without smoothing
+    m_Options.antiAliasing = false;
+    const auto aliased = m2::ElxTestData::GetValues(helper.WarpImage(image, "float", 1, m_Options));
+    CPPUNIT_ASSERT(m2::ElxTestData::GetMaximumDifference(warped, aliased) > 10);
+  }
+
+  void WarpImage_Stack_SmoothsEverySlice()
+  {
+    constexpr unsigned int Slices = 3;
+    using StackType = itk::Image<float, 3>;
+    const auto reference = m2::ElxTestData::CreateMovingImage<itk::Image<float, 2>>();
+    const auto &size = reference->GetLargestPossibleRegion().GetSize();
+    auto stack = StackType::New();
+    StackType::RegionType region;
+    StackType::SpacingType spacing;
+    StackType::PointType origin;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      region.SetSize(i, size[i]);
+      spacing[i] = reference->GetSpacing()[i];
+      origin[i] = reference->GetOrigin()[i];
+    }
+    region.SetSize(2, Slices);
+    spacing[2] = 1;
+    origin[2] = 0;
+    stack->SetRegions(region);
+    stack->SetSpacing(spacing);
+    stack->SetOrigin(origin);
+    stack->Allocate();
+    itk::ImageRegionIteratorWithIndex<StackType> it(stack, region);
+    for (; !it.IsAtEnd(); ++it)
+      it.Set(static_cast<float>(GetValue(it.GetIndex()[0], it.GetIndex()[1], it.GetIndex()[2])));
+
+    m2::ElxRegistrationHelper helper;
+    helper.SetTransformations(m_Transformations);
+    const auto warped = m2::ElxTestData::GetValues(helper.WarpImage(m2::ElxTestData::ToMitkImage(stack.GetPointer()),
+                                                                    "float", 1, m_Options));
+    for (unsigned int z = 0; z < Slices; ++z)
+    {
+      const auto expected =
+        m2::ElxTestData::GetValues(helper.WarpImage(CreateComponentImage(z), "float", 1, m_Options));
+      CPPUNIT_ASSERT_EQUAL(Slices * expected.size(), warped.size());
+      double difference = 0;
+      for (std::size_t i = 0; i < expected.size(); ++i)
+        difference = std::max(difference, std::abs(expected[i] - warped[z * expected.size() + i]));
+      CPPUNIT_ASSERT_MESSAGE("slice " + std::to_string(z), difference < 1e-2);
+    }
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxWarpOptions)
@@ -0,0 +1,461 @@
+/*===================================================================
+MSI applications for interactive analysis in MITK (M2aia)
+
+Copyright (c) Jonas Cordes
+
+All rights reserved.
+
+This software is distributed WITHOUT ANY WARRANTY; without
+even the implied warranty of MERCHANTABILITY or FITNESS FOR
+A PARTICULAR PURPOSE.
+
+See LICENSE.txt for details.
+
+===================================================================*/
+
+#include "m2ElxTestData.h"
+
+#include <m2ElxRegistrationHelper.h>
+#include <m2ElxWarpSession.h>
+#include <mitkITKImageImport.h>
+#include <mitkTestFixture.h>
+#include <mitkTestingMacros.h>
+
+#include <mitkIOUtil.h>
+
+#include <itkImageFileReader.h>
+#include <itkImageFileWriter.h>
+#include <itkVectorImage.h>
+#include <itksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <string>
+
+class m2ElxWarpSessionTestSuite : public mitk::TestFixture
+{
+  CPPUNIT_TEST_SUITE(m2ElxWarpSessionTestSuite);
+  MITK_TEST(Warp_BSplineOrders_MatchesResampleImageFilter);
+  MITK_TEST(WarpMultiChannel_BSpline_MatchesWarpPerComponent);
+  MITK_TEST(Warp_IntegerTypes_RoundsAndClampsValuesAndDefault);
+  MITK_TEST(WarpImage_MultiComponentSlice_MatchesScalarGeometry);
+  MITK_TEST(WarpSlices_OneSession_MatchesWarpPerSlice);
+  MITK_TEST(WarpSlices_SessionPerSlice_MatchesWarpPerSlice);
+  MITK_TEST(WarpToFile_MetaImage_MatchesWarp);
+  MITK_TEST(WarpLabels_Nearest_MatchesNearestNeighborWarp);
+  MITK_TEST(WarpLabels_Smooth_KeepsLabels);
+  MITK_TEST(WarpLabels_FloatImage_Throws);
+  CPPUNIT_TEST_SUITE_END();
+
+private:
+  using ImageType = itk::Image<float, 2>;
+
+  std::vector<std::string> m_Transformations;
+  m2::ElxWarpSession::Pointer m_Session;
+  std::vector<mitk::Image::ConstPointer> m_Labels;
+
+  /**
+   * Label image on the moving grid (see ElxTestData::CreateMovingImage) with discs and rectangles.
+   */
+  template <class TPixel>
+  static mitk::Image::Pointer CreateLabelImage(bool rectangles)
+  {
+    using ImageType = itk::Image<TPixel, 2>;
+    auto image = m2::ElxTestData::CreateMovingImage<ImageType>();
+    itk::ImageRegionIteratorWithIndex<ImageType> it(image, image->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it)
+    {
+      const auto &i = it.GetIndex();
+      TPixel label = 0;
+      if (rectangles)
+      {
+        if (i[0] >= 30 && i[0] < 60 && i[1] >= 25 && i[1] < 40)
+          label = 2;
+        else if (i[0] >= 65 && i[0] < 85 && i[1] >= 45 && i[1] < 75)
+          label = 7;
+      }
+      else
+      {
+        const auto d = [&](double x, double y) { return std::hypot(i[0] - x, i[1] - y); };
+        if (d(40, 40) < 12)
+          label = 1;
+        else if (d(70, 50) < 15)
+          label = 2;
+        else if (d(50, 70) < 8)
+          label = 3;
+      }
+      it.Set(label);
+    }
+    return m2::ElxTestData::ToMitkImage(image.GetPointer());
+  }
+
+  /**
+   * Moving grid (see ElxTestData::CreateMovingImage) with a single slice at z = 5 (spacing 2); component c is
+   * the moving image plus 100 * c. One component gives a scalar image.
+   */
+  static mitk::Image::Pointer CreateSliceImage(unsigned int components)
+  {
+    using SliceType = itk::VectorImage<float, 3>;
+    const auto moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    auto image = SliceType::New();
+    SliceType::RegionType region;
+    SliceType::SpacingType spacing;
+    SliceType::PointType origin;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      region.SetSize(i, moving->GetLargestPossibleRegion().GetSize(i));
+      spacing[i] = moving->GetSpacing()[i];
+      origin[i] = moving->GetOrigin()[i];
+    }
+    region.SetSize(2, 1);
+    spacing[2] = 2;
+    origin[2] = 5;
+    image->SetRegions(region);
+    image->SetSpacing(spacing);
+    image->SetOrigin(origin);
+    image->SetNumberOfComponentsPerPixel(components);
+    image->Allocate();
+    const auto n = moving->GetLargestPossibleRegion().GetNumberOfPixels();
+    for (std::size_t i = 0; i < n; ++i)
+      for (unsigned int c = 0; c < components; ++c)
+        image->GetBufferPointer()[i * components + c] = moving->GetBufferPointer()[i] + 100.0f * c;
+    if (components > 1)
+      return mitk::ImportItkImage(image);
+
+    // scalar image of the same grid
+    auto scalar = itk::Image<float, 3>::New();
+    scalar->CopyInformation(image);
+    scalar->SetRegions(region);
+    scalar->Allocate();
+    std::copy(image->GetBufferPointer(), image->GetBufferPointer() + n, scalar->GetBufferPointer());
+    return m2::ElxTestData::ToMitkImage(scalar.GetPointer());
+  }
+
+  /**
+   * Step edge from 0 to the maximum of the type on the moving grid; B-splines overshoot at the edge.
+   */
+  template <class TPixel>
+  static mitk::Image::Pointer CreateStepImage()
+  {
+    using StepImageType = itk::Image<TPixel, 2>;
+    auto image = m2::ElxTestData::CreateMovingImage<StepImageType>();
+    itk::ImageRegionIteratorWithIndex<StepImageType> it(image, image->GetLargestPossibleRegion());
+    for (; !it.IsAtEnd(); ++it)
+      it.Set(it.GetIndex()[0] < 78 ? 0 : std::numeric_limits<TPixel>::max());
+    return m2::ElxTestData::ToMitkImage(image.GetPointer());
+  }
+
+  /**
+   * Warps the step image into its own integer type and compares the result with the rounded and clamped
+   * double warp, including the default value of pixels outside of the moving image.
+   */
+  template <class TPixel>
+  static void CheckIntegerWarp(const m2::ElxWarpSession *session, unsigned int order)
+  {
+    const auto image = CreateStepImage<TPixel>();
+    const auto type = m2::ElxUtil::GetPixelTypeName(image);
+    const auto reference = m2::ElxTestData::GetValues(session->Warp(image, "double", order));
+    const double maximum = std::numeric_limits<TPixel>::max();
+    CPPUNIT_ASSERT(*std::min_element(reference.begin(), reference.end()) < 0);
+    if (order > 1)
+      CPPUNIT_ASSERT(*std::max_element(reference.begin(), reference.end()) > maximum);
+
+    for (const auto &warped : {session->Warp(image, type, order), session->WarpMultiChannel(image, type, order)})
+    {
+      CPPUNIT_ASSERT_EQUAL(type, m2::ElxUtil::GetPixelTypeName(warped));
+      const auto values = m2::ElxTestData::GetValues(warped);
+      CPPUNIT_ASSERT_EQUAL(reference.size(), values.size());
+      // linear weights of the mapping and of the ITK resampler may round ties differently
+      for (std::size_t i = 0; i < values.size(); ++i)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(std::min(std::max(std::round(reference[i]), 0.0), maximum), values[i], 1.0);
+    }
+  }
+
+  static constexpr unsigned int Slices = 4;
+
+  /**
+   * Slice z of the stack: the moving image times (z + 1).
+   */
+  static ImageType::Pointer CreateStackSlice(unsigned int z)
+  {
+    auto slice = m2::ElxTestData::CreateMovingImage<ImageType>();
+    const auto n = slice->GetLargestPossibleRegion().GetNumberOfPixels();
+    for (std::size_t i = 0; i < n; ++i)
+      slice->GetBufferPointer()[i] *= z + 1.0f;
+    return slice;
+  }
+
+  /**
+   * Stack of Slices slices on the moving grid (z spacing 3).
+   */
+  static mitk::Image::Pointer CreateStack()
+  {
+    using StackType = itk::Image<float, 3>;
+    const auto first = CreateStackSlice(0);
+    auto stack = StackType::New();
+    StackType::RegionType region;
+    StackType::SpacingType spacing;
+    StackType::PointType origin;
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+      region.SetSize(i, first->GetLargestPossibleRegion().GetSize(i));
+      spacing[i] = first->GetSpacing()[i];
+      origin[i] = first->GetOrigin()[i];
+    }
+    region.SetSize(2, Slices);
+    spacing[2] = 3;
+    origin[2] = 0;
+    stack->SetRegions(region);
+    stack->SetSpacing(spacing);
+    stack->SetOrigin(origin);
+    stack->Allocate();
+    const auto n = first->GetLargestPossibleRegion().GetNumberOfPixels();
+    for (unsigned int z = 0; z < Slices; ++z)
+    {
+      const auto slice = CreateStackSlice(z);
+      std::copy(slice->GetBufferPointer(), slice->GetBufferPointer() + n, stack->GetBufferPointer() + z * n);
+    }
+    return m2::ElxTestData::ToMitkImage(stack.GetPointer());
+  }
+
+  /**
+   * Compares every slice of the warped stack with Warp() of the slice by its session.
+   */
+  static void CheckSlices(const mitk::Image *warped,
+                          const std::vector<m2::ElxWarpSession::Pointer> &sessions,
+                          unsigned int order)
+  {
+    CPPUNIT_ASSERT_EQUAL(3u, warped->GetDimension());
+    CPPUNIT_ASSERT_EQUAL(Slices, warped->GetDimension(2));
+    const auto values = m2::ElxTestData::GetValues(warped);
+    const std::size_t n = warped->GetDimension(0) * warped->GetDimension(1);
+    for (unsigned int z = 0; z < Slices; ++z)
+    {
+      const auto &session = sessions.size() == 1 ? sessions.front() : sessions[z];
+      const auto slice = CreateStackSlice(z);
+      const auto expected =
+        m2::ElxTestData::GetValues(session->Warp(m2::ElxTestData::ToMitkImage(slice.GetPointer()), "float", order));
+      CPPUNIT_ASSERT_EQUAL(n, expected.size());
+      const std::vector<double> actual(values.begin() + z * n, values.begin() + (z + 1) * n);
+      CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE("slice " + std::to_string(z) + ", order " + std::to_string(order),
+                                           0.0,
+                                           m2::ElxTestData::GetMaximumDifference(actual, expected),
+                                           1e-2);
+    }
+  }
+
+  static std::set<double> GetLabels(const std::vector<double> &values)
+  {
+    return std::set<double>(values.begin(), values.end());
+  }
+
+public:
+  void setUp() override
+  {
+    m_Transformations = {m2::ElxTestData::CreateAffineTransformation(0.17, 1.05, 2.0, -1.5),
+                         m2::ElxTestData::CreateBSplineTransformation(2.0)};
+    m_Session = m2::ElxWarpSession::CreateFromTransformations(
+      m_Transformations, m2::ElxTransformEngine::DeformationRepresentation::DisplacementField, std::size_t(1) << 30);
+    m_Labels = {CreateLabelImage<unsigned short>(false), CreateLabelImage<short>(true)};
+  }
+
+  void tearDown() override
+  {
+    m_Session = nullptr;
+    m_Labels.clear();
+  }
+
+  void Warp_BSplineOrders_MatchesResampleImageFilter()
+  {
+    const auto moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    const auto image = m2::ElxTestData::ToMitkImage(moving.GetPointer());
+    for (unsigned int order : {2, 3, 5})
+    {
+      const auto reference = m2::ElxTestData::Resample(moving.GetPointer(), m_Transformations, order);
+      const auto values = m2::ElxTestData::GetValues(m_Session->Warp(image, "float", order));
+      CPPUNIT_ASSERT_DOUBLES_EQUAL_MESSAGE(
+        "order " + std::to_string(order),
+        0.0,
+        m2::ElxTestData::GetMaximumDifference(values, m2::ElxTestData::GetValues(reference.GetPointer())),
+        1e-2);
+    }
+  }
+
+  void WarpMultiChannel_BSpline_MatchesWarpPerComponent()
+  {
+    const unsigned int components = 3;
+    const auto moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    auto vectorImage = itk::VectorImage<float, 2>::New();
+    vectorImage->CopyInformation(moving);
+    vectorImage->SetRegions(moving->GetLargestPossibleRegion());
+    vectorImage->SetNumberOfComponentsPerPixel(components);
+    vectorImage->Allocate();
+    const auto n = moving->GetLargestPossibleRegion().GetNumberOfPixels();
+    for (std::size_t i = 0; i < n; ++i)
+      for (unsigned int c = 0; c < components; ++c)
+        vectorImage->GetBufferPointer()[i * components + c] = moving->GetBufferPointer()[i] * (c + 1.0f);
+    const auto image = mitk::ImportItkImage(vectorImage);
+
+    for (unsigned int order : {2, 3})
+    {
+      const auto values = m2::ElxTestData::GetValues(m_Session->WarpMultiChannel(image, "float", order));
+      for (unsigned int c = 0; c < components; ++c)
+      {
+        auto channel = ImageType::New();
+        channel->CopyInformation(moving);
+        channel->SetRegions(moving->GetLargestPossibleRegion());
+        channel->Allocate();
+        for (std::size_t i = 0; i < n; ++i)
+          channel->GetBufferPointer()[i] = moving->GetBufferPointer()[i] * (c + 1.0f);
+        const auto expected = m2::ElxTestData::GetValues(
+          m_Session->Warp(m2::ElxTestData::ToMitkImage(channel.GetPointer()), "float", order));
+        CPPUNIT_ASSERT_EQUAL(expected.size() * components, values.size());
+        double maximum = 0;
+        for (std::size_t i = 0; i < expected.size(); ++i)
+          maximum = std::max(maximum, std::abs(values[i * components + c] - expected[i]));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, maximum, 1e-2);
+      }
+    }
+  }
+
+  void WarpImage_MultiComponentSlice_MatchesScalarGeometry()
+  {
+    m2::ElxRegistrationHelper helper;
+    helper.SetTransformations(m_Transformations);
+    const auto scalar = helper.WarpImage(CreateSliceImage(1), "float", 3);
+    const auto vector = helper.WarpImage(CreateSliceImage(3), "float", 3);
+    CPPUNIT_ASSERT(scalar.IsNotNull() && vector.IsNotNull());
+    CPPUNIT_ASSERT_EQUAL(scalar->GetDimension(), vector->GetDimension());
+    for (unsigned int i = 0; i < scalar->GetDimension(); ++i)
+      CPPUNIT_ASSERT_EQUAL(scalar->GetDimension(i), vector->GetDimension(i));
+    CPPUNIT_ASSERT(mitk::Equal(*scalar->GetGeometry(), *vector->GetGeometry(), mitk::eps, true));
+    CPPUNIT_ASSERT_EQUAL(3u, vector->GetPixelType().GetNumberOfComponents());
+  }
+
+  void Warp_IntegerTypes_RoundsAndClampsValuesAndDefault()
+  {
+    // shifted, so the right part of the output maps outside of the moving image; the default value is negative
+    auto transformation = m2::ElxTestData::CreateAffineTransformation(0.1, 1.0, 30.0, 0.0);
+    const std::string defaultValue = "(DefaultPixelValue 0)";
+    transformation.replace(transformation.find(defaultValue), defaultValue.size(), "(DefaultPixelValue -5)");
+    const auto session = m2::ElxWarpSession::CreateFromTransformations(
+      {transformation}, m2::ElxTransformEngine::DeformationRepresentation::Automatic, std::size_t(1) << 30);
+    for (unsigned int order : {1, 3})
+    {
+      CheckIntegerWarp<unsigned char>(session.get(), order);
+      CheckIntegerWarp<unsigned short>(session.get(), order);
+    }
+  }
+
+  void WarpSlices_OneSession_MatchesWarpPerSlice()
+  {
+    const auto stack = CreateStack();
+    for (unsigned int order : {1, 3})
+      CheckSlices(m_Session->WarpSlices(stack, "float", order), {m_Session}, order);
+  }
+
+  void WarpSlices_SessionPerSlice_MatchesWarpPerSlice()
+  {
+    const auto other = m2::ElxWarpSession::CreateFromTransformations(
+      {m2::ElxTestData::CreateEulerTransformation(-0.1, 1.0, 3.0)},
+      m2::ElxTransformEngine::DeformationRepresentation::Automatic,
+      std::size_t(1) << 30);
+    const std::vector<m2::ElxWarpSession::Pointer> sessions = {m_Session, other, other, m_Session};
+    const auto stack = CreateStack();
+    for (unsigned int order : {1, 3})
+      CheckSlices(m2::ElxWarpSession::WarpSlices(sessions, stack, "float", order), sessions, order);
+  }
+
+  void WarpToFile_MetaImage_MatchesWarp()
+  {
+    const auto directory = mitk::IOUtil::CreateTemporaryDirectory();
+    const auto inputPath = directory + "/moving.mha";
+    const auto outputPath = directory + "/warped.mha";
+    const auto moving = m2::ElxTestData::CreateMovingImage<ImageType>();
+    auto writer = itk::ImageFileWriter<ImageType>::New();
+    writer->SetInput(moving);
+    writer->SetFileName(inputPath);
+    writer->SetUseCompression(false);
+    writer->Update();
+
+    for (unsigned int order : {0, 1})
+    {
+      // a small budget splits the output into many tiles
+      m_Session->WarpToFile(inputPath, outputPath, "float", order, std::size_t(64) << 10);
+      auto reader = itk::ImageFileReader<ImageType>::New();
+      reader->SetFileName(outputPath);
+      reader->Update();
+      const auto warped = reader->GetOutput();
+      const auto expected = m_Session->Warp(m2::ElxTestData::ToMitkImage(moving.GetPointer()), "float", order);
+      for (unsigned int i = 0; i < 2; ++i)
+      {
+        CPPUNIT_ASSERT_EQUAL(expected->GetDimension(i), static_cast<unsigned int>(warped->GetLargestPossibleRegion().GetSize(i)));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->GetGeometry()->GetSpacing()[i], warped->GetSpacing()[i], 1e-9);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected->GetGeometry()->GetOrigin()[i], warped->GetOrigin()[i], 1e-9);
+      }
+      const auto values = m2::ElxTestData::GetValues(warped);
+      const auto reference = m2::ElxTestData::GetValues(expected);
+      // nearest neighbor ties may be resolved differently than by the ITK resampler
+      std::size_t differences = 0;
+      for (std::size_t k = 0; k < values.size() && k < reference.size(); ++k)
+        differences += std::abs(values[k] - reference[k]) > 1e-2;
+      CPPUNIT_ASSERT_EQUAL(reference.size(), values.size());
+      CPPUNIT_ASSERT(differences <= values.size() / 1000);
+    }
+
+    // B-spline coefficients depend on the whole image
+    CPPUNIT_ASSERT_THROW(m_Session->WarpToFile(inputPath, outputPath, "float", 3, std::size_t(64) << 10), mitk::Exception);
+    itksys::SystemTools::RemoveADirectory(directory);
+  }
+
+  void WarpLabels_Nearest_MatchesNearestNeighborWarp()
+  {
+    const auto warped = m_Session->WarpLabels(m_Labels);
+    CPPUNIT_ASSERT_EQUAL(m_Labels.size(), warped.size());
+    for (std::size_t k = 0; k < m_Labels.size(); ++k)
+    {
+      const auto pixelType = m_Labels[k]->GetPixelType().GetComponentTypeAsString();
+      CPPUNIT_ASSERT_EQUAL(pixelType, warped[k]->GetPixelType().GetComponentTypeAsString());
+
+      const auto values = m2::ElxTestData::GetValues(warped[k]);
+      const auto expected = m2::ElxTestData::GetValues(m_Session->Warp(m_Labels[k], pixelType, 0));
+      CPPUNIT_ASSERT_EQUAL(expected.size(), values.size());
+      // both round the same continuous index; only ties may be resolved differently
+      std::size_t differences = 0;
+      for (std::size_t i = 0; i < values.size(); ++i)
+        differences += values[i] != expected[i];
+      CPPUNIT_ASSERT(differences <= values.size() / 1000);
+    }
+  }
+
+  void WarpLabels_Smooth_KeepsLabels()
+  {
+    const auto nearest = m_Session->WarpLabels(m_Labels);
+    const auto smooth = m_Session->WarpLabels(m_Labels, true);
+    CPPUNIT_ASSERT_EQUAL(m_Labels.size(), smooth.size());
+    for (std::size_t k = 0; k < m_Labels.size(); ++k)
+    {
+      const auto values = m2::ElxTestData::GetValues(smooth[k]);
+      const auto expected = m2::ElxTestData::GetValues(nearest[k]);
+      CPPUNIT_ASSERT_EQUAL(expected.size(), values.size());
+
+      // no new label values, no label lost; boundaries may move by about a pixel
+      CPPUNIT_ASSERT(GetLabels(values) == GetLabels(expected));
+      std::size_t differences = 0;
+      for (std::size_t i = 0; i < values.size(); ++i)
+        differences += values[i] != expected[i];
+      CPPUNIT_ASSERT(differences <= values.size() / 20);
+    }
+  }
+
+  void WarpLabels_FloatImage_Throws()
+  {
+    const auto image = m2::ElxTestData::CreateMovingImage<ImageType>();
+    CPPUNIT_ASSERT_THROW(m_Session->WarpLabels({m2::ElxTestData::ToMitkImage(image.GetPointer())}),
+                         mitk::Exception);
+  }
+};
+
+MITK_TEST_SUITE_REGISTRATION(m2ElxWarpSession)
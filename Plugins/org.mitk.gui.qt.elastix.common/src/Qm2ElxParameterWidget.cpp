@@ -226,6 +226,16 @@ bool Qm2ElxParameterWidget::IsDeformableEnabled() const
   return m_Controls.grpDeformable->isChecked();
 }
 
+unsigned int Qm2ElxParameterWidget::GetNumberOfRigidStarts() const
+{
+  return m_Controls.grpRigid->isChecked() ? m_Controls.spinRigidStarts->value() : 1;
+}
+
+bool Qm2ElxParameterWidget::IsRigidStartFlipsEnabled() const
+{
+  return m_Controls.chkRigidStartFlips->isChecked();
+}
+
 void Qm2ElxParameterWidget::SetRawParameters(const std::string &rigidParams,
                                               const std::string &deformableParams)
 {
@@ -69,6 +69,12 @@ public:
   /** True when the deformable registration group is enabled. */
   bool IsDeformableEnabled() const;
 
+  /** Number of initial rotations of the multi-start rigid initialization (1 = disabled). */
+  unsigned int GetNumberOfRigidStarts() const;
+
+  /** True when flipped starts are added to the multi-start rigid initialization. */
+  bool IsRigidStartFlipsEnabled() const;
+
   /** Directly replace the underlying raw parameter file strings (e.g. when loading presets). */
   void SetRawParameters(const std::string &rigidParams, const std::string &deformableParams);
 
@@ -30,6 +30,7 @@ struct RegistrationData : public mitk::BaseData{
     std::string m_Name;
     
     std::vector<std::string> m_Transformations;
+    std::vector<std::vector<std::string>> m_TimeStepTransformations;
     RegistrationData * m_RelatedData;
 
     void SetRequestedRegionToLargestPossibleRegion() override {};
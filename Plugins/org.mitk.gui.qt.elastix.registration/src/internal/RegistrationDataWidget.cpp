@@ -86,6 +86,11 @@ void RegistrationDataWidget::SetDataStorage(mitk::DataStorage::Pointer storage){
   m_DataStorage = storage;
 }
 
+void RegistrationDataWidget::SetWarpedImageCache(m2::ElxLazyWarpedImage::Cache::Pointer cache)
+{
+  m_WarpedImageCache = cache;
+}
+
 
 void RegistrationDataWidget::OnLoadTransformations()
 {
@@ -143,7 +148,11 @@ void RegistrationDataWidget::OnApplyTransformations()
   mitk::Image::Pointer result;
 
   if(auto image = dynamic_cast<const mitk::Image *>(node->GetData())){
-    result = warpingHelper.WarpImage(image);
+    // slices are warped when they are shown or accessed (see ElxLazyWarpedImage)
+    if (auto lazyImage = warpingHelper.CreateLazyWarpedImage(image, "", 3, m_WarpedImageCache))
+      result = lazyImage.GetPointer();
+    else
+      result = warpingHelper.WarpImage(image);
 
     auto newNode = mitk::DataNode::New();
     newNode->SetData(result);
@@ -151,10 +160,7 @@ void RegistrationDataWidget::OnApplyTransformations()
     m_DataStorage->Add(newNode, node);
   }
   else if(auto mlSeg = dynamic_cast<const mitk::MultiLabelSegmentation *>(node->GetData())){
-    result = warpingHelper.WarpImage(mlSeg->GetGroupImage(0), "short");
-
-    auto newMlSeg = mitk::MultiLabelSegmentation::New();
-    newMlSeg->InitializeByLabeledImage(result);
+    auto newMlSeg = warpingHelper.WarpSegmentation(mlSeg);
 
     auto newNode = mitk::DataNode::New();
     newNode->SetData(newMlSeg);
@@ -267,6 +273,10 @@ void RegistrationDataWidget::SetTransformations(const std::vector<std::string> &
   GetRegistrationData()->m_Transformations = data;
 }
 
+void RegistrationDataWidget::SetTimeStepTransformations(const std::vector<std::vector<std::string>> & data){
+  GetRegistrationData()->m_TimeStepTransformations = data;
+}
+
 std::vector<std::string> RegistrationDataWidget::GetTransformations() const{
   return GetRegistrationData()->m_Transformations;
 }
@@ -20,6 +20,7 @@ See LICENSE.txt or https://www.github.com/jtfcordes/m2aia for details.
 #include <QString>
 #include <QWidget>
 
+#include <m2ElxLazyWarpedImage.h>
 #include <mitkDataStorage.h>
 
 class RegistrationDataWidget : public QWidget
@@ -29,6 +30,7 @@ private:
   QWidget *m_Parent;
   mitk::DataStorage::Pointer m_DataStorage;
   std::shared_ptr<RegistrationData> m_RegistrationData;
+  m2::ElxLazyWarpedImage::Cache::Pointer m_WarpedImageCache;
   void UpdateRegistrationDataFromUI();
 
 private slots:
@@ -52,11 +54,17 @@ public:
 
   Ui_RegistrationDataWidgetControls m_Controls;
   void SetDataStorage(mitk::DataStorage::Pointer storage);
+
+  /**
+   * @brief Slice cache of the images warped by OnApplyTransformations (see ElxLazyWarpedImage).
+   */
+  void SetWarpedImageCache(m2::ElxLazyWarpedImage::Cache::Pointer cache);
   mitk::DataNode::Pointer GetImageNode() const;
   mitk::DataNode::Pointer GetMaskNode() const;
   mitk::DataNode::Pointer GetPointSetNode() const;
   std::vector<std::string> GetTransformations() const;
   void SetTransformations(const std::vector<std::string> & data);
+  void SetTimeStepTransformations(const std::vector<std::vector<std::string>> & data);
 
   /**
    * @brief Returns the selected mitk::Image or null;
@@ -14,6 +14,7 @@ See LICENSE.txt or https://www.github.com/jtfcordes/m2aia for details.
 
 ===================================================================*/
 
+#include <algorithm>
 #include <queue>
 
 // Blueberry
@@ -28,6 +29,9 @@ See LICENSE.txt or https://www.github.com/jtfcordes/m2aia for details.
 #include "RegistrationView.h"
 // Qt
 
+#include <QApplication>
+#include <QCheckBox>
+#include <QComboBox>
 #include <QDialogButtonBox>
 #include <QHBoxLayout>
 #include <QMessageBox>
@@ -59,6 +63,8 @@ See LICENSE.txt or https://www.github.com/jtfcordes/m2aia for details.
 
 // m2
 #include "RegistrationDataWidget.h"
+#include <m2ElxChannelFusion.h>
+#include <m2ElxChannelStatistics.h>
 #include <m2ElxDefaultParameterFiles.h>
 #include <m2ElxRegistrationHelper.h>
 #include <m2ElxUtil.h>
@@ -75,7 +81,9 @@ void RegistrationView::CreateQtPartControl(QWidget *parent)
   m_Parent = parent;
   m_Controls.tabWidget->setCornerWidget(m_Controls.btnAddModality);
 
+  m_WarpedImageCache = m2::ElxLazyWarpedImage::Cache::New();
   m_FixedEntity = new RegistrationDataWidget(parent, this->GetDataStorage());
+  m_FixedEntity->SetWarpedImageCache(m_WarpedImageCache);
   m_FixedEntity->EnableButtons(false);
   m_FixedEntity->m_Controls.imageSelection->SetAutoSelectNewNodes(true);
   m_Controls.tabWidget->addTab(m_FixedEntity, "Fixed");
@@ -84,6 +92,11 @@ void RegistrationView::CreateQtPartControl(QWidget *parent)
   connect(m_Controls.btnStartRegistration, SIGNAL(clicked()), this, SLOT(OnStartRegistration()));
   connect(m_Controls.btnAddModality, SIGNAL(clicked()), this, SLOT(OnAddRegistrationData()));
   connect(m_Controls.btnSelectChannels, SIGNAL(clicked()), this, SLOT(OnSelectChannels()));
+  connect(m_Controls.cbChannelFusion, qOverload<int>(&QComboBox::currentIndexChanged), this, [this](int) {
+    const auto method = m2::ElxChannelFusion::GetMethod(m_Controls.cbChannelFusion->currentText().toStdString());
+    m_Controls.spnFusionImages->setEnabled(method == m2::ElxChannelFusion::Method::PCA ||
+                                           method == m2::ElxChannelFusion::Method::NMF);
+  });
 
   connect(m_Controls.btnOpenPontSetInteractionView, &QPushButton::clicked, this, []() {
     try
@@ -159,6 +172,8 @@ void RegistrationView::OnSelectChannels(){
           auto item = new QListWidgetItem();
           ui.movingImageListWidget->addItem(item);
           auto *itemWidget = new QCheckBox(name.c_str());
+          itemWidget->setChecked(std::find(m_SelectedChannels.begin(), m_SelectedChannels.end(), itemIndex) !=
+                                 m_SelectedChannels.end());
           ui.movingImageListWidget->setItemWidget(item, itemWidget);
           item->setData(Qt::UserRole, QVariant(itemIndex));
           // connect(itemWidget, &QCheckBox::clicked, this, [&, itemIndex](bool toggled)
@@ -180,9 +195,55 @@ void RegistrationView::OnSelectChannels(){
           });
   }
 
-  
+  // rank the channels of the moving image (statistics and mutual information with the fixed image)
+  auto suggestButton = ui.buttonBox->addButton("Suggest", QDialogButtonBox::ActionRole);
+  suggestButton->setToolTip("Check the channels with the best structure and mutual information with the fixed image");
+  connect(suggestButton, &QPushButton::clicked, this, [&]() {
+    auto movingEntity = dynamic_cast<RegistrationDataWidget *>(m_Controls.tabWidget->widget(1));
+    if (!movingEntity || !movingEntity->HasImage())
+      return;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    try
+    {
+      const auto reference = fixedEntity->HasImage() ? fixedEntity->GetImage() : mitk::Image::Pointer();
+      const auto statistics = m2::ElxChannelStatistics::Compute(movingEntity->GetImage(), reference);
+      const auto suggested = m2::ElxChannelStatistics::Suggest(statistics);
+      for (int i = 0; i < ui.movingImageListWidget->count(); ++i)
+      {
+        auto item = ui.movingImageListWidget->item(i);
+        auto checkBox = qobject_cast<QCheckBox *>(ui.movingImageListWidget->itemWidget(item));
+        const auto channel = item->data(Qt::UserRole).toUInt();
+        if (!checkBox || channel >= statistics.size())
+          continue;
+        const auto &s = statistics[channel];
+        checkBox->setToolTip(QString("score %1\nvariance %2\nentropy %3\ngradient energy %4\nmutual information %5")
+                               .arg(s.score)
+                               .arg(s.variance)
+                               .arg(s.entropy)
+                               .arg(s.gradientEnergy)
+                               .arg(s.mutualInformation));
+        checkBox->setChecked(std::find(suggested.begin(), suggested.end(), channel) != suggested.end());
+      }
+      for (auto channel : suggested)
+        MITK_INFO << "Suggested channel " << channel << " (score " << statistics[channel].score << ")";
+    }
+    catch (std::exception &e)
+    {
+      MITK_ERROR << e.what();
+    }
+    QApplication::restoreOverrideCursor();
+  });
+
   if(dia->exec()){
-    
+    // checked channels of the moving image are used for the registration (see Registration)
+    m_SelectedChannels.clear();
+    for (int i = 0; i < ui.movingImageListWidget->count(); ++i)
+    {
+      auto item = ui.movingImageListWidget->item(i);
+      auto checkBox = qobject_cast<QCheckBox *>(ui.movingImageListWidget->itemWidget(item));
+      if (checkBox && checkBox->isChecked())
+        m_SelectedChannels.push_back(item->data(Qt::UserRole).toUInt());
+    }
   }
   delete dia;
 }
@@ -190,6 +251,7 @@ void RegistrationView::OnSelectChannels(){
 void RegistrationView::OnAddRegistrationData()
 {
   auto widget = new RegistrationDataWidget(m_Parent, GetDataStorage());
+  widget->SetWarpedImageCache(m_WarpedImageCache);
   auto tabWidget = m_Controls.tabWidget;
   auto ignoreCheck = [tabWidget](const mitk::DataNode *node) {
     std::vector<mitk::DataNode::Pointer> ignoreNodes;
@@ -401,7 +463,7 @@ void RegistrationView::Registration(RegistrationDataWidget *fixed, RegistrationD
     {
       m2::ElxRegistrationHelper warpingHelper;
       warpingHelper.SetTransformations(fixed->GetTransformations());
-      fixedImageMask = warpingHelper.WarpImage(fixedImageMask, "short", 1);
+      fixedImageMask = warpingHelper.WarpImage(fixedImageMask, "short", 0);
     }
   }
 
@@ -426,10 +488,34 @@ void RegistrationView::Registration(RegistrationDataWidget *fixed, RegistrationD
     helper->SetFixedImageMaskData(fixedImageMask);
     helper->SetPointData(fixedPointSet, movingPointSet);
     helper->SetRegistrationParameters(parameterFiles);
+    helper->SetMultiStartRigid(m_Controls.paramWidget->GetNumberOfRigidStarts(),
+                               m_Controls.paramWidget->IsRigidStartFlipsEnabled());
     helper->SetRemoveWorkingDirectory(true);
     // helper.UseMovingImageSpacing(m_Controls.keepSpacings->isChecked());
     helper->SetStatusCallback(statusCallback);
-    helper->GetRegistration();
+    // vector images (e.g. MSI) are registered on the selected channel pairs or, with a channel fusion, on a few
+    // fused images; channels checked in the channel selection dialog restrict the fusion to these channels
+    if (fixedImage->GetPixelType().GetNumberOfComponents() > 1 && movingImage->GetPixelType().GetNumberOfComponents() > 1)
+    {
+      std::vector<std::pair<unsigned int, unsigned int>> channelSelections;
+      for (auto channel : m_SelectedChannels)
+        if (channel < fixedImage->GetPixelType().GetNumberOfComponents() &&
+            channel < movingImage->GetPixelType().GetNumberOfComponents())
+          channelSelections.emplace_back(channel, channel);
+      helper->SetChannelSelections(channelSelections);
+
+      m2::ElxChannelFusion::Parameters fusion;
+      fusion.method = m2::ElxChannelFusion::GetMethod(m_Controls.cbChannelFusion->currentText().toStdString());
+      fusion.numberOfImages = static_cast<unsigned int>(m_Controls.spnFusionImages->value());
+      if (fusion.method != m2::ElxChannelFusion::Method::None)
+        helper->SetChannelFusion(fusion);
+    }
+    // every time step of a series gets its own transformation
+    const bool timeSeries = movingImage->GetTimeSteps() > 1;
+    if (timeSeries)
+      helper->GetTimeStepRegistration();
+    else
+      helper->GetRegistration();
     
     mitk::ProgressBar::GetInstance()->Progress(1);
 
@@ -437,8 +523,28 @@ void RegistrationView::Registration(RegistrationDataWidget *fixed, RegistrationD
     mitk::ProgressBar::GetInstance()->Progress(1);
     MITK_INFO << "Use Count: " << helper.use_count();
     auto movingImage = dynamic_cast<const mitk::Image *>(movingImageNode->GetData());
-    auto warpedImage = helper->WarpImage(movingImage);
+    mitk::Image::Pointer warpedImage;
+    if (timeSeries)
+    {
+      warpedImage = helper->WarpTimeSteps(movingImage);
+    }
+    else if (m_Controls.chkGeometryOnly->isChecked() && m_Controls.paramWidget->IsRigidOnly() &&
+        helper->CanApplyToGeometry())
+    {
+      MITK_INFO << "Apply rigid result to the geometry (no resampling)";
+      warpedImage = helper->CreateAlignedImage(movingImage);
+    }
+    else if (auto lazyImage = helper->CreateLazyWarpedImage(movingImage, "", 3, m_WarpedImageCache))
+    {
+      // slices are warped when they are shown or accessed (see ElxLazyWarpedImage)
+      warpedImage = lazyImage.GetPointer();
+    }
+    else
+    {
+      warpedImage = helper->WarpImage(movingImage);
+    }
     moving->SetTransformations(helper->GetTransformation());
+    moving->SetTimeStepTransformations(helper->GetTimeStepTransformations());
 
     // build timestamp suffix
     std::time_t t = std::time(nullptr);
@@ -453,6 +559,16 @@ void RegistrationView::Registration(RegistrationDataWidget *fixed, RegistrationD
     auto newNode = mitk::DataNode::New();
     newNode->SetData(warpedImage);
     newNode->SetName(moving->GetImageNode()->GetName() + "_warped_" + timestamp);
+    // the transformations of all time steps are kept with the result
+    const auto timeStepTransformations = helper->GetTimeStepTransformations();
+    for (unsigned int step = 0; step < timeStepTransformations.size(); ++step)
+      for (unsigned int i = 0; i < timeStepTransformations[step].size(); ++i)
+        newNode->SetStringProperty(
+          ("m2aia.registration.timestep." + std::to_string(step) + ".transform." + std::to_string(i)).c_str(),
+          timeStepTransformations[step][i].c_str());
+    const auto fusionWeights = helper->GetChannelFusionWeights();
+    if (fusionWeights.method != m2::ElxChannelFusion::Method::None)
+      newNode->SetStringProperty("m2aia.registration.channel.fusion", fusionWeights.ToString().c_str());
     this->GetDataStorage()->Add(newNode, parentNode);
     mitk::ProgressBar::GetInstance()->Progress(1);
 
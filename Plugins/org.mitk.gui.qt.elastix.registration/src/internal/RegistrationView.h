@@ -26,6 +26,7 @@ See LICENSE.txt or https://www.github.com/jtfcordes/m2aia for details.
 #include <map>
 #include <mitkPointSet.h>
 #include <Qm2ElxParameterWidget.h>
+#include <m2ElxLazyWarpedImage.h>
 
 class QmitkSingleNodeSelectionWidget;
 class RegistrationDataWidget;
@@ -67,6 +68,8 @@ protected:
   RegistrationDataWidget *m_FixedEntity;
 
   std::vector<std::string> m_ParameterFiles;
+  std::vector<unsigned int> m_SelectedChannels; // channels of the moving image checked in OnSelectChannels
+  m2::ElxLazyWarpedImage::Cache::Pointer m_WarpedImageCache; // slices of all lazily warped results
 
   void Registration(RegistrationDataWidget *fixed, RegistrationDataWidget *moving);
 